@@ -0,0 +1,55 @@
+# embed_kernels.cmake - Generates a C++ source file holding every kernels/*.cl
+# file (and every kernels/*.clh header they include) as a null terminated
+# char array (see include/jtorch/kernel.h).
+#
+# Usage: cmake -DKERNEL_DIR=<dir> -DOUTPUT=<file.cpp> -P embed_kernels.cmake
+#
+# The sources are written as hex bytes rather than string literals to stay
+# clear of compiler limits on literal length.  OUTPUT is only rewritten when
+# its contents change.
+
+file(GLOB KERNEL_FILES "${KERNEL_DIR}/*.cl" "${KERNEL_DIR}/*.clh")
+list(SORT KERNEL_FILES)
+
+set(BYTES_16 "")
+foreach(I RANGE 15)
+  set(BYTES_16 "${BYTES_16}0x[0-9a-f][0-9a-f],")
+endforeach()
+
+set(SOURCES "")
+set(TABLE "")
+set(COUNT 0)
+foreach(KERNEL_FILE ${KERNEL_FILES})
+  get_filename_component(KERNEL_NAME ${KERNEL_FILE} NAME)
+  string(REPLACE "." "_" KERNEL_ID ${KERNEL_NAME})
+  file(READ ${KERNEL_FILE} KERNEL_HEX HEX)
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," KERNEL_HEX
+    "${KERNEL_HEX}")
+  # 16 bytes per line (CMake regexes have no {n} repetition)
+  string(REGEX REPLACE "(${BYTES_16})" "\\1\n    " KERNEL_HEX
+    "${KERNEL_HEX}")
+  set(SOURCES "${SOURCES}  static const unsigned char ${KERNEL_ID}[] = {\n    ${KERNEL_HEX}0x00};\n\n")
+  set(TABLE "${TABLE}    {\"${KERNEL_NAME}\", (const char*)${KERNEL_ID}},\n")
+  math(EXPR COUNT "${COUNT} + 1")
+endforeach()
+
+set(CONTENT "// Generated by cmake/embed_kernels.cmake from ${KERNEL_DIR}.
+// Do not edit.
+
+#include \"jtorch/kernel.h\"
+
+namespace jtorch {
+
+${SOURCES}  extern const EmbeddedKernelSource embedded_kernel_sources[] = {
+${TABLE}  };
+  extern const uint32_t num_embedded_kernel_sources = ${COUNT};
+
+}  // namespace jtorch
+")
+
+if(EXISTS ${OUTPUT})
+  file(READ ${OUTPUT} OLD_CONTENT)
+endif()
+if(NOT "${OLD_CONTENT}" STREQUAL "${CONTENT}")
+  file(WRITE ${OUTPUT} "${CONTENT}")
+endif()
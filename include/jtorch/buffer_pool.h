@@ -0,0 +1,113 @@
+//
+//  buffer_pool.h
+//
+//  A size-bucketed, reference-counted cache of OpenCL buffers that sits
+//  underneath Tensor<T>.  When the last Tensor (or view) referencing a buffer
+//  is deleted the buffer is returned to a free list instead of being released,
+//  so that stages which re-create their outputs on every input size change
+//  (and models that run at multiple resolutions) stop hammering
+//  clCreateBuffer / clReleaseMemObject.
+//
+//  Buffer sizes are rounded up to a bucket size (at most 25% slack) so that
+//  similarly sized tensors can share storage.  This means the underlying
+//  buffer may be LARGER than the tensor that uses it.
+//
+//  A buffer is only recycled for the device that released it (the queues of
+//  different devices are not ordered with each other).
+//
+//  All functions are thread safe.
+//
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include "jcl/math/int_types.h"
+#include "jcl/jcl.h"  // For jcl::JCLBuffer
+
+namespace jtorch {
+
+  struct BufferPoolStats {
+    uint64_t hits;  // allocate() calls served from the free list
+    uint64_t misses;  // allocate() calls that created a new buffer
+    uint64_t bytes_in_use;  // Bytes held by buffers with live references
+    uint64_t bytes_cached;  // Bytes held by buffers sitting in the free list
+    uint32_t buffers_in_use;
+    uint32_t buffers_cached;
+  };
+
+  class BufferPool {
+  public:
+    // Constructor / Destructor
+    BufferPool(jcl::JCL* context);
+    ~BufferPool();  // Releases all cached buffers
+
+    // allocate - Returns a buffer of at least nelems (float sized) elements
+    // with a reference count of 1.
+    jcl::JCLBuffer allocate(const uint32_t nelems);
+    void addReference(const jcl::JCLBuffer buffer);
+    // releaseReference - When the count reaches zero the buffer is returned
+    // to the free list (it is NOT released back to OpenCL).
+    void releaseReference(const jcl::JCLBuffer buffer);
+
+    // trim - Release cached (unreferenced) buffers back to OpenCL, largest
+    // first, until at most max_cached_bytes remain in the free list.
+    void trim(const uint64_t max_cached_bytes = 0);
+
+    // deferRecycling / resumeRecycling - In between, buffers whose last
+    // reference is released are held back from the free list, so that work
+    // issued to one queue is never handed a buffer that work on another
+    // queue may still be using.  Calls nest.
+    void deferRecycling();
+    void resumeRecycling();
+
+    // setDevice - Allocations are served from this device's free list
+    // (called by jtorch::SetDevice)
+    void setDevice(const uint32_t device);
+
+    // setMaxCachedBytes - The free list is trimmed to this size whenever a
+    // buffer is returned to it.  Default is unlimited.
+    void setMaxCachedBytes(const uint64_t max_cached_bytes);
+
+    // bufferSize / refCount - For a buffer with live references (throws
+    // otherwise).  bufferSize is the bucket size in elements.
+    uint32_t bufferSize(const jcl::JCLBuffer buffer) const;
+    uint32_t refCount(const jcl::JCLBuffer buffer) const;
+
+    BufferPoolStats stats() const;
+    void resetStats();  // Resets the hit and miss counters only
+
+    // bucketSize - The number of elements actually allocated for a request
+    static uint32_t bucketSize(const uint32_t nelems);
+
+  protected:
+    struct BufferEntry {
+      uint32_t nelems;  // Bucket size
+      uint32_t ref_count;
+    };
+
+    jcl::JCL* context_;
+    mutable std::mutex lock_;
+    std::unordered_map<jcl::JCLBuffer, BufferEntry> buffers_;
+    typedef std::pair<uint32_t, uint32_t> FreeListKey;  // {size, device}
+    std::map<FreeListKey, std::vector<jcl::JCLBuffer>> free_lists_;
+    uint32_t device_;
+    uint64_t max_cached_bytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t bytes_in_use_;
+    uint64_t bytes_cached_;
+    uint32_t defer_depth_;
+    std::vector<std::pair<FreeListKey, jcl::JCLBuffer>> deferred_;
+
+    void recycleDeferred();  // lock_ must be held
+    void trimInternal(const uint64_t max_cached_bytes);  // lock_ must be held
+
+    // Non-copyable, non-assignable.
+    BufferPool(BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+  };
+
+};  // namespace jtorch
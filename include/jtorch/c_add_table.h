@@ -23,6 +23,7 @@ namespace jtorch {
     virtual TorchStageType type() const { return C_ADD_TABLE_STAGE; }
     virtual std::string name() const { return "CAddTable"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
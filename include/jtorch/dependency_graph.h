@@ -0,0 +1,109 @@
+//
+//  dependency_graph.h
+//
+//  Producer -> consumer ordering for the out-of-order queue (see
+//  CLOutOfOrderQueue in jtorch.h).  The graph remembers, for every buffer,
+//  the event of the last command that wrote it and of the commands that
+//  read it since.  A new command waits for the last writer of everything it
+//  reads and for the last writer and readers of everything it writes, so
+//  commands that touch unrelated buffers (ie ParallelTable branches, the
+//  bias GEMM and im2col of SpatialConvolutionMM) are free to overlap.
+//
+//  Every jtorch launch site (Kernel::run, the Tensor<T> transfers and
+//  copies, clBLAS) describes its command with a CommandDeps.  Kernel
+//  arguments declared const in the .cl source are reads, all other buffer
+//  arguments are writes.  When the current queue is in order CommandDeps
+//  does nothing.
+//
+//  Which arguments are const comes from the kernel argument info, which
+//  programs loaded from the kernel binary cache may not have (it is up to
+//  the driver).  Every buffer argument then counts as a write, which is
+//  safe but serializes all readers of a buffer: ie clones sharing weights
+//  no longer overlap.  Disable the cache (an empty kernel_cache_dir) if
+//  that matters on your driver.
+//
+//  The graph holds a reference to the events it tracks until Sync() (or
+//  until they are superseded), so call Sync() now and then on long runs.
+//
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
+
+namespace jtorch {
+
+  class DependencyGraph {
+  public:
+    // Constructor / Destructor
+    DependencyGraph();
+    ~DependencyGraph();  // Releases the tracked events
+
+    // waitList - Appends the events that a command reading reads and writing
+    // writes must wait for (buffers in both lists are writes)
+    void waitList(const std::vector<cl_mem>& reads,
+      const std::vector<cl_mem>& writes,
+      std::vector<cl_event>& wait_list) const;
+    // record - Adds the command's event (the graph retains it)
+    void record(const std::vector<cl_mem>& reads,
+      const std::vector<cl_mem>& writes, cl_event event);
+    void clear();  // Once the queue is finished
+
+    inline uint32_t numBuffers() const { return (uint32_t)buffers_.size(); }
+
+  protected:
+    typedef struct {
+      cl_event writer;  // NULL before the first tracked write
+      std::vector<cl_event> readers;  // Since the last write
+    } BufferDeps;
+
+    std::unordered_map<cl_mem, BufferDeps> buffers_;
+
+    // Non-copyable, non-assignable.
+    DependencyGraph(DependencyGraph&);
+    DependencyGraph& operator=(const DependencyGraph&);
+  };
+
+  // CommandDeps - Describes one command for the current queue's graph.  Add
+  // the buffers, pass numWaits(), waitList() and event() to the clEnqueue
+  // call, and the command is recorded when the CommandDeps goes out of scope
+  // (unless the enqueue failed).
+  class CommandDeps {
+  public:
+    // Constructor / Destructor
+    CommandDeps();  // Uses CLDependencies() (NULL for an in-order queue)
+    ~CommandDeps();
+
+    void reads(cl_mem mem);
+    void writes(cl_mem mem);
+    // after - Also waits for event (on any queue, tracked or not).  NULL is
+    // ignored.
+    void after(cl_event event);
+
+    cl_uint numWaits();
+    const cl_event* waitList();  // NULL when there is nothing to wait for
+    // event - Pass a caller's event to keep it after the command is recorded
+    // (it is set to NULL first).  Otherwise NULL unless tracking.
+    cl_event* event(cl_event* caller_event = NULL);
+
+    inline bool tracking() const { return graph_ != NULL; }
+
+  protected:
+    DependencyGraph* graph_;
+    std::vector<cl_mem> reads_;
+    std::vector<cl_mem> writes_;
+    std::vector<cl_event> wait_list_;
+    bool resolved_;
+    cl_event event_;
+    cl_event* caller_event_;
+
+    void resolve();
+
+    // Non-copyable, non-assignable.
+    CommandDeps(CommandDeps&);
+    CommandDeps& operator=(const CommandDeps&);
+  };
+
+};  // namespace jtorch
@@ -0,0 +1,94 @@
+//
+//  device_dispatcher.h
+//
+//  Runs frames of one model on several OpenCL devices.  The dispatcher keeps
+//  a replica of the model per device (each created with its device current,
+//  see jtorch::SetDevice) and sends every frame to one replica, either in
+//  turn or to the replica with the fewest frames still in flight.
+//
+//  dispatch() only enqueues work (the input upload, the forward pass and the
+//  output read back) and returns the frame's Event, so frames on different
+//  devices overlap.  Replicas whose forwardProp does host work (ie
+//  SpatialConvolutionMap) still block the dispatching thread.  Like its
+//  replicas, the dispatcher belongs to the engine that was current when it
+//  was created (see jtorch/engine.h).
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <functional>
+#include "jcl/math/int_types.h"
+#include "jtorch/event.h"
+
+namespace jtorch {
+
+  class TorchStage;
+  template <typename T> class Tensor;
+
+  typedef enum {
+    DISPATCH_ROUND_ROBIN = 0,
+    DISPATCH_LEAST_LOADED = 1,  // Fewest frames in flight
+  } DispatchPolicy;
+
+  class DeviceDispatcher {
+  public:
+    // Constructor / Destructor
+    // create_replica - Called once per device (with that device current).
+    // The dispatcher owns the returned stages.  Every replica is run once on
+    // a zero input so that later frames run at steady state.
+    // devices - The devices to use (empty for all of them)
+    DeviceDispatcher(const std::function<TorchStage*()>& create_replica,
+      const uint32_t input_dim, const uint32_t* input_size,
+      const std::vector<uint32_t>& devices = std::vector<uint32_t>(),
+      const DispatchPolicy policy = DISPATCH_LEAST_LOADED);
+    // Waits for all frames.  Must be destroyed before ShutdownJTorch().
+    ~DeviceDispatcher();
+
+    // dispatch - Runs one frame without waiting for it.  input
+    // (inputNElems() floats) and output (outputNElems() floats) must stay
+    // valid until the returned Event completes.  Replicas run on their
+    // device's default queue, and the caller's current device and queue
+    // (see SetCLQueue) are left unchanged.
+    Event dispatch(const float* input, float* output);
+    void sync();  // Waits for every dispatched frame
+
+    inline uint32_t numReplicas() const {
+      return (uint32_t)replicas_.size();
+    }
+    inline uint32_t replicaDevice(const uint32_t i) const {
+      return replicas_[i].device;
+    }
+    inline TorchStage* replica(const uint32_t i) { return replicas_[i].model; }
+    // replicaFrames - Frames dispatched to replica i so far
+    inline uint64_t replicaFrames(const uint32_t i) const {
+      return replicas_[i].num_frames;
+    }
+    inline uint32_t inputNElems() const { return input_nelems_; }
+    inline uint32_t outputNElems() const { return output_nelems_; }
+
+  protected:
+    struct Replica {
+      uint32_t device;
+      TorchStage* model;
+      Tensor<float>* input;
+      std::deque<Event> in_flight;
+      uint64_t num_frames;
+    };
+
+    std::vector<Replica> replicas_;
+    DispatchPolicy policy_;
+    uint32_t next_replica_;  // Round robin position
+    uint32_t input_nelems_;
+    uint32_t output_nelems_;
+
+    uint32_t pickReplica();
+    void cleanup();
+
+    // Non-copyable, non-assignable.
+    DeviceDispatcher(DeviceDispatcher&);
+    DeviceDispatcher& operator=(const DeviceDispatcher&);
+  };
+
+};  // namespace jtorch
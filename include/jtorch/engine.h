@@ -0,0 +1,115 @@
+//
+//  engine.h
+//
+//  An Engine is one jtorch instance: it owns a JCL context (every OpenCL
+//  device of the chosen type), the buffer pool, the queues and the compiled
+//  kernels of each device.  Independent engines share nothing, so several
+//  threads can each run models on their own engine at the same time.
+//
+//  jtorch functions and stages work on the calling thread's CURRENT engine
+//  (see makeCurrent and EngineScope), which the globals in jtorch.h refer to.
+//  InitJTorch() creates a default engine and makes it current on the calling
+//  thread, so single threaded code does not need to know about engines.
+//
+//  Stages and tensors belong to the engine that was current when they were
+//  created (ie pass the engine to TorchStage::loadFromFile) and must only be
+//  used, and deleted, with that engine current.  An engine is NOT thread
+//  safe: it may be current on one thread at a time.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
+
+namespace jcl { class JCL; }
+
+namespace jtorch {
+
+  class BufferPool;
+  class KernelRegistry;
+  class DependencyGraph;
+
+  class Engine {
+  public:
+    // Constructor / Destructor
+    // See InitJTorch() for the arguments.  The new engine is not made
+    // current.
+    Engine(const std::string& path_to_jtorch = "", const bool use_cpu = false,
+      const std::string& kernel_cache_dir = "");
+    // Every stage and tensor of the engine must be deleted first.  Stops
+    // being current on the calling thread (it must not be current on any
+    // other thread).
+    ~Engine();
+
+    // makeCurrent - For the calling thread
+    void makeCurrent();
+    static Engine* current();  // NULL if the thread has no engine
+    static void setCurrent(Engine* engine);  // NULL for none
+
+    // Devices
+    uint32_t numDevices() const;
+    std::string deviceName(const uint32_t device) const;
+    void setDevice(const uint32_t device);  // Also resets setQueue()
+    inline uint32_t device() const { return device_; }
+    void sync();  // Waits for the current device (and out-of-order queue)
+
+    // Queues of the current device (see CLQueue() in jtorch.h)
+    cl_command_queue queue() const;
+    cl_command_queue defaultQueue() const;
+    cl_command_queue extraQueue(const uint32_t index);  // Created on demand
+    void setQueue(cl_command_queue queue);  // NULL for the default queue
+    cl_command_queue outOfOrderQueue();  // Created on demand
+    // dependencies - The graph of the current queue (NULL unless it is the
+    // out-of-order queue)
+    inline DependencyGraph* dependencies() const {
+      return cur_queue_ != NULL && cur_queue_ == ooo_queues_[device_] ?
+        graphs_[device_] : NULL;
+    }
+
+    inline jcl::JCL* context() const { return cl_context_; }
+    inline BufferPool* bufferPool() const { return buffer_pool_; }
+    // kernelRegistry - For the current device
+    inline KernelRegistry* kernelRegistry() const {
+      return kernel_registries_[device_];
+    }
+    inline const std::string& path() const { return path_; }
+
+  protected:
+    jcl::JCL* cl_context_;
+    BufferPool* buffer_pool_;
+    std::string path_;
+    std::string kernel_cache_dir_;
+    uint32_t device_;
+    cl_command_queue cur_queue_;  // NULL for the default queue
+    // Per device (created on first use of the device)
+    std::vector<KernelRegistry*> kernel_registries_;
+    std::vector<std::vector<cl_command_queue>> extra_queues_;
+    std::vector<cl_command_queue> ooo_queues_;  // NULL until first used
+    std::vector<DependencyGraph*> graphs_;  // Of each out-of-order queue
+
+    void cleanup();
+
+    // Non-copyable, non-assignable.
+    Engine(Engine&);
+    Engine& operator=(const Engine&);
+  };
+
+  // EngineScope - Makes engine current on the calling thread for the scope's
+  // lifetime and then restores the previous engine.
+  class EngineScope {
+  public:
+    explicit EngineScope(Engine& engine);
+    ~EngineScope();
+
+  protected:
+    Engine* prev_;
+
+    // Non-copyable, non-assignable.
+    EngineScope(EngineScope&);
+    EngineScope& operator=(const EngineScope&);
+  };
+
+};  // namespace jtorch
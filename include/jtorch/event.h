@@ -0,0 +1,44 @@
+//
+//  event.h
+//
+//  A completion handle for asynchronous jtorch work (backed by an OpenCL
+//  event).  Events are cheap to copy (copies share the underlying cl_event).
+//  A default constructed Event is already complete.
+//
+
+#pragma once
+
+#include <functional>
+#include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
+
+namespace jtorch {
+
+  class Event {
+  public:
+    // Constructor / Destructor
+    Event();
+    explicit Event(cl_event event);  // Takes ownership of one reference
+    Event(const Event& other);
+    Event& operator=(const Event& other);
+    ~Event();
+
+    void wait() const;  // Blocks until the work has finished
+    bool isComplete() const;  // Non-blocking poll
+
+    // setCallback - The callback is called exactly once when the work has
+    // finished.  NOTE: it is called from an OpenCL runtime thread (or
+    // immediately, if the Event is empty) so it must be thread safe and must
+    // NOT call back into jtorch or jcl.
+    void setCallback(const std::function<void()>& callback);
+
+    inline cl_event clEvent() const { return event_; }  // NULL if empty
+
+    // waitAll - Blocks until all events have finished
+    static void waitAll(const uint32_t num_events, const Event* events);
+
+  protected:
+    cl_event event_;
+  };
+
+};  // namespace jtorch
@@ -0,0 +1,116 @@
+//
+//  half.h
+//
+//  16 bit IEEE 754 storage type.  Tensor<half> halves the footprint and
+//  memory traffic of whatever it stores.  Kernels read and write fp16 data
+//  with vload_half and vstore_half (core OpenCL, so no cl_khr_fp16 is
+//  needed).  The elementwise Tensor<T> math (add, fill, reduce, etc) is
+//  float only.
+//
+//  Weights are stored in fp16 with WEIGHT_PRECISION_HALF (Linear,
+//  SpatialConvolution and SpatialConvolutionMM) and do all arithmetic in
+//  fp32.  The pooling and normalization stages store their activations in
+//  fp16 with OUTPUT_PRECISION_HALF (see torch_stage.h), using kernel
+//  variants built from the same sources (see kernels/half.clh).  Those do
+//  their elementwise math in half on devices with cl_khr_fp16 (see
+//  KernelRegistry::halfArithmetic) and fall back to fp32 math elsewhere.
+//
+
+#pragma once
+
+#include <string.h>
+#include "jcl/math/int_types.h"
+
+namespace jtorch {
+
+  template <typename T> class Tensor;
+  class Kernel;
+  class KernelHandle;
+
+  struct half {
+    uint16_t bits;
+
+    half() : bits(0) { }
+    half(const float val) : bits(floatToBits(val)) { }
+    operator float() const { return bitsToFloat(bits); }
+
+    static uint16_t floatToBits(const float val);  // Round to nearest even
+    static float bitsToFloat(const uint16_t bits);
+  };
+
+  // ConvertTensor - Precision conversion on the device.  Both tensors must
+  // be flat and have the same number of elements.
+  void ConvertTensor(Tensor<half>& dst, const Tensor<float>& src);
+  void ConvertTensor(Tensor<float>& dst, const Tensor<half>& src);
+
+  // KernelFor - The fp32 (T = float) or fp16 (T = half) variant of a kernel
+  template <typename T>
+  Kernel* KernelFor(KernelHandle& fp32, KernelHandle& fp16);
+  template <>
+  Kernel* KernelFor<float>(KernelHandle& fp32, KernelHandle& fp16);
+  template <>
+  Kernel* KernelFor<half>(KernelHandle& fp32, KernelHandle& fp16);
+
+  inline uint16_t half::floatToBits(const float val) {
+    uint32_t f;
+    memcpy(&f, &val, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000;
+    const uint32_t abs_f = f & 0x7fffffff;
+    if (abs_f >= 0x7f800000) {
+      // Inf or NaN (keep NaNs quiet)
+      return (uint16_t)(sign | 0x7c00 | (abs_f > 0x7f800000 ? 0x200 : 0));
+    }
+    if (abs_f >= 0x477ff000) {
+      // Rounds to more than 65504 (the largest half)
+      return (uint16_t)(sign | 0x7c00);
+    }
+    uint32_t h, rem, halfway;
+    if (abs_f < 0x38800000) {
+      // Denormal half (|val| < 2^-14): h is in units of 2^-24
+      const uint32_t exp = abs_f >> 23;
+      if (exp < 102) {
+        return (uint16_t)sign;  // Less than half of the smallest denormal
+      }
+      const uint32_t mant = (abs_f & 0x7fffff) | 0x800000;
+      const uint32_t shift = 126 - exp;
+      h = mant >> shift;
+      rem = mant & ((1u << shift) - 1);
+      halfway = 1u << (shift - 1);
+    } else {
+      // Rebias the exponent from 127 to 15 and drop 13 mantissa bits
+      h = (abs_f >> 13) - (112 << 10);
+      rem = abs_f & 0x1fff;
+      halfway = 0x1000;
+    }
+    if (rem > halfway || (rem == halfway && (h & 1))) {
+      h++;  // May carry into the exponent, which is still correct
+    }
+    return (uint16_t)(sign | h);
+  }
+
+  inline float half::bitsToFloat(const uint16_t bits) {
+    const uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+    const uint32_t exp = (bits >> 10) & 0x1f;
+    uint32_t mant = bits & 0x3ff;
+    uint32_t f;
+    if (exp == 0x1f) {
+      f = sign | 0x7f800000 | (mant << 13);  // Inf or NaN
+    } else if (exp != 0) {
+      f = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+      f = sign;
+    } else {
+      // Denormal half --> normalize
+      uint32_t e = 113;
+      while ((mant & 0x400) == 0) {
+        mant <<= 1;
+        e--;
+      }
+      f = sign | (e << 23) | ((mant & 0x3ff) << 13);
+    }
+    float val;
+    memcpy(&val, &f, sizeof(val));
+    return val;
+  }
+
+};  // namespace jtorch
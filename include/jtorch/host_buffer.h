@@ -0,0 +1,48 @@
+//
+//  host_buffer.h
+//
+//  Page-locked host memory for staging Tensor<T> transfers.  Passing
+//  data() to Tensor<T>::setData / getData lets the driver DMA straight to and
+//  from the device instead of first copying through its own pinned bounce
+//  buffer (which is what happens with pageable new[] arrays).
+//
+//  On devices with fine-grain SVM (OpenCL 2.0, mostly CPU runtimes and
+//  integrated GPUs) the memory comes from clSVMAlloc and is shared with the
+//  device directly.  Otherwise it is a CL_MEM_ALLOC_HOST_PTR buffer that stays
+//  mapped for the lifetime of the HostBuffer.
+//
+//  A HostBuffer must be destroyed before ShutdownJTorch() is called.
+//
+
+#pragma once
+
+#include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
+
+namespace jtorch {
+
+  class HostBuffer {
+  public:
+    // Constructor / Destructor
+    HostBuffer(const uint64_t nbytes);
+    ~HostBuffer();
+
+    inline void* data() const { return data_; }
+    inline uint64_t nbytes() const { return nbytes_; }
+    inline bool isSVM() const { return svm_; }  // false --> pinned + mapped
+
+    // deviceSupportsSVM - true if the jtorch device has fine-grain SVM buffers
+    static bool deviceSupportsSVM();
+
+  protected:
+    void* data_;
+    uint64_t nbytes_;
+    bool svm_;
+    cl_mem mem_;  // Only used when svm_ == false
+
+    // Non-copyable, non-assignable.
+    HostBuffer(HostBuffer&);
+    HostBuffer& operator=(const HostBuffer&);
+  };
+
+};  // namespace jtorch
@@ -24,6 +24,7 @@ namespace jtorch {
     virtual TorchStageType type() const { return IDENTITY_STAGE; }
     virtual std::string name() const { return "Identity"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
@@ -0,0 +1,113 @@
+//
+//  inference_queue.h
+//
+//  Dynamic batching in front of a model for callers that each have a single
+//  sample.  Any thread may submit() a sample and gets a future for the
+//  model output.  A thread with the model's engine current pumps the queue
+//  with processBatch() or run(): it waits until max_batch_size
+//  requests are pending or the oldest request has waited max_delay_ms, runs
+//  ONE batched forwardProp (see the batch support in TorchStage) and scatters
+//  the output back to the futures.
+//
+//  The model must be batch capable and its output must be one sample's
+//  output per batch entry (with the batch as the last dimension).  While the
+//  queue is being pumped the model belongs to it.
+//
+//  Batches are padded up to the next power of two (or max_batch_size), so
+//  the model only ever sees a handful of input sizes and its stages don't
+//  reallocate their outputs for every new batch size.  The padding entries
+//  hold stale samples and their outputs are dropped.
+//
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <future>
+#include <deque>
+#include <vector>
+#include "jcl/math/int_types.h"
+
+namespace jtorch {
+
+  class TorchStage;
+  template <typename T> class Tensor;
+
+  struct InferenceQueueStats {
+    uint32_t queue_depth;  // Requests waiting for a batch right now
+    uint32_t max_queue_depth;
+    uint64_t num_requests;  // Requests that have been run
+    uint64_t num_batches;
+    // batch_size_histogram[n] - Number of batches of n samples
+    std::vector<uint64_t> batch_size_histogram;
+    // Added latency is the time a request waits before its batch starts
+    double mean_added_latency_ms;
+    double max_added_latency_ms;
+  };
+
+  class InferenceQueue {
+  public:
+    // Constructor / Destructor
+    // sample_dim and sample_size describe ONE sample (ie {W, H, F})
+    InferenceQueue(TorchStage& model, const uint32_t sample_dim,
+      const uint32_t* sample_size, const uint32_t max_batch_size,
+      const double max_delay_ms);
+    // Must be destroyed before ShutdownJTorch().  Fails any request that was
+    // never run.
+    ~InferenceQueue();
+
+    // submit - Thread safe.  sample is copied (sampleNElems() floats).
+    std::future<std::vector<float>> submit(const float* sample);
+
+    // processBatch - Runs one batch, waiting for the first request and then
+    // for the batch to fill up (or the deadline).  Returns the batch size,
+    // or 0 once stop() was called and no requests are left.
+    uint32_t processBatch();
+    // run - processBatch() until stop() is called and the queue is empty
+    void run();
+    void stop();  // Thread safe
+
+    InferenceQueueStats stats() const;  // Thread safe
+    void resetStats();  // Thread safe
+
+    inline uint32_t sampleNElems() const { return sample_nelems_; }
+    inline uint32_t maxBatchSize() const { return max_batch_size_; }
+
+  protected:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request {
+      std::vector<float> sample;
+      std::promise<std::vector<float>> result;
+      Clock::time_point submitted;
+    };
+
+    TorchStage& model_;
+    uint32_t sample_dim_;
+    uint32_t sample_size_[4];  // Plus the batch size
+    uint32_t sample_nelems_;
+    uint32_t max_batch_size_;
+    double max_delay_ms_;
+
+    mutable std::mutex lock_;
+    std::condition_variable not_empty_;
+    std::deque<Request> requests_;
+    bool stopped_;
+    InferenceQueueStats stats_;
+    double total_added_latency_ms_;
+
+    // Only touched by the pumping thread
+    std::vector<Tensor<float>*> inputs_;  // Indexed by padded batch size
+    std::vector<float> input_cpu_;
+    std::vector<float> output_cpu_;
+
+    void runBatch(std::vector<Request>& batch);
+    uint32_t paddedBatchSize(const uint32_t batch_size) const;
+
+    // Non-copyable, non-assignable.
+    InferenceQueue(InferenceQueue&);
+    InferenceQueue& operator=(const InferenceQueue&);
+  };
+
+};  // namespace jtorch
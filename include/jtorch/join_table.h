@@ -3,9 +3,11 @@
 //
 //  Created by Jonathan Tompson on 4/9/13.
 //
-//  NOTE: This version of Join Table ALWAYS joins along the top dimension
-//  As per the torch version, the dimension 0 is defined as the top most
-//  dimension (ie f in fxhxw).
+//  Joins along any dimension.  Each input is copied (by a strided copy) into
+//  a narrow() view of the output.  As per the torch version, the dimension 0
+//  is defined as the top most dimension (ie f in fxhxw).  Also as per torch,
+//  when n_input_dims is given an input with n_input_dims + 1 dimensions is a
+//  batch and is joined along dimension + 1.
 //
 
 #pragma once
@@ -21,20 +23,24 @@ namespace jtorch {
   class JoinTable : public TorchStage {
   public:
     // Constructor / Destructor
-    JoinTable(const uint32_t dimension);
+    JoinTable(const uint32_t dimension, const uint32_t n_input_dims = 0);
     virtual ~JoinTable();
 
     virtual TorchStageType type() const { return JOIN_TABLE_STAGE; }
     virtual std::string name() const { return "JoinTable"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
     inline uint32_t dimension() const { return dimension_; }
+    inline uint32_t nInputDims() const { return n_input_dims_; }
 
   protected:
     void init(TorchData& input);
+    uint32_t joinDim(const uint32_t dim) const;
     uint32_t dimension_;
+    uint32_t n_input_dims_;  // 0 if the input is never a batch
 
     // Non-copyable, non-assignable.
     JoinTable(JoinTable&);
@@ -4,8 +4,18 @@
 //  Created by Jonathan Tompson on 5/14/13.
 //
 //  NOTE: YOU MUST CALL jtorch::InitTorch() before using any of these functions
-//  since a valid OpenCL context must exist.  Then you can only use these
-//  functions in the same thread that InitTorch was called.
+//  since a valid OpenCL context must exist.  InitJTorch() creates the default
+//  jtorch::Engine and makes it current on the calling thread.  Everything
+//  below works on the calling thread's current engine, so other threads
+//  either create and use their own Engine (see jtorch/engine.h) or must not
+//  use jtorch at the same time.
+//
+//  The context holds every OpenCL device of the chosen type on the platform.
+//  All jtorch work goes to the current device (deviceid, device 0 after
+//  init), and SetDevice() switches it.  Tensors can be used on any device,
+//  but each device has its own queues and compiled kernels, and a stage must
+//  keep to the device it first ran on (see DeviceDispatcher for running a
+//  model on several devices).
 //
 //  Call ShutdownJTorch() when finished.
 //
@@ -14,26 +24,85 @@
 
 #include <string>
 #include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
 
 #define USE_OPENCL_LOCAL_SIZES  // Let OpenCL choose worksizes
 
+// Per thread storage (VS2012 has no thread_local, only for POD types)
+#if defined(_MSC_VER) && _MSC_VER < 1900
+  #define JTORCH_THREAD_LOCAL __declspec(thread)
+#else
+  #define JTORCH_THREAD_LOCAL thread_local
+#endif
+
 namespace jcl { class JCL; }
+namespace jtorch {
+  class BufferPool; class KernelRegistry; class DependencyGraph;
+}
 
 namespace jtorch {
 
-  // path_to_jtorch should be the path to "/path/to/jtorch"
+  // path_to_jtorch should be the path to "/path/to/jtorch".  It is only
+  // needed to read kernels that were not embedded into the library (see
+  // jtorch/kernel.h), so it may be left empty for the default CMake build.
+  // kernel_cache_dir is an existing directory where compiled kernel binaries
+  // are kept between runs.  When it is set every kernel is also precompiled
+  // in the background.
   // InitJTorch - Throws exception on multiple init
-  void InitJTorch(const std::string& path_to_jtorch, 
-    const bool use_cpu = false);  // Thread safe
+  void InitJTorch(const std::string& path_to_jtorch = "",
+    const bool use_cpu = false,
+    const std::string& kernel_cache_dir = "");  // Thread safe
   // InitJTorchSafe - Multiple init OK
-  void InitJTorchSafe(const std::string& path_to_jtorch, 
-    const bool use_cpu = false);  // Thread safe
+  void InitJTorchSafe(const std::string& path_to_jtorch = "",
+    const bool use_cpu = false,
+    const std::string& kernel_cache_dir = "");  // Thread safe
+  // ShutdownJTorch - Destroys the default engine (it must not be current on
+  // any other thread)
   void ShutdownJTorch();  // Thread safe
-  void Sync();  // NOT Thread safe
+  void Sync();  // Syncs the current device
+
+  // Devices
+  uint32_t NumDevices();
+  std::string DeviceName(const uint32_t device);
+  void SetDevice(const uint32_t device);  // Also resets SetCLQueue()
+
+  // Raw OpenCL handles backing the jtorch queue, for the few places that need
+  // to bypass jcl (clBLAS, sized transfers, mapping, SVM, events).  Note that
+  // the OpenCL context type must be written ::cl_context inside this
+  // namespace (since jtorch::cl_context is the jcl instance).
+  cl_command_queue CLQueue();
+  ::cl_context CLContext();
+  cl_device_id CLDevice();
+
+  // Extra in-order queues on the jtorch device, for work that may overlap
+  // (ie ParallelTable branches).  CLQueue() returns the queue that jtorch
+  // work is currently issued to, which is the default queue unless
+  // SetCLQueue() was called.  Ordering between queues is up to the caller
+  // (see ParallelTable::forwardProp).
+  cl_command_queue CLDefaultQueue();
+  cl_command_queue CLExtraQueue(const uint32_t index);  // Created on demand
+  void SetCLQueue(cl_command_queue queue);  // NULL for the default queue
+
+  // An out-of-order queue on the jtorch device (created on demand).  While it
+  // is the current queue (SetCLQueue(CLOutOfOrderQueue())) every launch is
+  // ordered only by the buffers it reads and writes, so independent kernels
+  // may run concurrently (see jtorch/dependency_graph.h).  Sync() waits for
+  // it too.  Devices without out-of-order execution get an in-order queue.
+  // The graph only orders launches on this queue: it is NOT ordered with the
+  // default (or any other) queue in either direction, and SetCLQueue() adds
+  // no barrier.  Call Sync() (or enqueue a marker on one queue and a
+  // barrier waiting for it on the other) whenever work switches between
+  // this queue and another one.
+  cl_command_queue CLOutOfOrderQueue();
+  // CLDependencies - The graph of the current queue, NULL when the current
+  // queue is in order
+  DependencyGraph* CLDependencies();
 
-  // Some constants and globals for the jtorch instance
-  extern jcl::JCL* cl_context;
-  extern std::string jtorch_path;
-  const uint32_t deviceid = 0;
+  // The calling thread's view of its current engine (NULL when it has none)
+  extern JTORCH_THREAD_LOCAL jcl::JCL* cl_context;
+  extern JTORCH_THREAD_LOCAL BufferPool* buffer_pool;  // Backs all Tensor<T>
+  extern JTORCH_THREAD_LOCAL KernelRegistry* kernel_registry;  // Cur device
+  extern JTORCH_THREAD_LOCAL uint32_t deviceid;  // See SetDevice
+  extern std::string jtorch_path;  // Of the default engine
 
 };  // namespace jtorch
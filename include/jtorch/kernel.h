@@ -0,0 +1,208 @@
+//
+//  kernel.h
+//
+//  OpenCL kernels compiled and owned by jtorch (rather than jcl).
+//
+//  The kernels/*.cl sources are embedded into the library at build time (see
+//  cmake/embed_kernels.cmake) so that deployments do not need the jtorch
+//  tree.  Builds without the embedded sources (JTORCH_EMBED_KERNELS not
+//  defined) read kernels/<filename> from path_to_jtorch instead.  Each
+//  program is built once, the first time one of its kernels is requested.
+//  Code shared between programs lives in kernels/*.clh headers: a line
+//  #include "name.clh" is replaced by the header (from the same place as the
+//  .cl files) before the build, so the cache key covers the headers too.
+//
+//  When given a cache directory the registry also keeps the device binary of
+//  every program it builds there, keyed by device name, driver version, build
+//  options and source hash, so later processes skip the driver compile.
+//  precompile() builds every embedded program up front (optionally on a
+//  background thread) so that the first forwardProp runs at steady state.
+//
+//  Stages launch through a KernelHandle: it resolves to a Kernel the first
+//  time it is used with each registry (every engine has one per device, see
+//  jtorch/engine.h) and from then on costs one vector lookup per launch
+//  (instead of building a path string and doing jcl's file and name lookups).
+//
+//  A Kernel keeps its arguments between launches and every handle to the same
+//  kernel shares them, so set all of the arguments before each run().  Only
+//  the registry itself is thread safe (for the precompile thread), its
+//  kernels and handle cache belong to the thread using its engine.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
+#include "jcl/jcl.h"  // For jcl::JCLBuffer
+#include "jtorch/jtorch.h"
+
+namespace jtorch {
+
+  typedef struct {
+    const char* filename;  // ie "tanh.cl"
+    const char* source;
+  } EmbeddedKernelSource;
+
+  typedef struct {
+    uint32_t cache_hits;  // Programs loaded from cached binaries
+    uint32_t cache_misses;  // Programs compiled from source
+    uint32_t cache_writes;  // Binaries added to the cache
+    double build_ms;  // Total time spent creating programs
+  } KernelCacheStats;
+
+  typedef struct {
+    size_t size;
+    std::vector<char> value;  // Empty for local memory
+    jcl::JCLBuffer buffer;  // (jcl::JCLBuffer)-1 unless a buffer argument
+  } KernelArg;
+
+  class Kernel {
+  public:
+    // Constructor / Destructor
+    Kernel(cl_program program, const std::string& name);
+    ~Kernel();
+
+    void setArg(const uint32_t index, const jcl::JCLBuffer& buffer);
+    void setArg(const uint32_t index, const int val);
+    void setArg(const uint32_t index, const float val);
+    // data == NULL --> Local memory allocation (per local workgroup)
+    void setArg(const uint32_t index, const uint32_t size, void* data);
+
+    // run - local_size == NULL lets OpenCL choose the local work size
+    void run(const uint32_t dim, const uint32_t* global_size,
+      const bool blocking);
+    void run(const uint32_t dim, const uint32_t* global_size,
+      const uint32_t* local_size, const bool blocking);
+
+    uint32_t maxWorkgroupSize() const;  // For this kernel on the device
+    inline cl_kernel handle() const { return kernel_; }
+    inline cl_program program() const { return program_; }
+    inline const std::string& name() const { return name_; }
+    // args - The arguments as last set (for LaunchPlan)
+    inline const std::vector<KernelArg>& args() const { return args_; }
+    // constArg - Declared const (or __constant) in the source, so the
+    // kernel only reads it (see DependencyGraph)
+    inline bool constArg(const uint32_t index) const {
+      return index < const_args_.size() && const_args_[index];
+    }
+
+  protected:
+    cl_program program_;
+    cl_kernel kernel_;
+    std::string name_;
+    std::vector<KernelArg> args_;
+    std::vector<bool> const_args_;
+
+    void queryConstArgs();
+    void storeArg(const uint32_t index, const size_t size, const void* data,
+      const jcl::JCLBuffer buffer = (jcl::JCLBuffer)-1);
+
+    // Non-copyable, non-assignable.
+    Kernel(Kernel&);
+    Kernel& operator=(const Kernel&);
+  };
+
+  class KernelRegistry {
+  public:
+    // Constructor / Destructor
+    // path_to_jtorch - Only used for kernels that were not embedded (can be
+    // empty)
+    // cache_dir - An existing directory for program binaries (empty for no
+    // cache)
+    // context, device - The context and device to build for (NULL for the
+    // current engine's).  The registry never looks up the current engine
+    // after construction, so precompile(false) works from a thread that has
+    // no engine.
+    KernelRegistry(const std::string& path_to_jtorch,
+      const std::string& cache_dir, ::cl_context context = NULL,
+      cl_device_id device = NULL);
+    ~KernelRegistry();  // Must be destroyed before the OpenCL context
+
+    // get - Builds the program on first use.  The Kernel is owned by the
+    // registry.
+    Kernel* get(const std::string& filename, const std::string& name);
+
+    // precompile - Builds every embedded program.  Non-blocking calls
+    // return immediately and get() waits for any build it needs.
+    void precompile(const bool blocking);
+    KernelCacheStats stats();
+    // halfArithmetic - The device has cl_khr_fp16 (native half math)
+    inline bool halfArithmetic() const { return half_arithmetic_; }
+
+    // handleKernel - The kernel cached for a KernelHandle (NULL until
+    // setHandleKernel).  Not locked (see above).
+    inline Kernel* handleKernel(const uint32_t handle_index) const {
+      return handle_index < handle_kernels_.size() ?
+        handle_kernels_[handle_index] : NULL;
+    }
+    void setHandleKernel(const uint32_t handle_index, Kernel* kernel);
+
+  protected:
+    std::string path_;
+    std::string cache_dir_;
+    std::string build_key_;  // Device, driver and build options
+    std::string build_options_;
+    bool half_arithmetic_;
+    ::cl_context context_;
+    cl_device_id device_;
+    std::vector<Kernel*> handle_kernels_;  // By KernelHandle index
+    std::map<std::string, cl_program> programs_;  // By filename
+    std::map<std::string, Kernel*> kernels_;  // By "filename:name"
+    KernelCacheStats stats_;
+    std::mutex lock_;  // Guards everything above (held while building)
+    std::thread precompile_thread_;
+    std::atomic<bool> stop_precompile_;
+
+    cl_program getProgram(const std::string& filename);  // lock_ held
+    cl_program buildProgram(const std::string& filename);
+    cl_program loadBinary(const std::string& cache_file,
+      const std::string& key);
+    void storeBinary(cl_program program, const std::string& cache_file,
+      const std::string& key);
+    std::string readSource(const std::string& filename) const;
+    // expandIncludes - source with its #include "x.clh" lines replaced by
+    // the headers (recursively)
+    std::string expandIncludes(const std::string& source,
+      const uint32_t depth = 0) const;
+    void precompileAll();
+
+    // Non-copyable, non-assignable.
+    KernelRegistry(KernelRegistry&);
+    KernelRegistry& operator=(const KernelRegistry&);
+  };
+
+  class KernelHandle {
+  public:
+    // Constructor / Destructor
+    // filename and name must outlive the handle (ie string literals).  Cheap
+    // enough to construct statically: nothing is resolved until get().
+    KernelHandle(const char* filename, const char* name);
+
+    inline Kernel* get();
+    inline Kernel* operator->() { return get(); }
+
+  protected:
+    const char* filename_;
+    const char* name_;
+    uint32_t index_;  // Into each registry's handle cache
+
+    Kernel* resolve();
+
+    // Non-copyable, non-assignable.
+    KernelHandle(KernelHandle&);
+    KernelHandle& operator=(const KernelHandle&);
+  };
+
+  Kernel* KernelHandle::get() {
+    Kernel* kernel = kernel_registry != NULL ?
+      kernel_registry->handleKernel(index_) : NULL;
+    return kernel != NULL ? kernel : resolve();
+  }
+
+};  // namespace jtorch
@@ -0,0 +1,91 @@
+//
+//  launch_plan.h
+//
+//  A pre-bound replay of one forward pass.  LaunchPlan::compile() runs the
+//  model for a fixed input and records every device launch it makes
+//  (kernels, buffer copies and clBLAS calls).  Each recorded kernel gets its
+//  own cl_kernel with the arguments bound once, so run() is a list of
+//  enqueues followed by a single flush: no init() size checks, handle
+//  lookups or setArg calls per frame.
+//
+//  The plan holds on to the storage of the model's tensors as it was at
+//  compile time, so compile again after anything that reallocates or rebinds
+//  them: a different input tensor or size, setWeightPrecision, calibrate,
+//  setInPlace or MemoryPlanner::plan.  The contents of the input tensor may
+//  change between runs (ie Tensor<T>::setData on the same tensor).  The plan
+//  keeps a pool reference to every buffer it uses, so temporaries are not
+//  recycled (and MemoryPlanner leaves those buffers alone).
+//
+//  Models that transfer data to or from the host on every forwardProp
+//  (SpatialConvolutionMap, int8 stages before calibration, ...) cannot be
+//  replayed and compile() throws for them.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
+#include "jcl/jcl.h"  // For jcl::JCLBuffer
+#include "jtorch/jtorch.h"
+
+namespace jtorch {
+
+  class TorchStage;
+  class TorchData;
+  class Kernel;
+
+  class LaunchPlan {
+  public:
+    // Constructor / Destructor
+    LaunchPlan();
+    ~LaunchPlan();  // Must be destroyed before ShutdownJTorch()
+
+    // compile - Runs model.forwardProp(input) twice and records the second
+    // pass (the first one allocates outputs and does any one-off host work).
+    void compile(TorchStage& model, TorchData& input);
+    // run - Enqueues the recorded launches and flushes the queue (it does not
+    // wait for them).  model.output then holds the result.  Throws on the
+    // out-of-order queue.
+    void run();
+    void clear();
+
+    inline uint32_t numLaunches() const { return (uint32_t)launches_.size(); }
+
+    // recording - The plan being compiled on the calling thread, otherwise
+    // NULL.  Kernel::run() records itself, other launch sites call
+    // recordLaunch().
+    static LaunchPlan* recording() { return recording_; }
+    void recordKernel(const Kernel& kernel, const uint32_t dim,
+      const uint32_t* global_size, const uint32_t* local_size);
+    // recordLaunch - launch is called again on every run() so it must
+    // capture its arguments by value.  buffers are the pool buffers it uses.
+    void recordLaunch(const std::function<void()>& launch,
+      const std::vector<jcl::JCLBuffer>& buffers);
+    // recordHostAccess - Makes compile() fail (func is a string literal)
+    void recordHostAccess(const char* func);
+
+  protected:
+    struct Launch {
+      cl_kernel kernel;  // NULL for recordLaunch() launches
+      uint32_t dim;
+      size_t global_size[3];
+      size_t local_size[3];
+      bool has_local_size;
+      std::function<void()> launch;
+    };
+
+    std::vector<Launch> launches_;
+    // Referenced so that temporaries are not recycled while the plan exists
+    std::vector<jcl::JCLBuffer> buffers_;
+    const char* host_access_;  // First host transfer seen while recording
+    static JTORCH_THREAD_LOCAL LaunchPlan* recording_;  // Per thread
+
+    // Non-copyable, non-assignable.
+    LaunchPlan(LaunchPlan&);
+    LaunchPlan& operator=(const LaunchPlan&);
+  };
+
+};  // namespace jtorch
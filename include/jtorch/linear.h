@@ -6,10 +6,12 @@
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include "jcl/math/int_types.h"
 #include "jtorch/torch_stage.h"
+#include "jtorch/quantize.h"
 
 #define SIMPLE_LINEAR  // Might actually be faster when using the CPU!
 
@@ -26,11 +28,18 @@ namespace jtorch {
     virtual TorchStageType type() const { return LINEAR_STAGE; }
     virtual std::string name() const { return "Linear"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual uint64_t parameterBytes() const;
+    virtual void setWeightPrecision(const WeightPrecision precision);
+    virtual void setCalibrating(const bool calibrating);
+    virtual bool setActivation(const Activation& activation);
+    const Activation& activation() const { return activation_; }
 
     void setWeights(const float* weights);
     void setBiases(const float* biases);
-    Tensor<float>* weights() { return weights_; }
-    Tensor<float>* biases() { return biases_; }
+    Tensor<float>* weights() { return weights_->f32(); }  // NULL unless fp32
+    WeightTensor* weightTensor() { return weights_.get(); }
+    Tensor<float>* biases() { return biases_.get(); }
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
@@ -38,8 +47,14 @@ namespace jtorch {
     uint32_t n_inputs_;
     uint32_t n_outputs_;
 
-    Tensor<float>* weights_;  // n_outputs (rows) * n_inputs (columns), stored row major
-    Tensor<float>* biases_;  // n_outputs
+    // n_outputs (rows) * n_inputs (columns), stored row major.  The weights
+    // and biases are shared with clones.
+    std::shared_ptr<WeightTensor> weights_;
+    std::shared_ptr<Tensor<float>> biases_;  // n_outputs
+    ActivationQuantizer* input_quantizer_;  // Only used for int8 weights
+    Activation activation_;  // Fused epilogue
+
+    explicit Linear(const Linear* src);  // See clone()
 
     void init(TorchData& input);
 
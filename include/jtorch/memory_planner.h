@@ -0,0 +1,115 @@
+//
+//  memory_planner.h
+//
+//  Static activation memory planning.  By default every stage keeps its own
+//  output (and scratch) tensors for the life of the model, so a deep
+//  Sequential holds every intermediate activation at once.
+//
+//  MemoryPlanner::plan() runs the model once for a given input so that every
+//  tensor exists at its final size, and then walks the stage tree in
+//  execution order (TorchStage::planMemory) to find the first and last step
+//  at which each storage buffer is used.  Buffers whose lifetimes do not
+//  overlap are then packed greedily (largest first) into shared slots, and
+//  the tensors are rebound to the slot storage (Tensor<T>::setStorage).
+//
+//  Sharing happens at buffer granularity: the kernels index flat storage
+//  from offset zero, so a slot is a whole pool buffer rather than a range of
+//  one big allocation.  Buffers are grouped by storage, so views (Reshape,
+//  Transpose, ...) extend the lifetime of the tensor they look into.  Buffers
+//  that are referenced from outside the stage tree (including the model
+//  input) are never touched, and nor are fp16 activations (see
+//  OutputPrecision), which keep their own storage.  A slot holds whatever
+//  the stage before wrote, so stages must not rely on their outputs or
+//  scratch starting out zeroed (ie SpatialConvolutionMM and Linear zero
+//  their GEMM output every frame).
+//
+//  The plan relies on the stages running in order on the one jtorch queue,
+//  except within a concurrent region (ie ParallelTable branches on separate
+//  queues) where every buffer is treated as live for the whole region.  So a
+//  planned model must not be split across queues in any other way (ie by
+//  PipelineExecutor, which refuses planned models).
+//  It stays correct if the input size later changes (stages that reallocate
+//  simply drop out of their slot), but it is only optimal for the planned
+//  size.  Planning again after that is safe, though tensors that already
+//  share a slot are treated as one buffer.
+//
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <set>
+#include "jcl/math/int_types.h"
+#include "jcl/jcl.h"  // For jcl::JCLBuffer
+
+namespace jtorch {
+
+  class TorchData;
+  class TorchStage;
+  template <typename T> class Tensor;
+
+  typedef struct {
+    // Bytes held by the planned (activation and scratch) buffers
+    uint64_t peak_bytes_before;
+    uint64_t peak_bytes_after;
+    uint32_t num_buffers;  // Planned buffers before
+    uint32_t num_slots;  // Shared buffers after
+    uint32_t num_steps;  // Leaf stages visited
+  } MemoryPlanStats;
+
+  typedef struct {
+    TorchStage* stage;  // A leaf stage
+    TorchData* output;
+    std::vector<Tensor<float>*> scratch;
+  } MemoryPlanStep;
+
+  class MemoryPlanner {
+  public:
+    // Constructor / Destructor
+    MemoryPlanner();
+    ~MemoryPlanner();
+
+    // plan - Calls model.forwardProp(input) and then shares storage between
+    // the model's tensors.  Buffers released by the plan are trimmed from the
+    // buffer pool.
+    MemoryPlanStats plan(TorchStage& model, TorchData& input);
+
+    // addStep - Called by TorchStage::planMemory for every leaf stage, in
+    // execution order.  input is read, output and scratch are written.
+    void addStep(TorchStage& stage, TorchData& input, TorchData* output,
+      const std::vector<Tensor<float>*>& scratch);
+    // beginConcurrent / endConcurrent - The steps added in between may run
+    // in any order (or at the same time).  Regions nest.
+    void beginConcurrent();
+    void endConcurrent();
+
+    // steps - The leaf stages visited so far in execution order (calling
+    // model.planMemory directly just walks the tree, see TorchStage::prepare)
+    inline const std::vector<MemoryPlanStep>& steps() const { return steps_; }
+
+  protected:
+    struct BufferUse {
+      std::set<Tensor<float>*> tensors;  // Owned by stages
+      uint32_t first_step;
+      uint32_t last_step;
+      bool external;  // Referenced from outside the stage tree
+    };
+
+    uint32_t num_steps_;
+    std::vector<MemoryPlanStep> steps_;
+    std::vector<uint32_t> concurrent_starts_;  // First step of each region
+    std::map<jcl::JCLBuffer, BufferUse> buffers_;
+    std::set<Tensor<float>*> external_tensors_;
+
+    // collectTensors - Appends the tensors in data (recursing into tables)
+    static void collectTensors(TorchData* data,
+      std::vector<Tensor<float>*>& tensors);
+    void read(TorchData* data, const uint32_t step);
+    void write(Tensor<float>* tensor, const uint32_t step);
+
+    // Non-copyable, non-assignable.
+    MemoryPlanner(MemoryPlanner&);
+    MemoryPlanner& operator=(const MemoryPlanner&);
+  };
+
+};  // namespace jtorch
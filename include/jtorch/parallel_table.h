@@ -3,6 +3,15 @@
 //
 //  Created by Jonathan Tompson on 4/8/13.
 //
+//  By default the branches are issued to separate in-order queues (see
+//  CLExtraQueue) so that small branches can overlap on the device.  The
+//  branches wait for the work queued before the ParallelTable, and work
+//  queued after it waits for all of the branches.  Nested ParallelTables, and
+//  forward passes that are being recorded into a LaunchPlan, run their
+//  branches one after another on the current queue.  On the out-of-order
+//  queue (see CLOutOfOrderQueue) the branches are also issued one after
+//  another, and overlap wherever their buffers allow.
+//
 
 #pragma once
 
@@ -15,6 +24,8 @@
 namespace jcl { namespace data_str { template <typename T> class VectorManaged; } }
 
 namespace jtorch {
+
+  class Table;
   
   class ParallelTable : public TorchStage {
   public:
@@ -25,9 +36,22 @@ namespace jtorch {
     virtual TorchStageType type() const { return PARALLEL_TABLE_STAGE; }
     virtual std::string name() const { return "ParallelTable"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual uint64_t parameterBytes() const;
+    virtual void setWeightPrecision(const WeightPrecision precision);
+    virtual void setOutputPrecision(const OutputPrecision precision);
+    virtual void setCalibrating(const bool calibrating);
+    virtual void planMemory(MemoryPlanner& planner, TorchData& input);
+    virtual uint32_t fuseActivations();
 
     void add(TorchStage* stage);
 
+    // setConcurrent - Run the branches on separate queues (default true)
+    inline void setConcurrent(const bool concurrent) {
+      concurrent_ = concurrent;
+    }
+    inline bool concurrent() const { return concurrent_; }
+
     uint32_t numBanks() const;
 
     TorchStage* get(const uint32_t i);
@@ -36,8 +60,11 @@ namespace jtorch {
 
   protected:
     jcl::data_str::VectorManaged<TorchStage*>* network_;
+    bool concurrent_;
 
     void initOutput();
+    bool runConcurrently() const;
+    void forwardPropConcurrent(Table& input);
 
     // Non-copyable, non-assignable.
     ParallelTable(ParallelTable&);
@@ -0,0 +1,117 @@
+//
+//  pipeline_executor.h
+//
+//  Runs a stream of frames through a Sequential split into segments of
+//  consecutive stages, so that segment i works on frame n while segment i+1
+//  works on frame n-1 (a few frames of latency for more throughput).
+//
+//  The segments are balanced by the cost of each stage, measured once when
+//  the executor is built, and can only end at stages with a tensor output.
+//  Each segment has its own queue.  A segment's output is copied into one of
+//  two boundary tensors (alternating every frame) for the next segment to
+//  read, so a segment can start on the next frame while the one after it
+//  still reads the last one.  All ordering is done with OpenCL events:
+//  push() only enqueues work and returns the frame's Event.
+//
+//  Like the rest of jtorch the executor must be used with its engine
+//  current, and the model belongs to it until it is destroyed.  The input
+//  size is fixed and the stages must not reallocate their outputs after the
+//  first frame (buffers released while frames are in flight are only
+//  recycled by sync()).  Segments run concurrently, so no two segments may
+//  write the same storage: do NOT run MemoryPlanner::plan on the model (the
+//  constructor throws if it finds storage shared between segments).
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include "jcl/math/int_types.h"
+#include "jcl/cl_include.h"
+#include "jtorch/event.h"
+
+namespace jtorch {
+
+  class Sequential;
+  class TorchData;
+  template <typename T> class Tensor;
+
+  typedef struct {
+    uint32_t first_stage;  // Index into the Sequential
+    uint32_t num_stages;
+    double cost_ms;  // Measured when the executor was built
+    uint64_t num_frames;  // Frames finished since resetStats()
+    double busy_ms;  // Device time spent on those frames
+    // utilization - busy_ms over the time from the first segment starting
+    // to the last one finishing (the wall time of the pipeline)
+    double utilization;
+  } PipelineSegmentStats;
+
+  class PipelineExecutor {
+  public:
+    // Constructor / Destructor
+    // input_dim / input_size - The size of every frame
+    // max_frames_in_flight - push() waits for the oldest frame beyond this
+    // many (0 for num_segments)
+    PipelineExecutor(Sequential& model, const uint32_t input_dim,
+      const uint32_t* input_size, const uint32_t num_segments,
+      const uint32_t max_frames_in_flight = 0);
+    ~PipelineExecutor();  // Waits for all frames
+
+    // push - Starts one frame.  input (inputNElems() floats) and output
+    // (outputNElems() floats) must stay valid until the returned Event
+    // completes.
+    Event push(const float* input, float* output);
+    void sync();  // Waits for every frame
+
+    std::vector<PipelineSegmentStats> segmentStats() const;
+    void resetStats();
+
+    inline uint32_t numSegments() const {
+      return (uint32_t)segments_.size();
+    }
+    inline uint32_t inputNElems() const { return input_nelems_; }
+    inline uint32_t outputNElems() const { return output_nelems_; }
+
+  protected:
+    struct Segment {
+      uint32_t first_stage;
+      uint32_t num_stages;
+      double cost_ms;
+      cl_command_queue queue;
+      Tensor<float>* boundary[2];  // Output copies (NULL for the last one)
+      uint64_t num_frames;
+      double busy_ms;
+    };
+
+    struct Frame {
+      std::vector<cl_event> start;  // Per segment
+      std::vector<cl_event> end;  // Per segment
+      Event output;
+    };
+
+    Sequential& model_;
+    std::vector<Segment> segments_;
+    std::deque<Frame> frames_;  // In flight, oldest first
+    uint32_t max_frames_in_flight_;
+    uint64_t num_pushed_;
+    Tensor<float>* input_;
+    uint32_t input_nelems_;
+    uint32_t output_nelems_;
+    cl_ulong stats_start_;  // Device time (0 until the first frame)
+    cl_ulong stats_end_;
+
+    std::vector<double> measureStageCosts();
+    void partition(const std::vector<double>& costs,
+      const uint32_t num_segments);
+    void runSegment(const uint32_t segment, TorchData& input);
+    void checkStorage();  // Throws if two segments write the same buffer
+    void retireFrame();  // Waits for the oldest frame
+    void cleanup();
+
+    // Non-copyable, non-assignable.
+    PipelineExecutor(PipelineExecutor&);
+    PipelineExecutor& operator=(const PipelineExecutor&);
+  };
+
+};  // namespace jtorch
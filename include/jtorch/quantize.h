@@ -0,0 +1,97 @@
+//
+//  quantize.h
+//
+//  Reduced precision storage for stage weights and activations.
+//
+//  WeightTensor holds a stage's weights in one of the WeightPrecision
+//  formats.  WEIGHT_PRECISION_INT8 is symmetric per output channel
+//  quantization: w = scale[c] * q, with q in [-127, 127] and
+//  scale[c] = max(|w_c|) / 127.  Precision changes go through the host, so
+//  they are meant for load time.
+//
+//  ActivationQuantizer converts a stage's float input to int8 with a single
+//  symmetric scale so that the int8 kernels can accumulate in int32.  Until
+//  it is calibrated the scale comes from max(|x|) of every input, which costs
+//  a blocking read back per forwardProp.  While calibrating it records the
+//  largest max(|x|) seen, and that fixed scale is used from then on.
+//
+
+#pragma once
+
+#include "jcl/math/int_types.h"
+#include "jtorch/torch_stage.h"
+#include "jtorch/half.h"
+
+namespace jtorch {
+
+  template <typename T> class Tensor;
+
+  class WeightTensor {
+  public:
+    // Constructor / Destructor
+    // channel_dim - The output channel dimension (indexed as in size())
+    WeightTensor(const uint32_t dim, const uint32_t* size,
+      const uint32_t channel_dim);  // Zero-filled fp32
+    ~WeightTensor();
+
+    void setData(const float* data);  // Converted to the current precision
+    void getData(float* data) const;  // Converted back to fp32
+    void setPrecision(const WeightPrecision precision);
+
+    inline WeightPrecision precision() const { return precision_; }
+    inline const uint32_t dim() const { return dim_; }
+    inline const uint32_t* size() const { return size_; }
+    uint32_t nelems() const;
+    uint64_t bytes() const;  // Device memory held
+
+    // Only the tensor(s) for the current precision are non-NULL
+    inline Tensor<float>* f32() const { return float_; }
+    inline Tensor<half>* f16() const { return half_; }
+    inline Tensor<int8_t>* i8() const { return int8_; }
+    inline Tensor<float>* scales() const { return scales_; }  // Per channel
+
+  protected:
+    WeightPrecision precision_;
+    uint32_t dim_;
+    uint32_t* size_;
+    uint32_t channel_dim_;
+    Tensor<float>* float_;
+    Tensor<half>* half_;
+    Tensor<int8_t>* int8_;
+    Tensor<float>* scales_;
+
+    void allocate();  // For precision_
+
+    // Non-copyable, non-assignable.
+    WeightTensor(WeightTensor&);
+    WeightTensor& operator=(const WeightTensor&);
+  };
+
+  class ActivationQuantizer {
+  public:
+    // Constructor / Destructor
+    ActivationQuantizer();
+    ~ActivationQuantizer();
+
+    // quantize - Returns the int8 copy of x (owned by the quantizer and only
+    // valid until the next call).  x is recovered as scale * q.  x must be
+    // flat.
+    Tensor<int8_t>* quantize(const Tensor<float>& x, float& scale);
+
+    // setCalibrating - Calibration restarts every time it is enabled
+    void setCalibrating(const bool calibrating);
+    inline bool calibrated() const { return !calibrating_ && calib_max_ > 0; }
+    // copyCalibration - Uses src's calibration (for TorchStage::clone)
+    void copyCalibration(const ActivationQuantizer& src);
+
+  protected:
+    bool calibrating_;
+    float calib_max_;  // max(|x|) over the calibration inputs
+    Tensor<int8_t>* q_;
+
+    // Non-copyable, non-assignable.
+    ActivationQuantizer(ActivationQuantizer&);
+    ActivationQuantizer& operator=(const ActivationQuantizer&);
+  };
+
+};  // namespace jtorch
@@ -9,6 +9,11 @@
 //  But really this 1D array is just a straight copy of the input data (since
 //  we define tensors as float* anyway).
 //
+//  A batch keeps its (outer most) batch dimension.  When n_input_dims is
+//  given an input with n_input_dims + 1 dimensions is a batch (as in
+//  JoinTable), so a batch of one is still a batch.  Otherwise, as per torch,
+//  an input with more elements than the output size is a batch.
+//
 
 #pragma once
 
@@ -23,18 +28,23 @@ namespace jtorch {
   public:
     // Constructor / Destructor
     // For 1D tensor: set sz1 = -1, for 2D tensor: set sz2 = -1
-    Reshape(const uint32_t dim, const uint32_t* size);
+    Reshape(const uint32_t dim, const uint32_t* size,
+      const uint32_t n_input_dims = 0);
     virtual ~Reshape();
 
     virtual TorchStageType type() const { return RESHAPE_STAGE; }
     virtual std::string name() const { return "Reshape"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
+    inline uint32_t nInputDims() const { return n_input_dims_; }
+
   protected:
     uint32_t odim_;
     uint32_t* osize_;
+    uint32_t n_input_dims_;  // 0 to detect a batch from the element count
     void init(TorchData& input);
 
     uint32_t outNElem() const;
@@ -23,6 +23,7 @@ namespace jtorch {
     virtual TorchStageType type() const { return SELECT_TABLE_STAGE; }
     virtual std::string name() const { return "SelectTable"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
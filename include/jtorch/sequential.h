@@ -25,6 +25,13 @@ namespace jtorch {
     virtual TorchStageType type() const { return SEQUENTIAL_STAGE; }
     virtual std::string name() const { return "Sequential"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual uint64_t parameterBytes() const;
+    virtual void setWeightPrecision(const WeightPrecision precision);
+    virtual void setOutputPrecision(const OutputPrecision precision);
+    virtual void setCalibrating(const bool calibrating);
+    virtual void planMemory(MemoryPlanner& planner, TorchData& input);
+    virtual uint32_t fuseActivations();
 
     void add(TorchStage* stage);
     TorchStage* get(const uint32_t i);
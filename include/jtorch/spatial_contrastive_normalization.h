@@ -11,9 +11,16 @@
 //
 //  This stage is the default for local contrast normalization.
 //
+//  By default both stages run fused (setFused) in two launches: one computes
+//  the local mean and the next the local std (from a local memory tile of
+//  the zero mean input) and writes the normalized output directly.  The only
+//  temporary is the 2D mean map.  Filters whose tile does not fit in local
+//  memory fall back to the two separate stages.
+//
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include "jtorch/torch_stage.h"
@@ -33,11 +40,37 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_CONTRASTIVE_NORMALIZATION_STAGE; }
     virtual std::string name() const { return "SpatialContrastiveNormalization"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual uint64_t parameterBytes() const;
+    virtual void planMemory(MemoryPlanner& planner, TorchData& input);
+    virtual void setOutputPrecision(const OutputPrecision precision);
+
+    // setFused - false runs the separate subtractive and divisive stages
+    void setFused(const bool fused) { fused_ = fused; }
+    bool fused() const { return fused_; }
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
   protected:
-    Sequential* network_;
+    Sequential* network_;  // The unfused stages
+    bool fused_;
+    float threshold_;
+    // Normalized (1D kernels are expanded), shared with clones
+    std::shared_ptr<Tensor<float>> kernel2d_;
+    TorchData* fused_output_;  // Tensor<half> at OUTPUT_PRECISION_HALF
+    Tensor<float>* mean_;
+    uint32_t local_size_;  // Fused workgroup width and height (0 if unfused)
+
+    // See clone()
+    explicit SpatialContrastiveNormalization(
+      const SpatialContrastiveNormalization* src);
+
+    template <typename T>
+    void init(Tensor<T>& in);
+    // runFused - false if the filter's tile does not fit in local memory
+    template <typename T>
+    bool runFused(Tensor<T>& in);
+    virtual void scratchTensors(std::vector<Tensor<float>*>& scratch);
 
     // Non-copyable, non-assignable.
     SpatialContrastiveNormalization(SpatialContrastiveNormalization&);
@@ -6,11 +6,13 @@
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include "jcl/math/int_types.h"
 #include "jcl/math/math_types.h"
 #include "jtorch/torch_stage.h"
+#include "jtorch/quantize.h"
 #include "jcl/jcl.h"  // For jcl::JCLBuffer
 
 namespace jcl { namespace data_str { template <typename T> class VectorManaged; } }
@@ -30,11 +32,18 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_CONVOLUTION_STAGE; }
     virtual std::string name() const { return "SpatialConvolution"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual uint64_t parameterBytes() const;
+    virtual void setWeightPrecision(const WeightPrecision precision);
+    virtual void setCalibrating(const bool calibrating);
+    virtual bool setActivation(const Activation& activation);
+    const Activation& activation() const { return activation_; }
 
     void setWeights(const float* weights);
     void setBiases(const float* biases);
-    Tensor<float>* weights() { return weights_; }
-    Tensor<float>* biases() { return biases_; }
+    Tensor<float>* weights() { return weights_->f32(); }  // NULL unless fp32
+    WeightTensor* weightTensor() { return weights_.get(); }
+    Tensor<float>* biases() { return biases_.get(); }
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
@@ -45,8 +54,12 @@ namespace jtorch {
     uint32_t feats_out_;
     uint32_t padding_;
 
-    Tensor<float>* weights_;
-    Tensor<float>* biases_;
+    std::shared_ptr<WeightTensor> weights_;  // Shared with clones
+    std::shared_ptr<Tensor<float>> biases_;  // Shared with clones
+    ActivationQuantizer* input_quantizer_;  // Only used for int8 weights
+    Activation activation_;  // Fused epilogue
+
+    explicit SpatialConvolution(const SpatialConvolution* src);  // See clone()
 
     void init(TorchData& input);
 
@@ -38,6 +38,8 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_CONVOLUTION_MAP_STAGE; }
     virtual std::string name() const { return "SpatialConvolutionMap"; }
     virtual void forwardProp(TorchData& input);
+    // clone - The weights are on the host, so the clone gets a copy
+    virtual TorchStage* clone() const;
 
     float** weights;
     float* biases;
@@ -48,8 +50,8 @@ namespace jtorch {
     static TorchStage* loadFromFile(std::ifstream& file);
 
   protected:
-    float* input_cpu_;
-    float* output_cpu_;
+    float* input_cpu_;  // Mapped input (only valid inside forwardProp)
+    float* output_cpu_;  // Mapped output (only valid inside forwardProp)
     uint32_t filt_width_;
     uint32_t filt_height_;
     uint32_t feats_in_;
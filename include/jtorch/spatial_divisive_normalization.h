@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include "jcl/math/int_types.h"
@@ -32,20 +33,31 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_DIVISIVE_NORMALIZATION_STAGE; }
     virtual std::string name() const { return "SpatialDivisiveNormalization"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual uint64_t parameterBytes() const;
+    virtual void setOutputPrecision(const OutputPrecision precision);
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
   protected:
-    Tensor<float>* kernel_;
+    std::shared_ptr<Tensor<float>> kernel_;  // Shared with clones
     Tensor<float>* kernel_norm_;  // kernel normalization depends on input size
     Tensor<float>* std_coef_;
-    Tensor<float>* std_;        // 2D
+    Tensor<float>* std_;        // 2D (3D for a batch)
     Tensor<float>* std_pass1_;  // 3D - Horizontal pass
     Tensor<float>* std_pass2_;  // 3D - Vertical + normalization pass
     float threshold_;
 
-    void init(TorchData& input);
+    // See clone()
+    explicit SpatialDivisiveNormalization(
+      const SpatialDivisiveNormalization* src);
+
+    template <typename T>
+    void init(Tensor<T>& in);
+    template <typename T>
+    void run(Tensor<T>& in);
     void cleanup();
+    virtual void scratchTensors(std::vector<Tensor<float>*>& scratch);
 
     // Non-copyable, non-assignable.
     SpatialDivisiveNormalization(SpatialDivisiveNormalization&);
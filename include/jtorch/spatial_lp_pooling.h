@@ -33,14 +33,20 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_LP_POOLING_STAGE; }
     virtual std::string name() const { return "SpatialLPPooling"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual void setOutputPrecision(const OutputPrecision precision);
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
   protected:
-    float* input_cpu_;
-    float* output_cpu_;
+    // Mapped input and output (only valid inside forwardProp), float or
+    // half (see OutputPrecision)
+    void* input_cpu_;
+    void* output_cpu_;
     uint32_t cur_in_w;
     uint32_t cur_in_h;
+    uint32_t cur_out_w;
+    uint32_t cur_out_h;
     float p_norm_;
     uint32_t poolsize_v_;
     uint32_t poolsize_u_;
@@ -53,8 +59,13 @@ namespace jtorch {
     jcl::data_str::VectorManaged<jcl::threading::Callback<void>*>* thread_cbs_; 
 
     void forwardPropThread(const uint32_t outf);
+    template <typename T>
+    void poolPlane(const T* in, T* out);
 
-    void init(TorchData& input, jcl::threading::ThreadPool& tp);
+    template <typename T>
+    void init(Tensor<T>& in, jcl::threading::ThreadPool& tp);
+    template <typename T>
+    void run(Tensor<T>& input);
     void cleanup();
 
     // Non-copyable, non-assignable.
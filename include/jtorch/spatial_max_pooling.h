@@ -28,6 +28,8 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_MAX_POOLING_STAGE; }
     virtual std::string name() const { return "SpatialMaxPooling"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual void setOutputPrecision(const OutputPrecision precision);
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
@@ -35,7 +37,10 @@ namespace jtorch {
     uint32_t poolsize_v_;
     uint32_t poolsize_u_;
 
-    void init(TorchData& input);
+    template <typename T>
+    void init(Tensor<T>& in);
+    template <typename T>
+    void run(Tensor<T>& in);
 
     // Non-copyable, non-assignable.
     SpatialMaxPooling(SpatialMaxPooling&);
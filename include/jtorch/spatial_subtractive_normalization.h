@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include "jcl/math/int_types.h"
@@ -27,18 +28,30 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_SUBTRACTIVE_NORMALIZATION_STAGE; }
     virtual std::string name() const { return "SpatialSubtractiveNormalization"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
+    virtual uint64_t parameterBytes() const;
+    virtual void setOutputPrecision(const OutputPrecision precision);
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
   protected:
-    Tensor<float>* kernel_;
+    std::shared_ptr<Tensor<float>> kernel_;  // Shared with clones
     Tensor<float>* mean_coef_;
-    Tensor<float>* mean_;        // 2D
-    Tensor<float>* mean_pass1_;  // 3D - Horizontal pass
-    Tensor<float>* mean_pass2_;  // 3D - Vertical + normalization pass
-
-    void init(TorchData& input);
+    // The passes are Tensor<half> at OUTPUT_PRECISION_HALF
+    TorchData* mean_;        // 2D (3D for a batch)
+    TorchData* mean_pass1_;  // 3D - Horizontal pass
+    TorchData* mean_pass2_;  // 3D - Vertical + normalization pass
+
+    // See clone()
+    explicit SpatialSubtractiveNormalization(
+      const SpatialSubtractiveNormalization* src);
+
+    template <typename T>
+    void init(Tensor<T>& in);
+    template <typename T>
+    void run(Tensor<T>& in);
     void cleanup();
+    virtual void scratchTensors(std::vector<Tensor<float>*>& scratch);
 
     // Non-copyable, non-assignable.
     SpatialSubtractiveNormalization(SpatialSubtractiveNormalization&);
@@ -28,6 +28,7 @@ namespace jtorch {
     virtual TorchStageType type() const { return SPATIAL_UP_SAMPLING_NEAREST_STAGE; }
     virtual std::string name() const { return "SpatialUpSamplingNearest"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
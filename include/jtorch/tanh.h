@@ -25,6 +25,7 @@ namespace jtorch {
     virtual TorchStageType type() const { return TANH_STAGE; }
     virtual std::string name() const { return "Tanh"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
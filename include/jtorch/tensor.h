@@ -14,39 +14,128 @@
 #include <iomanip>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include "jcl/math/int_types.h"
 #include "jcl/math/math_types.h"
 #include "jcl/jcl.h"  // For jcl::JCLBuffer
+#include "jcl/cl_include.h"
 #include "jtorch/torch_data.h"
+#include "jtorch/half.h"
 #include "jtorch/jtorch.h"
+#include "jtorch/buffer_pool.h"
+#include "jtorch/event.h"
+#include "jtorch/dependency_graph.h"
+#include "jtorch/kernel.h"
+#include "jtorch/launch_plan.h"
 
 #define JTORCH_TENSOR_PRECISON 4
 
+// These must match the defines in kernels/reduce.cl
+#define JTORCH_REDUCE_SUM 0
+#define JTORCH_REDUCE_MAX 1
+#define JTORCH_REDUCE_MIN 2
+#define JTORCH_REDUCE_SUM_SQ 3
+#define JTORCH_REDUCE_ARGMAX 4
+#define JTORCH_REDUCE_ABS_MAX 5
+#define JTORCH_IDX_ROW 0
+#define JTORCH_IDX_FLAT 1
+#define JTORCH_IDX_READ 2
+#define JTORCH_FINALIZE_NONE 0
+#define JTORCH_FINALIZE_DIV 1
+#define JTORCH_FINALIZE_SQRT 2
+#define JTORCH_FINALIZE_IDX 3
+#define JTORCH_REDUCE_MAX_LOCAL_SIZE 256
+
 namespace jcl { namespace threading { class ThreadPool; } }
 
 #define TO_TENSOR_PTR(x) ((x)->type() == jtorch::TorchDataType::TENSOR_DATA ? (jtorch::Tensor<float>*)(x) : NULL)
+#define TO_HALF_TENSOR_PTR(x) ((x)->type() == jtorch::TorchDataType::HALF_TENSOR_DATA ? (jtorch::Tensor<jtorch::half>*)(x) : NULL)
 
 namespace jtorch {
+
+  typedef enum {
+    TENSOR_MAP_READ = 0,
+    TENSOR_MAP_WRITE = 1,  // Previous contents are discarded
+    TENSOR_MAP_READ_WRITE = 2,
+  } TensorMapMode;
+
+  typedef enum {
+    REDUCE_SUM = 0,
+    REDUCE_MAX = 1,
+    REDUCE_MIN = 2,
+    REDUCE_MEAN = 3,
+    REDUCE_ARGMAX = 4,  // Index of the first maximum
+    REDUCE_L2 = 5,  // sqrt(sum(x^2))
+    REDUCE_ABS_MAX = 6,  // max(|x|)
+  } ReduceOp;
   
   template <typename T>
   class Tensor : public TorchData {
   public:
-    Tensor(const uint32_t dim, const uint32_t* size);
+    Tensor(const uint32_t dim, const uint32_t* size);  // Zero-filled
     virtual ~Tensor();
 
+    // uninitialized - Allocates storage WITHOUT launching the zero-fill 
+    // kernel.  Use it for tensors whose every element is about to be
+    // overwritten (stage outputs, scratch buffers, setData targets).  Note: 
+    // storage may be recycled by the buffer pool, so contents are arbitrary.
+    static Tensor<T>* uninitialized(const uint32_t dim, const uint32_t* size);
+
     virtual TorchDataType type() const { return TENSOR_DATA; }
 
     // setData and getData are EXPENSIVE --> They require a CPU to GPU copy
     void setData(const T* data);
     void getData(T* data) const;
 
+    // setDataAsync and getDataAsync return immediately.  The host array must
+    // stay valid (and, for setDataAsync, unmodified) until the returned Event
+    // completes.  Transfers are ordered with the kernels on the jtorch queue.
+    // getDataAsync also waits for after (ie from forwardPropAsync), which may
+    // come from another queue.
+    Event setDataAsync(const T* data);
+    Event getDataAsync(T* data, const Event& after = Event()) const;
+
+    // map / unmap - Map the storage into host memory for direct CPU access.
+    // On CPU runtimes and integrated GPUs this is zero-copy; on discrete GPUs
+    // the driver transfers through pinned memory.  The mapping is blocking and
+    // the tensor must not be used by any kernel until unmap() is called.
+    T* map(const TensorMapMode mode);
+    void unmap();
+
     // View returns a new view on the same object.  The caller owns the new
-    // memory (ie, it is transferred).
+    // memory (ie, it is transferred).  The tensor must be contiguous.
     Tensor<T>* view(const uint32_t dim, const uint32_t* size);
 
+    // narrow, select and transpose also return views that share storage (no
+    // data is copied, the caller owns the returned header).  Dimensions are
+    // indexed as in size(), ie 0 is the innermost dimension.
+    // narrow - Restricts dimension dim to [first, first + length)
+    Tensor<T>* narrow(const uint32_t dim, const uint32_t first, 
+      const uint32_t length);
+    // select - Slices at index along dim (the result has one less dimension)
+    Tensor<T>* select(const uint32_t dim, const uint32_t index);
+    // transpose - Swaps two dimensions
+    Tensor<T>* transpose(const uint32_t dim0, const uint32_t dim1);
+
     const uint32_t dim() const { return dim_; }
     const uint32_t* size() const { return size_; }
+    const uint32_t* stride() const { return stride_; }  // In elements
+    const uint32_t offset() const { return offset_; }  // In elements
     const bool isSameSizeAs(const Tensor<T>& src) const;
+    // isContiguous - true if the elements are densely packed in size() order
+    // (the view may still start at a non-zero offset)
+    const bool isContiguous() const;
+    // isFlat - true if contiguous AND the offset is zero, ie storage() can be
+    // handed to any kernel that indexes it as a flat array.
+    const bool isFlat() const { return offset_ == 0 && isContiguous(); }
+
+    // Kernels that read strided tensors take an element offset followed by
+    // 4 strides (missing dimensions have zero stride) and are launched over
+    // {size[0], size[1], size[2] * size[3]}.  setStridedArgs sets the 5
+    // arguments of kernel starting at first_arg and stridedWorkSize fills the
+    // global work size.
+    void setStridedArgs(Kernel* kernel, const uint32_t first_arg) const;
+    void stridedWorkSize(uint32_t* global_size) const;  // global_size[3]
 
     // Print --> EXPENSIVE
     virtual void print();  // print to std::cout
@@ -59,9 +148,19 @@ namespace jtorch {
     static void accumulate(Tensor<T>& dst, const Tensor<T>& src);
     static void zero(Tensor<T>& x);
     static void fill(Tensor<T>& x, float value);
-    // slowSum - This does a CPU copy because I haven't written a reduction 
-    // operator yet
-    static float slowSum(const Tensor<T>& x);  
+
+    // Reductions run on the device as work-group tree reductions.  Strided 
+    // views are first copied to a contiguous temporary.
+    // reduce - Reduces the whole tensor and reads back the result (blocking).
+    // For REDUCE_ARGMAX the flat index is returned (exact up to 2^24).
+    static float reduce(const Tensor<T>& x, const ReduceOp op);
+    // reduce - Reduces along dimension dim (indexed as in size()).  dst must 
+    // be flat with x.nelems() / x.size()[dim] elements (ie x's size with 
+    // dim removed or set to 1).  REDUCE_ARGMAX writes the index within dim.
+    static void reduce(Tensor<T>& dst, const Tensor<T>& x, const uint32_t dim,
+      const ReduceOp op);
+    static float sum(const Tensor<T>& x) { return reduce(x, REDUCE_SUM); }
+    static uint32_t argmax(const Tensor<T>& x);
     
     // Some tensor math operations that return new tensors
     static Tensor<T>* clone(const Tensor<T>& x);
@@ -72,47 +171,111 @@ namespace jtorch {
 
     inline const jcl::JCLBuffer& storage() const { return storage_; }
     inline uint32_t nelems() const;
+    // setStorage - Rebinds the tensor to another pool buffer (keeping its
+    // size, strides and offset).  The caller must make sure the buffer is
+    // large enough.  Used by MemoryPlanner.
+    void setStorage(const jcl::JCLBuffer& storage);
 
-    uint32_t* calcStride() const;  // memory returned is owned by caller
+    // calcStride - The strides of a contiguous tensor of this size.  Memory
+    // returned is owned by caller.
+    uint32_t* calcStride() const;
 
   protected:
     jcl::JCLBuffer storage_;  // Internal data
     uint32_t dim_;
     uint32_t* size_;  // size_[0] is lowest contiguous dimension, 
                       // size_[2] is highest dimension
+    uint32_t* stride_;  // Element stride of each dimension
+    uint32_t offset_;  // Element offset of the first element into storage_
+    T* mapped_data_;  // NULL when not mapped
 
     Tensor();  // Default constructor used internally (in view function)
+    // newView - Returns a header that shares storage_ with this tensor
+    Tensor<T>* newView(const uint32_t dim, const uint32_t* size, 
+      const uint32_t* stride, const uint32_t offset) const;
+    // requireFlat - Throws if x is a (non-flat) strided view
+    static void requireFlat(const Tensor<T>& x, const char* func);
+    // requireFloat - Throws for storage only types (eg Tensor<half>)
+    static void requireFloat(const char* func);
+    // storageElems - The number of float sized pool elements for n T's
+    static uint32_t storageElems(const uint32_t n);
+    // reduceDevice - Whole tensor reduction, the result is left in the first
+    // element of value (and, for REDUCE_ARGMAX, of index as int bits).  Both
+    // are owned by the caller.
+    static void reduceDevice(const Tensor<T>& x, const ReduceOp op,
+      Tensor<T>*& value, Tensor<T>*& index);
+    // runReduce - One launch of the Reduce kernel (see kernels/reduce.cl)
+    static void runReduce(const jcl::JCLBuffer& input, 
+      const jcl::JCLBuffer& input_idx, const jcl::JCLBuffer& output, 
+      const jcl::JCLBuffer& output_idx, const uint32_t inner, 
+      const uint32_t reduce_size, const uint32_t nelems, const uint32_t rows,
+      const int kernel_op, const int idx_mode, const int finalize, 
+      const uint32_t count);
 
     // Non-copyable, non-assignable.
     Tensor(Tensor&);
     Tensor& operator=(const Tensor&);
   };
 
+  // fp16 activations are their own TorchData type, so stages can tell them
+  // apart (TO_TENSOR_PTR returns NULL for them)
+  template <>
+  inline TorchDataType Tensor<half>::type() const { return HALF_TENSOR_DATA; }
+
   template <typename T>
   Tensor<T>::Tensor(const uint32_t dim, const uint32_t* size) {
     this->dim_ = dim;
     this->size_ = new uint32_t[dim];
     memcpy(this->size_, size, sizeof(this->size_[0]) * dim);
-    storage_ = jtorch::cl_context->allocateBuffer(jcl::CLBufferTypeReadWrite,
-      nelems());  // Adds a reference to the reference count
+    stride_ = calcStride();
+    offset_ = 0;
+    mapped_data_ = NULL;
+    // The pool may hand back a (recycled) buffer that is larger than nelems()
+    storage_ = jtorch::buffer_pool->allocate(storageElems(nelems()));
     zero(*this);
   }
 
+  template <typename T>
+  Tensor<T>* Tensor<T>::uninitialized(const uint32_t dim, 
+    const uint32_t* size) {
+    Tensor<T>* ret = new Tensor<T>();
+    ret->dim_ = dim;
+    ret->size_ = new uint32_t[dim];
+    memcpy(ret->size_, size, sizeof(ret->size_[0]) * dim);
+    ret->stride_ = ret->calcStride();
+    ret->storage_ = 
+      jtorch::buffer_pool->allocate(storageElems(ret->nelems()));
+    return ret;
+  }
+
   template <typename T>
   Tensor<T>::Tensor() {
     // Default constructor returns an empty header.  Used internally (ie 
     // private).
     dim_ = 0;
     size_ = NULL;
+    stride_ = NULL;
+    offset_ = 0;
+    mapped_data_ = NULL;
     storage_ = (jcl::JCLBuffer)-1;
   }
 
   template <typename T>
   Tensor<T>::~Tensor() {
-    jtorch::cl_context->releaseReference(storage_);
+    if (mapped_data_ != NULL) {
+      cl_mem mem = (cl_mem)cl_context->getCLMem(storage_);
+      CommandDeps deps;
+      deps.writes(mem);
+      clEnqueueUnmapMemObject(jtorch::CLQueue(), mem, mapped_data_,
+        deps.numWaits(), deps.waitList(), deps.event());
+    }
+    jtorch::buffer_pool->releaseReference(storage_);
     if (size_) {
       delete[] size_;
     }
+    if (stride_) {
+      delete[] stride_;
+    }
   }
 
   template <typename T>
@@ -147,6 +310,46 @@ namespace jtorch {
     return true;
   }
 
+  template <typename T>
+  const bool Tensor<T>::isContiguous() const {
+    uint32_t expected_stride = 1;
+    for (uint32_t i = 0; i < dim_; i++) {
+      // Size 1 dimensions can have any stride
+      if (size_[i] != 1 && stride_[i] != expected_stride) {
+        return false;
+      }
+      expected_stride *= size_[i];
+    }
+    return true;
+  }
+
+  template <typename T>
+  void Tensor<T>::setStorage(const jcl::JCLBuffer& storage) {
+    if (mapped_data_ != NULL) {
+      throw std::runtime_error("Tensor<T>::setStorage() - ERROR: The tensor "
+        "is mapped!");
+    }
+    jtorch::buffer_pool->addReference(storage);
+    jtorch::buffer_pool->releaseReference(storage_);
+    storage_ = storage;
+  }
+
+  template <typename T>
+  Tensor<T>* Tensor<T>::newView(const uint32_t dim, const uint32_t* size,
+    const uint32_t* stride, const uint32_t offset) const {
+    Tensor<T>* return_header = new Tensor<T>();
+    return_header->dim_ = dim;
+    return_header->size_ = new uint32_t[dim];
+    memcpy(return_header->size_, size, sizeof(return_header->size_[0]) * dim);
+    return_header->stride_ = new uint32_t[dim];
+    memcpy(return_header->stride_, stride, 
+      sizeof(return_header->stride_[0]) * dim);
+    return_header->offset_ = offset;
+    return_header->storage_ = storage_;
+    jtorch::buffer_pool->addReference(storage_);
+    return return_header;
+  }
+
   template <typename T>
   Tensor<T>* Tensor<T>::view(const uint32_t dim, const uint32_t* size) {
     if (dim == 0) {
@@ -160,24 +363,319 @@ namespace jtorch {
     if (view_nelem != nelems()) {
       throw std::runtime_error("ERROR - view() - Size mismatch!"); 
     }
+    if (!isContiguous()) {
+      throw std::runtime_error("ERROR - view() - Tensor is not contiguous!"); 
+    }
 
-    Tensor<T>* return_header = new Tensor<T>();
-    return_header->dim_ = dim;
-    return_header->size_ = new uint32_t[dim];
-    memcpy(return_header->size_, size, sizeof(return_header->size_[0]) * dim);
-    return_header->storage_ = storage_;
-    jtorch::cl_context->addReference(storage_);
+    uint32_t* stride = new uint32_t[dim];
+    stride[0] = 1;
+    for (uint32_t i = 1; i < dim; i++) {
+      stride[i] = stride[i-1] * size[i-1];
+    }
+    Tensor<T>* return_header = newView(dim, size, stride, offset_);
+    delete[] stride;
     return return_header;
   }
 
+  template <typename T>
+  Tensor<T>* Tensor<T>::narrow(const uint32_t dim, const uint32_t first,
+    const uint32_t length) {
+    if (dim >= dim_ || length == 0 || first + length > size_[dim]) {
+      throw std::runtime_error("ERROR - narrow() - Index out of range!"); 
+    }
+    Tensor<T>* return_header = newView(dim_, size_, stride_, 
+      offset_ + first * stride_[dim]);
+    return_header->size_[dim] = length;
+    return return_header;
+  }
+
+  template <typename T>
+  Tensor<T>* Tensor<T>::select(const uint32_t dim, const uint32_t index) {
+    if (dim_ <= 1) {
+      throw std::runtime_error("ERROR - select() - Tensor must be at least "
+        "2D!"); 
+    }
+    if (dim >= dim_ || index >= size_[dim]) {
+      throw std::runtime_error("ERROR - select() - Index out of range!"); 
+    }
+    uint32_t* size = new uint32_t[dim_ - 1];
+    uint32_t* stride = new uint32_t[dim_ - 1];
+    for (uint32_t i = 0, j = 0; i < dim_; i++) {
+      if (i != dim) {
+        size[j] = size_[i];
+        stride[j] = stride_[i];
+        j++;
+      }
+    }
+    Tensor<T>* return_header = newView(dim_ - 1, size, stride, 
+      offset_ + index * stride_[dim]);
+    delete[] size;
+    delete[] stride;
+    return return_header;
+  }
+
+  template <typename T>
+  Tensor<T>* Tensor<T>::transpose(const uint32_t dim0, const uint32_t dim1) {
+    if (dim0 >= dim_ || dim1 >= dim_) {
+      throw std::runtime_error("ERROR - transpose() - Index out of range!"); 
+    }
+    Tensor<T>* return_header = newView(dim_, size_, stride_, offset_);
+    std::swap(return_header->size_[dim0], return_header->size_[dim1]);
+    std::swap(return_header->stride_[dim0], return_header->stride_[dim1]);
+    return return_header;
+  }
+
+  template <typename T>
+  void Tensor<T>::setStridedArgs(Kernel* kernel,
+    const uint32_t first_arg) const {
+    if (dim_ > 4) {
+      throw std::runtime_error("Tensor<T>::setStridedArgs() - ERROR: Strided "
+        "kernels support at most 4 dimensions!");
+    }
+    kernel->setArg(first_arg, (int)offset_);
+    for (uint32_t i = 0; i < 4; i++) {
+      kernel->setArg(first_arg + 1 + i, i < dim_ ? (int)stride_[i] : 0);
+    }
+  }
+
+  template <typename T>
+  void Tensor<T>::stridedWorkSize(uint32_t* global_size) const {
+    if (dim_ > 4) {
+      throw std::runtime_error("Tensor<T>::stridedWorkSize() - ERROR: Strided "
+        "kernels support at most 4 dimensions!");
+    }
+    global_size[0] = dim_ > 0 ? size_[0] : 1;
+    global_size[1] = dim_ > 1 ? size_[1] : 1;
+    global_size[2] = (dim_ > 2 ? size_[2] : 1) * (dim_ > 3 ? size_[3] : 1);
+  }
+
+  template <typename T>
+  void Tensor<T>::requireFlat(const Tensor<T>& x, const char* func) {
+    if (!x.isFlat()) {
+      std::stringstream ss;
+      ss << "Tensor<T>::" << func << "() - ERROR: Not supported on strided "
+        "views (use clone() first)";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  template <typename T>
+  void Tensor<T>::requireFloat(const char* func) {
+    if (sizeof(T) != sizeof(float)) {
+      std::stringstream ss;
+      ss << "Tensor<T>::" << func << "() - ERROR: Only supported for float "
+        "tensors!";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  template <typename T>
+  uint32_t Tensor<T>::storageElems(const uint32_t n) {
+    return (uint32_t)((n * sizeof(T) + sizeof(float) - 1) / sizeof(float));
+  }
+
   template <typename T>
   void Tensor<T>::setData(const T* data) {
-    jtorch::cl_context->writeToBuffer(data, jtorch::deviceid, storage_, true);
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordHostAccess("Tensor<T>::setData");
+    }
+    if (!isContiguous()) {
+      // Upload densely and then scatter into the view on the device
+      Tensor<T>* temp = Tensor<T>::uninitialized(dim_, size_);
+      temp->setData(data);
+      copy(*this, *temp);
+      delete temp;
+      return;
+    }
+    // Note: pooled buffers can be larger than the tensor, so we can't use
+    // jcl's writeToBuffer (which always copies the entire buffer).
+    cl_mem mem = (cl_mem)cl_context->getCLMem(storage_);
+    CommandDeps deps;
+    deps.writes(mem);
+    cl_int err = clEnqueueWriteBuffer(jtorch::CLQueue(), mem, CL_TRUE,
+      offset_ * sizeof(T), nelems() * sizeof(T), data, deps.numWaits(),
+      deps.waitList(), deps.event());
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Tensor<T>::setData() - ERROR: clEnqueueWriteBuffer failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
   }
 
   template <typename T>
   void Tensor<T>::getData(T* data) const {
-    jtorch::cl_context->readFromBuffer(data, jtorch::deviceid, storage_, true);
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordHostAccess("Tensor<T>::getData");
+    }
+    if (!isContiguous()) {
+      Tensor<T>* temp = Tensor<T>::clone(*this);  // Gathers the view
+      temp->getData(data);
+      delete temp;
+      return;
+    }
+    cl_mem mem = (cl_mem)cl_context->getCLMem(storage_);
+    CommandDeps deps;
+    deps.reads(mem);
+    cl_int err = clEnqueueReadBuffer(jtorch::CLQueue(), mem, CL_TRUE,
+      offset_ * sizeof(T), nelems() * sizeof(T), data, deps.numWaits(),
+      deps.waitList(), deps.event());
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Tensor<T>::getData() - ERROR: clEnqueueReadBuffer failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  template <typename T>
+  Event Tensor<T>::setDataAsync(const T* data) {
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordHostAccess("Tensor<T>::setDataAsync");
+    }
+    if (!isContiguous()) {
+      // Note: deleting temp straight away is safe since the pool will only
+      // recycle its storage for work queued after the copy.
+      Tensor<T>* temp = Tensor<T>::uninitialized(dim_, size_);
+      Event event = temp->setDataAsync(data);
+      copy(*this, *temp);
+      delete temp;
+      return event;
+    }
+    cl_event event;
+    cl_int err;
+    {
+      cl_mem mem = (cl_mem)cl_context->getCLMem(storage_);
+      CommandDeps deps;
+      deps.writes(mem);
+      err = clEnqueueWriteBuffer(jtorch::CLQueue(), mem, CL_FALSE,
+        offset_ * sizeof(T), nelems() * sizeof(T), data, deps.numWaits(),
+        deps.waitList(), deps.event(&event));
+    }
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Tensor<T>::setDataAsync() - ERROR: clEnqueueWriteBuffer failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    clFlush(jtorch::CLQueue());  // Make sure the transfer actually starts
+    return Event(event);
+  }
+
+  template <typename T>
+  Event Tensor<T>::getDataAsync(T* data, const Event& after) const {
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordHostAccess("Tensor<T>::getDataAsync");
+    }
+    if (!isContiguous()) {
+      if (after.clEvent() != NULL) {
+        // The gather must wait too
+        cl_event after_event = after.clEvent();
+        cl_int err = clEnqueueBarrierWithWaitList(jtorch::CLQueue(), 1,
+          &after_event, NULL);
+        if (err != CL_SUCCESS) {
+          std::stringstream ss;
+          ss << "Tensor<T>::getDataAsync() - ERROR: "
+            "clEnqueueBarrierWithWaitList failed: ";
+          ss << jcl::JCL::getErrorString(err);
+          throw std::runtime_error(ss.str());
+        }
+      }
+      Tensor<T>* temp = Tensor<T>::clone(*this);
+      Event event = temp->getDataAsync(data);
+      delete temp;
+      return event;
+    }
+    cl_event event;
+    cl_int err;
+    {
+      cl_mem mem = (cl_mem)cl_context->getCLMem(storage_);
+      CommandDeps deps;
+      deps.reads(mem);
+      deps.after(after.clEvent());
+      err = clEnqueueReadBuffer(jtorch::CLQueue(), mem, CL_FALSE,
+        offset_ * sizeof(T), nelems() * sizeof(T), data, deps.numWaits(),
+        deps.waitList(), deps.event(&event));
+    }
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Tensor<T>::getDataAsync() - ERROR: clEnqueueReadBuffer failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    clFlush(jtorch::CLQueue());
+    return Event(event);
+  }
+
+  template <typename T>
+  T* Tensor<T>::map(const TensorMapMode mode) {
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordHostAccess("Tensor<T>::map");
+    }
+    if (mapped_data_ != NULL) {
+      throw std::runtime_error("Tensor<T>::map() - ERROR: Tensor is already "
+        "mapped!");
+    }
+    if (!isContiguous()) {
+      throw std::runtime_error("Tensor<T>::map() - ERROR: Tensor is not "
+        "contiguous!");
+    }
+    cl_map_flags flags;
+    switch (mode) {
+    case TENSOR_MAP_READ:
+      flags = CL_MAP_READ;
+      break;
+    case TENSOR_MAP_WRITE:
+#ifdef CL_VERSION_1_2
+      flags = CL_MAP_WRITE_INVALIDATE_REGION;
+#else
+      flags = CL_MAP_WRITE;
+#endif
+      break;
+    default:
+      flags = CL_MAP_READ | CL_MAP_WRITE;
+      break;
+    }
+    cl_mem mem = (cl_mem)cl_context->getCLMem(storage_);
+    CommandDeps deps;
+    if (mode == TENSOR_MAP_READ) {
+      deps.reads(mem);
+    } else {
+      deps.writes(mem);
+    }
+    cl_int err;
+    mapped_data_ = (T*)clEnqueueMapBuffer(jtorch::CLQueue(), mem, CL_TRUE,
+      flags, offset_ * sizeof(T), nelems() * sizeof(T), deps.numWaits(),
+      deps.waitList(), deps.event(), &err);
+    if (err != CL_SUCCESS) {
+      mapped_data_ = NULL;
+      std::stringstream ss;
+      ss << "Tensor<T>::map() - ERROR: clEnqueueMapBuffer failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    return mapped_data_;
+  }
+
+  template <typename T>
+  void Tensor<T>::unmap() {
+    if (mapped_data_ == NULL) {
+      throw std::runtime_error("Tensor<T>::unmap() - ERROR: Tensor is not "
+        "mapped!");
+    }
+    // The host may have written the mapping
+    cl_mem mem = (cl_mem)cl_context->getCLMem(storage_);
+    CommandDeps deps;
+    deps.writes(mem);
+    cl_int err = clEnqueueUnmapMemObject(jtorch::CLQueue(), mem,
+      mapped_data_, deps.numWaits(), deps.waitList(), deps.event());
+    mapped_data_ = NULL;
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Tensor<T>::unmap() - ERROR: clEnqueueUnmapMemObject failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
   }
 
   template <typename T>
@@ -300,7 +798,7 @@ namespace jtorch {
   template <typename T>
   Tensor<T>* Tensor<T>::gaussian1D(const int32_t kernel_size) {
     const uint32_t size = kernel_size;
-    Tensor<T>* ret = new Tensor<T>(1, &size);
+    Tensor<T>* ret = Tensor<T>::uninitialized(1, &size);
     const float sigma = 0.25f;
     const float amplitude = 1.0f;
     const float center = (float)kernel_size/2.0f + 0.5f;
@@ -317,7 +815,7 @@ namespace jtorch {
   template <typename T>
   Tensor<T>* Tensor<T>::gaussian(const int32_t kernel_size) {
     const uint32_t size[2] = {kernel_size, kernel_size};
-    Tensor<T>* ret = new Tensor<T>(2, size);
+    Tensor<T>* ret = Tensor<T>::uninitialized(2, size);
     const float sigma = 0.25f;
     const float amplitude = 1.0f;
     const float center = (float)kernel_size/2.0f + 0.5f;
@@ -337,99 +835,407 @@ namespace jtorch {
 
   template <typename T>
   Tensor<T>* Tensor<T>::clone(const Tensor<T>& x) {
-    Tensor<T>* ret = new Tensor<T>(x.dim_, x.size_);
-    std::string kernel = jtorch::jtorch_path + "kernels/copy.cl";
-    cl_context->useKernel(kernel.c_str(), "Copy");
-    cl_context->setArg(0, x.storage());
-    cl_context->setArg(1, ret->storage());
-    uint32_t dim = 1;
-    uint32_t nelem = x.nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    // Note: the clone of a strided view is contiguous
+    Tensor<T>* ret = Tensor<T>::uninitialized(x.dim_, x.size_);
+    copy(*ret, x);
     return ret;
   }
   
   template <typename T>
   void Tensor<T>::copy(Tensor<T>& dst, const Tensor<T>& src) {
-    std::string kernel = jtorch::jtorch_path + "kernels/copy.cl";
-    cl_context->useKernel(kernel.c_str(), "Copy");
-    cl_context->setArg(0, src.storage());
-    cl_context->setArg(1, dst.storage());
+    if (sizeof(T) != sizeof(float) && dst.isContiguous() && 
+      src.isContiguous() && dst.nelems() == src.nelems()) {
+      // Storage only types (eg half) are copied byte for byte
+      cl_mem src_mem = (cl_mem)cl_context->getCLMem(src.storage_);
+      cl_mem dst_mem = (cl_mem)cl_context->getCLMem(dst.storage_);
+      const size_t src_offset = src.offset_ * sizeof(T);
+      const size_t dst_offset = dst.offset_ * sizeof(T);
+      const size_t bytes = dst.nelems() * sizeof(T);
+      std::function<void()> launch = [=]() {
+        CommandDeps deps;
+        deps.reads(src_mem);
+        deps.writes(dst_mem);
+        cl_int err = clEnqueueCopyBuffer(jtorch::CLQueue(), src_mem, dst_mem,
+          src_offset, dst_offset, bytes, deps.numWaits(), deps.waitList(),
+          deps.event());
+        if (err != CL_SUCCESS) {
+          std::stringstream ss;
+          ss << "Tensor<T>::copy() - ERROR: clEnqueueCopyBuffer failed: ";
+          ss << jcl::JCL::getErrorString(err);
+          throw std::runtime_error(ss.str());
+        }
+      };
+      launch();
+      if (LaunchPlan::recording() != NULL) {
+        std::vector<jcl::JCLBuffer> buffers;
+        buffers.push_back(src.storage_);
+        buffers.push_back(dst.storage_);
+        LaunchPlan::recording()->recordLaunch(launch, buffers);
+      }
+      return;
+    }
+    requireFloat("copy");
+    if (!dst.isFlat() || !src.isFlat()) {
+      if (!dst.isSameSizeAs(src)) {
+        throw std::runtime_error("Tensor<T>::copy() - ERROR: Strided copies "
+          "require tensors of the same size!");
+      }
+      static KernelHandle copy_strided_kernel("copy.cl", "CopyStrided");
+      Kernel* kernel = copy_strided_kernel.get();
+      kernel->setArg(0, src.storage());
+      src.setStridedArgs(kernel, 1);
+      kernel->setArg(6, dst.storage());
+      dst.setStridedArgs(kernel, 7);
+      kernel->setArg(12, dst.dim_ > 2 ? (int)dst.size_[2] : 1);
+      uint32_t global_size[3];
+      dst.stridedWorkSize(global_size);
+      kernel->run(3, global_size, false);
+      return;
+    }
+    static KernelHandle copy_kernel("copy.cl", "Copy");
+    Kernel* kernel = copy_kernel.get();
+    kernel->setArg(0, src.storage());
+    kernel->setArg(1, dst.storage());
     uint32_t dim = 1;
     uint32_t nelem = dst.nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
   }
 
   template <typename T>
   void Tensor<T>::add(Tensor<T>& dst, const Tensor<T>& x, const Tensor<T>& y) {
-    std::string kernel = jtorch::jtorch_path + "kernels/add.cl";
-    cl_context->useKernel(kernel.c_str(), "Add");
-    cl_context->setArg(0, src1.storage());
-    cl_context->setArg(1, src2.storage());
-    cl_context->setArg(2, dst.storage());
+    requireFloat("add");
+    requireFlat(dst, "add");
+    requireFlat(x, "add");
+    requireFlat(y, "add");
+    static KernelHandle add_kernel("add.cl", "Add");
+    Kernel* kernel = add_kernel.get();
+    kernel->setArg(0, x.storage());
+    kernel->setArg(1, y.storage());
+    kernel->setArg(2, dst.storage());
     uint32_t dim = 1;
     uint32_t nelem = dst.nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
   }
 
   template <typename T>
   void Tensor<T>::mul(Tensor<T>& x, float mul_val) {
-    std::string kernel = jtorch::jtorch_path + "kernels/mul.cl";
-    cl_context->useKernel(kernel.c_str(), "Mul");
-    cl_context->setArg(0, mul_val);
-    cl_context->setArg(1, x.storage());
+    requireFloat("mul");
+    requireFlat(x, "mul");
+    static KernelHandle mul_kernel("mul.cl", "Mul");
+    Kernel* kernel = mul_kernel.get();
+    kernel->setArg(0, mul_val);
+    kernel->setArg(1, x.storage());
     uint32_t dim = 1;
     uint32_t nelem = x.nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
   }
 
   template <typename T>
   void Tensor<T>::div(Tensor<T>& x, float div_val) {
-    std::string kernel = jtorch::jtorch_path + "kernels/div.cl";
-    cl_context->useKernel(kernel.c_str(), "Div");
-    cl_context->setArg(0, div_val);
-    cl_context->setArg(1, x.storage());
+    requireFloat("div");
+    requireFlat(x, "div");
+    static KernelHandle div_kernel("div.cl", "Div");
+    Kernel* kernel = div_kernel.get();
+    kernel->setArg(0, div_val);
+    kernel->setArg(1, x.storage());
     uint32_t dim = 1;
     uint32_t nelem = x.nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
   }
 
   template <typename T>
   void Tensor<T>::accumulate(Tensor<T>& dst, const Tensor<T>& src) {
-    std::string kernel = jtorch::jtorch_path + "kernels/accumulate.cl";
-    cl_context->useKernel(kernel.c_str(), "Accumulate");
-    cl_context->setArg(0, src.storage());
-    cl_context->setArg(1, dst.storage());
+    requireFloat("accumulate");
+    requireFlat(dst, "accumulate");
+    if (!src.isFlat()) {
+      if (!dst.isSameSizeAs(src)) {
+        throw std::runtime_error("Tensor<T>::accumulate() - ERROR: Strided "
+          "sources require tensors of the same size!");
+      }
+      static KernelHandle accumulate_strided_kernel("accumulate.cl",
+        "AccumulateStrided");
+      Kernel* kernel = accumulate_strided_kernel.get();
+      kernel->setArg(0, src.storage());
+      src.setStridedArgs(kernel, 1);
+      kernel->setArg(6, dst.storage());
+      kernel->setArg(7, dst.dim_ > 2 ? (int)dst.size_[2] : 1);
+      uint32_t global_size[3];
+      dst.stridedWorkSize(global_size);
+      kernel->run(3, global_size, false);
+      return;
+    }
+    static KernelHandle accumulate_kernel("accumulate.cl", "Accumulate");
+    Kernel* kernel = accumulate_kernel.get();
+    kernel->setArg(0, src.storage());
+    kernel->setArg(1, dst.storage());
     uint32_t dim = 1;
     uint32_t nelem = dst.nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
   }
 
   template <typename T>
   void Tensor<T>::zero(Tensor<T>& dst) {
+    if (sizeof(T) != sizeof(float)) {
+      // Storage only types are zeroed from the host.  This only happens when
+      // their (weight) tensors are constructed.
+      T* zeros = new T[dst.nelems()];
+      memset(zeros, 0, sizeof(zeros[0]) * dst.nelems());
+      dst.setData(zeros);
+      delete[] zeros;
+      return;
+    }
     Tensor<T>::fill(dst, 0);
   }
 
   template <typename T>
   void Tensor<T>::fill(Tensor<T>& dst, float value) {
-    std::string kernel = jtorch::jtorch_path + "kernels/fill.cl";
-    cl_context->useKernel(kernel.c_str(), "Fill");
-    cl_context->setArg(0, dst.storage());
-    cl_context->setArg(1, value);
+    requireFloat("fill");
+    requireFlat(dst, "fill");
+    static KernelHandle fill_kernel("fill.cl", "Fill");
+    Kernel* kernel = fill_kernel.get();
+    kernel->setArg(0, dst.storage());
+    kernel->setArg(1, value);
     uint32_t dim = 1;
     uint32_t nelem = dst.nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
+  }
+
+  template <typename T>
+  void Tensor<T>::runReduce(const jcl::JCLBuffer& input, 
+    const jcl::JCLBuffer& input_idx, const jcl::JCLBuffer& output, 
+    const jcl::JCLBuffer& output_idx, const uint32_t inner, 
+    const uint32_t reduce_size, const uint32_t nelems, const uint32_t rows,
+    const int kernel_op, const int idx_mode, const int finalize, 
+    const uint32_t count) {
+    static KernelHandle reduce_kernel("reduce.cl", "Reduce");
+    Kernel* kernel = reduce_kernel.get();
+
+    // The tree reduction needs a power of 2 local size.  There is no point 
+    // launching many more threads than there are elements in a row.
+    uint32_t max_size = std::min<uint32_t>(JTORCH_REDUCE_MAX_LOCAL_SIZE,
+      kernel->maxWorkgroupSize());
+    max_size = std::min<uint32_t>(max_size, 
+      cl_context->getMaxWorkitemSize(jtorch::deviceid, 0));
+    uint32_t local_size = 1;
+    while (local_size * 2 <= max_size && local_size < reduce_size) {
+      local_size *= 2;
+    }
+
+    kernel->setArg(0, input);
+    kernel->setArg(1, input_idx);
+    kernel->setArg(2, output);
+    kernel->setArg(3, output_idx);
+    // setArg with NULL --> Local memory allocation (per local workgroup)
+    kernel->setArg(4, sizeof(float) * local_size, NULL);
+    kernel->setArg(5, sizeof(int32_t) * local_size, NULL);
+    kernel->setArg(6, (int)inner);
+    kernel->setArg(7, (int)reduce_size);
+    kernel->setArg(8, (int)nelems);
+    kernel->setArg(9, kernel_op);
+    kernel->setArg(10, idx_mode);
+    kernel->setArg(11, finalize);
+    kernel->setArg(12, (int)count);
+    uint32_t global_size[2] = {local_size, rows};
+    uint32_t local_work_size[2] = {local_size, 1};
+    kernel->run(2, global_size, local_work_size, false);
+  }
+
+  template <typename T>
+  void Tensor<T>::reduceDevice(const Tensor<T>& x, const ReduceOp op,
+    Tensor<T>*& value, Tensor<T>*& index) {
+    const uint32_t n = x.nelems();
+    if (n == 0) {
+      throw std::runtime_error("Tensor<T>::reduce() - ERROR: Empty tensor!");
+    }
+    int kernel_op = JTORCH_REDUCE_SUM;  // Also REDUCE_MEAN
+    int finalize = JTORCH_FINALIZE_NONE;
+    switch (op) {
+    case REDUCE_MAX:
+      kernel_op = JTORCH_REDUCE_MAX;
+      break;
+    case REDUCE_MIN:
+      kernel_op = JTORCH_REDUCE_MIN;
+      break;
+    case REDUCE_MEAN:
+      finalize = JTORCH_FINALIZE_DIV;
+      break;
+    case REDUCE_ARGMAX:
+      kernel_op = JTORCH_REDUCE_ARGMAX;
+      break;
+    case REDUCE_L2:
+      kernel_op = JTORCH_REDUCE_SUM_SQ;
+      finalize = JTORCH_FINALIZE_SQRT;
+      break;
+    case REDUCE_ABS_MAX:
+      kernel_op = JTORCH_REDUCE_ABS_MAX;
+      break;
+    default:
+      break;
+    }
+
+    // Pass 1: num_groups work-groups each reduce a contiguous chunk.  The
+    // number of groups is capped so that pass 2 fits in one work-group.
+    uint32_t num_groups = std::min<uint32_t>(JTORCH_REDUCE_MAX_LOCAL_SIZE, 
+      (n + JTORCH_REDUCE_MAX_LOCAL_SIZE - 1) / JTORCH_REDUCE_MAX_LOCAL_SIZE);
+    const uint32_t chunk = (n + num_groups - 1) / num_groups;
+    num_groups = (n + chunk - 1) / chunk;
+    const bool one_pass = num_groups == 1;
+
+    Tensor<T>* partial = Tensor<T>::uninitialized(1, &num_groups);
+    Tensor<T>* partial_idx = Tensor<T>::uninitialized(1, &num_groups);
+    runReduce(x.storage(), x.storage(), partial->storage(), 
+      partial_idx->storage(), 1, chunk, n, num_groups, kernel_op, 
+      JTORCH_IDX_FLAT, one_pass ? finalize : JTORCH_FINALIZE_NONE, n);
+    if (one_pass) {
+      value = partial;
+      index = partial_idx;
+      return;
+    }
+
+    // Pass 2: combine the partial results (sums of squares are now sums and
+    // absolute values are already positive)
+    const uint32_t one = 1;
+    value = Tensor<T>::uninitialized(1, &one);
+    index = Tensor<T>::uninitialized(1, &one);
+    runReduce(partial->storage(), partial_idx->storage(), value->storage(),
+      index->storage(), 1, num_groups, num_groups, 1, 
+      kernel_op == JTORCH_REDUCE_SUM_SQ ? JTORCH_REDUCE_SUM : 
+      (kernel_op == JTORCH_REDUCE_ABS_MAX ? JTORCH_REDUCE_MAX : kernel_op),
+      JTORCH_IDX_READ, finalize, n);
+    delete partial;
+    delete partial_idx;
   }
 
   template <typename T>
-  float Tensor<T>::slowSum(const Tensor<T>& x) {
-    float* temp = new float[x.nelems()];
-    x.getData(temp);
-    float sum = 0.0f;
-    for (uint32_t i = 0; i < x.nelems(); i++) {
-      sum += temp[i];
+  float Tensor<T>::reduce(const Tensor<T>& x, const ReduceOp op) {
+    requireFloat("reduce");
+    if (op == REDUCE_ARGMAX) {
+      return (float)argmax(x);
+    }
+    if (!x.isFlat()) {
+      Tensor<T>* tmp = clone(x);
+      const float ret = reduce(*tmp, op);
+      delete tmp;
+      return ret;
+    }
+    Tensor<T>* value;
+    Tensor<T>* index;
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordHostAccess("Tensor<T>::reduce");
+    }
+    reduceDevice(x, op, value, index);
+    float ret;
+    cl_int err;
+    {
+      cl_mem mem = (cl_mem)cl_context->getCLMem(value->storage());
+      CommandDeps deps;
+      deps.reads(mem);
+      err = clEnqueueReadBuffer(jtorch::CLQueue(), mem, CL_TRUE, 0,
+        sizeof(ret), &ret, deps.numWaits(), deps.waitList(), deps.event());
+    }
+    delete value;
+    delete index;
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Tensor<T>::reduce() - ERROR: clEnqueueReadBuffer failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    return ret;
+  }
+
+  template <typename T>
+  uint32_t Tensor<T>::argmax(const Tensor<T>& x) {
+    requireFloat("argmax");
+    if (!x.isFlat()) {
+      Tensor<T>* tmp = clone(x);
+      const uint32_t ret = argmax(*tmp);
+      delete tmp;
+      return ret;
+    }
+    Tensor<T>* value;
+    Tensor<T>* index;
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordHostAccess("Tensor<T>::argmax");
+    }
+    reduceDevice(x, REDUCE_ARGMAX, value, index);
+    int32_t ret;
+    cl_int err;
+    {
+      cl_mem mem = (cl_mem)cl_context->getCLMem(index->storage());
+      CommandDeps deps;
+      deps.reads(mem);
+      err = clEnqueueReadBuffer(jtorch::CLQueue(), mem, CL_TRUE, 0,
+        sizeof(ret), &ret, deps.numWaits(), deps.waitList(), deps.event());
+    }
+    delete value;
+    delete index;
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Tensor<T>::argmax() - ERROR: clEnqueueReadBuffer failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    return (uint32_t)ret;
+  }
+
+  template <typename T>
+  void Tensor<T>::reduce(Tensor<T>& dst, const Tensor<T>& x, 
+    const uint32_t dim, const ReduceOp op) {
+    requireFloat("reduce");
+    requireFlat(dst, "reduce");
+    if (dim >= x.dim_) {
+      throw std::runtime_error("Tensor<T>::reduce() - ERROR: dim out of "
+        "range!");
+    }
+    if (dst.nelems() * x.size_[dim] != x.nelems()) {
+      throw std::runtime_error("Tensor<T>::reduce() - ERROR: dst size "
+        "mismatch!");
+    }
+    if (!x.isFlat()) {
+      Tensor<T>* tmp = clone(x);
+      reduce(dst, *tmp, dim, op);
+      delete tmp;
+      return;
+    }
+
+    uint32_t inner = 1;
+    for (uint32_t i = 0; i < dim; i++) {
+      inner *= x.size_[i];
+    }
+    const uint32_t reduce_size = x.size_[dim];
+    const uint32_t rows = dst.nelems();
+    switch (op) {
+    case REDUCE_ARGMAX: {
+      // The max values go to a scratch buffer, the indices to dst
+      Tensor<T>* values = Tensor<T>::uninitialized(1, &rows);
+      runReduce(x.storage(), x.storage(), values->storage(), dst.storage(),
+        inner, reduce_size, x.nelems(), rows, JTORCH_REDUCE_ARGMAX, 
+        JTORCH_IDX_ROW, JTORCH_FINALIZE_IDX, reduce_size);
+      delete values;
+      break;
+    }
+    case REDUCE_MAX:
+    case REDUCE_MIN:
+    case REDUCE_ABS_MAX:
+      runReduce(x.storage(), x.storage(), dst.storage(), dst.storage(),
+        inner, reduce_size, x.nelems(), rows, op == REDUCE_MAX ? 
+        JTORCH_REDUCE_MAX : (op == REDUCE_MIN ? JTORCH_REDUCE_MIN : 
+        JTORCH_REDUCE_ABS_MAX), JTORCH_IDX_ROW, JTORCH_FINALIZE_NONE, 
+        reduce_size);
+      break;
+    case REDUCE_L2:
+      runReduce(x.storage(), x.storage(), dst.storage(), dst.storage(),
+        inner, reduce_size, x.nelems(), rows, JTORCH_REDUCE_SUM_SQ, 
+        JTORCH_IDX_ROW, JTORCH_FINALIZE_SQRT, reduce_size);
+      break;
+    default:  // REDUCE_SUM and REDUCE_MEAN
+      runReduce(x.storage(), x.storage(), dst.storage(), dst.storage(),
+        inner, reduce_size, x.nelems(), rows, JTORCH_REDUCE_SUM, 
+        JTORCH_IDX_ROW, op == REDUCE_MEAN ? JTORCH_FINALIZE_DIV : 
+        JTORCH_FINALIZE_NONE, reduce_size);
+      break;
     }
-    delete[] temp;
-    return sum;
   }
 
   template <typename T>
@@ -447,7 +1253,7 @@ namespace jtorch {
         ifile.read((char*)(&cur_size), sizeof(cur_size));
         size[dim-i-1] = (uint32_t)cur_size;
       }
-      new_tensor = new Tensor<T>(dim, size);
+      new_tensor = Tensor<T>::uninitialized(dim, size);
 
       T* data = new T[new_tensor->nelems()];
       ifile.read((char*)(data), sizeof(data[0]) * new_tensor->nelems());
@@ -25,6 +25,7 @@ namespace jtorch {
     virtual TorchStageType type() const { return THRESHOLD_STAGE; }
     virtual std::string name() const { return "Threshold"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     float threshold;  // Single threshold value
     float val;  // Single output value (when input < threshold)
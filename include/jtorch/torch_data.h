@@ -19,6 +19,7 @@ namespace jtorch {
     UNDEFINED_DATA = 0,
     TABLE_DATA = 1,
     TENSOR_DATA = 2,
+    HALF_TENSOR_DATA = 3,  // Tensor<half> (see OutputPrecision)
   } TorchDataType;
 
   class TorchData {
@@ -15,6 +15,8 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <vector>
+#include "jtorch/event.h"
 
 namespace jtorch {
 
@@ -34,7 +36,7 @@ namespace jtorch {
     SPATIAL_DIVISIVE_NORMALIZATION_STAGE = 12,
     SPATIAL_CONTRASTIVE_NORMALIZATION_STAGE = 13,
     JOIN_TABLE_STAGE = 14,
-    TRANSPOSE_STAGE = 15,  // Not actually implemented --> Ignored
+    TRANSPOSE_STAGE = 15,
     IDENTITY_STAGE = 16,
     SELECT_TABLE_STAGE = 17,
     SPATIAL_UP_SAMPLING_NEAREST_STAGE = 18,
@@ -42,7 +44,55 @@ namespace jtorch {
     SPATIAL_CONVOLUTION_MM_STAGE = 20,
   } TorchStageType;
 
+  typedef enum {
+    WEIGHT_PRECISION_FLOAT = 0,
+    WEIGHT_PRECISION_HALF = 1,  // fp16 storage, fp32 arithmetic (see half.h)
+    WEIGHT_PRECISION_INT8 = 2,  // int8 weights and inputs, int32 arithmetic
+  } WeightPrecision;
+
+  typedef enum {
+    OUTPUT_PRECISION_FLOAT = 0,
+    OUTPUT_PRECISION_HALF = 1,  // Tensor<half> output (see half.h)
+  } OutputPrecision;
+
+  typedef enum {
+    IN_PLACE_AUTO = 0,  // Only when nothing else reads the input
+    IN_PLACE_NEVER = 1,
+    IN_PLACE_ALWAYS = 2,
+  } InPlaceMode;
+
+  typedef enum {
+    ACTIVATION_NONE = 0,
+    ACTIVATION_TANH = 1,
+    ACTIVATION_THRESHOLD = 2,  // x > threshold ? x : val
+  } ActivationType;
+
+  typedef struct {
+    ActivationType type;
+    float threshold;  // ACTIVATION_THRESHOLD only
+    float val;
+  } Activation;
+
   class TorchData;
+  class TorchStage;
+  class MemoryPlanner;
+  class Kernel;
+  class Engine;
+  template <typename T> class Tensor;
+  struct half;
+
+  typedef struct {
+    TorchStage* stage;  // A leaf stage
+    std::vector<std::vector<uint32_t>> output_size;  // Per output tensor
+    uint64_t output_bytes;  // Of the output tensors (views included)
+    uint64_t scratch_bytes;
+  } PreparedStage;
+
+  typedef struct {
+    std::vector<PreparedStage> stages;  // In execution order
+    uint64_t allocated_bytes;  // Device memory allocated by prepare()
+    uint64_t parameter_bytes;  // See parameterBytes()
+  } PrepareReport;
   
   class TorchStage {
   public:
@@ -53,16 +103,157 @@ namespace jtorch {
     virtual TorchStageType type() const { return UNDEFINED_STAGE; }
     virtual std::string name() const = 0;
     virtual void forwardProp(TorchData& input) = 0;  // Pure virtual
+    // forwardPropAsync - forwardProp, and an Event that completes once output
+    // has been written.  Waiting on it does not drain anything queued after
+    // it or on other queues (unlike Sync()).  Queue the readback behind it
+    // with Tensor<T>::getDataAsync(data, event).
+    Event forwardPropAsync(TorchData& input);
+
+    // prepare - Does everything the first forwardProp of an input of this
+    // size would: allocates every output and scratch tensor, computes the
+    // normalization coefficients and builds the kernels, by running (and
+    // waiting for) one forwardProp of a zero input.  Later inputs of that
+    // size start at steady state.  Reports the output size and memory of
+    // every leaf stage.  Models that take a table prepare with an example
+    // input instead.
+    PrepareReport prepare(const uint32_t input_dim,
+      const uint32_t* input_size);
+    PrepareReport prepare(TorchData& input);
+
+    // setWeightPrecision - Converts the stage's weights (and those of any
+    // child stages) to the given storage precision.  Stages that have no
+    // weights, or no kernels for that precision, ignore it.
+    virtual void setWeightPrecision(const WeightPrecision precision) { }
 
-    // Top level read-write
-    static TorchStage* loadFromFile(const std::string& file);
+    // setOutputPrecision - With OUTPUT_PRECISION_HALF the pooling and
+    // normalization stages (and containers, for their children) write their
+    // output, and keep their large intermediates, as Tensor<half>, which
+    // halves the memory traffic between them (see half.h).  They read fp16
+    // inputs directly and convert fp32 ones on entry.  Any other stage
+    // ignores the setting and converts an fp16 input back to fp32 (see
+    // contiguousInput).  Tanh, Threshold and the table stages need fp32
+    // inputs, as does InferenceQueue for the model output.
+    virtual void setOutputPrecision(const OutputPrecision precision) { }
+    OutputPrecision outputPrecision() const { return output_precision_; }
+
+    // setCalibrating - While calibrating, stages with int8 weights record the
+    // range of their inputs, and then use it as a fixed quantization scale 
+    // (see ActivationQuantizer).  calibrate() runs each sample input through
+    // the network with calibration enabled.
+    virtual void setCalibrating(const bool calibrating) { }
+    void calibrate(const uint32_t num_inputs, TorchData* const* inputs);
+
+    // clone - A new stage (with clones of any child stages) that SHARES this
+    // stage's parameters: weights, biases and normalization kernels.  Only
+    // outputs and scratch tensors are allocated (on the clone's first
+    // forwardProp), so replicas of a model can run at the same time (ie on
+    // separate queues) without another copy of the weights.  Parameter
+    // changes (setWeights, setBiases, setWeightPrecision) apply to every
+    // clone, while settings (activation epilogues, in-place mode, int8
+    // calibration) are copied.  Use the engine of this stage.
+    virtual TorchStage* clone() const = 0;
+    // parameterBytes - Device memory held by the parameters, ie what each
+    // clone saves compared to loading the model again
+    virtual uint64_t parameterBytes() const { return 0; }
+
+    // planMemory - Describes the stage to a MemoryPlanner (after a
+    // forwardProp of input).  Stages report their output and scratch tensors
+    // with MemoryPlanner::addStep(); containers instead visit their children
+    // in execution order.
+    virtual void planMemory(MemoryPlanner& planner, TorchData& input);
+
+    // fuseActivations - Folds every Tanh or Threshold stage that directly
+    // follows a stage with an activation epilogue (SpatialConvolution,
+    // SpatialConvolutionMM and Linear) into that stage, and replaces it with
+    // an Identity.  Applies to every container in the tree.  Note: the
+    // output of the folded stage is then the activated result.  Returns the
+    // number of stages folded.
+    virtual uint32_t fuseActivations() { return 0; }
+    // setActivation - Returns false if the stage has no activation epilogue
+    virtual bool setActivation(const Activation& activation) { return false; }
+
+    // setInPlace - Elementwise stages (Tanh, Threshold) can overwrite a flat
+    // input tensor instead of writing a separate output, and output is then
+    // a view of the input.  With IN_PLACE_AUTO this only happens when the
+    // enclosing container reports that the stage is the only reader of its
+    // input (never for the input passed to the top level stage).  Set
+    // IN_PLACE_NEVER on the consumer of any intermediate output that is read
+    // after forwardProp.
+    void setInPlace(const InPlaceMode mode) { in_place_ = mode; }
+    InPlaceMode inPlace() const { return in_place_; }
+    // setInputExclusive - Called by containers before each forwardProp
+    void setInputExclusive(const bool exclusive) {
+      input_exclusive_ = exclusive;
+    }
+
+    // Top level read-write.  The weights are converted to precision as the
+    // model is loaded.
+    static TorchStage* loadFromFile(const std::string& file,
+      const WeightPrecision precision = WEIGHT_PRECISION_FLOAT);
+    // Loads the model into engine (rather than the current engine).  Run it
+    // with engine current (see EngineScope).
+    static TorchStage* loadFromFile(Engine& engine, const std::string& file,
+      const WeightPrecision precision = WEIGHT_PRECISION_FLOAT);
 
     // Everyone must define an output structure
     TorchData* output;
 
   protected:
+    Tensor<float>* contiguous_input_;  // See contiguousInput()
+    Tensor<half>* half_input_;  // See halfInput()
+    OutputPrecision output_precision_;
+    InPlaceMode in_place_;
+    bool input_exclusive_;  // No other stage reads the input
+    bool output_in_place_;  // output is a view of the input
+
     static TorchStage* loadFromFile(std::ifstream& file);
 
+    // setActivationArgs - Sets the 3 epilogue arguments (type, threshold and
+    // val) of kernel starting at first_arg
+    static void setActivationArgs(Kernel* kernel, const uint32_t first_arg,
+      const Activation& activation);
+
+    // The tensor helpers below are instantiated for float and half.
+    // batchSize - Stages take a single sample of sample_dim dimensions or a
+    // batch of them, with the batch as the outermost (last) dimension.
+    // Returns 1 for a single sample and throws for any other dimension.
+    template <typename T>
+    static uint32_t batchSize(const Tensor<T>& input,
+      const uint32_t sample_dim, const char* func);
+    // sameSampleSize - true if a and b hold samples of the same size (their
+    // batch sizes may differ)
+    template <typename T>
+    static bool sameSampleSize(const Tensor<T>& a, const Tensor<T>& b,
+      const uint32_t sample_dim);
+    // planeWorkSize - {width, height, planes} for kernels that process every
+    // 2D plane (each feature of each sample) separately
+    template <typename T>
+    static void planeWorkSize(const Tensor<T>& tensor,
+      uint32_t* global_size);
+
+    // elementwiseOutput - (Re)creates output for an elementwise stage: a view
+    // of input when running in place, otherwise a tensor of the same size.
+    // Returns true when running in place.
+    bool elementwiseOutput(Tensor<float>& input);
+
+    // scratchTensors - Tensors that are completely rewritten before they are
+    // read in every forwardProp, and so can share storage with tensors that
+    // are not live during this stage.  Persistent state must NOT be listed.
+    virtual void scratchTensors(std::vector<Tensor<float>*>& scratch);
+
+    // contiguousInput - Stages whose kernels index the input storage as a
+    // flat array call this first.  A strided Tensor view is copied into
+    // contiguous_input_ (allocated on first use or size change) and that is
+    // returned instead, as is an fp16 input converted to fp32.  Any other 
+    // input is returned unchanged.  If allow_offset is true, contiguous views
+    // at a non-zero offset are not copied either.
+    TorchData& contiguousInput(TorchData& input, 
+      const bool allow_offset = false);
+    // halfInput - contiguousInput for stages running at OUTPUT_PRECISION_HALF.
+    // An fp16 input is returned unchanged and an fp32 one is converted into
+    // half_input_.  Throws for anything else.
+    Tensor<half>& halfInput(TorchData& input, const char* func);
+
     // Non-copyable, non-assignable.
     TorchStage(TorchStage&);
     TorchStage& operator=(const TorchStage&);
@@ -3,7 +3,8 @@
 //
 //  Created by Jonathan Tompson on 4/9/13.
 //
-//  NOTE: Transpose is NOT implemented, it just passes the data through
+//  The output is a zero-copy strided view of the input (see
+//  Tensor<T>::transpose).  Stages that need flat inputs will materialize it.
 //
 
 #pragma once
@@ -18,16 +19,22 @@ namespace jtorch {
   class Transpose : public TorchStage {
   public:
     // Constructor / Destructor
-    Transpose();
+    Transpose();  // No permutations --> Identity
+    // perms holds num_permutations pairs of torch dimensions to swap (1 is
+    // the top-most dimension, as in nn.Transpose({1,2},{2,3}))
+    Transpose(const uint32_t num_permutations, const int32_t* perms);
     virtual ~Transpose();
 
     virtual TorchStageType type() const { return TRANSPOSE_STAGE; }
     virtual std::string name() const { return "Transpose"; }
     virtual void forwardProp(TorchData& input);
+    virtual TorchStage* clone() const;
 
     static TorchStage* loadFromFile(std::ifstream& file);
 
   protected:
+    uint32_t num_permutations_;
+    int32_t* perms_;
 
     // Non-copyable, non-assignable.
     Transpose(Transpose&);
@@ -5,4 +5,30 @@ __kernel void Copy(
   const int x_out = get_global_id(0);
 
   output[x_out] = input[x_out];
+}
+
+// Strided (view) copy.  Launched over {size0, size1, size2 * size3}.
+__kernel void CopyStrided(
+  const __global float* input,  // 0
+  const int in_offset,          // 1
+  const int in_stride0,         // 2
+  const int in_stride1,         // 3
+  const int in_stride2,         // 4
+  const int in_stride3,         // 5
+  __global float* output,       // 6
+  const int out_offset,         // 7
+  const int out_stride0,        // 8
+  const int out_stride1,        // 9
+  const int out_stride2,        // 10
+  const int out_stride3,        // 11
+  const int size2) {            // 12
+
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  const int z = get_global_id(2) % size2;
+  const int w = get_global_id(2) / size2;
+
+  output[out_offset + x * out_stride0 + y * out_stride1 + z * out_stride2 + 
+    w * out_stride3] = input[in_offset + x * in_stride0 + y * in_stride1 + 
+    z * in_stride2 + w * in_stride3];
 }
\ No newline at end of file
@@ -0,0 +1,20 @@
+// Pointers to half are legal without cl_khr_fp16, only half arithmetic
+// needs the extension.  vload_half and vstore_half are core.
+
+__kernel void FloatToHalf(
+  const __global float* input,  // 0
+  __global half* output) {      // 1
+
+  const int i = get_global_id(0);
+
+  vstore_half_rte(input[i], i, output);
+}
+
+__kernel void HalfToFloat(
+  const __global half* input,  // 0
+  __global float* output) {    // 1
+
+  const int i = get_global_id(0);
+
+  output[i] = vload_half(i, input);
+}
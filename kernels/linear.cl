@@ -1,3 +1,5 @@
+#include "activation.clh"  // Fused activation epilogue
+
 // From here: http://www.bealto.com/gpu-gemv_v1.html
 __kernel void MatVecMultSimple(
   // Y = A * X (matrix-vector mulitply)
@@ -60,12 +62,105 @@ __kernel void MatVecMultThreads(
   }
 }
 
+// The Half variants read fp16 weights (vload_half is core OpenCL, so they
+// do not need cl_khr_fp16) and accumulate in fp32.
+__kernel void MatVecMultSimpleHalf(
+  // Y = A * X (matrix-vector mulitply)
+  __global const half* A,   // 0  --> Size M (rows) x N (cols) stored column major
+  __global const float* X,  // 1  --> Size N
+  __global  float* Y,       // 2  --> Size M
+  const int M,              // 3
+  const int N) {            // 4
+
+  const int i = get_global_id(0);  // row index
+  const int b = get_global_id(1);  // sample index (for a batch)
+
+  float sum = 0;
+  // Perform the linear accumulation
+  for (int k = 0; k < N; k++) {
+    sum += vload_half(i + M * k, A) * X[b * N + k];
+  }
+
+  Y[b * M + i] = sum;
+}
+
+__kernel void MatVecMultThreadsHalf(
+  // Y = A * X (matrix-vector mulitply)
+  __global const half* A,   // 0  --> Size M (rows) x N (cols) stored column major
+  __global const float* X,  // 1  --> Size N
+  __global  float* Y,       // 2  --> Size M
+  __local float* work,      // 3  --> Size M by p
+  const int M,              // 4
+  const int N) {            // 5
+
+  // Compute partial dot product
+  float sum = 0;
+  for (int k = get_global_id(COL_DIM); k < N; k += get_global_size(COL_DIM)) {
+    sum += vload_half(get_global_id(ROW_DIM) + M * k, A) * X[k];
+  }
+
+  // Each thread stores its partial sum in WORK
+  int rows = get_local_size(ROW_DIM); // rows in group
+  int cols = get_local_size(COL_DIM); // initial cols in group
+  int ii = get_local_id(ROW_DIM); // local row index in group, 0<=ii<rows
+  int jj = get_local_id(COL_DIM); // block index in column, 0<=jj<cols
+  work[ii+rows*jj] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE); // sync group
+
+  // Reduce sums in log2(cols) steps
+  while (cols > 1) {
+    cols >>= 1;
+    if (jj < cols) { 
+      work[ii + rows * jj] += work[ii + rows * (jj + cols)];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE); // sync group
+  }
+
+  // Write final result in Y
+  if ( jj == 0 ) {
+    Y[ get_global_id(ROW_DIM) ] = work[ii];
+  }
+}
+
+// int8 weights and input with int32 accumulation, requantized to float with
+// the per row weight scale and the input scale.  Also adds the bias.
+__kernel void MatVecMultSimpleInt8(
+  // Y = A * X (matrix-vector mulitply)
+  __global const char* A,        // 0  --> Size M (rows) x N (cols) stored column major
+  __global const char* X,        // 1  --> Size N
+  __global  float* Y,            // 2  --> Size M
+  __global const float* scales,  // 3  --> Size M
+  __global const float* biases,  // 4  --> Size M
+  const float x_scale,           // 5
+  const int M,                   // 6
+  const int N,                   // 7
+  const int act_type,            // 8
+  const float act_threshold,     // 9
+  const float act_val) {         // 10
+
+  const int i = get_global_id(0);  // row index
+  const int b = get_global_id(1);  // sample index (for a batch)
+
+  int sum = 0;
+  for (int k = 0; k < N; k++) {
+    sum += A[i + M * k] * X[b * N + k];
+  }
+
+  Y[b * M + i] = activation((float)sum * scales[i] * x_scale + biases[i],
+    act_type, act_threshold, act_val);
+}
+
 __kernel void Accum (
-  // output = bias
+  // output = activation(output + bias), for each sample (dim 1) of a batch
   __global  float* output,          // 0
-  const __global float* biases) {   // 1
+  const __global float* biases,     // 1
+  const int act_type,               // 2
+  const float act_threshold,        // 3
+  const float act_val) {            // 4
 
   const int x_out = get_global_id(0);
+  const int i = get_global_id(1) * get_global_size(0) + x_out;
 
-  output[x_out] += biases[x_out];
+  output[i] = activation(output[i] + biases[x_out], act_type,
+    act_threshold, act_val);
 }
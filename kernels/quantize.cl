@@ -0,0 +1,11 @@
+// q = round(x / scale), saturated to the symmetric range [-127, 127]
+__kernel void Quantize(
+  const __global float* input,  // 0
+  __global char* output,        // 1
+  const float inv_scale) {      // 2
+
+  const int i = get_global_id(0);
+
+  output[i] = (char)clamp(convert_int_sat_rte(input[i] * inv_scale), -127,
+    127);
+}
@@ -0,0 +1,118 @@
+#define REDUCE_SUM 0
+#define REDUCE_MAX 1
+#define REDUCE_MIN 2
+#define REDUCE_SUM_SQ 3
+#define REDUCE_ARGMAX 4
+#define REDUCE_ABS_MAX 5
+
+#define IDX_ROW 0   // Argmax index is the position within the row
+#define IDX_FLAT 1  // Argmax index is the flat input index
+#define IDX_READ 2  // Argmax index is read from input_idx (second pass)
+
+#define FINALIZE_NONE 0
+#define FINALIZE_DIV 1   // output = acc / count
+#define FINALIZE_SQRT 2  // output = sqrt(acc)
+#define FINALIZE_IDX 3   // output_idx = (float)index
+
+// Each work-group reduces one row of reduce_size elements:
+//    input[inner_i + inner * (r + reduce_size * outer_i)], 0 <= r < reduce_size
+// where row = get_global_id(1) = inner_i + inner * outer_i.  Each work item
+// accumulates a strided subset of the row and the partial results are then
+// combined with a tree reduction in local memory (so local_size must be a
+// power of 2).  Elements with a flat index >= nelems are skipped.
+//
+// Argmax indices are stored as int bits in a float buffer (as_float) so that
+// they are exact; FINALIZE_IDX writes them as float values instead.
+__kernel void Reduce(
+  const __global float* input,      // 0
+  const __global float* input_idx,  // 1  --> Only read when idx_mode == IDX_READ
+  __global float* output,           // 2
+  __global float* output_idx,       // 3  --> Only written for REDUCE_ARGMAX
+  __local float* work,              // 4  --> Size local_size
+  __local int* work_idx,            // 5  --> Size local_size
+  const int inner,                  // 6
+  const int reduce_size,            // 7
+  const int nelems,                 // 8
+  const int op,                     // 9
+  const int idx_mode,               // 10
+  const int finalize,               // 11
+  const int count) {                // 12
+
+  const int lid = get_local_id(0);
+  const int lsize = get_local_size(0);
+  const int row = get_global_id(1);
+  const int base = (row % inner) + inner * reduce_size * (row / inner);
+
+  float acc;
+  if (op == REDUCE_MAX || op == REDUCE_ARGMAX) {
+    acc = -INFINITY;
+  } else if (op == REDUCE_MIN) {
+    acc = INFINITY;
+  } else {
+    acc = 0.0f;  // Also the identity for REDUCE_ABS_MAX
+  }
+  int acc_idx = -1;
+
+  for (int r = lid; r < reduce_size; r += lsize) {
+    const int i = base + inner * r;
+    if (i >= nelems) {
+      break;
+    }
+    const float val = input[i];
+    if (op == REDUCE_SUM) {
+      acc += val;
+    } else if (op == REDUCE_MAX) {
+      acc = fmax(acc, val);
+    } else if (op == REDUCE_MIN) {
+      acc = fmin(acc, val);
+    } else if (op == REDUCE_SUM_SQ) {
+      acc += val * val;
+    } else if (op == REDUCE_ABS_MAX) {
+      acc = fmax(acc, fabs(val));
+    } else if (acc_idx < 0 || val > acc) {  // REDUCE_ARGMAX (first wins ties)
+      acc = val;
+      acc_idx = idx_mode == IDX_ROW ? r :
+        (idx_mode == IDX_FLAT ? i : as_int(input_idx[i]));
+    }
+  }
+
+  work[lid] = acc;
+  work_idx[lid] = acc_idx;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int s = lsize >> 1; s > 0; s >>= 1) {
+    if (lid < s) {
+      const float other = work[lid + s];
+      if (op == REDUCE_SUM || op == REDUCE_SUM_SQ) {
+        work[lid] += other;
+      } else if (op == REDUCE_MAX || op == REDUCE_ABS_MAX) {
+        work[lid] = fmax(work[lid], other);
+      } else if (op == REDUCE_MIN) {
+        work[lid] = fmin(work[lid], other);
+      } else {
+        const int other_idx = work_idx[lid + s];
+        const int cur_idx = work_idx[lid];
+        if (other_idx >= 0 && (cur_idx < 0 || other > work[lid] ||
+          (other == work[lid] && other_idx < cur_idx))) {
+          work[lid] = other;
+          work_idx[lid] = other_idx;
+        }
+      }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid == 0) {
+    if (finalize == FINALIZE_DIV) {
+      output[row] = work[0] / (float)count;
+    } else if (finalize == FINALIZE_SQRT) {
+      output[row] = sqrt(work[0]);
+    } else {
+      output[row] = work[0];
+    }
+    if (op == REDUCE_ARGMAX) {
+      output_idx[row] = finalize == FINALIZE_IDX ? (float)work_idx[0] :
+        as_float(work_idx[0]);
+    }
+  }
+}
@@ -0,0 +1,158 @@
+// Fused SpatialContrastiveNormalization (a SpatialSubtractiveNormalization
+// followed by a SpatialDivisiveNormalization) in two launches.  Both kernels
+// stage a tile of per-pixel feature sums plus its filter apron in local
+// memory, so every pixel only reads the input features once per pass.
+//
+// With kernel2d normalized to sum to one and wsum the sum of the filter taps
+// that fall inside the image:
+//   mean = conv(sum_f input_f, kernel2d) / (nfeats * wsum)
+//   std = max(sqrt(conv(sum_f (input_f - mean)^2, kernel2d) / nfeats) / wsum,
+//             threshold)
+//   output_f = (input_f - mean) / std
+// which is the same as the two separate stages.
+//
+// The global size is padded up to a multiple of the local size in the first
+// two dimensions, the third dimension is the sample index (for a batch).
+//
+// The input and output are activations (act_t, see half.clh), the mean map
+// and the tiles stay float.
+
+#include "half.clh"
+
+__kernel void SpatialContrastiveNormalizationMean(
+  const __global act_t* input,     // 0
+  __global float* mean,            // 1
+  const __global float* kernel2d,  // 2
+  const int filt_rad_u,            // 3
+  const int filt_rad_v,            // 4
+  const int width,                 // 5
+  const int height,                // 6
+  const int input_nfeats,          // 7
+  __local float* tile) {           // 8
+
+  const int local_width = get_local_size(0);
+  const int local_height = get_local_size(1);
+  const int x_local = get_local_id(0);
+  const int y_local = get_local_id(1);
+  const int tile_width = local_width + 2 * filt_rad_u;
+  const int tile_height = local_height + 2 * filt_rad_v;
+  const int x_tile = get_group_id(0) * local_width - filt_rad_u;
+  const int y_tile = get_group_id(1) * local_height - filt_rad_v;
+  const int im_dim = width * height;
+  const int b = get_global_id(2);
+
+  // Sum the input features of every pixel in the tile (and its apron)
+  for (int v = y_local; v < tile_height; v += local_height) {
+    for (int u = x_local; u < tile_width; u += local_width) {
+      const int x = x_tile + u;
+      const int y = y_tile + v;
+      float sum = 0;
+      if (x >= 0 && x < width && y >= 0 && y < height) {
+        for (int f = 0; f < input_nfeats; f++) {
+          sum += LOAD_ACT((b * input_nfeats + f) * im_dim + y * width + x,
+            input);
+        }
+      }
+      tile[v * tile_width + u] = sum;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const int x_out = get_global_id(0);
+  const int y_out = get_global_id(1);
+  if (x_out >= width || y_out >= height) {
+    return;
+  }
+
+  float sum = 0;
+  float wsum = 0;
+  const int filt_size_u = 2 * filt_rad_u + 1;
+  for (int v_filt = 0; v_filt < 2 * filt_rad_v + 1; v_filt++) {
+    const int y = y_out + v_filt - filt_rad_v;
+    for (int u_filt = 0; u_filt < filt_size_u; u_filt++) {
+      const int x = x_out + u_filt - filt_rad_u;
+      if (x >= 0 && x < width && y >= 0 && y < height) {
+        const float k = kernel2d[v_filt * filt_size_u + u_filt];
+        sum += k * tile[(y_local + v_filt) * tile_width + x_local + u_filt];
+        wsum += k;
+      }
+    }
+  }
+
+  mean[b * im_dim + y_out * width + x_out] =
+    sum / ((float)input_nfeats * wsum);
+}
+
+__kernel void SpatialContrastiveNormalization(
+  const __global act_t* input,     // 0
+  __global act_t* output,          // 1
+  const __global float* mean,      // 2
+  const __global float* kernel2d,  // 3
+  const int filt_rad_u,            // 4
+  const int filt_rad_v,            // 5
+  const int width,                 // 6
+  const int height,                // 7
+  const int input_nfeats,          // 8
+  const float threshold,           // 9
+  __local float* tile) {           // 10
+
+  const int local_width = get_local_size(0);
+  const int local_height = get_local_size(1);
+  const int x_local = get_local_id(0);
+  const int y_local = get_local_id(1);
+  const int tile_width = local_width + 2 * filt_rad_u;
+  const int tile_height = local_height + 2 * filt_rad_v;
+  const int x_tile = get_group_id(0) * local_width - filt_rad_u;
+  const int y_tile = get_group_id(1) * local_height - filt_rad_v;
+  const int im_dim = width * height;
+  const int b = get_global_id(2);
+
+  // Sum the squared zero mean features of every pixel in the tile
+  for (int v = y_local; v < tile_height; v += local_height) {
+    for (int u = x_local; u < tile_width; u += local_width) {
+      const int x = x_tile + u;
+      const int y = y_tile + v;
+      float sum = 0;
+      if (x >= 0 && x < width && y >= 0 && y < height) {
+        const float m = mean[b * im_dim + y * width + x];
+        for (int f = 0; f < input_nfeats; f++) {
+          const float val = LOAD_ACT((b * input_nfeats + f) * im_dim +
+            y * width + x, input) - m;
+          sum += val * val;
+        }
+      }
+      tile[v * tile_width + u] = sum;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const int x_out = get_global_id(0);
+  const int y_out = get_global_id(1);
+  if (x_out >= width || y_out >= height) {
+    return;
+  }
+
+  float sum = 0;
+  float wsum = 0;
+  const int filt_size_u = 2 * filt_rad_u + 1;
+  for (int v_filt = 0; v_filt < 2 * filt_rad_v + 1; v_filt++) {
+    const int y = y_out + v_filt - filt_rad_v;
+    for (int u_filt = 0; u_filt < filt_size_u; u_filt++) {
+      const int x = x_out + u_filt - filt_rad_u;
+      if (x >= 0 && x < width && y >= 0 && y < height) {
+        const float k = kernel2d[v_filt * filt_size_u + u_filt];
+        sum += k * tile[(y_local + v_filt) * tile_width + x_local + u_filt];
+        wsum += k;
+      }
+    }
+  }
+
+  const int uvout = y_out * width + x_out;
+  const float m = mean[b * im_dim + uvout];
+  const float std = max(sqrt(sum / (float)input_nfeats) / wsum, threshold);
+  const int offset = b * input_nfeats * im_dim + uvout;
+  for (int f = 0; f < input_nfeats; f++) {
+    const int index = offset + f * im_dim;
+    STORE_ACT((LOAD_ACT(index, input) - m) / std, index, output);
+  }
+}
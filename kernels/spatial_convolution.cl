@@ -1,3 +1,5 @@
+#include "activation.clh"  // Fused activation epilogue
+
 __kernel void SpatialConvolution(
   const __global  float* input,  // 0
   __global  float* output,       // 1 
@@ -7,7 +9,11 @@ __kernel void SpatialConvolution(
   const int input_height,        // 5
   const int input_width,         // 6
   const int filt_height,         // 7
-  const int filt_width) {        // 8
+  const int filt_width,          // 8
+  const int act_type,            // 9
+  const float act_threshold,     // 10
+  const float act_val,           // 11
+  const int output_nfeats) {     // 12
 
   const int width = get_global_size(0);
   const int height = get_global_size(1);
@@ -15,7 +21,9 @@ __kernel void SpatialConvolution(
 
   const int x_out = get_global_id(0);
   const int y_out = get_global_id(1);
-  const int f_out = get_global_id(2);
+  // Planes are (sample, output feature) pairs for a batch
+  const int plane = get_global_id(2);
+  const int f_out = plane % output_nfeats;
   const int xInTopLeft = x_out;
   const int yInTopLeft = y_out;
 
@@ -25,11 +33,12 @@ __kernel void SpatialConvolution(
   const int filt_size = filt_height * filt_width;
   const int filt_size_per_fout = input_nfeats * filt_size;
   const int in_size = input_width * input_height;
+  const int batch_in = (plane / output_nfeats) * input_nfeats;
   for (int f = 0; f < input_nfeats; f++) {
     // Get a pointer to the current weight matrix and input feature
     // THIS COULD BE FASTER --> STRIPE WEIGHTS MATRIX FOR BETTER DATA ACCESS!
     const __global  float* pkernel = &weights[f_out * filt_size_per_fout + f * filt_size];
-    const __global  float* pinput = &input[f * in_size];
+    const __global  float* pinput = &input[(batch_in + f) * in_size];
 
     // Perform the convolution on this input feature
     for (int r = 0; r < filt_height; r++) {
@@ -43,8 +52,8 @@ __kernel void SpatialConvolution(
       }
     }
   }
-  const int iout = x_out + width * (y_out + height * f_out);
-  output[iout] = sum;
+  const int iout = x_out + width * (y_out + height * plane);
+  output[iout] = activation(sum, act_type, act_threshold, act_val);
 }
 
 __kernel void SpatialConvolutionPadding(
@@ -57,7 +66,11 @@ __kernel void SpatialConvolutionPadding(
   const int input_width,          // 6
   const int filt_height,          // 7
   const int filt_width,           // 8
-  const int padding) {            // 9
+  const int padding,              // 9
+  const int act_type,             // 10
+  const float act_threshold,      // 11
+  const float act_val,            // 12
+  const int output_nfeats) {      // 13
 
   const int width = get_global_size(0);
   const int height = get_global_size(1);
@@ -65,7 +78,9 @@ __kernel void SpatialConvolutionPadding(
 
   const int x_out = get_global_id(0);
   const int y_out = get_global_id(1);
-  const int f_out = get_global_id(2);
+  // Planes are (sample, output feature) pairs for a batch
+  const int plane = get_global_id(2);
+  const int f_out = plane % output_nfeats;
   const int xInTopLeft = x_out;
   const int yInTopLeft = y_out;
 
@@ -77,11 +92,12 @@ __kernel void SpatialConvolutionPadding(
   const int filt_size = filt_height * filt_width;
   const int filt_size_per_fout = input_nfeats * filt_size;
   const int in_size = input_width * input_height;
+  const int batch_in = (plane / output_nfeats) * input_nfeats;
   for (int f = 0; f < input_nfeats; f++) {
     // Get a pointer to the current weight matrix and input feature
     // THIS COULD BE FASTER --> STRIPE WEIGHTS MATRIX FOR BETTER DATA ACCESS!
     const __global  float* pkernel = &weights[f_out * filt_size_per_fout + f * filt_size];
-    const __global  float* pinput = &input[f * in_size];
+    const __global  float* pinput = &input[(batch_in + f) * in_size];
 
     // Perform the convolution on this input feature
     for (int r = 0; r < filt_height; r++) {
@@ -101,8 +117,120 @@ __kernel void SpatialConvolutionPadding(
       }
     }
   }
-  const int iout = x_out + width * (y_out + height * f_out);
-  output[iout] = sum;
+  const int iout = x_out + width * (y_out + height * plane);
+  output[iout] = activation(sum, act_type, act_threshold, act_val);
+}
+
+// Reads fp16 weights (with vload_half) and accumulates in fp32.  Handles
+// both the padded and unpadded cases (padding = 0).
+__kernel void SpatialConvolutionHalf(
+  const __global  float* input,   // 0
+  __global  float* output,        // 1 
+  const __global half* weights,   // 2
+  const __global float* biases,   // 3
+  const int input_nfeats,         // 4
+  const int input_height,         // 5
+  const int input_width,          // 6
+  const int filt_height,          // 7
+  const int filt_width,           // 8
+  const int padding,              // 9
+  const int act_type,             // 10
+  const float act_threshold,      // 11
+  const float act_val,            // 12
+  const int output_nfeats) {      // 13
+
+  const int width = get_global_size(0);
+  const int height = get_global_size(1);
+
+  const int x_out = get_global_id(0);
+  const int y_out = get_global_id(1);
+  // Planes are (sample, output feature) pairs for a batch
+  const int plane = get_global_id(2);
+  const int f_out = plane % output_nfeats;
+
+  // Initilize the output to the bias
+  float sum = biases[f_out];
+
+  const int filt_size = filt_height * filt_width;
+  const int filt_size_per_fout = input_nfeats * filt_size;
+  const int in_size = input_width * input_height;
+  const int batch_in = (plane / output_nfeats) * input_nfeats;
+  for (int f = 0; f < input_nfeats; f++) {
+    const __global  half* pkernel = &weights[f_out * filt_size_per_fout + f * filt_size];
+    const __global  float* pinput = &input[(batch_in + f) * in_size];
+
+    for (int r = 0; r < filt_height; r++) {
+      const int yIn = y_out + r - padding;
+      if (yIn >= 0 && yIn < input_height) {
+        for (int c = 0; c < filt_width; c++) {
+          const int xIn = x_out + c - padding;
+          if (xIn >= 0 && xIn < input_width) {
+            sum += vload_half(r * filt_width + c, pkernel) * 
+              pinput[yIn * input_width + xIn];
+          }
+        }
+      }
+    }
+  }
+  const int iout = x_out + width * (y_out + height * plane);
+  output[iout] = activation(sum, act_type, act_threshold, act_val);
+}
+
+// int8 weights and input with int32 accumulation, requantized to float with
+// the per output feature weight scale and the input scale.
+__kernel void SpatialConvolutionInt8(
+  const __global  char* input,    // 0
+  __global  float* output,        // 1 
+  const __global char* weights,   // 2
+  const __global float* biases,   // 3
+  const int input_nfeats,         // 4
+  const int input_height,         // 5
+  const int input_width,          // 6
+  const int filt_height,          // 7
+  const int filt_width,           // 8
+  const int padding,              // 9
+  const __global float* scales,   // 10
+  const float in_scale,           // 11
+  const int act_type,             // 12
+  const float act_threshold,      // 13
+  const float act_val,            // 14
+  const int output_nfeats) {      // 15
+
+  const int width = get_global_size(0);
+  const int height = get_global_size(1);
+
+  const int x_out = get_global_id(0);
+  const int y_out = get_global_id(1);
+  // Planes are (sample, output feature) pairs for a batch
+  const int plane = get_global_id(2);
+  const int f_out = plane % output_nfeats;
+
+  int sum = 0;
+
+  const int filt_size = filt_height * filt_width;
+  const int filt_size_per_fout = input_nfeats * filt_size;
+  const int in_size = input_width * input_height;
+  const int batch_in = (plane / output_nfeats) * input_nfeats;
+  for (int f = 0; f < input_nfeats; f++) {
+    const __global  char* pkernel = &weights[f_out * filt_size_per_fout + f * filt_size];
+    const __global  char* pinput = &input[(batch_in + f) * in_size];
+
+    for (int r = 0; r < filt_height; r++) {
+      const int yIn = y_out + r - padding;
+      if (yIn >= 0 && yIn < input_height) {
+        for (int c = 0; c < filt_width; c++) {
+          const int xIn = x_out + c - padding;
+          if (xIn >= 0 && xIn < input_width) {
+            sum += pkernel[r * filt_width + c] * 
+              pinput[yIn * input_width + xIn];
+          }
+        }
+      }
+    }
+  }
+  const int iout = x_out + width * (y_out + height * plane);
+  output[iout] = activation((float)sum * scales[f_out] * in_scale + 
+    biases[f_out], act_type, act_threshold, act_val);
 }
 
 /*
@@ -11,9 +11,13 @@
       i < (n);                                                        \
       i += get_local_size(0) * get_num_groups(0))
 
+#include "activation.clh"  // Fused activation epilogue
+
 // Kernel for fast unfold+copy
 // (borrowed from Caffe: https://github.com/BVLC/caffe/blob/master/src/caffe/layers/conv_layer.cu)
 // And then I (Jonathan Tompson) took the Torch version
+// For a batch each row of data_col holds the columns of every sample (one
+// after the other), so a single GEMM covers the whole batch.
 __kernel void im2col_kernel(const int n,                    // 0
                             const __global float* data_im,  // 1
                             const int height,               // 2
@@ -26,26 +30,113 @@ __kernel void im2col_kernel(const int n,                    // 0
                             const int stride_w,             // 9
                             const int height_col,           // 10
                             const int width_col,            // 11
-                            __global float* data_col) {     // 12
+                            __global float* data_col,       // 12
+                            const int channels,             // 13
+                            const int batch_size) {         // 14
   CUDA_KERNEL_LOOP(index, n) {
     int w_out = index % width_col;
     index /= width_col;
     int h_out = index % height_col;
-    int channel_in = index / height_col;
+    index /= height_col;
+    int channel_in = index % channels;
+    int b = index / channels;
     int channel_out = channel_in * ksize_h * ksize_w;
     int h_in = h_out * stride_h - pad_h;
     int w_in = w_out * stride_w - pad_w;
-    data_col += (channel_out * height_col + h_out) * width_col + w_out;
-    data_im += (channel_in * height + h_in) * width + w_in;
+    data_col += ((channel_out * batch_size + b) * height_col + h_out) * 
+      width_col + w_out;
+    data_im += ((b * channels + channel_in) * height + h_in) * width + w_in;
     for (int i = 0; i < ksize_h; ++i) {
       for (int j = 0; j < ksize_w; ++j) {
         int h = h_in + i;
         int w = w_in + j;
         *data_col = (h >= 0 && w >= 0 && h < height && w < width) ?
           data_im[i * width + j] : 0;
-        data_col += height_col * width_col;
+        data_col += batch_size * height_col * width_col;
       }
     }
   }
 }
 
+// C = A * B with int8 A (the weights) and B (the quantized columns) and
+// int32 accumulation.  The result is requantized to float with the per
+// output feature weight scale and the input scale, and the bias is added.
+// For a batch N covers every sample and C is written sample by sample.
+__kernel void GemmInt8(
+  const __global char* weights,  // 0  --> Size M x K (K stored contiguously)
+  const __global char* columns,  // 1  --> Size K x N (N stored contiguously)
+  __global float* output,        // 2  --> Size N / P x M x P
+  const __global float* scales,  // 3  --> Size M
+  const __global float* biases,  // 4  --> Size M
+  const float in_scale,          // 5
+  const int N,                   // 6
+  const int K,                   // 7
+  const int act_type,            // 8
+  const float act_threshold,     // 9
+  const float act_val,           // 10
+  const int P) {                 // 11 --> Output plane size (N / batch size)
+
+  const int n = get_global_id(0);
+  const int m = get_global_id(1);
+  const int M = get_global_size(1);
+
+  const __global char* pweights = &weights[m * K];
+  int sum = 0;
+  for (int k = 0; k < K; k++) {
+    sum += pweights[k] * columns[k * N + n];
+  }
+  output[((n / P) * M + m) * P + n % P] = activation((float)sum * 
+    scales[m] * in_scale + biases[m], act_type, act_threshold, act_val);
+}
+
+// C = A * B with fp16 A (the weights, read with vload_half) and float B
+// (the columns), accumulated in fp32.  The bias is added and the output is
+// written as in GemmInt8.  clBLAS only has fp32 GEMMs, so fp16 weights use
+// this kernel.
+__kernel void GemmHalf(
+  const __global half* weights,  // 0  --> Size M x K (K stored contiguously)
+  const __global float* columns, // 1  --> Size K x N (N stored contiguously)
+  __global float* output,        // 2  --> Size N / P x M x P
+  const __global float* biases,  // 3  --> Size M
+  const int N,                   // 4
+  const int K,                   // 5
+  const int act_type,            // 6
+  const float act_threshold,     // 7
+  const float act_val,           // 8
+  const int P) {                 // 9  --> Output plane size (N / batch size)
+
+  const int n = get_global_id(0);
+  const int m = get_global_id(1);
+  const int M = get_global_size(1);
+
+  float sum = biases[m];
+  for (int k = 0; k < K; k++) {
+    sum += vload_half(m * K + k, weights) * columns[k * N + n];
+  }
+  output[((n / P) * M + m) * P + n % P] = activation(sum, act_type,
+    act_threshold, act_val);
+}
+
+// GEMM epilogue for the clBLAS path when an activation is fused or the
+// input is a batch: the GEMM writes the convolution without the bias and
+// this adds it (instead of a second GEMM) and applies the activation in the
+// same pass.  For a batch it also reorders the GEMM result (M x N, with the
+// samples side by side in N) to one M x P output per sample.  input and
+// output can be the same buffer when P == N.
+__kernel void BiasActivation(
+  const __global float* input,   // 0  --> Size M x N (N stored contiguously)
+  __global float* output,        // 1  --> Size N / P x M x P
+  const __global float* biases,  // 2  --> Size M
+  const int N,                   // 3
+  const int P,                   // 4  --> Output plane size (N / batch size)
+  const int act_type,            // 5
+  const float act_threshold,     // 6
+  const float act_val) {         // 7
+
+  const int n = get_global_id(0);
+  const int m = get_global_id(1);
+  const int M = get_global_size(1);
+
+  output[((n / P) * M + m) * P + n % P] = activation(input[m * N + n] + 
+    biases[m], act_type, act_threshold, act_val);
+}
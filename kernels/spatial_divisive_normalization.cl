@@ -1,5 +1,10 @@
+#include "half.clh"
+
+// Only the input and output are activations (act_t).  The sums of squares
+// need twice the exponent range of the input, so the passes stay float.
+
 __kernel void SpatialDivisiveNormalizationHoriz(
-  const __global float* input,       // 0
+  const __global act_t* input,       // 0
   __global  float* output,           // 1 
   const __global float* kernel1d,    // 2
   const int filt_rad) {              // 3
@@ -20,7 +25,8 @@ __kernel void SpatialDivisiveNormalizationHoriz(
   for (int u_offset = -filt_rad; u_offset <= filt_rad; u_offset++, i++) {
     int u = x_out + u_offset;
 	  if (u >= 0 && u < width) {
-	    sum += kernel1d[i] * (input[iout + u_offset] * input[iout + u_offset]);  // Sum sqs
+	    float val = LOAD_ACT(iout + u_offset, input);
+	    sum += kernel1d[i] * (val * val);  // Sum sqs
     }
   }
 
@@ -57,7 +63,7 @@ __kernel void SpatialDivisiveNormalizationVert(
 }
 
 __kernel void SpatialDivisiveNormalization2D(
-  const __global float* input,       // 0
+  const __global act_t* input,       // 0
   __global  float* output,           // 1 
   const __global float* kernel2d,    // 2
   const int filt_rad_u,              // 3
@@ -83,7 +89,7 @@ __kernel void SpatialDivisiveNormalization2D(
       int u = x_out + u_offset;
       int u_filt = u_offset + filt_rad_u;
 	    if (v >= 0 && v < height && u >= 0 && u < width) {
-        float val = input[iout + v_offset * width + u_offset];
+        float val = LOAD_ACT(iout + v_offset * width + u_offset, input);
         sum += kernel2d[v_filt * filt_size_u + u_filt] * (val * val);  // Sum sqs
       }
     }
@@ -105,7 +111,7 @@ __kernel void SpatialDivisiveNormalizationAccumDiv(
 
   const int x_out = get_global_id(0);
   const int y_out = get_global_id(1);
-  const int f_out = get_global_id(2);
+  const int b = get_global_id(2);  // sample index (for a batch)
 
   // Initilize the output to zero and accumulate the input values
   float sum = 0;
@@ -113,17 +119,18 @@ __kernel void SpatialDivisiveNormalizationAccumDiv(
   const int uvout = x_out + width * y_out;  // index on each input image
   const int im_dim = width * height;
   for (int f = 0; f < input_nfeats; f++) {
-    sum += input[f * im_dim + uvout];
+    sum += input[(b * input_nfeats + f) * im_dim + uvout];
   }
 
-  output[uvout] = max(sqrt(sum) / ((float)input_nfeats * (float)input_nfeats * std_coef[uvout]),
+  output[b * im_dim + uvout] = max(sqrt(sum) / ((float)input_nfeats * (float)input_nfeats * std_coef[uvout]),
                       threshold);
 }
 
 __kernel void SpatialDivisiveNormalization(
-  const __global float* input,     // 0
-  __global float* output,          // 1 
-  const __global float* std) {     // 2
+  const __global act_t* input,     // 0
+  __global act_t* output,          // 1 
+  const __global float* std,       // 2
+  const int input_nfeats) {        // 3
 
   const int width = get_global_size(0);
   const int height = get_global_size(1);
@@ -133,5 +140,7 @@ __kernel void SpatialDivisiveNormalization(
   const int f_out = get_global_id(2);
 
   const int index = x_out + width * (y_out + height * f_out);
-  output[index] = input[index] / std[y_out * width + x_out];
+  // The std of the sample that this plane belongs to
+  const int uv = x_out + width * (y_out + height * (f_out / input_nfeats));
+  STORE_ACT(LOAD_ACT(index, input) / std[uv], index, output);
 }
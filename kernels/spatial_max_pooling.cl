@@ -1,5 +1,7 @@
-__kernel void SpatialMaxPooling(const __global  float* input,  // 0
-                                __global  float* output,       // 1 
+#include "half.clh"
+
+__kernel void SpatialMaxPooling(const __global  act_t* input,  // 0
+                                __global  act_t* output,       // 1 
                                 const int input_height,        // 2
                                 const int input_width,         // 3
                                 const int poolsize_v,          // 4
@@ -14,30 +16,30 @@ __kernel void SpatialMaxPooling(const __global  float* input,  // 0
   const int f_out = get_global_id(2);
 
   // Initilize the output to the bias
-  float out_val = - INFINITY;
+  real_t out_val = - INFINITY;
 
   const int vstart = y_out * poolsize_v;
   const int vend = (y_out + 1) * poolsize_v - 1;
 
   // Get a pointer to the current input feature (that corresponds to this
   // output feature;
-  const __global  float* input_f = &input[f_out * input_width * input_height];
+  const __global  act_t* input_f = &input[f_out * input_width * input_height];
 
   for (int v = vstart; v <= vend; v++) {
     const int istart = v * input_width + x_out * poolsize_u;
 	  const int iend = v * input_width + (x_out + 1) * poolsize_u - 1;
 
     for (int i = istart; i <= iend; i++) {
-	    out_val = max(out_val, input_f[i]);
+	    out_val = max(out_val, (real_t)LOAD_ACT(i, input_f));
 	  }
   }
 
   const int index = x_out + width * (y_out + height * f_out);
-  output[index] = out_val;
+  STORE_ACT(out_val, index, output);
 }
 
-__kernel void SpatialMaxPooling2D(const __global  float* input,  // 0
-                                  __global  float* output,       // 1 
+__kernel void SpatialMaxPooling2D(const __global  act_t* input,  // 0
+                                  __global  act_t* output,       // 1 
                                   const int input_height,        // 2
                                   const int input_width,         // 3
                                   const int poolsize_v,          // 4
@@ -50,24 +52,24 @@ __kernel void SpatialMaxPooling2D(const __global  float* input,  // 0
   const int y_out = get_global_id(1);
 
   // Initilize the output to the bias
-  float out_val = - INFINITY;
+  real_t out_val = - INFINITY;
 
   const int vstart = y_out * poolsize_v;
   const int vend = (y_out + 1) * poolsize_v - 1;
 
   // Get a pointer to the current input feature (that corresponds to this
   // output feature;
-  const __global  float* input_f = input;
+  const __global  act_t* input_f = input;
 
   for (int v = vstart; v <= vend; v++) {
     const int istart = v * input_width + x_out * poolsize_u;
 	  const int iend = v * input_width + (x_out + 1) * poolsize_u - 1;
 
     for (int i = istart; i <= iend; i++) {
-	    out_val = max(out_val, input_f[i]);
+	    out_val = max(out_val, (real_t)LOAD_ACT(i, input_f));
 	  }
   }
 
   const int index = x_out + width * y_out;
-  output[index] = out_val;
+  STORE_ACT(out_val, index, output);
 }
@@ -0,0 +1,3 @@
+// fp16 activation variant of spatial_max_pooling.cl (see half.clh)
+#define JTORCH_HALF
+#include "spatial_max_pooling.cl"
@@ -1,6 +1,11 @@
+#include "half.clh"
+
+// The input, output and the mean passes are all activations (act_t): the
+// passes are weighted means of the input, so they have the same range.
+
 __kernel void SpatialSubtractiveNormalizationHoriz(
-  const __global float* input,     // 0
-  __global float* output,          // 1 
+  const __global act_t* input,     // 0
+  __global act_t* output,          // 1 
   const __global float* kernel1d,  // 2
   const int filt_rad) {            // 3
 
@@ -20,16 +25,16 @@ __kernel void SpatialSubtractiveNormalizationHoriz(
   for (int u_offset = -filt_rad; u_offset <= filt_rad; u_offset++, i++) {
     int u = x_out + u_offset;
 	  if (u >= 0 && u < width) {
-	    sum += kernel1d[i] * input[iout + u_offset];
+	    sum += kernel1d[i] * LOAD_ACT(iout + u_offset, input);
     }
   }
 
-  output[iout] = sum;
+  STORE_ACT(sum, iout, output);
 }
 
 __kernel void SpatialSubtractiveNormalizationVert(
-  const __global float* input,     // 0
-  __global  float* output,         // 1 
+  const __global act_t* input,     // 0
+  __global act_t* output,          // 1 
   const __global float* kernel1d,  // 2
   const int filt_rad) {            // 3
 
@@ -49,16 +54,16 @@ __kernel void SpatialSubtractiveNormalizationVert(
   for (int v_offset = -filt_rad; v_offset <= filt_rad; v_offset++, i++) {
     int v = y_out + v_offset;
 	  if (v >= 0 && v < height) {
-	    sum += kernel1d[i] * input[iout + v_offset * width];
+	    sum += kernel1d[i] * LOAD_ACT(iout + v_offset * width, input);
     }
   }
 
-  output[iout] = sum;
+  STORE_ACT(sum, iout, output);
 }
 
 __kernel void SpatialSubtractiveNormalization2D(
-  const __global float* input,     // 0
-  __global  float* output,         // 1 
+  const __global act_t* input,     // 0
+  __global act_t* output,          // 1 
   const __global float* kernel2d,  // 2
   const int filt_rad_u,            // 3
   const int filt_rad_v) {          // 4
@@ -84,17 +89,17 @@ __kernel void SpatialSubtractiveNormalization2D(
       int u_filt = u_offset + filt_rad_u;
 	    if (v >= 0 && v < height && u >= 0 && u < width) {
         sum += kernel2d[v_filt * filt_size_u + u_filt] * 
-          input[iout + v_offset * width + u_offset];
+          LOAD_ACT(iout + v_offset * width + u_offset, input);
       }
     }
   }
 
-  output[iout] = sum;
+  STORE_ACT(sum, iout, output);
 }
 
 __kernel void SpatialSubtractiveNormalizationAccumDiv(
-  const __global float* input,       // 0
-  __global  float* output,           // 1 
+  const __global act_t* input,       // 0
+  __global act_t* output,            // 1 
   const __global float* mean_coeff,  // 2
   const int input_nfeats) {          // 3
 
@@ -103,7 +108,7 @@ __kernel void SpatialSubtractiveNormalizationAccumDiv(
 
   const int x_out = get_global_id(0);
   const int y_out = get_global_id(1);
-  const int f_out = get_global_id(2);
+  const int b = get_global_id(2);  // sample index (for a batch)
 
   // Initilize the output to zero and accumulate the input values
   float sum = 0;
@@ -111,16 +116,19 @@ __kernel void SpatialSubtractiveNormalizationAccumDiv(
   const int uvout = x_out + width * y_out;  // index on each input image
   const int im_dim = width * height;
   for (int f = 0; f < input_nfeats; f++) {
-    sum += input[f * im_dim + uvout];
+    sum += LOAD_ACT((b * input_nfeats + f) * im_dim + uvout, input);
   }
 
-  output[uvout] = sum / ((float)input_nfeats * (float)input_nfeats * mean_coeff[uvout]);
+  const float mean = sum /
+    ((float)input_nfeats * (float)input_nfeats * mean_coeff[uvout]);
+  STORE_ACT(mean, b * im_dim + uvout, output);
 }
 
 __kernel void SpatialSubtractiveNormalization(
-  const __global float* input,      // 0
-  __global float* output,           // 1 
-  const __global float* mean) {     // 2
+  const __global act_t* input,      // 0
+  __global act_t* output,           // 1 
+  const __global act_t* mean,       // 2
+  const int input_nfeats) {         // 3
 
   const int width = get_global_size(0);
   const int height = get_global_size(1);
@@ -130,5 +138,8 @@ __kernel void SpatialSubtractiveNormalization(
   const int f_out = get_global_id(2);
 
   const int index = x_out + width * (y_out + height * f_out);
-  output[index] = input[index] - mean[y_out * width + x_out];
+  // The mean of the sample that this plane belongs to
+  const int uv = x_out + width * (y_out + height * (f_out / input_nfeats));
+  STORE_ACT((real_t)LOAD_ACT(index, input) - (real_t)LOAD_ACT(uv, mean),
+    index, output);
 }
@@ -0,0 +1,3 @@
+// fp16 activation variant of spatial_subtractive_normalization.cl (see half.clh)
+#define JTORCH_HALF
+#include "spatial_subtractive_normalization.cl"
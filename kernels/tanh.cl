@@ -19,3 +19,25 @@ __kernel void TanH1D(const __global float* input, __global float* output) {
   output[x_out] = tanh(input[x_out]);
 }
 
+// input is a strided view, output is contiguous.
+__kernel void TanHStrided(
+  const __global float* input,  // 0
+  const int in_offset,          // 1
+  const int in_stride0,         // 2
+  const int in_stride1,         // 3
+  const int in_stride2,         // 4
+  const int in_stride3,         // 5
+  __global float* output,       // 6
+  const int size2) {            // 7
+
+  const int width = get_global_size(0);
+  const int height = get_global_size(1);
+
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  const int z = get_global_id(2) % size2;
+  const int w = get_global_id(2) / size2;
+
+  output[x + width * (y + height * get_global_id(2))] = tanh(input[in_offset + 
+    x * in_stride0 + y * in_stride1 + z * in_stride2 + w * in_stride3]);
+}
@@ -1,4 +1,6 @@
 function saveJoinTableNode(node, ofile)
   -- Save the dimension to join
   ofile:writeInt(node.dimension)
+  -- And the number of dimensions of a non-batch input (0 if not set)
+  ofile:writeInt(node.nInputDims or 0)
 end
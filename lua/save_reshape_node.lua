@@ -8,4 +8,8 @@ function saveReshapeNode(node, ofile)
   for i = 1, #sz do
     ofile:writeInt(sz[i])
   end
+  -- And the number of dimensions of a non-batch input (0 if not set).  torch
+  -- has no such field, so set node.nInputDims before saving a model that
+  -- runs batches of one.
+  ofile:writeInt(node.nInputDims or 0)
 end
@@ -0,0 +1,226 @@
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <limits>
+#include "jtorch/buffer_pool.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+// Requests smaller than this are all served from the same bucket
+#define JTORCH_BUFFER_POOL_MIN_BUCKET 256
+// Each power of two is split into this many buckets (so at most 25% of a
+// buffer is slack)
+#define JTORCH_BUFFER_POOL_SUB_BUCKETS 4
+
+namespace jtorch {
+
+  BufferPool::BufferPool(jcl::JCL* context) {
+    context_ = context;
+    max_cached_bytes_ = std::numeric_limits<uint64_t>::max();
+    hits_ = 0;
+    misses_ = 0;
+    bytes_in_use_ = 0;
+    bytes_cached_ = 0;
+    defer_depth_ = 0;
+    device_ = 0;
+  }
+
+  BufferPool::~BufferPool() {
+    std::lock_guard<std::mutex> lck(lock_);
+    recycleDeferred();
+    trimInternal(0);
+    if (buffers_.size() != 0) {
+      std::cout << "\tWARNING: BufferPool destroyed with " << buffers_.size()
+        << " buffers still referenced (Tensors outlived jtorch)." << std::endl;
+    }
+  }
+
+  uint32_t BufferPool::bucketSize(const uint32_t nelems) {
+    if (nelems <= JTORCH_BUFFER_POOL_MIN_BUCKET) {
+      return JTORCH_BUFFER_POOL_MIN_BUCKET;
+    }
+    // Find the largest power of two <= nelems and then round up to the next
+    // sub-bucket boundary above it.
+    uint32_t pow2 = JTORCH_BUFFER_POOL_MIN_BUCKET;
+    while (pow2 <= (nelems >> 1)) {
+      pow2 <<= 1;
+    }
+    const uint32_t step = pow2 / JTORCH_BUFFER_POOL_SUB_BUCKETS;
+    const uint64_t bucket = ((uint64_t)nelems + step - 1) / step * step;
+    if (bucket > std::numeric_limits<uint32_t>::max()) {
+      return nelems;
+    }
+    return (uint32_t)bucket;
+  }
+
+  jcl::JCLBuffer BufferPool::allocate(const uint32_t nelems) {
+    const uint32_t bucket = bucketSize(nelems);
+    const uint64_t bytes = (uint64_t)bucket * sizeof(float);
+    std::lock_guard<std::mutex> lck(lock_);
+    std::map<FreeListKey, std::vector<jcl::JCLBuffer>>::iterator free_list =
+      free_lists_.find(FreeListKey(bucket, device_));
+    jcl::JCLBuffer buffer;
+    if (free_list != free_lists_.end() && free_list->second.size() > 0) {
+      buffer = free_list->second.back();
+      free_list->second.pop_back();
+      bytes_cached_ -= bytes;
+      hits_++;
+    } else {
+      // Adds a reference to the jcl reference count.  The pool holds this
+      // single reference for the lifetime of the buffer.
+      buffer = context_->allocateBuffer(jcl::CLBufferTypeReadWrite, bucket);
+      misses_++;
+    }
+    BufferEntry entry;
+    entry.nelems = bucket;
+    entry.ref_count = 1;
+    buffers_[buffer] = entry;
+    bytes_in_use_ += bytes;
+    return buffer;
+  }
+
+  void BufferPool::addReference(const jcl::JCLBuffer buffer) {
+    std::lock_guard<std::mutex> lck(lock_);
+    std::unordered_map<jcl::JCLBuffer, BufferEntry>::iterator it =
+      buffers_.find(buffer);
+    if (it == buffers_.end()) {
+      throw std::runtime_error("BufferPool::addReference() - ERROR: "
+        "Buffer is not owned by the pool!");
+    }
+    it->second.ref_count++;
+  }
+
+  void BufferPool::releaseReference(const jcl::JCLBuffer buffer) {
+    std::lock_guard<std::mutex> lck(lock_);
+    std::unordered_map<jcl::JCLBuffer, BufferEntry>::iterator it =
+      buffers_.find(buffer);
+    if (it == buffers_.end()) {
+      throw std::runtime_error("BufferPool::releaseReference() - ERROR: "
+        "Buffer is not owned by the pool!");
+    }
+    it->second.ref_count--;
+    if (it->second.ref_count > 0) {
+      return;
+    }
+    const uint32_t bucket = it->second.nelems;
+    const uint64_t bytes = (uint64_t)bucket * sizeof(float);
+    buffers_.erase(it);
+    bytes_in_use_ -= bytes;
+    if (defer_depth_ > 0) {
+      deferred_.push_back(std::make_pair(FreeListKey(bucket, device_),
+        buffer));
+      return;
+    }
+    free_lists_[FreeListKey(bucket, device_)].push_back(buffer);
+    bytes_cached_ += bytes;
+    if (bytes_cached_ > max_cached_bytes_) {
+      trimInternal(max_cached_bytes_);
+    }
+  }
+
+  void BufferPool::deferRecycling() {
+    std::lock_guard<std::mutex> lck(lock_);
+    defer_depth_++;
+  }
+
+  void BufferPool::resumeRecycling() {
+    std::lock_guard<std::mutex> lck(lock_);
+    if (defer_depth_ == 0) {
+      throw std::runtime_error("BufferPool::resumeRecycling() - ERROR: "
+        "Recycling was not deferred!");
+    }
+    defer_depth_--;
+    if (defer_depth_ == 0) {
+      recycleDeferred();
+      if (bytes_cached_ > max_cached_bytes_) {
+        trimInternal(max_cached_bytes_);
+      }
+    }
+  }
+
+  void BufferPool::recycleDeferred() {
+    for (uint32_t i = 0; i < deferred_.size(); i++) {
+      free_lists_[deferred_[i].first].push_back(deferred_[i].second);
+      bytes_cached_ += (uint64_t)deferred_[i].first.first * sizeof(float);
+    }
+    deferred_.clear();
+  }
+
+  void BufferPool::trim(const uint64_t max_cached_bytes) {
+    std::lock_guard<std::mutex> lck(lock_);
+    trimInternal(max_cached_bytes);
+  }
+
+  void BufferPool::trimInternal(const uint64_t max_cached_bytes) {
+    // Release the largest buffers first (they are the least likely to be
+    // reused and free the most memory).
+    std::map<FreeListKey, std::vector<jcl::JCLBuffer>>::reverse_iterator it =
+      free_lists_.rbegin();
+    while (bytes_cached_ > max_cached_bytes && it != free_lists_.rend()) {
+      const uint64_t bytes = (uint64_t)it->first.first * sizeof(float);
+      while (bytes_cached_ > max_cached_bytes && it->second.size() > 0) {
+        context_->releaseReference(it->second.back());
+        it->second.pop_back();
+        bytes_cached_ -= bytes;
+      }
+      it++;
+    }
+  }
+
+  void BufferPool::setDevice(const uint32_t device) {
+    std::lock_guard<std::mutex> lck(lock_);
+    device_ = device;
+  }
+
+  void BufferPool::setMaxCachedBytes(const uint64_t max_cached_bytes) {
+    std::lock_guard<std::mutex> lck(lock_);
+    max_cached_bytes_ = max_cached_bytes;
+    trimInternal(max_cached_bytes_);
+  }
+
+  uint32_t BufferPool::bufferSize(const jcl::JCLBuffer buffer) const {
+    std::lock_guard<std::mutex> lck(lock_);
+    std::unordered_map<jcl::JCLBuffer, BufferEntry>::const_iterator it =
+      buffers_.find(buffer);
+    if (it == buffers_.end()) {
+      throw std::runtime_error("BufferPool::bufferSize() - ERROR: "
+        "Buffer is not owned by the pool!");
+    }
+    return it->second.nelems;
+  }
+
+  uint32_t BufferPool::refCount(const jcl::JCLBuffer buffer) const {
+    std::lock_guard<std::mutex> lck(lock_);
+    std::unordered_map<jcl::JCLBuffer, BufferEntry>::const_iterator it =
+      buffers_.find(buffer);
+    if (it == buffers_.end()) {
+      throw std::runtime_error("BufferPool::refCount() - ERROR: "
+        "Buffer is not owned by the pool!");
+    }
+    return it->second.ref_count;
+  }
+
+  BufferPoolStats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lck(lock_);
+    BufferPoolStats ret;
+    ret.hits = hits_;
+    ret.misses = misses_;
+    ret.bytes_in_use = bytes_in_use_;
+    ret.bytes_cached = bytes_cached_;
+    ret.buffers_in_use = (uint32_t)buffers_.size();
+    ret.buffers_cached = 0;
+    std::map<FreeListKey, std::vector<jcl::JCLBuffer>>::const_iterator it;
+    for (it = free_lists_.begin(); it != free_lists_.end(); it++) {
+      ret.buffers_cached += (uint32_t)it->second.size();
+    }
+    return ret;
+  }
+
+  void BufferPool::resetStats() {
+    std::lock_guard<std::mutex> lck(lock_);
+    hits_ = 0;
+    misses_ = 0;
+  }
+
+}  // namespace jtorch
@@ -24,6 +24,10 @@ namespace jtorch {
     delete output;
   }
 
+  TorchStage* CAddTable::clone() const {
+    return new CAddTable();
+  }
+
 
   TorchStage* CAddTable::loadFromFile(std::ifstream& file) {
     // Nothing to load from file
@@ -62,7 +66,7 @@ namespace jtorch {
       !TO_TENSOR_PTR(in(0))->isSameSizeAs(*TO_TENSOR_PTR(output))) {
       // Reinitialize the output Tensor
       SAFE_DELETE(output);
-      output = new Tensor<float>(TO_TENSOR_PTR(in(0))->dim(), 
+      output = Tensor<float>::uninitialized(TO_TENSOR_PTR(in(0))->dim(), 
         TO_TENSOR_PTR(in(0))->size());
     }
 
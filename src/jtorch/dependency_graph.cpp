@@ -0,0 +1,167 @@
+#include <algorithm>
+#include "jtorch/dependency_graph.h"
+#include "jtorch/jtorch.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+// Readers of a buffer that is never written again (ie weights) are pruned of
+// finished events once there are this many
+#define JTORCH_MAX_PENDING_READERS 32
+
+namespace jtorch {
+
+  static void addWait(cl_event event, std::vector<cl_event>& wait_list) {
+    if (event != NULL && std::find(wait_list.begin(), wait_list.end(),
+      event) == wait_list.end()) {
+      wait_list.push_back(event);
+    }
+  }
+
+  static bool isComplete(cl_event event) {
+    cl_int status;
+    return clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+      sizeof(status), &status, NULL) == CL_SUCCESS && status <= CL_COMPLETE;
+  }
+
+  DependencyGraph::DependencyGraph() {
+  }
+
+  DependencyGraph::~DependencyGraph() {
+    clear();
+  }
+
+  void DependencyGraph::clear() {
+    for (std::unordered_map<cl_mem, BufferDeps>::iterator it =
+      buffers_.begin(); it != buffers_.end(); it++) {
+      if (it->second.writer != NULL) {
+        clReleaseEvent(it->second.writer);
+      }
+      for (uint32_t i = 0; i < it->second.readers.size(); i++) {
+        clReleaseEvent(it->second.readers[i]);
+      }
+    }
+    buffers_.clear();
+  }
+
+  void DependencyGraph::waitList(const std::vector<cl_mem>& reads,
+    const std::vector<cl_mem>& writes,
+    std::vector<cl_event>& wait_list) const {
+    std::unordered_map<cl_mem, BufferDeps>::const_iterator it;
+    for (uint32_t i = 0; i < reads.size(); i++) {
+      it = buffers_.find(reads[i]);
+      if (it != buffers_.end()) {
+        addWait(it->second.writer, wait_list);  // Read after write
+      }
+    }
+    for (uint32_t i = 0; i < writes.size(); i++) {
+      it = buffers_.find(writes[i]);
+      if (it == buffers_.end()) {
+        continue;
+      }
+      // Write after write, and write after read (the readers themselves
+      // waited for the writer)
+      if (it->second.readers.empty()) {
+        addWait(it->second.writer, wait_list);
+      }
+      for (uint32_t j = 0; j < it->second.readers.size(); j++) {
+        addWait(it->second.readers[j], wait_list);
+      }
+    }
+  }
+
+  void DependencyGraph::record(const std::vector<cl_mem>& reads,
+    const std::vector<cl_mem>& writes, cl_event event) {
+    for (uint32_t i = 0; i < writes.size(); i++) {
+      BufferDeps& deps = buffers_[writes[i]];  // Zeroed when new
+      if (deps.writer != NULL) {
+        clReleaseEvent(deps.writer);
+      }
+      for (uint32_t j = 0; j < deps.readers.size(); j++) {
+        clReleaseEvent(deps.readers[j]);
+      }
+      deps.readers.clear();
+      clRetainEvent(event);
+      deps.writer = event;
+    }
+    for (uint32_t i = 0; i < reads.size(); i++) {
+      if (std::find(writes.begin(), writes.end(), reads[i]) != writes.end()) {
+        continue;
+      }
+      BufferDeps& deps = buffers_[reads[i]];
+      if (deps.readers.size() >= JTORCH_MAX_PENDING_READERS) {
+        std::vector<cl_event> pending;
+        for (uint32_t j = 0; j < deps.readers.size(); j++) {
+          if (isComplete(deps.readers[j])) {
+            clReleaseEvent(deps.readers[j]);
+          } else {
+            pending.push_back(deps.readers[j]);
+          }
+        }
+        deps.readers.swap(pending);
+      }
+      clRetainEvent(event);
+      deps.readers.push_back(event);
+    }
+  }
+
+  CommandDeps::CommandDeps() {
+    graph_ = CLDependencies();
+    resolved_ = false;
+    event_ = NULL;
+    caller_event_ = NULL;
+  }
+
+  CommandDeps::~CommandDeps() {
+    cl_event event = caller_event_ != NULL ? *caller_event_ : event_;
+    if (graph_ != NULL && event != NULL) {
+      graph_->record(reads_, writes_, event);
+    }
+    if (event_ != NULL) {
+      clReleaseEvent(event_);
+    }
+  }
+
+  void CommandDeps::reads(cl_mem mem) {
+    if (graph_ != NULL) {
+      reads_.push_back(mem);
+    }
+  }
+
+  void CommandDeps::writes(cl_mem mem) {
+    if (graph_ != NULL) {
+      writes_.push_back(mem);
+    }
+  }
+
+  void CommandDeps::after(cl_event event) {
+    addWait(event, wait_list_);
+  }
+
+  void CommandDeps::resolve() {
+    if (!resolved_ && graph_ != NULL) {
+      graph_->waitList(reads_, writes_, wait_list_);
+    }
+    resolved_ = true;
+  }
+
+  cl_uint CommandDeps::numWaits() {
+    resolve();
+    return (cl_uint)wait_list_.size();
+  }
+
+  const cl_event* CommandDeps::waitList() {
+    resolve();
+    return wait_list_.empty() ? NULL : &wait_list_[0];
+  }
+
+  cl_event* CommandDeps::event(cl_event* caller_event) {
+    if (caller_event != NULL) {
+      *caller_event = NULL;
+      caller_event_ = caller_event;
+      return caller_event;
+    }
+    return graph_ != NULL ? &event_ : NULL;
+  }
+
+}  // namespace jtorch
@@ -0,0 +1,149 @@
+#include <sstream>
+#include <stdexcept>
+#include "jtorch/device_dispatcher.h"
+#include "jtorch/jtorch.h"
+#include "jtorch/torch_stage.h"
+#include "jtorch/tensor.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  // DeviceScope - Restores the calling thread's device and current queue
+  // (which SetDevice() resets to the default queue) when it goes out of
+  // scope
+  class DeviceScope {
+  public:
+    DeviceScope() : device_(deviceid), queue_(CLQueue()) { }
+    ~DeviceScope() {
+      SetDevice(device_);
+      SetCLQueue(queue_);
+    }
+
+  private:
+    uint32_t device_;
+    cl_command_queue queue_;
+
+    // Non-copyable, non-assignable.
+    DeviceScope(DeviceScope&);
+    DeviceScope& operator=(const DeviceScope&);
+  };
+
+  DeviceDispatcher::DeviceDispatcher(
+    const std::function<TorchStage*()>& create_replica,
+    const uint32_t input_dim, const uint32_t* input_size,
+    const std::vector<uint32_t>& devices, const DispatchPolicy policy) {
+    policy_ = policy;
+    next_replica_ = 0;
+    input_nelems_ = 0;
+    output_nelems_ = 0;
+    std::vector<uint32_t> replica_devices = devices;
+    if (replica_devices.empty()) {
+      for (uint32_t d = 0; d < NumDevices(); d++) {
+        replica_devices.push_back(d);
+      }
+    }
+
+    DeviceScope scope;
+    try {
+      for (uint32_t i = 0; i < replica_devices.size(); i++) {
+        SetDevice(replica_devices[i]);
+        Replica replica;
+        replica.device = replica_devices[i];
+        replica.model = NULL;
+        replica.input = NULL;
+        replica.num_frames = 0;
+        replicas_.push_back(replica);
+        Replica& cur = replicas_.back();
+        cur.model = create_replica();
+        cur.input = new Tensor<float>(input_dim, input_size);  // Zeros
+        cur.model->forwardProp(*cur.input);
+        Tensor<float>* output = TO_TENSOR_PTR(cur.model->output);
+        if (output == NULL) {
+          throw std::runtime_error("DeviceDispatcher::DeviceDispatcher() - "
+            "ERROR: The model output must be a tensor!");
+        }
+        if (i > 0 && output->nelems() != output_nelems_) {
+          throw std::runtime_error("DeviceDispatcher::DeviceDispatcher() - "
+            "ERROR: The replicas disagree on the output size!");
+        }
+        input_nelems_ = cur.input->nelems();
+        output_nelems_ = output->nelems();
+        Sync();
+      }
+    } catch (...) {
+      cleanup();
+      throw;
+    }
+    if (replicas_.empty()) {
+      throw std::runtime_error("DeviceDispatcher::DeviceDispatcher() - "
+        "ERROR: No devices!");
+    }
+  }
+
+  DeviceDispatcher::~DeviceDispatcher() {
+    sync();
+    cleanup();
+  }
+
+  void DeviceDispatcher::cleanup() {
+    // Freed storage goes back to the free list of the replica's device
+    DeviceScope scope;
+    for (uint32_t i = 0; i < replicas_.size(); i++) {
+      SetDevice(replicas_[i].device);
+      SAFE_DELETE(replicas_[i].model);
+      SAFE_DELETE(replicas_[i].input);
+    }
+    replicas_.clear();
+  }
+
+  uint32_t DeviceDispatcher::pickReplica() {
+    const uint32_t n_replicas = (uint32_t)replicas_.size();
+    for (uint32_t i = 0; i < n_replicas; i++) {
+      std::deque<Event>& in_flight = replicas_[i].in_flight;
+      while (!in_flight.empty() && in_flight.front().isComplete()) {
+        in_flight.pop_front();
+      }
+    }
+    uint32_t ret = next_replica_;
+    if (policy_ == DISPATCH_LEAST_LOADED) {
+      // Ties go to the next replica in turn
+      for (uint32_t i = 1; i < n_replicas; i++) {
+        const uint32_t cur = (next_replica_ + i) % n_replicas;
+        if (replicas_[cur].in_flight.size() <
+          replicas_[ret].in_flight.size()) {
+          ret = cur;
+        }
+      }
+    }
+    next_replica_ = (ret + 1) % n_replicas;
+    return ret;
+  }
+
+  Event DeviceDispatcher::dispatch(const float* input, float* output) {
+    Replica& replica = replicas_[pickReplica()];
+    Event event;
+    {
+      DeviceScope scope;
+      SetDevice(replica.device);
+      replica.input->setDataAsync(input);
+      replica.model->forwardProp(*replica.input);
+      event = TO_TENSOR_PTR(replica.model->output)->getDataAsync(output);
+    }
+    replica.in_flight.push_back(event);
+    replica.num_frames++;
+    return event;
+  }
+
+  void DeviceDispatcher::sync() {
+    for (uint32_t i = 0; i < replicas_.size(); i++) {
+      std::deque<Event>& in_flight = replicas_[i].in_flight;
+      while (!in_flight.empty()) {
+        in_flight.front().wait();
+        in_flight.pop_front();
+      }
+    }
+  }
+
+}  // namespace jtorch
@@ -0,0 +1,284 @@
+#include <mutex>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "jcl/jcl.h"
+#include "jtorch/engine.h"
+#include "jtorch/jtorch.h"
+#include "jtorch/buffer_pool.h"
+#include "jtorch/kernel.h"
+#include "jtorch/dependency_graph.h"
+#include <clBLAS.h>
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  static JTORCH_THREAD_LOCAL Engine* cur_engine_ = NULL;
+  // clBLAS is set up once per process, while any engine exists
+  static std::mutex clblas_lock_;
+  static uint32_t clblas_users_ = 0;
+
+  static cl_device_id QueueDevice(cl_command_queue queue) {
+    cl_device_id device;
+    cl_int err = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE,
+      sizeof(device), &device, NULL);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "ERROR - Engine: clGetCommandQueueInfo returned error: " <<
+        jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    return device;
+  }
+
+  static ::cl_context QueueContext(cl_command_queue queue) {
+    ::cl_context context;
+    cl_int err = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT,
+      sizeof(context), &context, NULL);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "ERROR - Engine: clGetCommandQueueInfo returned error: " <<
+        jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    return context;
+  }
+
+  Engine::Engine(const std::string& path_to_jtorch, const bool use_cpu,
+    const std::string& kernel_cache_dir) {
+    cl_context_ = NULL;
+    buffer_pool_ = NULL;
+    device_ = 0;
+    cur_queue_ = NULL;
+
+    const bool strict_float = false;
+    if (!strict_float) {
+      std::cout << "\tWARNING: not using strict floats." << std::endl;
+    }
+    if (use_cpu) {
+      cl_context_ = new jcl::JCL(jcl::CLDeviceCPU, jcl::CLVendorAny,
+        strict_float);
+    } else {
+      if (jcl::JCL::queryDeviceExists(jcl::CLDeviceGPU, jcl::CLVendorAny)) {
+        cl_context_ = new jcl::JCL(jcl::CLDeviceGPU, jcl::CLVendorAny,
+          strict_float);
+      } else {
+        std::cout << "\tWARNING: jtorch is using the CPU!" << std::endl;
+        // Fall back to using the CPU (if a valid GPU context doesn't exist)
+        cl_context_ = new jcl::JCL(jcl::CLDeviceCPU, jcl::CLVendorAny,
+          strict_float);
+      }
+    }
+    buffer_pool_ = new BufferPool(cl_context_);
+    path_ = path_to_jtorch;
+    if (!path_.empty() && path_.at(path_.size()-1) != '\\' &&
+      path_.at(path_.size()-1) != '/') {
+      path_ = path_ + '/';
+    }
+    kernel_cache_dir_ = kernel_cache_dir;
+    kernel_registries_.resize(cl_context_->getNumDevices(), NULL);
+    extra_queues_.resize(cl_context_->getNumDevices());
+    ooo_queues_.resize(cl_context_->getNumDevices(), NULL);
+    graphs_.resize(cl_context_->getNumDevices(), NULL);
+
+    std::lock_guard<std::mutex> lck(clblas_lock_);
+    try {
+      setDevice(0);
+      if (clblas_users_ == 0) {
+        cl_int err = clblasSetup();
+        if (err != CL_SUCCESS) {
+          std::stringstream ss;
+          ss << "ERROR - Engine: clblasSetup returned error: " <<
+            jcl::JCL::getErrorString(err);
+          throw std::runtime_error(ss.str());
+        }
+      }
+    } catch (...) {
+      cleanup();
+      throw;
+    }
+    clblas_users_++;
+  }
+
+  Engine::~Engine() {
+    {
+      std::lock_guard<std::mutex> lck(clblas_lock_);
+      clblas_users_--;
+      if (clblas_users_ == 0) {
+        clblasTeardown();
+      }
+    }
+    if (cur_engine_ == this) {
+      setCurrent(NULL);
+    }
+    cleanup();
+  }
+
+  void Engine::cleanup() {
+    for (uint32_t d = 0; d < extra_queues_.size(); d++) {
+      for (uint32_t i = 0; i < extra_queues_[d].size(); i++) {
+        clReleaseCommandQueue(extra_queues_[d][i]);
+      }
+    }
+    extra_queues_.clear();
+    for (uint32_t d = 0; d < ooo_queues_.size(); d++) {
+      if (ooo_queues_[d] != NULL) {
+        clFinish(ooo_queues_[d]);
+        clReleaseCommandQueue(ooo_queues_[d]);
+      }
+      SAFE_DELETE(graphs_[d]);
+    }
+    ooo_queues_.clear();
+    graphs_.clear();
+    cur_queue_ = NULL;
+    for (uint32_t d = 0; d < kernel_registries_.size(); d++) {
+      SAFE_DELETE(kernel_registries_[d]);
+    }
+    kernel_registries_.clear();
+    SAFE_DELETE(buffer_pool_);  // Must release buffers before the context
+    SAFE_DELETE(cl_context_);
+  }
+
+  void Engine::makeCurrent() {
+    setCurrent(this);
+  }
+
+  Engine* Engine::current() {
+    return cur_engine_;
+  }
+
+  void Engine::setCurrent(Engine* engine) {
+    cur_engine_ = engine;
+    if (engine != NULL) {
+      cl_context = engine->cl_context_;
+      buffer_pool = engine->buffer_pool_;
+      kernel_registry = engine->kernelRegistry();
+      deviceid = engine->device_;
+    } else {
+      cl_context = NULL;
+      buffer_pool = NULL;
+      kernel_registry = NULL;
+      deviceid = 0;
+    }
+  }
+
+  uint32_t Engine::numDevices() const {
+    return cl_context_->getNumDevices();
+  }
+
+  std::string Engine::deviceName(const uint32_t device) const {
+    return cl_context_->getDeviceName(device);
+  }
+
+  void Engine::setDevice(const uint32_t device) {
+    if (device >= kernel_registries_.size()) {
+      std::stringstream ss;
+      ss << "ERROR - Engine::setDevice: device " << device << " does not "
+        "exist (" << kernel_registries_.size() << " devices)!";
+      throw std::runtime_error(ss.str());
+    }
+    if (kernel_registries_[device] == NULL) {
+      // The registry gets the context and device explicitly: its precompile
+      // thread has no current engine
+      cl_command_queue queue = (cl_command_queue)cl_context_->queue(device);
+      kernel_registries_[device] = new KernelRegistry(path_,
+        kernel_cache_dir_, QueueContext(queue), QueueDevice(queue));
+      if (!kernel_cache_dir_.empty()) {
+        // Mostly cache hits, so this is cheap (and overlaps model loading)
+        kernel_registries_[device]->precompile(false);
+      }
+    }
+    device_ = device;
+    cur_queue_ = NULL;
+    buffer_pool_->setDevice(device);
+    if (cur_engine_ == this) {
+      kernel_registry = kernel_registries_[device];
+      deviceid = device;
+    }
+  }
+
+  void Engine::sync() {
+    if (ooo_queues_[device_] != NULL) {
+      clFinish(ooo_queues_[device_]);
+      graphs_[device_]->clear();  // Everything it tracks has finished
+    }
+    cl_context_->sync(device_);
+  }
+
+  cl_command_queue Engine::queue() const {
+    return cur_queue_ != NULL ? cur_queue_ : defaultQueue();
+  }
+
+  cl_command_queue Engine::defaultQueue() const {
+    return (cl_command_queue)cl_context_->queue(device_);
+  }
+
+  cl_command_queue Engine::extraQueue(const uint32_t index) {
+    std::vector<cl_command_queue>& queues = extra_queues_[device_];
+    while (queues.size() <= index) {
+      cl_command_queue default_queue = defaultQueue();
+      ::cl_context context;
+      cl_command_queue queue = NULL;
+      cl_int err = clGetCommandQueueInfo(default_queue, CL_QUEUE_CONTEXT,
+        sizeof(context), &context, NULL);
+      if (err == CL_SUCCESS) {
+        queue = clCreateCommandQueue(context, QueueDevice(default_queue), 0,
+          &err);
+      }
+      if (err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "ERROR - Engine::extraQueue: clCreateCommandQueue returned "
+          "error: " << jcl::JCL::getErrorString(err);
+        throw std::runtime_error(ss.str());
+      }
+      queues.push_back(queue);
+    }
+    return queues[index];
+  }
+
+  void Engine::setQueue(cl_command_queue queue) {
+    cur_queue_ = queue;
+  }
+
+  cl_command_queue Engine::outOfOrderQueue() {
+    if (ooo_queues_[device_] != NULL) {
+      return ooo_queues_[device_];
+    }
+    cl_command_queue default_queue = defaultQueue();
+    cl_device_id device = QueueDevice(default_queue);
+    ::cl_context context;
+    cl_command_queue_properties supported = 0;
+    cl_int err = clGetCommandQueueInfo(default_queue, CL_QUEUE_CONTEXT,
+      sizeof(context), &context, NULL);
+    if (err == CL_SUCCESS) {
+      err = clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES,
+        sizeof(supported), &supported, NULL);
+    }
+    cl_command_queue queue = NULL;
+    if (err == CL_SUCCESS) {
+      queue = clCreateCommandQueue(context, device, supported &
+        CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+    }
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "ERROR - Engine::outOfOrderQueue: clCreateCommandQueue returned "
+        "error: " << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    ooo_queues_[device_] = queue;
+    graphs_[device_] = new DependencyGraph();
+    return queue;
+  }
+
+  EngineScope::EngineScope(Engine& engine) {
+    prev_ = Engine::current();
+    engine.makeCurrent();
+  }
+
+  EngineScope::~EngineScope() {
+    Engine::setCurrent(prev_);
+  }
+
+}  // namespace jtorch
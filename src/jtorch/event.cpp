@@ -0,0 +1,124 @@
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "jcl/jcl.h"
+#include "jtorch/event.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  static void CL_CALLBACK EventCallbackTrampoline(cl_event event, 
+    cl_int status, void* user_data) {
+    std::function<void()>* callback = (std::function<void()>*)user_data;
+    (*callback)();
+    delete callback;
+  }
+
+  Event::Event() {
+    event_ = NULL;
+  }
+
+  Event::Event(cl_event event) {
+    event_ = event;
+  }
+
+  Event::Event(const Event& other) {
+    event_ = other.event_;
+    if (event_ != NULL) {
+      clRetainEvent(event_);
+    }
+  }
+
+  Event& Event::operator=(const Event& other) {
+    if (other.event_ != NULL) {
+      clRetainEvent(other.event_);
+    }
+    if (event_ != NULL) {
+      clReleaseEvent(event_);
+    }
+    event_ = other.event_;
+    return *this;
+  }
+
+  Event::~Event() {
+    if (event_ != NULL) {
+      clReleaseEvent(event_);
+    }
+  }
+
+  void Event::wait() const {
+    if (event_ == NULL) {
+      return;
+    }
+    cl_int err = clWaitForEvents(1, &event_);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Event::wait() - ERROR: clWaitForEvents failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  bool Event::isComplete() const {
+    if (event_ == NULL) {
+      return true;
+    }
+    cl_int status;
+    cl_int err = clGetEventInfo(event_, CL_EVENT_COMMAND_EXECUTION_STATUS,
+      sizeof(status), &status, NULL);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Event::isComplete() - ERROR: clGetEventInfo failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    if (status < 0) {
+      // Negative values are error codes (the command was aborted)
+      std::stringstream ss;
+      ss << "Event::isComplete() - ERROR: command failed: ";
+      ss << jcl::JCL::getErrorString(status);
+      throw std::runtime_error(ss.str());
+    }
+    return status == CL_COMPLETE;
+  }
+
+  void Event::setCallback(const std::function<void()>& callback) {
+    if (event_ == NULL) {
+      callback();
+      return;
+    }
+    // Ownership of the copy passes to the trampoline
+    std::function<void()>* cb = new std::function<void()>(callback);
+    cl_int err = clSetEventCallback(event_, CL_COMPLETE,
+      EventCallbackTrampoline, cb);
+    if (err != CL_SUCCESS) {
+      delete cb;
+      std::stringstream ss;
+      ss << "Event::setCallback() - ERROR: clSetEventCallback failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  void Event::waitAll(const uint32_t num_events, const Event* events) {
+    std::vector<cl_event> cl_events;
+    for (uint32_t i = 0; i < num_events; i++) {
+      if (events[i].event_ != NULL) {
+        cl_events.push_back(events[i].event_);
+      }
+    }
+    if (cl_events.size() == 0) {
+      return;
+    }
+    cl_int err = clWaitForEvents((cl_uint)cl_events.size(), &cl_events[0]);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Event::waitAll() - ERROR: clWaitForEvents failed: ";
+      ss << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+}  // namespace jtorch
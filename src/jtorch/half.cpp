@@ -0,0 +1,51 @@
+#include <sstream>
+#include <stdexcept>
+#include "jtorch/half.h"
+#include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
+#include "jcl/jcl.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  static KernelHandle float_to_half_kernel("half.cl", "FloatToHalf");
+  static KernelHandle half_to_float_kernel("half.cl", "HalfToFloat");
+
+  template <typename TDst, typename TSrc>
+  static void runConvert(Tensor<TDst>& dst, const Tensor<TSrc>& src,
+    KernelHandle& handle) {
+    if (!dst.isFlat() || !src.isFlat() || dst.nelems() != src.nelems()) {
+      std::stringstream ss;
+      ss << "ConvertTensor() - ERROR: " << handle->name() << " requires flat "
+        "tensors with the same number of elements!";
+      throw std::runtime_error(ss.str());
+    }
+    Kernel* kernel = handle.get();
+    kernel->setArg(0, src.storage());
+    kernel->setArg(1, dst.storage());
+    uint32_t dim = 1;
+    uint32_t nelem = dst.nelems();
+    kernel->run(dim, &nelem, false);
+  }
+
+  void ConvertTensor(Tensor<half>& dst, const Tensor<float>& src) {
+    runConvert(dst, src, float_to_half_kernel);
+  }
+
+  void ConvertTensor(Tensor<float>& dst, const Tensor<half>& src) {
+    runConvert(dst, src, half_to_float_kernel);
+  }
+
+  template <>
+  Kernel* KernelFor<float>(KernelHandle& fp32, KernelHandle& fp16) {
+    return fp32.get();
+  }
+
+  template <>
+  Kernel* KernelFor<half>(KernelHandle& fp32, KernelHandle& fp16) {
+    return fp16.get();
+  }
+
+}  // namespace jtorch
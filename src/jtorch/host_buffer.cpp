@@ -0,0 +1,74 @@
+#include <sstream>
+#include <stdexcept>
+#include "jcl/jcl.h"
+#include "jtorch/host_buffer.h"
+#include "jtorch/jtorch.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  HostBuffer::HostBuffer(const uint64_t nbytes) {
+    data_ = NULL;
+    nbytes_ = nbytes;
+    svm_ = false;
+    mem_ = NULL;
+
+#ifdef CL_VERSION_2_0
+    if (deviceSupportsSVM()) {
+      data_ = clSVMAlloc(CLContext(), CL_MEM_READ_WRITE |
+        CL_MEM_SVM_FINE_GRAIN_BUFFER, (size_t)nbytes_, 0);
+      // On failure, fall through to the pinned path
+      svm_ = data_ != NULL;
+    }
+#endif
+
+    if (data_ == NULL) {
+      cl_int err;
+      mem_ = clCreateBuffer(CLContext(), CL_MEM_READ_WRITE |
+        CL_MEM_ALLOC_HOST_PTR, (size_t)nbytes_, NULL, &err);
+      if (err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "HostBuffer::HostBuffer() - ERROR: clCreateBuffer failed: ";
+        ss << jcl::JCL::getErrorString(err);
+        throw std::runtime_error(ss.str());
+      }
+      // The buffer stays mapped until it is destroyed.
+      data_ = clEnqueueMapBuffer(CLQueue(), mem_, CL_TRUE,
+        CL_MAP_READ | CL_MAP_WRITE, 0, (size_t)nbytes_, 0, NULL, NULL, &err);
+      if (err != CL_SUCCESS) {
+        clReleaseMemObject(mem_);
+        std::stringstream ss;
+        ss << "HostBuffer::HostBuffer() - ERROR: clEnqueueMapBuffer failed: ";
+        ss << jcl::JCL::getErrorString(err);
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  HostBuffer::~HostBuffer() {
+#ifdef CL_VERSION_2_0
+    if (svm_) {
+      clSVMFree(CLContext(), data_);
+      return;
+    }
+#endif
+    clEnqueueUnmapMemObject(CLQueue(), mem_, data_, 0, NULL, NULL);
+    clFinish(CLQueue());
+    clReleaseMemObject(mem_);
+  }
+
+  bool HostBuffer::deviceSupportsSVM() {
+#ifdef CL_VERSION_2_0
+    cl_device_svm_capabilities caps = 0;
+    // Pre 2.0 devices return CL_INVALID_VALUE for this query
+    cl_int err = clGetDeviceInfo(CLDevice(), CL_DEVICE_SVM_CAPABILITIES,
+      sizeof(caps), &caps, NULL);
+    return err == CL_SUCCESS && (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) != 0;
+#else
+    return false;
+#endif
+  }
+
+}  // namespace jtorch
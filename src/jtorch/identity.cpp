@@ -23,6 +23,10 @@ namespace jtorch {
     // Nothing to do for output (we don't own it)
   }
 
+  TorchStage* Identity::clone() const {
+    return new Identity();
+  }
+
   TorchStage* Identity::loadFromFile(std::ifstream& file) {
     // Nothing to load for identity
     return new Identity();
@@ -0,0 +1,200 @@
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include "jtorch/inference_queue.h"
+#include "jtorch/torch_stage.h"
+#include "jtorch/tensor.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  InferenceQueue::InferenceQueue(TorchStage& model, const uint32_t sample_dim,
+    const uint32_t* sample_size, const uint32_t max_batch_size,
+    const double max_delay_ms) : model_(model) {
+    if (sample_dim == 0 || sample_dim > 3) {
+      throw std::runtime_error("InferenceQueue::InferenceQueue() - ERROR: "
+        "Samples must be 1D, 2D or 3D!");
+    }
+    if (max_batch_size == 0) {
+      throw std::runtime_error("InferenceQueue::InferenceQueue() - ERROR: "
+        "max_batch_size must be at least 1!");
+    }
+    sample_dim_ = sample_dim;
+    sample_nelems_ = 1;
+    for (uint32_t i = 0; i < sample_dim_; i++) {
+      sample_size_[i] = sample_size[i];
+      sample_nelems_ *= sample_size[i];
+    }
+    max_batch_size_ = max_batch_size;
+    max_delay_ms_ = max_delay_ms;
+    stopped_ = false;
+    inputs_.resize(max_batch_size_ + 1, NULL);
+    input_cpu_.resize((size_t)sample_nelems_ * max_batch_size_);
+    resetStats();
+  }
+
+  InferenceQueue::~InferenceQueue() {
+    for (uint32_t i = 0; i < inputs_.size(); i++) {
+      SAFE_DELETE(inputs_[i]);
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    for (uint32_t i = 0; i < requests_.size(); i++) {
+      requests_[i].result.set_exception(std::make_exception_ptr(
+        std::runtime_error("InferenceQueue - ERROR: The queue was destroyed "
+        "before the request was run!")));
+    }
+  }
+
+  std::future<std::vector<float>> InferenceQueue::submit(
+    const float* sample) {
+    Request request;
+    request.sample.assign(sample, sample + sample_nelems_);
+    std::future<std::vector<float>> ret = request.result.get_future();
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      if (stopped_) {
+        throw std::runtime_error("InferenceQueue::submit() - ERROR: The "
+          "queue has been stopped!");
+      }
+      request.submitted = Clock::now();
+      requests_.push_back(std::move(request));
+      stats_.queue_depth = (uint32_t)requests_.size();
+      stats_.max_queue_depth = std::max<uint32_t>(stats_.max_queue_depth,
+        stats_.queue_depth);
+    }
+    not_empty_.notify_one();
+    return ret;
+  }
+
+  uint32_t InferenceQueue::processBatch() {
+    std::vector<Request> batch;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      while (requests_.empty() && !stopped_) {
+        not_empty_.wait(lock);
+      }
+      if (requests_.empty()) {
+        return 0;  // Stopped
+      }
+      // Wait for a full batch until the oldest request's deadline (a stopped
+      // queue drains what is left without waiting)
+      const Clock::time_point deadline = requests_.front().submitted +
+        std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(max_delay_ms_));
+      while (requests_.size() < max_batch_size_ && !stopped_) {
+        if (not_empty_.wait_until(lock, deadline) ==
+          std::cv_status::timeout) {
+          break;
+        }
+      }
+
+      const Clock::time_point start = Clock::now();
+      const uint32_t batch_size = std::min<uint32_t>(max_batch_size_,
+        (uint32_t)requests_.size());
+      for (uint32_t i = 0; i < batch_size; i++) {
+        const double added_latency_ms = std::chrono::duration<double,
+          std::milli>(start - requests_.front().submitted).count();
+        total_added_latency_ms_ += added_latency_ms;
+        stats_.max_added_latency_ms = std::max<double>(
+          stats_.max_added_latency_ms, added_latency_ms);
+        batch.push_back(std::move(requests_.front()));
+        requests_.pop_front();
+      }
+      stats_.queue_depth = (uint32_t)requests_.size();
+      stats_.num_requests += batch_size;
+      stats_.num_batches++;
+      stats_.batch_size_histogram[batch_size]++;
+      stats_.mean_added_latency_ms = total_added_latency_ms_ /
+        (double)stats_.num_requests;
+    }
+
+    try {
+      runBatch(batch);
+    } catch (...) {
+      for (uint32_t i = 0; i < batch.size(); i++) {
+        batch[i].result.set_exception(std::current_exception());
+      }
+    }
+    return (uint32_t)batch.size();
+  }
+
+  uint32_t InferenceQueue::paddedBatchSize(const uint32_t batch_size) const {
+    uint32_t padded = 1;
+    while (padded < batch_size) {
+      padded *= 2;
+    }
+    return std::min<uint32_t>(padded, max_batch_size_);
+  }
+
+  void InferenceQueue::runBatch(std::vector<Request>& batch) {
+    const uint32_t batch_size = (uint32_t)batch.size();
+    const uint32_t padded_size = paddedBatchSize(batch_size);
+    if (inputs_[padded_size] == NULL) {
+      // A batch of one is passed as a single sample
+      sample_size_[sample_dim_] = padded_size;
+      inputs_[padded_size] = Tensor<float>::uninitialized(
+        padded_size > 1 ? sample_dim_ + 1 : sample_dim_, sample_size_);
+    }
+    Tensor<float>* input = inputs_[padded_size];
+    // The padding keeps whatever samples input_cpu_ held before
+    for (uint32_t i = 0; i < batch_size; i++) {
+      memcpy(&input_cpu_[(size_t)i * sample_nelems_], &batch[i].sample[0],
+        sizeof(float) * sample_nelems_);
+    }
+    input->setData(&input_cpu_[0]);
+
+    model_.forwardProp(*input);
+    if (model_.output == NULL ||
+      model_.output->type() != TorchDataType::TENSOR_DATA) {
+      throw std::runtime_error("InferenceQueue::runBatch() - ERROR: "
+        "The model output must be a tensor!");
+    }
+    Tensor<float>* output = TO_TENSOR_PTR(model_.output);
+    if (output->nelems() % padded_size != 0) {
+      throw std::runtime_error("InferenceQueue::runBatch() - ERROR: "
+        "The model output is not one output per sample!");
+    }
+    output_cpu_.resize(output->nelems());
+    output->getData(&output_cpu_[0]);  // Blocking
+
+    const uint32_t out_nelems = output->nelems() / padded_size;
+    for (uint32_t i = 0; i < batch_size; i++) {
+      const float* out = &output_cpu_[(size_t)i * out_nelems];
+      batch[i].result.set_value(std::vector<float>(out, out + out_nelems));
+    }
+  }
+
+  void InferenceQueue::run() {
+    while (processBatch() > 0) {
+    }
+  }
+
+  void InferenceQueue::stop() {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      stopped_ = true;
+    }
+    not_empty_.notify_all();
+  }
+
+  InferenceQueueStats InferenceQueue::stats() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return stats_;
+  }
+
+  void InferenceQueue::resetStats() {
+    std::lock_guard<std::mutex> lock(lock_);
+    stats_.queue_depth = (uint32_t)requests_.size();
+    stats_.max_queue_depth = stats_.queue_depth;
+    stats_.num_requests = 0;
+    stats_.num_batches = 0;
+    stats_.batch_size_histogram.assign(max_batch_size_ + 1, 0);
+    stats_.mean_added_latency_ms = 0;
+    stats_.max_added_latency_ms = 0;
+    total_added_latency_ms_ = 0;
+  }
+
+}  // namespace jtorch
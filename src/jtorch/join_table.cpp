@@ -16,8 +16,10 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
-  JoinTable::JoinTable(const uint32_t dimension) {
+  JoinTable::JoinTable(const uint32_t dimension,
+    const uint32_t n_input_dims) {
     dimension_ = dimension;
+    n_input_dims_ = n_input_dims;
     output = NULL;
   }
 
@@ -25,13 +27,30 @@ namespace jtorch {
     SAFE_DELETE(output);
   }
 
+  TorchStage* JoinTable::clone() const {
+    return new JoinTable(dimension_, n_input_dims_);
+  }
+
 
   TorchStage* JoinTable::loadFromFile(std::ifstream& file) {
     int32_t dimension;
     file.read((char*)(&dimension), sizeof(dimension));
     dimension = dimension - 1;  // We index from 0 in C++
-    // But we don't really use it...
-    return new JoinTable(dimension);
+    int32_t n_input_dims;
+    file.read((char*)(&n_input_dims), sizeof(n_input_dims));
+    return new JoinTable(dimension, n_input_dims);
+  }
+
+  uint32_t JoinTable::joinDim(const uint32_t dim) const {
+    // An input with one more dimension than n_input_dims_ is a batch, whose
+    // (top most) batch dimension is not counted by dimension_
+    const uint32_t dimension = (n_input_dims_ > 0 &&
+      dim == n_input_dims_ + 1) ? dimension_ + 1 : dimension_;
+    if (dim <= dimension) {
+      throw std::runtime_error("JoinTable::forwardProp() - "
+        "Input is smaller than join dimension!");
+    }
+    return dim - dimension - 1;  // dimension=0 is the top dim
   }
 
   void JoinTable::init(TorchData& input) {
@@ -55,11 +74,7 @@ namespace jtorch {
     }
 
     uint32_t dim = TO_TENSOR_PTR(in(0))->dim();
-    if (dim <= dimension_) {
-      throw std::runtime_error("JoinTable::forwardProp() - "
-        "Input is smaller than join dimension!");
-    }
-    uint32_t jdim = dim - dimension_ - 1;  // dimension_=0 is the top dim
+    uint32_t jdim = joinDim(dim);
 
     // Make sure the dimensions OTHER than the join dimension are all the same
     for (uint32_t d = 0; d < dim; d++) {
@@ -78,7 +93,7 @@ namespace jtorch {
     }
 
     uint32_t nelems_jdim = 0;
-    for (uint32_t j = 1; j < in.tableSize(); j++) {
+    for (uint32_t j = 0; j < in.tableSize(); j++) {
       nelems_jdim += TO_TENSOR_PTR(in(j))->size()[jdim];
     }
 
@@ -90,8 +105,8 @@ namespace jtorch {
     if (output == NULL) {
       uint32_t* size = new uint32_t[dim];
       memcpy(size, TO_TENSOR_PTR(in(0))->size(), sizeof(size[0]) * dim);
-      size[dimension_] = nelems_jdim;
-      output = new Tensor<float>(dim, size);
+      size[jdim] = nelems_jdim;
+      output = Tensor<float>::uninitialized(dim, size);
       SAFE_DELETE_ARR(size);
     }
   }
@@ -101,26 +116,17 @@ namespace jtorch {
 
     Table& in = (Table&)input;
 
-    // AT THE MOMENT ONLY JOINS ALONG THE TOP DIMENSION ARE SUPPORTED
-    if (dimension_ != 0) {
-      throw std::runtime_error("JoinTable::forwardProp() - "
-        "Only dimension=0 is supported for now");
-    }
-
-    // Copy each table element's raw data into the output
-    std::string kernel = jtorch::jtorch_path + "kernels/join_table.cl";
-    cl_context->useKernel(kernel.c_str(), "JoinTable1D");
-    int out_offset = 0;
+    // Copy each table element into its slice of the output
+    Tensor<float>* out = TO_TENSOR_PTR(output);
+    const uint32_t jdim = joinDim(out->dim());
+    uint32_t out_offset = 0;
     for (uint32_t i = 0; i < in.tableSize(); i++) {
       Tensor<float>* cur_input = (Tensor<float>*)in(i);
-      cl_context->setArg(0, cur_input->storage());
-      cl_context->setArg(1, TO_TENSOR_PTR(output)->storage());
-      cl_context->setArg(2, out_offset);
-      uint32_t dim = 1;
-      uint32_t nelem = cur_input->nelems();
-      cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
-
-      out_offset += nelem;
+      const uint32_t cur_size = cur_input->size()[jdim];
+      Tensor<float>* out_slice = out->narrow(jdim, out_offset, cur_size);
+      Tensor<float>::copy(*out_slice, *cur_input);
+      delete out_slice;
+      out_offset += cur_size;
     }
   }
 
@@ -1,79 +1,121 @@
 #include <mutex>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include "jcl/jcl.h"
 #include "jtorch/jtorch.h"
-#include <clBLAS.h>
+#include "jtorch/engine.h"
 
 #define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
 #define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
 
 namespace jtorch {
 
-  jcl::JCL* cl_context = NULL;
+  JTORCH_THREAD_LOCAL jcl::JCL* cl_context = NULL;
+  JTORCH_THREAD_LOCAL BufferPool* buffer_pool = NULL;
+  JTORCH_THREAD_LOCAL KernelRegistry* kernel_registry = NULL;
+  JTORCH_THREAD_LOCAL uint32_t deviceid = 0;
   std::mutex cl_context_lock_;
   std::string jtorch_path;
+  Engine* default_engine_ = NULL;
 
   void InitJTorchInternal(const std::string& path_to_jtorch, 
-    const bool use_cpu) {
-    const bool strict_float = false;
-    if (!strict_float) {
-      std::cout << "\tWARNING: not using strict floats." << std::endl;
-    }
-    if (use_cpu) {
-      cl_context = new jcl::JCL(jcl::CLDeviceCPU, jcl::CLVendorAny),
-        strict_float;
-    } else {
-      if (jcl::JCL::queryDeviceExists(jcl::CLDeviceGPU, jcl::CLVendorAny)) {
-        cl_context = new jcl::JCL(jcl::CLDeviceGPU, jcl::CLVendorAny,
-          strict_float);
-      } else {
-        std::cout << "\tWARNING: jtorch is using the CPU!" << std::endl;
-        // Fall back to using the CPU (if a valid GPU context doesn't exist)
-        cl_context = new jcl::JCL(jcl::CLDeviceCPU, jcl::CLVendorAny,
-          strict_float);
-      }
-    }
-    jtorch_path = path_to_jtorch;
-    if (jtorch_path.at(jtorch_path.size()-1) != '\\' && 
-      jtorch_path.at(jtorch_path.size()-1) != '/') {
-      jtorch_path = jtorch_path + '/';
-    }
-
-    cl_int err = clblasSetup();
-    if (err != CL_SUCCESS) {
-      std::stringstream ss;
-      ss << "ERROR - InitJTorchInternal: clblasSetup returned error: " <<
-        jcl::JCL::getErrorString(err);
-      throw std::runtime_error(ss.str());
-    }
+    const bool use_cpu, const std::string& kernel_cache_dir) {
+    default_engine_ = new Engine(path_to_jtorch, use_cpu, kernel_cache_dir);
+    default_engine_->makeCurrent();
+    jtorch_path = default_engine_->path();
   }
 
-  void InitJTorch(const std::string& path_to_jtorch, const bool use_cpu) {
+  void InitJTorch(const std::string& path_to_jtorch, const bool use_cpu,
+    const std::string& kernel_cache_dir) {
     std::lock_guard<std::mutex> lck(cl_context_lock_);
-    if (cl_context != NULL) {
+    if (default_engine_ != NULL) {
       throw std::runtime_error("jtorch::InitJTorch() - ERROR: Init called "
         "twice!");
     }
-    InitJTorchInternal(path_to_jtorch, use_cpu);
+    InitJTorchInternal(path_to_jtorch, use_cpu, kernel_cache_dir);
   }
 
-  void InitJTorchSafe(const std::string& path_to_jtorch, const bool use_cpu) {
+  void InitJTorchSafe(const std::string& path_to_jtorch, const bool use_cpu,
+    const std::string& kernel_cache_dir) {
     std::lock_guard<std::mutex> lck(cl_context_lock_);
-    if (cl_context != NULL) {
+    if (default_engine_ != NULL) {
       return;
     }
-    InitJTorchInternal(path_to_jtorch, use_cpu);
+    InitJTorchInternal(path_to_jtorch, use_cpu, kernel_cache_dir);
   }
 
   void ShutdownJTorch() {
     std::lock_guard<std::mutex> lck(cl_context_lock_);
-    clblasTeardown();
-    SAFE_DELETE(cl_context);
+    SAFE_DELETE(default_engine_);
+    jtorch_path.clear();
   }
 
   void Sync() {
-    cl_context->sync(deviceid);
+    Engine::current()->sync();
+  }
+
+  uint32_t NumDevices() {
+    return Engine::current()->numDevices();
+  }
+
+  std::string DeviceName(const uint32_t device) {
+    return Engine::current()->deviceName(device);
+  }
+
+  void SetDevice(const uint32_t device) {
+    Engine::current()->setDevice(device);
+  }
+
+  cl_command_queue CLQueue() {
+    return Engine::current()->queue();
+  }
+
+  cl_command_queue CLDefaultQueue() {
+    return Engine::current()->defaultQueue();
+  }
+
+  cl_command_queue CLExtraQueue(const uint32_t index) {
+    return Engine::current()->extraQueue(index);
+  }
+
+  void SetCLQueue(cl_command_queue queue) {
+    Engine::current()->setQueue(queue);
+  }
+
+  cl_command_queue CLOutOfOrderQueue() {
+    return Engine::current()->outOfOrderQueue();
+  }
+
+  DependencyGraph* CLDependencies() {
+    Engine* engine = Engine::current();
+    return engine != NULL ? engine->dependencies() : NULL;
+  }
+
+  ::cl_context CLContext() {
+    ::cl_context context;
+    cl_int err = clGetCommandQueueInfo(CLQueue(), CL_QUEUE_CONTEXT,
+      sizeof(context), &context, NULL);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "ERROR - CLContext: clGetCommandQueueInfo returned error: " <<
+        jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    return context;
+  }
+
+  cl_device_id CLDevice() {
+    cl_device_id device;
+    cl_int err = clGetCommandQueueInfo(CLQueue(), CL_QUEUE_DEVICE,
+      sizeof(device), &device, NULL);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "ERROR - CLDevice: clGetCommandQueueInfo returned error: " <<
+        jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    return device;
   }
 
 }  // namespace jtorch
@@ -0,0 +1,559 @@
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <cstdio>
+#include <iostream>
+#include <string.h>
+#include "jtorch/kernel.h"
+#include "jtorch/jtorch.h"
+#include "jtorch/launch_plan.h"
+#include "jtorch/dependency_graph.h"
+#include "jcl/jcl.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+// Matches the (non strict float) options jtorch used to get from jcl, plus
+// the argument info that DependencyGraph needs
+#define JTORCH_KERNEL_BUILD_OPTIONS \
+  "-cl-mad-enable -cl-no-signed-zeros -cl-kernel-arg-info"
+// Bump when the cache file layout changes
+#define JTORCH_KERNEL_CACHE_VERSION "1"
+// Deeper #include nesting in kernel sources is taken to be a cycle
+#define JTORCH_MAX_KERNEL_INCLUDE_DEPTH 8
+
+namespace jtorch {
+
+#ifdef JTORCH_EMBED_KERNELS
+  // Generated by cmake/embed_kernels.cmake
+  extern const EmbeddedKernelSource embedded_kernel_sources[];
+  extern const uint32_t num_embedded_kernel_sources;
+#endif
+
+  static void checkError(const cl_int err, const char* func) {
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "ERROR - " << func << ": " << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  // 64 bit FNV-1a
+  static uint64_t hashString(const std::string& str) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < str.size(); i++) {
+      hash ^= (uint8_t)str[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  static std::string hashToHex(const uint64_t hash) {
+    std::stringstream ss;
+    ss << std::hex;
+    ss.width(16);
+    ss.fill('0');
+    ss << hash;
+    return ss.str();
+  }
+
+  static std::string deviceInfoString(cl_device_id device,
+    cl_device_info param) {
+    size_t size = 0;
+    checkError(clGetDeviceInfo(device, param, 0, NULL, &size),
+      "deviceInfoString");
+    std::string str(size, '\0');
+    checkError(clGetDeviceInfo(device, param, size, &str[0], NULL),
+      "deviceInfoString");
+    return str.c_str();  // Drop the null terminator
+  }
+
+  Kernel::Kernel(cl_program program, const std::string& name) {
+    program_ = program;
+    name_ = name;
+    cl_int err;
+    kernel_ = clCreateKernel(program, name.c_str(), &err);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Kernel::Kernel() - ERROR: clCreateKernel failed for " << name <<
+        ": " << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    queryConstArgs();
+  }
+
+  void Kernel::queryConstArgs() {
+    cl_uint num_args = 0;
+    clGetKernelInfo(kernel_, CL_KERNEL_NUM_ARGS, sizeof(num_args), &num_args,
+      NULL);
+    const_args_.resize(num_args, false);
+#ifdef CL_VERSION_1_2
+    for (cl_uint i = 0; i < num_args; i++) {
+      // Binaries loaded from the cache may not have the argument info, in
+      // which case the arguments are treated as written
+      cl_kernel_arg_address_qualifier address;
+      cl_kernel_arg_type_qualifier type;
+      if (clGetKernelArgInfo(kernel_, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER,
+        sizeof(address), &address, NULL) != CL_SUCCESS ||
+        clGetKernelArgInfo(kernel_, i, CL_KERNEL_ARG_TYPE_QUALIFIER,
+        sizeof(type), &type, NULL) != CL_SUCCESS) {
+        continue;
+      }
+      const_args_[i] = address == CL_KERNEL_ARG_ADDRESS_CONSTANT ||
+        (type & CL_KERNEL_ARG_TYPE_CONST) != 0;
+    }
+#endif
+  }
+
+  Kernel::~Kernel() {
+    clReleaseKernel(kernel_);
+  }
+
+  void Kernel::storeArg(const uint32_t index, const size_t size,
+    const void* data, const jcl::JCLBuffer buffer) {
+    checkError(clSetKernelArg(kernel_, index, size, data), "Kernel::setArg");
+    if (index >= args_.size()) {
+      args_.resize(index + 1);
+    }
+    args_[index].size = size;
+    args_[index].buffer = buffer;
+    if (data != NULL) {
+      args_[index].value.assign((const char*)data, (const char*)data + size);
+    } else {
+      args_[index].value.clear();
+    }
+  }
+
+  void Kernel::setArg(const uint32_t index, const jcl::JCLBuffer& buffer) {
+    cl_mem mem = (cl_mem)cl_context->getCLMem(buffer);
+    storeArg(index, sizeof(mem), &mem, buffer);
+  }
+
+  void Kernel::setArg(const uint32_t index, const int val) {
+    storeArg(index, sizeof(val), &val);
+  }
+
+  void Kernel::setArg(const uint32_t index, const float val) {
+    storeArg(index, sizeof(val), &val);
+  }
+
+  void Kernel::setArg(const uint32_t index, const uint32_t size, void* data) {
+    storeArg(index, size, data);
+  }
+
+  void Kernel::run(const uint32_t dim, const uint32_t* global_size,
+    const bool blocking) {
+    run(dim, global_size, NULL, blocking);
+  }
+
+  void Kernel::run(const uint32_t dim, const uint32_t* global_size,
+    const uint32_t* local_size, const bool blocking) {
+    if (dim < 1 || dim > 3) {
+      throw std::runtime_error("Kernel::run() - ERROR: dim must be 1, 2 or "
+        "3!");
+    }
+    size_t global[3];
+    size_t local[3];
+    for (uint32_t i = 0; i < dim; i++) {
+      global[i] = global_size[i];
+      local[i] = local_size != NULL ? local_size[i] : 0;
+    }
+    CommandDeps deps;
+    if (deps.tracking()) {
+      for (uint32_t i = 0; i < args_.size(); i++) {
+        if (args_[i].buffer == (jcl::JCLBuffer)-1) {
+          continue;
+        }
+        const cl_mem mem = *(const cl_mem*)&args_[i].value[0];
+        if (constArg(i)) {
+          deps.reads(mem);
+        } else {
+          deps.writes(mem);
+        }
+      }
+    }
+    cl_int err = clEnqueueNDRangeKernel(CLQueue(), kernel_, dim, NULL, global,
+      local_size != NULL ? local : NULL, deps.numWaits(), deps.waitList(),
+      deps.event());
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "Kernel::run() - ERROR: clEnqueueNDRangeKernel failed for " <<
+        name_ << ": " << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    if (LaunchPlan::recording() != NULL) {
+      LaunchPlan::recording()->recordKernel(*this, dim, global_size,
+        local_size);
+    }
+    if (blocking) {
+      checkError(clFinish(CLQueue()), "Kernel::run");
+    }
+  }
+
+  uint32_t Kernel::maxWorkgroupSize() const {
+    size_t size;
+    checkError(clGetKernelWorkGroupInfo(kernel_, CLDevice(),
+      CL_KERNEL_WORK_GROUP_SIZE, sizeof(size), &size, NULL),
+      "Kernel::maxWorkgroupSize");
+    return (uint32_t)size;
+  }
+
+  KernelRegistry::KernelRegistry(const std::string& path_to_jtorch,
+    const std::string& cache_dir, ::cl_context context,
+    cl_device_id device) {
+    context_ = context != NULL ? context : CLContext();
+    device_ = device != NULL ? device : CLDevice();
+    path_ = path_to_jtorch;
+    cache_dir_ = cache_dir;
+    if (!cache_dir_.empty() && cache_dir_.at(cache_dir_.size()-1) != '\\' &&
+      cache_dir_.at(cache_dir_.size()-1) != '/') {
+      cache_dir_ = cache_dir_ + '/';
+    }
+    // Devices with cl_khr_fp16 do the elementwise math of the fp16 kernel
+    // variants in half (see kernels/half.clh), the rest only store fp16
+    half_arithmetic_ = (" " + deviceInfoString(device_, CL_DEVICE_EXTENSIONS) +
+      " ").find(" cl_khr_fp16 ") != std::string::npos;
+    build_options_ = JTORCH_KERNEL_BUILD_OPTIONS;
+    if (half_arithmetic_) {
+      build_options_ += " -D JTORCH_HALF_ARITHMETIC";
+    }
+    if (!cache_dir_.empty()) {
+      build_key_ = std::string("jtorch kernel cache v") +
+        JTORCH_KERNEL_CACHE_VERSION + "\n" +
+        deviceInfoString(device_, CL_DEVICE_NAME) + "\n" +
+        deviceInfoString(device_, CL_DEVICE_VERSION) + "\n" +
+        deviceInfoString(device_, CL_DRIVER_VERSION) + "\n" +
+        build_options_ + "\n";
+    }
+    memset(&stats_, 0, sizeof(stats_));
+    stop_precompile_ = false;
+  }
+
+  KernelRegistry::~KernelRegistry() {
+    stop_precompile_ = true;
+    if (precompile_thread_.joinable()) {
+      precompile_thread_.join();
+    }
+    for (std::map<std::string, Kernel*>::iterator it = kernels_.begin();
+      it != kernels_.end(); it++) {
+      delete it->second;
+    }
+    kernels_.clear();
+    for (std::map<std::string, cl_program>::iterator it = programs_.begin();
+      it != programs_.end(); it++) {
+      clReleaseProgram(it->second);
+    }
+    programs_.clear();
+  }
+
+  Kernel* KernelRegistry::get(const std::string& filename,
+    const std::string& name) {
+    std::lock_guard<std::mutex> lck(lock_);
+    const std::string key = filename + ":" + name;
+    std::map<std::string, Kernel*>::iterator it = kernels_.find(key);
+    if (it != kernels_.end()) {
+      return it->second;
+    }
+    Kernel* kernel = new Kernel(getProgram(filename), name);
+    kernels_[key] = kernel;
+    return kernel;
+  }
+
+  cl_program KernelRegistry::getProgram(const std::string& filename) {
+    std::map<std::string, cl_program>::iterator it = programs_.find(filename);
+    if (it != programs_.end()) {
+      return it->second;
+    }
+    cl_program program = buildProgram(filename);
+    programs_[filename] = program;
+    return program;
+  }
+
+  void KernelRegistry::precompile(const bool blocking) {
+    if (precompile_thread_.joinable()) {
+      precompile_thread_.join();
+    }
+    if (blocking) {
+      precompileAll();
+    } else {
+      precompile_thread_ = std::thread(&KernelRegistry::precompileAll, this);
+    }
+  }
+
+  void KernelRegistry::precompileAll() {
+#ifdef JTORCH_EMBED_KERNELS
+    for (uint32_t i = 0; i < num_embedded_kernel_sources &&
+      !stop_precompile_; i++) {
+      const std::string filename = embedded_kernel_sources[i].filename;
+      if (filename.size() < 3 ||
+        filename.compare(filename.size() - 3, 3, ".cl") != 0) {
+        continue;  // A header (only built as part of a program)
+      }
+      std::lock_guard<std::mutex> lck(lock_);
+      try {
+        getProgram(filename);
+      } catch (std::runtime_error& e) {
+        // get() will report it again if the program is ever used
+        std::cout << "\tWARNING: precompile failed: " << e.what() <<
+          std::endl;
+      }
+    }
+#endif
+  }
+
+  KernelCacheStats KernelRegistry::stats() {
+    std::lock_guard<std::mutex> lck(lock_);
+    return stats_;
+  }
+
+  std::string KernelRegistry::readSource(const std::string& filename) const {
+#ifdef JTORCH_EMBED_KERNELS
+    for (uint32_t i = 0; i < num_embedded_kernel_sources; i++) {
+      if (filename == embedded_kernel_sources[i].filename) {
+        return embedded_kernel_sources[i].source;
+      }
+    }
+#endif
+    if (path_.empty()) {
+      std::stringstream ss;
+      ss << "KernelRegistry::readSource() - ERROR: " << filename << " is "
+        "not embedded and InitJTorch() was not given path_to_jtorch!";
+      throw std::runtime_error(ss.str());
+    }
+    const std::string path = path_ + "kernels/" + filename;
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+      std::stringstream ss;
+      ss << "KernelRegistry::readSource() - ERROR: Could not open " << path;
+      throw std::runtime_error(ss.str());
+    }
+    std::stringstream source;
+    source << file.rdbuf();
+    return source.str();
+  }
+
+  std::string KernelRegistry::expandIncludes(const std::string& source,
+    const uint32_t depth) const {
+    if (depth > JTORCH_MAX_KERNEL_INCLUDE_DEPTH) {
+      throw std::runtime_error("KernelRegistry::expandIncludes() - ERROR: "
+        "#include nested too deeply (is there a cycle?)");
+    }
+    const std::string directive = "#include \"";
+    std::stringstream ret;
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+      const size_t start = line.find_first_not_of(" \t");
+      if (start == std::string::npos ||
+        line.compare(start, directive.size(), directive) != 0) {
+        ret << line << "\n";
+        continue;
+      }
+      const size_t name_start = start + directive.size();
+      const size_t name_end = line.find('"', name_start);
+      if (name_end == std::string::npos) {
+        std::stringstream ss;
+        ss << "KernelRegistry::expandIncludes() - ERROR: Bad #include: " <<
+          line;
+        throw std::runtime_error(ss.str());
+      }
+      ret << expandIncludes(readSource(line.substr(name_start,
+        name_end - name_start)), depth + 1) << "\n";
+    }
+    return ret.str();
+  }
+
+  cl_program KernelRegistry::buildProgram(const std::string& filename) {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    const std::string source = expandIncludes(readSource(filename));
+
+    std::string key;
+    std::string cache_file;
+    if (!cache_dir_.empty()) {
+      key = build_key_ + hashToHex(hashString(source));
+      cache_file = cache_dir_ + "jtorch_" + hashToHex(hashString(key)) +
+        ".bin";
+      cl_program program = loadBinary(cache_file, key);
+      if (program != NULL) {
+        stats_.cache_hits++;
+        stats_.build_ms += std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+        return program;
+      }
+    }
+
+    const char* source_str = source.c_str();
+    cl_int err;
+    cl_program program = clCreateProgramWithSource(context_, 1,
+      &source_str, NULL, &err);
+    checkError(err, "KernelRegistry::buildProgram");
+
+    cl_device_id device = device_;
+    err = clBuildProgram(program, 1, &device, build_options_.c_str(),
+      NULL, NULL);
+    if (err != CL_SUCCESS) {
+      size_t log_size = 0;
+      clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL,
+        &log_size);
+      char* log = new char[log_size + 1];
+      clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size,
+        log, NULL);
+      log[log_size] = '\0';
+      std::stringstream ss;
+      ss << "KernelRegistry::buildProgram() - ERROR: Failed to build " <<
+        filename << " (" << jcl::JCL::getErrorString(err) << "):" <<
+        std::endl << log;
+      delete[] log;
+      clReleaseProgram(program);
+      throw std::runtime_error(ss.str());
+    }
+    stats_.cache_misses++;
+    if (!cache_file.empty()) {
+      storeBinary(program, cache_file, key);
+    }
+    stats_.build_ms += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+    return program;
+  }
+
+  // Cache file layout: "JTKB", uint32 key size, key, uint64 binary size,
+  // binary.  The full key is stored so that hash collisions are misses.
+  cl_program KernelRegistry::loadBinary(const std::string& cache_file,
+    const std::string& key) {
+    std::ifstream file(cache_file.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+      return NULL;
+    }
+    char magic[4];
+    uint32_t key_size = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char*)&key_size, sizeof(key_size));
+    if (!file || memcmp(magic, "JTKB", 4) != 0 || key_size != key.size()) {
+      return NULL;
+    }
+    std::string file_key(key_size, '\0');
+    file.read(&file_key[0], key_size);
+    uint64_t binary_size = 0;
+    file.read((char*)&binary_size, sizeof(binary_size));
+    if (!file || file_key != key || binary_size == 0) {
+      return NULL;
+    }
+    unsigned char* binary = new unsigned char[(size_t)binary_size];
+    file.read((char*)binary, binary_size);
+    if (!file) {
+      delete[] binary;
+      return NULL;
+    }
+
+    cl_device_id device = device_;
+    size_t size = (size_t)binary_size;
+    const unsigned char* binary_ptr = binary;
+    cl_int binary_status;
+    cl_int err;
+    cl_program program = clCreateProgramWithBinary(context_, 1, &device,
+      &size, &binary_ptr, &binary_status, &err);
+    delete[] binary;
+    if (err != CL_SUCCESS || binary_status != CL_SUCCESS) {
+      if (err == CL_SUCCESS) {
+        clReleaseProgram(program);
+      }
+      return NULL;
+    }
+    // Binaries still need to be "built" (but this skips the compiler)
+    err = clBuildProgram(program, 1, &device, build_options_.c_str(),
+      NULL, NULL);
+    if (err != CL_SUCCESS) {
+      clReleaseProgram(program);
+      return NULL;
+    }
+    return program;
+  }
+
+  // uniqueTempName - A temporary file name next to path that no other
+  // process (random per process tag) or thread (counter) writes to
+  static std::string uniqueTempName(const std::string& path) {
+    static const uint64_t process_tag = ((uint64_t)std::random_device()() <<
+      32) ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch(
+      ).count();
+    static std::atomic<uint32_t> counter(0);
+    std::stringstream ss;
+    ss << path << "." << std::hex << process_tag << "." << counter++ <<
+      ".tmp";
+    return ss.str();
+  }
+
+  void KernelRegistry::storeBinary(cl_program program,
+    const std::string& cache_file, const std::string& key) {
+    size_t size = 0;
+    cl_int err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+      sizeof(size), &size, NULL);
+    if (err != CL_SUCCESS || size == 0) {
+      return;  // Nothing to cache (the cache is best effort)
+    }
+    unsigned char* binary = new unsigned char[size];
+    err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary),
+      &binary, NULL);
+    if (err != CL_SUCCESS) {
+      delete[] binary;
+      return;
+    }
+
+    // Write a temporary and rename it so other processes never read a
+    // partial file
+    const std::string tmp_file = uniqueTempName(cache_file);
+    bool written;
+    {
+      std::ofstream file(tmp_file.c_str(), std::ios::out | std::ios::binary |
+        std::ios::trunc);
+      const uint32_t key_size = (uint32_t)key.size();
+      const uint64_t binary_size = size;
+      file.write("JTKB", 4);
+      file.write((const char*)&key_size, sizeof(key_size));
+      file.write(key.c_str(), key_size);
+      file.write((const char*)&binary_size, sizeof(binary_size));
+      file.write((const char*)binary, size);
+      written = file.good();
+    }
+    delete[] binary;
+    if (!written || rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+      remove(tmp_file.c_str());
+      return;
+    }
+    stats_.cache_writes++;
+  }
+
+  void KernelRegistry::setHandleKernel(const uint32_t handle_index,
+    Kernel* kernel) {
+    if (handle_index >= handle_kernels_.size()) {
+      handle_kernels_.resize(handle_index + 1, NULL);
+    }
+    handle_kernels_[handle_index] = kernel;
+  }
+
+  // Constant initialized, so handles in any translation unit can be
+  // constructed statically
+  static std::atomic<uint32_t> next_handle_index_(0);
+
+  KernelHandle::KernelHandle(const char* filename, const char* name) {
+    filename_ = filename;
+    name_ = name;
+    index_ = next_handle_index_++;
+  }
+
+  Kernel* KernelHandle::resolve() {
+    if (kernel_registry == NULL) {
+      std::stringstream ss;
+      ss << "KernelHandle::resolve() - ERROR: " << name_ << " used before "
+        "InitJTorch()!";
+      throw std::runtime_error(ss.str());
+    }
+    Kernel* kernel = kernel_registry->get(filename_, name_);
+    kernel_registry->setHandleKernel(index_, kernel);
+    return kernel;
+  }
+
+}  // namespace jtorch
@@ -0,0 +1,151 @@
+#include <sstream>
+#include <stdexcept>
+#include "jtorch/launch_plan.h"
+#include "jtorch/jtorch.h"
+#include "jtorch/kernel.h"
+#include "jtorch/torch_stage.h"
+#include "jtorch/buffer_pool.h"
+#include "jcl/jcl.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  JTORCH_THREAD_LOCAL LaunchPlan* LaunchPlan::recording_ = NULL;
+
+  LaunchPlan::LaunchPlan() {
+    host_access_ = NULL;
+  }
+
+  LaunchPlan::~LaunchPlan() {
+    clear();
+  }
+
+  void LaunchPlan::clear() {
+    for (uint32_t i = 0; i < launches_.size(); i++) {
+      if (launches_[i].kernel != NULL) {
+        clReleaseKernel(launches_[i].kernel);
+      }
+    }
+    launches_.clear();
+    for (uint32_t i = 0; i < buffers_.size(); i++) {
+      buffer_pool->releaseReference(buffers_[i]);
+    }
+    buffers_.clear();
+  }
+
+  void LaunchPlan::compile(TorchStage& model, TorchData& input) {
+    if (recording_ != NULL) {
+      throw std::runtime_error("LaunchPlan::compile() - ERROR: Another plan "
+        "is already being compiled!");
+    }
+    clear();
+    model.forwardProp(input);
+
+    host_access_ = NULL;
+    recording_ = this;
+    try {
+      model.forwardProp(input);
+    } catch (...) {
+      recording_ = NULL;
+      clear();
+      throw;
+    }
+    recording_ = NULL;
+
+    if (host_access_ != NULL) {
+      clear();
+      std::stringstream ss;
+      ss << "LaunchPlan::compile() - ERROR: The model calls " <<
+        host_access_ << " on every forwardProp, which cannot be replayed!";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  void LaunchPlan::run() {
+    if (CLDependencies() != NULL) {
+      throw std::runtime_error("LaunchPlan::run() - ERROR: Plans must be run "
+        "on an in-order queue (they do not record their dependencies)!");
+    }
+    cl_command_queue queue = CLQueue();
+    for (uint32_t i = 0; i < launches_.size(); i++) {
+      const Launch& launch = launches_[i];
+      if (launch.kernel == NULL) {
+        launch.launch();
+        continue;
+      }
+      cl_int err = clEnqueueNDRangeKernel(queue, launch.kernel, launch.dim,
+        NULL, launch.global_size,
+        launch.has_local_size ? launch.local_size : NULL, 0, NULL, NULL);
+      if (err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "LaunchPlan::run() - ERROR: clEnqueueNDRangeKernel failed: " <<
+          jcl::JCL::getErrorString(err);
+        throw std::runtime_error(ss.str());
+      }
+    }
+    clFlush(queue);
+  }
+
+  void LaunchPlan::recordKernel(const Kernel& kernel, const uint32_t dim,
+    const uint32_t* global_size, const uint32_t* local_size) {
+    Launch launch;
+    cl_int err;
+    // A private copy of the kernel so that its arguments stay bound
+    launch.kernel = clCreateKernel(kernel.program(), kernel.name().c_str(),
+      &err);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "LaunchPlan::recordKernel() - ERROR: clCreateKernel failed for " <<
+        kernel.name() << ": " << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    const std::vector<KernelArg>& args = kernel.args();
+    for (uint32_t i = 0; i < args.size() && err == CL_SUCCESS; i++) {
+      err = clSetKernelArg(launch.kernel, i, args[i].size,
+        args[i].value.empty() ? NULL : &args[i].value[0]);
+    }
+    if (err != CL_SUCCESS) {
+      clReleaseKernel(launch.kernel);
+      std::stringstream ss;
+      ss << "LaunchPlan::recordKernel() - ERROR: clSetKernelArg failed for " <<
+        kernel.name() << ": " << jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    for (uint32_t i = 0; i < args.size(); i++) {
+      if (args[i].buffer != (jcl::JCLBuffer)-1) {
+        buffer_pool->addReference(args[i].buffer);
+        buffers_.push_back(args[i].buffer);
+      }
+    }
+    launch.dim = dim;
+    launch.has_local_size = local_size != NULL;
+    for (uint32_t i = 0; i < dim; i++) {
+      launch.global_size[i] = global_size[i];
+      launch.local_size[i] = local_size != NULL ? local_size[i] : 0;
+    }
+    launches_.push_back(launch);
+  }
+
+  void LaunchPlan::recordLaunch(const std::function<void()>& launch,
+    const std::vector<jcl::JCLBuffer>& buffers) {
+    for (uint32_t i = 0; i < buffers.size(); i++) {
+      buffer_pool->addReference(buffers[i]);
+      buffers_.push_back(buffers[i]);
+    }
+    Launch other;
+    other.kernel = NULL;
+    other.dim = 0;
+    other.has_local_size = false;
+    other.launch = launch;
+    launches_.push_back(other);
+  }
+
+  void LaunchPlan::recordHostAccess(const char* func) {
+    if (host_access_ == NULL) {
+      host_access_ = func;
+    }
+  }
+
+}  // namespace jtorch
@@ -1,5 +1,6 @@
 #include "jtorch/linear.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -15,30 +16,82 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static KernelHandle mat_vec_mult_simple_kernel("linear.cl",
+    "MatVecMultSimple");
+  static KernelHandle mat_vec_mult_simple_half_kernel("linear.cl",
+    "MatVecMultSimpleHalf");
+  static KernelHandle mat_vec_mult_simple_int8_kernel("linear.cl",
+    "MatVecMultSimpleInt8");
+  static KernelHandle mat_vec_mult_threads_kernel("linear.cl",
+    "MatVecMultThreads");
+  static KernelHandle mat_vec_mult_threads_half_kernel("linear.cl",
+    "MatVecMultThreadsHalf");
+  static KernelHandle accum_kernel("linear.cl", "Accum");
+
+  // Defined in spatial_convolution_mm.cpp
+  void THCudaBlas_gemm(void* state, char transa, char transb, size_t m,
+    size_t n, size_t k, float alpha, Tensor<float> *a, size_t lda,
+    Tensor<float> *b, size_t ldb, float beta, Tensor<float> *c, size_t ldc);
+
   Linear::Linear(const uint32_t n_inputs, const uint32_t n_outputs) 
     : TorchStage() {
     n_inputs_ = n_inputs;
     n_outputs_ = n_outputs;
 
-    output = new Tensor<float>(1, &n_outputs_);
+    output = Tensor<float>::uninitialized(1, &n_outputs_);
 
     // NOTE: For efficiency we store the weight matrix transposed!
     // (we want the matrix vector multiply to be strided properly)
     uint32_t size_[2] = {n_outputs_, n_inputs_};
-    weights_ = new Tensor<float>(2, size_);
-    biases_ = new Tensor<float>(1, &n_outputs_);
+    weights_.reset(new WeightTensor(2, size_, 0));  // Output channels: dim 0
+    input_quantizer_ = new ActivationQuantizer();
+    activation_.type = ACTIVATION_NONE;
+    activation_.threshold = 0;
+    activation_.val = 0;
+    biases_.reset(new Tensor<float>(1, &n_outputs_));
+  }
+
+  Linear::Linear(const Linear* src) : TorchStage() {
+    n_inputs_ = src->n_inputs_;
+    n_outputs_ = src->n_outputs_;
+    output = Tensor<float>::uninitialized(1, &n_outputs_);
+    weights_ = src->weights_;
+    biases_ = src->biases_;
+    input_quantizer_ = new ActivationQuantizer();
+    input_quantizer_->copyCalibration(*src->input_quantizer_);
+    activation_ = src->activation_;
   }
 
   Linear::~Linear() {
     SAFE_DELETE(output);
-    SAFE_DELETE(weights_);
-    SAFE_DELETE(biases_);
+    SAFE_DELETE(input_quantizer_);
+  }
+
+  TorchStage* Linear::clone() const {
+    return new Linear(this);
+  }
+
+  uint64_t Linear::parameterBytes() const {
+    return weights_->bytes() + sizeof(float) * (uint64_t)biases_->nelems();
   }
 
   void Linear::setWeights(const float* weights) {
     weights_->setData(weights);
   }
 
+  void Linear::setWeightPrecision(const WeightPrecision precision) {
+    weights_->setPrecision(precision);
+  }
+
+  void Linear::setCalibrating(const bool calibrating) {
+    input_quantizer_->setCalibrating(calibrating);
+  }
+
+  bool Linear::setActivation(const Activation& activation) {
+    activation_ = activation;
+    return true;
+  }
+
   void Linear::setBiases(const float* biases) {
     biases_->setData(biases);
   }
@@ -49,31 +102,93 @@ namespace jtorch {
         "FloatTensor expected!");
     }
     Tensor<float>& in = (Tensor<float>&)input;
-    if (in.dim() != 1 || in.size()[0] != n_inputs_) {
+    const uint32_t batch_size = batchSize(in, 1, "Linear::init()");
+    if (in.size()[0] != n_inputs_) {
       throw std::runtime_error("Linear::init() - ERROR: input size mismatch!");
     }
+    Tensor<float>* out = TO_TENSOR_PTR(output);
+    if (out->dim() != in.dim() || (in.dim() == 2 &&
+      out->size()[1] != batch_size)) {
+      SAFE_DELETE(output);
+      uint32_t out_size[2] = {n_outputs_, batch_size};
+      output = Tensor<float>::uninitialized(in.dim(), out_size);
+    }
   }
 
-  void Linear::forwardProp(TorchData& input) { 
+  void Linear::forwardProp(TorchData& strided_input) { 
+    // Our kernels index the input as a flat array
+    TorchData& input = contiguousInput(strided_input);
     init(input);
     Tensor<float>& in = (Tensor<float>&)input;
+    // For a batch every kernel runs over (output, sample)
+    uint32_t out_size[2] = {n_outputs_, in.dim() == 2 ? in.size()[1] : 1};
+
+    if (weights_->i8() != NULL) {
+      // int8 x int8 with int32 accumulation.  The bias is added in the kernel.
+      float in_scale;
+      Tensor<int8_t>* in_q = input_quantizer_->quantize(in, in_scale);
+      Kernel* kernel = mat_vec_mult_simple_int8_kernel.get();
+      kernel->setArg(0, weights_->i8()->storage());
+      kernel->setArg(1, in_q->storage());
+      kernel->setArg(2, TO_TENSOR_PTR(output)->storage());
+      kernel->setArg(3, weights_->scales()->storage());
+      kernel->setArg(4, biases_->storage());
+      kernel->setArg(5, in_scale);
+      kernel->setArg(6, (int)n_outputs_);
+      kernel->setArg(7, (int)n_inputs_);
+      setActivationArgs(kernel, 8, activation_);
+      kernel->run(2, out_size, false);
+      return;
+    }
+
+    if (out_size[1] > 1) {
+      if (weights_->f32() != NULL) {
+        // One GEMM for the whole batch (column major): Y = A * X with A the
+        // M x N (transposed) weights and X and Y one column per sample.  Y
+        // is zeroed first since clBLAS may read C even with beta = 0 (see
+        // SpatialConvolutionMM::forwardProp).
+        Tensor<float>::fill(*TO_TENSOR_PTR(output), 0);
+        THCudaBlas_gemm(NULL, 'n', 'n', n_outputs_, out_size[1], n_inputs_,
+          1, weights_->f32(), n_outputs_, &in, n_inputs_, 0,
+          TO_TENSOR_PTR(output), n_outputs_);
+      } else {
+        Kernel* kernel = mat_vec_mult_simple_half_kernel.get();
+        kernel->setArg(0, weights_->f16()->storage());
+        kernel->setArg(1, in.storage());
+        kernel->setArg(2, TO_TENSOR_PTR(output)->storage());
+        kernel->setArg(3, (int)n_outputs_);
+        kernel->setArg(4, (int)n_inputs_);
+        kernel->run(2, out_size, false);
+      }
+      Kernel* kernel = accum_kernel.get();
+      kernel->setArg(0, TO_TENSOR_PTR(output)->storage());
+      kernel->setArg(1, biases_->storage());
+      setActivationArgs(kernel, 2, activation_);
+      kernel->run(2, out_size, false);
+      return;
+    }
 
 #ifdef SIMPLE_LINEAR
-    std::string kernel = jtorch::jtorch_path + "kernels/linear.cl";
-    cl_context->useKernel(kernel.c_str(), "MatVecMultSimple");
-    cl_context->setArg(0, weights_->storage());
-    cl_context->setArg(1, ((Tensor<float>&)input).storage());
-    cl_context->setArg(2, TO_TENSOR_PTR(output)->storage());
-    cl_context->setArg(3, (int)n_outputs_);
-    cl_context->setArg(4, (int)n_inputs_);
+    Kernel* kernel;
+    if (weights_->f16() != NULL) {
+      kernel = mat_vec_mult_simple_half_kernel.get();
+      kernel->setArg(0, weights_->f16()->storage());
+    } else {
+      kernel = mat_vec_mult_simple_kernel.get();
+      kernel->setArg(0, weights_->f32()->storage());
+    }
+    kernel->setArg(1, ((Tensor<float>&)input).storage());
+    kernel->setArg(2, TO_TENSOR_PTR(output)->storage());
+    kernel->setArg(3, (int)n_outputs_);
+    kernel->setArg(4, (int)n_inputs_);
     uint32_t dim = 1;
-    cl_context->runKernel(jtorch::deviceid, dim, &n_outputs_, false);
+    kernel->run(dim, &n_outputs_, false);
 #else
-    std::string kernel = jtorch::jtorch_path + "kernels/linear.cl";
-    cl_context->useKernel(kernel.c_str(), "MatVecMultThreads");
+    Kernel* kernel = weights_->f16() != NULL ?
+      mat_vec_mult_threads_half_kernel.get() :
+      mat_vec_mult_threads_kernel.get();
 
-    uint32_t max_worksize =
-      cl_context->queryMaxWorkgroupSizeForCurKernel(jtorch::deviceid);
+    uint32_t max_worksize = kernel->maxWorkgroupSize();
     // http://www.bealto.com/gpu-gemv_v2.html
     // Try and find a good local workgroup size allocation (that is legal)
     // TODO: This is a mess.  Clean it up.
@@ -92,25 +207,29 @@ namespace jtorch {
       local_size[0]--;
     }
 
-    cl_context->setArg(0, weights_->storage());
-    cl_context->setArg(1, in.storage());
-    cl_context->setArg(2, TO_TENSOR_PTR(output)->storage());
+    if (weights_->f16() != NULL) {
+      kernel->setArg(0, weights_->f16()->storage());
+    } else {
+      kernel->setArg(0, weights_->f32()->storage());
+    }
+    kernel->setArg(1, in.storage());
+    kernel->setArg(2, TO_TENSOR_PTR(output)->storage());
     float dummy; static_cast<void>(dummy);
     // setArg with NULL --> Local memory allocation (per local workgroup)
-    cl_context->setArg(3, sizeof(dummy) * local_size[0] * local_size[1], NULL);
-    cl_context->setArg(4, (int)n_outputs_);
-    cl_context->setArg(5, (int)n_inputs_);
+    kernel->setArg(3, sizeof(dummy) * local_size[0] * local_size[1], NULL);
+    kernel->setArg(4, (int)n_outputs_);
+    kernel->setArg(5, (int)n_inputs_);
     uint32_t dim = 2;
-    cl_context->runKernel(jtorch::deviceid, dim, global_size, local_size, 
-      false);
+    kernel->run(dim, global_size, local_size, false);
 #endif
 
-    // Now add in the bias
-    cl_context->useKernel(kernel.c_str(), "Accum");
-    cl_context->setArg(0, TO_TENSOR_PTR(output)->storage());
-    cl_context->setArg(1, biases_->storage());
+    // Now add in the bias (and apply any fused activation)
+    kernel = accum_kernel.get();
+    kernel->setArg(0, TO_TENSOR_PTR(output)->storage());
+    kernel->setArg(1, biases_->storage());
+    setActivationArgs(kernel, 2, activation_);
     dim = 1;
-    cl_context->runKernel(jtorch::deviceid, dim, &n_outputs_, false);
+    kernel->run(dim, &n_outputs_, false);
   }
 
   TorchStage* Linear::loadFromFile(std::ifstream& file) {
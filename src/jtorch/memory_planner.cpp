@@ -0,0 +1,210 @@
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include "jtorch/memory_planner.h"
+#include "jtorch/torch_stage.h"
+#include "jtorch/tensor.h"
+#include "jtorch/table.h"
+#include "jtorch/buffer_pool.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  MemoryPlanner::MemoryPlanner() {
+    num_steps_ = 0;
+  }
+
+  MemoryPlanner::~MemoryPlanner() {
+  }
+
+  void MemoryPlanner::collectTensors(TorchData* data,
+    std::vector<Tensor<float>*>& tensors) {
+    if (data == NULL) {
+      return;
+    }
+    if (data->type() == TENSOR_DATA) {
+      tensors.push_back((Tensor<float>*)data);
+    } else if (data->type() == TABLE_DATA) {
+      Table* table = (Table*)data;
+      for (uint32_t i = 0; i < table->tableSize(); i++) {
+        collectTensors((*table)(i), tensors);
+      }
+    }
+  }
+
+  void MemoryPlanner::read(TorchData* data, const uint32_t step) {
+    std::vector<Tensor<float>*> tensors;
+    collectTensors(data, tensors);
+    for (uint32_t i = 0; i < tensors.size(); i++) {
+      std::map<jcl::JCLBuffer, BufferUse>::iterator it =
+        buffers_.find(tensors[i]->storage());
+      if (it == buffers_.end()) {
+        // Read before it was written, so it comes from outside the tree
+        BufferUse use;
+        use.first_step = step;
+        use.last_step = step;
+        use.external = true;
+        buffers_[tensors[i]->storage()] = use;
+        continue;
+      }
+      it->second.last_step = std::max<uint32_t>(it->second.last_step, step);
+    }
+  }
+
+  void MemoryPlanner::write(Tensor<float>* tensor, const uint32_t step) {
+    std::map<jcl::JCLBuffer, BufferUse>::iterator it =
+      buffers_.find(tensor->storage());
+    if (it == buffers_.end()) {
+      BufferUse use;
+      use.first_step = step;
+      use.last_step = step;
+      use.external = false;
+      it = buffers_.insert(std::make_pair(tensor->storage(), use)).first;
+    }
+    BufferUse& use = it->second;
+    use.first_step = std::min<uint32_t>(use.first_step, step);
+    use.last_step = std::max<uint32_t>(use.last_step, step);
+    use.tensors.insert(tensor);
+    if (external_tensors_.find(tensor) != external_tensors_.end()) {
+      use.external = true;  // ie Identity passing the model input through
+    }
+  }
+
+  void MemoryPlanner::addStep(TorchStage& stage, TorchData& input,
+    TorchData* output, const std::vector<Tensor<float>*>& scratch) {
+    const uint32_t step = num_steps_++;
+    MemoryPlanStep plan_step;
+    plan_step.stage = &stage;
+    plan_step.output = output;
+    plan_step.scratch = scratch;
+    steps_.push_back(plan_step);
+    read(&input, step);
+    std::vector<Tensor<float>*> outputs;
+    collectTensors(output, outputs);
+    for (uint32_t i = 0; i < outputs.size(); i++) {
+      write(outputs[i], step);
+    }
+    for (uint32_t i = 0; i < scratch.size(); i++) {
+      write(scratch[i], step);
+    }
+  }
+
+  void MemoryPlanner::beginConcurrent() {
+    concurrent_starts_.push_back(num_steps_);
+  }
+
+  void MemoryPlanner::endConcurrent() {
+    if (concurrent_starts_.empty()) {
+      throw std::runtime_error("MemoryPlanner::endConcurrent() - ERROR: "
+        "No concurrent region was started!");
+    }
+    const uint32_t first = concurrent_starts_.back();
+    concurrent_starts_.pop_back();
+    if (num_steps_ == first) {
+      return;
+    }
+    const uint32_t last = num_steps_ - 1;
+    // Anything used in the region may be in use at any point of it
+    std::map<jcl::JCLBuffer, BufferUse>::iterator it;
+    for (it = buffers_.begin(); it != buffers_.end(); it++) {
+      BufferUse& use = it->second;
+      if (use.last_step >= first && use.first_step <= last) {
+        use.first_step = std::min<uint32_t>(use.first_step, first);
+        use.last_step = std::max<uint32_t>(use.last_step, last);
+      }
+    }
+  }
+
+  MemoryPlanStats MemoryPlanner::plan(TorchStage& model, TorchData& input) {
+    // Size every tensor
+    model.forwardProp(input);
+
+    num_steps_ = 0;
+    steps_.clear();
+    buffers_.clear();
+    concurrent_starts_.clear();
+    external_tensors_.clear();
+    std::vector<Tensor<float>*> inputs;
+    collectTensors(&input, inputs);
+    external_tensors_.insert(inputs.begin(), inputs.end());
+    read(&input, 0);
+
+    model.planMemory(*this, input);
+    // The output is read by the caller after the last stage
+    read(model.output, num_steps_);
+
+    // Only buffers whose every reference is a tensor that the stage tree
+    // reported can be moved safely
+    std::vector<std::pair<uint32_t, jcl::JCLBuffer>> candidates;
+    std::map<jcl::JCLBuffer, BufferUse>::iterator it;
+    for (it = buffers_.begin(); it != buffers_.end(); it++) {
+      const BufferUse& use = it->second;
+      if (use.external || use.tensors.size() == 0 ||
+        buffer_pool->refCount(it->first) != use.tensors.size()) {
+        continue;
+      }
+      candidates.push_back(std::make_pair(buffer_pool->bufferSize(it->first),
+        it->first));
+    }
+    // Largest first, so a slot's first buffer is always big enough
+    std::sort(candidates.begin(), candidates.end(),
+      std::greater<std::pair<uint32_t, jcl::JCLBuffer>>());
+
+    struct Slot {
+      jcl::JCLBuffer buffer;
+      uint32_t size;
+      std::vector<std::pair<uint32_t, uint32_t>> lifetimes;
+    };
+    std::vector<Slot> slots;
+    const uint64_t cached_bytes = buffer_pool->stats().bytes_cached;
+    MemoryPlanStats stats;
+    stats.peak_bytes_before = 0;
+    stats.peak_bytes_after = 0;
+    stats.num_buffers = (uint32_t)candidates.size();
+    stats.num_steps = num_steps_;
+
+    for (uint32_t i = 0; i < candidates.size(); i++) {
+      const jcl::JCLBuffer buffer = candidates[i].second;
+      const BufferUse& use = buffers_[buffer];
+      stats.peak_bytes_before += (uint64_t)candidates[i].first * sizeof(float);
+
+      // Best fit: the smallest slot that is free for this whole lifetime
+      int32_t best = -1;
+      for (uint32_t s = 0; s < slots.size(); s++) {
+        bool free = true;
+        for (uint32_t j = 0; j < slots[s].lifetimes.size() && free; j++) {
+          free = use.last_step < slots[s].lifetimes[j].first ||
+            use.first_step > slots[s].lifetimes[j].second;
+        }
+        if (free && (best < 0 || slots[s].size < slots[best].size)) {
+          best = (int32_t)s;
+        }
+      }
+      if (best < 0) {
+        Slot slot;
+        slot.buffer = buffer;
+        slot.size = candidates[i].first;
+        slots.push_back(slot);
+        best = (int32_t)slots.size() - 1;
+      } else {
+        std::set<Tensor<float>*>::const_iterator t;
+        for (t = use.tensors.begin(); t != use.tensors.end(); t++) {
+          (*t)->setStorage(slots[best].buffer);
+        }
+      }
+      slots[best].lifetimes.push_back(std::make_pair(use.first_step,
+        use.last_step));
+    }
+
+    for (uint32_t s = 0; s < slots.size(); s++) {
+      stats.peak_bytes_after += (uint64_t)slots[s].size * sizeof(float);
+    }
+    stats.num_slots = (uint32_t)slots.size();
+    // The buffers we just unreferenced are now in the pool's free list
+    buffer_pool->trim(cached_bytes);
+    return stats;
+  }
+
+}  // namespace jtorch
@@ -1,6 +1,12 @@
+#include <sstream>
 #include "jtorch/parallel_table.h"
+#include "jtorch/jtorch.h"
 #include "jtorch/tensor.h"
 #include "jtorch/table.h"
+#include "jtorch/buffer_pool.h"
+#include "jtorch/launch_plan.h"
+#include "jtorch/memory_planner.h"
+#include "jcl/jcl.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -15,9 +21,19 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static void checkCLError(const cl_int err, const char* func) {
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "ParallelTable::forwardProp() - ERROR: " << func << " failed: " <<
+        jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
   ParallelTable::ParallelTable() {
     // Create an empty container
     network_ = new VectorManaged<TorchStage*>(1);
+    concurrent_ = true;
     output = NULL;
   }
 
@@ -31,6 +47,24 @@ namespace jtorch {
     SAFE_DELETE(output);
   }
 
+  TorchStage* ParallelTable::clone() const {
+    ParallelTable* ret = new ParallelTable();
+    ret->network_->capacity(network_->size());
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      ret->network_->pushBack((*network_)[i]->clone());
+    }
+    ret->concurrent_ = concurrent_;
+    return ret;
+  }
+
+  uint64_t ParallelTable::parameterBytes() const {
+    uint64_t ret = 0;
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      ret += (*network_)[i]->parameterBytes();
+    }
+    return ret;
+  }
+
   void ParallelTable::add(TorchStage* stage) {
     network_->pushBack(stage);
     output = NULL;
@@ -69,13 +103,75 @@ namespace jtorch {
       throw std::runtime_error("Parallel::forwardProp() - ERROR: "
         "Table size does not match number of parallel stages!");
     }
-    for (uint32_t i = 0; i < network_->size(); i++) {
-      (*network_)[i]->forwardProp(*in(i));
+    if (runConcurrently()) {
+      forwardPropConcurrent(in);
+    } else {
+      for (uint32_t i = 0; i < network_->size(); i++) {
+        (*network_)[i]->setInputExclusive(input_exclusive_);
+        (*network_)[i]->forwardProp(*in(i));
+      }
     }
     initOutput();  // Init output just copies the pointers from the output
                    // of all the parallel stages and fills up a table with them
   }
 
+  bool ParallelTable::runConcurrently() const {
+    // A LaunchPlan replays everything on one queue, which is fine in order
+    return concurrent_ && network_->size() > 1 &&
+      CLQueue() == CLDefaultQueue() && LaunchPlan::recording() == NULL;
+  }
+
+  void ParallelTable::forwardPropConcurrent(Table& in) {
+    cl_command_queue queue = CLQueue();
+    const uint32_t n_branches = network_->size();
+    // The branches start once the work queued so far is done
+    cl_event fork;
+    checkCLError(clEnqueueMarkerWithWaitList(queue, 0, NULL, &fork),
+      "clEnqueueMarkerWithWaitList");
+    // The branch queues wait on fork, which must be flushed first (branches
+    // may block, ie on a normalization init() transfer)
+    clFlush(queue);
+    std::vector<cl_event> joins;
+    buffer_pool->deferRecycling();
+    try {
+      for (uint32_t i = 0; i < n_branches; i++) {
+        cl_command_queue branch_queue = CLExtraQueue(i);
+        checkCLError(clEnqueueBarrierWithWaitList(branch_queue, 1, &fork,
+          NULL), "clEnqueueBarrierWithWaitList");
+        SetCLQueue(branch_queue);
+        (*network_)[i]->setInputExclusive(input_exclusive_);
+        (*network_)[i]->forwardProp(*in(i));
+        cl_event join;
+        checkCLError(clEnqueueMarkerWithWaitList(branch_queue, 0, NULL,
+          &join), "clEnqueueMarkerWithWaitList");
+        joins.push_back(join);
+        clFlush(branch_queue);
+        SetCLQueue(NULL);
+      }
+      // And the work queued after us waits for every branch
+      checkCLError(clEnqueueBarrierWithWaitList(queue, n_branches,
+        &joins[0], NULL), "clEnqueueBarrierWithWaitList");
+    } catch (...) {
+      SetCLQueue(NULL);
+      for (uint32_t i = 0; i <= joins.size() && i < n_branches; i++) {
+        clFinish(CLExtraQueue(i));
+      }
+      for (uint32_t i = 0; i < joins.size(); i++) {
+        clReleaseEvent(joins[i]);
+      }
+      clReleaseEvent(fork);
+      buffer_pool->resumeRecycling();
+      throw;
+    }
+    for (uint32_t i = 0; i < joins.size(); i++) {
+      clReleaseEvent(joins[i]);
+    }
+    clReleaseEvent(fork);
+    // Buffers released by a branch are safe to hand out again, since
+    // anything that uses them is now queued behind the join
+    buffer_pool->resumeRecycling();
+  }
+
   uint32_t ParallelTable::numBanks() const {
     if (network_ == NULL) {
       throw std::runtime_error("Parallel::output() - ERROR: "
@@ -92,4 +188,43 @@ namespace jtorch {
     return (*network_)[i];
   }
 
+  void ParallelTable::setWeightPrecision(const WeightPrecision precision) {
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->setWeightPrecision(precision);
+    }
+  }
+
+  void ParallelTable::setOutputPrecision(const OutputPrecision precision) {
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->setOutputPrecision(precision);
+    }
+  }
+
+  void ParallelTable::setCalibrating(const bool calibrating) {
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->setCalibrating(calibrating);
+    }
+  }
+
+  void ParallelTable::planMemory(MemoryPlanner& planner, TorchData& input) {
+    Table& in = (Table&)input;
+    if (runConcurrently()) {
+      planner.beginConcurrent();
+    }
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->planMemory(planner, *in(i));
+    }
+    if (runConcurrently()) {
+      planner.endConcurrent();
+    }
+  }
+
+  uint32_t ParallelTable::fuseActivations() {
+    uint32_t num_fused = 0;
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      num_fused += (*network_)[i]->fuseActivations();
+    }
+    return num_fused;
+  }
+
 }  // namespace jtorch
\ No newline at end of file
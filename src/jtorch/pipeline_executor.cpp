@@ -0,0 +1,375 @@
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include "jtorch/pipeline_executor.h"
+#include "jtorch/jtorch.h"
+#include "jtorch/sequential.h"
+#include "jtorch/tensor.h"
+#include "jtorch/buffer_pool.h"
+#include "jtorch/memory_planner.h"
+#include "jtorch/table.h"
+#include "jcl/jcl.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  static void checkCLError(const cl_int err, const char* func) {
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "PipelineExecutor - ERROR: " << func << " failed: " <<
+        jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  // SharesStorage - Conservative: tables are assumed to share storage
+  static bool SharesStorage(TorchData& a, TorchData& b) {
+    Tensor<float>* ta = TO_TENSOR_PTR(&a);
+    Tensor<float>* tb = TO_TENSOR_PTR(&b);
+    return ta == NULL || tb == NULL || ta->storage() == tb->storage();
+  }
+
+  // collectTensors - Every fp32 tensor in data (recursing into tables).  fp16
+  // outputs are never planned (see MemoryPlanner), so no two segments share
+  // their storage.
+  static void collectTensors(TorchData* data,
+    std::vector<Tensor<float>*>& tensors) {
+    if (data == NULL) {
+      return;
+    }
+    if (data->type() == TorchDataType::TABLE_DATA) {
+      Table* table = (Table*)data;
+      for (uint32_t i = 0; i < table->tableSize(); i++) {
+        collectTensors((*table)(i), tensors);
+      }
+    } else if (data->type() == TorchDataType::TENSOR_DATA) {
+      tensors.push_back(TO_TENSOR_PTR(data));
+    }
+  }
+
+  PipelineExecutor::PipelineExecutor(Sequential& model,
+    const uint32_t input_dim, const uint32_t* input_size,
+    const uint32_t num_segments, const uint32_t max_frames_in_flight) :
+    model_(model) {
+    if (num_segments == 0 || num_segments > model_.size()) {
+      std::stringstream ss;
+      ss << "PipelineExecutor::PipelineExecutor() - ERROR: Can not split " <<
+        model_.size() << " stages into " << num_segments << " segments!";
+      throw std::runtime_error(ss.str());
+    }
+    max_frames_in_flight_ = max_frames_in_flight > 0 ? max_frames_in_flight :
+      num_segments;
+    num_pushed_ = 0;
+    input_ = NULL;
+    input_nelems_ = 0;
+    output_nelems_ = 0;
+    stats_start_ = 0;
+    stats_end_ = 0;
+
+    try {
+      input_ = new Tensor<float>(input_dim, input_size);  // Zeros
+      input_nelems_ = input_->nelems();
+      partition(measureStageCosts(), num_segments);
+
+      for (uint32_t s = 0; s < segments_.size(); s++) {
+        Segment& seg = segments_[s];
+        cl_int err;
+        seg.queue = clCreateCommandQueue(CLContext(), CLDevice(),
+          CL_QUEUE_PROFILING_ENABLE, &err);
+        checkCLError(err, "clCreateCommandQueue");
+        Tensor<float>* out = TO_TENSOR_PTR(
+          model_.get(seg.first_stage + seg.num_stages - 1)->output);
+        if (s + 1 < segments_.size()) {
+          for (uint32_t i = 0; i < 2; i++) {
+            seg.boundary[i] = Tensor<float>::uninitialized(out->dim(),
+              out->size());
+          }
+        } else {
+          output_nelems_ = out->nelems();
+        }
+      }
+      checkStorage();
+    } catch (...) {
+      cleanup();
+      throw;
+    }
+    // Buffers released while frames are in flight may still be in use on
+    // another segment's queue (see sync)
+    buffer_pool->deferRecycling();
+  }
+
+  PipelineExecutor::~PipelineExecutor() {
+    sync();
+    buffer_pool->resumeRecycling();
+    cleanup();
+  }
+
+  void PipelineExecutor::cleanup() {
+    for (uint32_t s = 0; s < segments_.size(); s++) {
+      if (segments_[s].queue != NULL) {
+        clFinish(segments_[s].queue);
+        clReleaseCommandQueue(segments_[s].queue);
+      }
+      SAFE_DELETE(segments_[s].boundary[0]);
+      SAFE_DELETE(segments_[s].boundary[1]);
+    }
+    segments_.clear();
+    SAFE_DELETE(input_);
+  }
+
+  std::vector<double> PipelineExecutor::measureStageCosts() {
+    // The first pass allocates every output (and does any one-off host
+    // work), the second one is timed stage by stage
+    model_.forwardProp(*input_);
+    Sync();
+    const uint32_t n_stages = model_.size();
+    std::vector<double> costs(n_stages);
+    TorchData* cur = input_;
+    for (uint32_t i = 0; i < n_stages; i++) {
+      TorchStage* stage = model_.get(i);
+      std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+      stage->forwardProp(*cur);
+      Sync();
+      costs[i] = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+      cur = stage->output;
+    }
+    return costs;
+  }
+
+  void PipelineExecutor::partition(const std::vector<double>& costs,
+    const uint32_t num_segments) {
+    const uint32_t n_stages = (uint32_t)costs.size();
+    std::vector<double> prefix(n_stages + 1, 0);
+    for (uint32_t i = 0; i < n_stages; i++) {
+      prefix[i + 1] = prefix[i] + costs[i];
+    }
+    // best[k][j] - The smallest maximum segment cost when splitting the first
+    // j stages into k segments (first[k][j] is where the last one starts)
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<std::vector<double>> best(num_segments + 1,
+      std::vector<double>(n_stages + 1, inf));
+    std::vector<std::vector<uint32_t>> first(num_segments + 1,
+      std::vector<uint32_t>(n_stages + 1, 0));
+    best[0][0] = 0;
+    for (uint32_t k = 1; k <= num_segments; k++) {
+      for (uint32_t j = k; j <= n_stages; j++) {
+        // Segments pass a tensor to the next one (or to the output)
+        TorchData* out = model_.get(j - 1)->output;
+        if (out == NULL || TO_TENSOR_PTR(out) == NULL) {
+          continue;
+        }
+        for (uint32_t i = k - 1; i < j; i++) {
+          const double cost = std::max<double>(best[k - 1][i],
+            prefix[j] - prefix[i]);
+          if (cost < best[k][j]) {
+            best[k][j] = cost;
+            first[k][j] = i;
+          }
+        }
+      }
+    }
+    if (best[num_segments][n_stages] == inf) {
+      std::stringstream ss;
+      ss << "PipelineExecutor::partition() - ERROR: Can not split the model "
+        "into " << num_segments << " segments with tensor outputs!";
+      throw std::runtime_error(ss.str());
+    }
+
+    segments_.resize(num_segments);
+    uint32_t end = n_stages;
+    for (uint32_t k = num_segments; k > 0; k--) {
+      Segment& seg = segments_[k - 1];
+      seg.first_stage = first[k][end];
+      seg.num_stages = end - seg.first_stage;
+      seg.cost_ms = prefix[end] - prefix[seg.first_stage];
+      seg.queue = NULL;
+      seg.boundary[0] = NULL;
+      seg.boundary[1] = NULL;
+      seg.num_frames = 0;
+      seg.busy_ms = 0;
+      end = seg.first_stage;
+    }
+  }
+
+  void PipelineExecutor::checkStorage() {
+    // Run one frame the way push() does (but in order on one queue), so that
+    // every output is bound as it will be while pipelining
+    std::map<jcl::JCLBuffer, uint32_t> owner;  // Segment writing each buffer
+    for (uint32_t s = 0; s < segments_.size(); s++) {
+      const Segment& seg = segments_[s];
+      TorchData& input = s == 0 ? *input_ : *segments_[s - 1].boundary[0];
+      runSegment(s, input);
+      MemoryPlanner walk;  // Only walks the stages, nothing is rebound
+      TorchData* cur = &input;
+      for (uint32_t i = 0; i < seg.num_stages; i++) {
+        TorchStage* stage = model_.get(seg.first_stage + i);
+        stage->planMemory(walk, *cur);
+        cur = stage->output;
+      }
+      if (s + 1 < segments_.size()) {
+        Tensor<float>::copy(*seg.boundary[0], *TO_TENSOR_PTR(cur));
+      }
+      for (uint32_t i = 0; i < walk.steps().size(); i++) {
+        const MemoryPlanStep& step = walk.steps()[i];
+        std::vector<Tensor<float>*> written = step.scratch;
+        collectTensors(step.output, written);
+        for (uint32_t j = 0; j < written.size(); j++) {
+          std::map<jcl::JCLBuffer, uint32_t>::iterator it =
+            owner.find(written[j]->storage());
+          if (it != owner.end() && it->second != s) {
+            std::stringstream ss;
+            ss << "PipelineExecutor::PipelineExecutor() - ERROR: Segments " <<
+              it->second << " and " << s << " write the same storage (was "
+              "the model planned with MemoryPlanner?)";
+            throw std::runtime_error(ss.str());
+          }
+          owner[written[j]->storage()] = s;
+        }
+      }
+    }
+    Sync();
+  }
+
+  void PipelineExecutor::runSegment(const uint32_t segment,
+    TorchData& input) {
+    const Segment& seg = segments_[segment];
+    TorchData* cur = &input;
+    for (uint32_t i = 0; i < seg.num_stages; i++) {
+      TorchStage* stage = model_.get(seg.first_stage + i);
+      // As in Sequential, except that the segment input (the frame input or
+      // a boundary tensor) is never overwritten
+      stage->setInputExclusive(i > 0 && !SharesStorage(*cur, input));
+      stage->forwardProp(*cur);
+      cur = stage->output;
+    }
+  }
+
+  Event PipelineExecutor::push(const float* input, float* output) {
+    while (frames_.size() >= max_frames_in_flight_) {
+      retireFrame();
+    }
+    const uint32_t n_segments = numSegments();
+    const uint32_t buf = (uint32_t)(num_pushed_ % 2);
+    // The frame from two pushes ago read the boundary tensors we write
+    // (NULL once it has finished)
+    const Frame* prev_reader = frames_.size() >= 2 ?
+      &frames_[frames_.size() - 2] : NULL;
+    Frame frame;
+    try {
+      for (uint32_t s = 0; s < n_segments; s++) {
+        Segment& seg = segments_[s];
+        SetCLQueue(seg.queue);
+        if (s > 0) {
+          checkCLError(clEnqueueBarrierWithWaitList(seg.queue, 1,
+            &frame.end[s - 1], NULL), "clEnqueueBarrierWithWaitList");
+        }
+        cl_event start;
+        checkCLError(clEnqueueMarkerWithWaitList(seg.queue, 0, NULL, &start),
+          "clEnqueueMarkerWithWaitList");
+        frame.start.push_back(start);
+
+        if (s == 0) {
+          input_->setDataAsync(input);
+        }
+        runSegment(s, s == 0 ? *input_ : *segments_[s - 1].boundary[buf]);
+        Tensor<float>* out = TO_TENSOR_PTR(
+          model_.get(seg.first_stage + seg.num_stages - 1)->output);
+        if (s + 1 < n_segments) {
+          if (prev_reader != NULL) {
+            checkCLError(clEnqueueBarrierWithWaitList(seg.queue, 1,
+              &prev_reader->end[s + 1], NULL),
+              "clEnqueueBarrierWithWaitList");
+          }
+          Tensor<float>::copy(*seg.boundary[buf], *out);
+        } else {
+          frame.output = out->getDataAsync(output);
+        }
+
+        cl_event end;
+        checkCLError(clEnqueueMarkerWithWaitList(seg.queue, 0, NULL, &end),
+          "clEnqueueMarkerWithWaitList");
+        frame.end.push_back(end);
+        clFlush(seg.queue);
+      }
+    } catch (...) {
+      SetCLQueue(NULL);
+      for (uint32_t s = 0; s < n_segments; s++) {
+        clFinish(segments_[s].queue);
+      }
+      for (uint32_t s = 0; s < frame.start.size(); s++) {
+        clReleaseEvent(frame.start[s]);
+      }
+      for (uint32_t s = 0; s < frame.end.size(); s++) {
+        clReleaseEvent(frame.end[s]);
+      }
+      throw;
+    }
+    SetCLQueue(NULL);
+    frames_.push_back(frame);
+    num_pushed_++;
+    return frame.output;
+  }
+
+  void PipelineExecutor::retireFrame() {
+    Frame& frame = frames_.front();
+    const uint32_t n_segments = numSegments();
+    clWaitForEvents(n_segments, &frame.end[0]);
+    for (uint32_t s = 0; s < n_segments; s++) {
+      cl_ulong start, end;
+      if (clGetEventProfilingInfo(frame.start[s], CL_PROFILING_COMMAND_END,
+        sizeof(start), &start, NULL) == CL_SUCCESS &&
+        clGetEventProfilingInfo(frame.end[s], CL_PROFILING_COMMAND_END,
+        sizeof(end), &end, NULL) == CL_SUCCESS && end >= start) {
+        segments_[s].busy_ms += (double)(end - start) * 1e-6;
+        if (stats_start_ == 0 || start < stats_start_) {
+          stats_start_ = start;
+        }
+        stats_end_ = std::max<cl_ulong>(stats_end_, end);
+      }
+      segments_[s].num_frames++;
+      clReleaseEvent(frame.start[s]);
+      clReleaseEvent(frame.end[s]);
+    }
+    frames_.pop_front();
+  }
+
+  void PipelineExecutor::sync() {
+    while (!frames_.empty()) {
+      retireFrame();
+    }
+    // Nothing is in flight, so the released buffers can be handed out again
+    buffer_pool->resumeRecycling();
+    buffer_pool->deferRecycling();
+  }
+
+  std::vector<PipelineSegmentStats> PipelineExecutor::segmentStats() const {
+    const double wall_ms = (double)(stats_end_ - stats_start_) * 1e-6;
+    std::vector<PipelineSegmentStats> ret(segments_.size());
+    for (uint32_t s = 0; s < segments_.size(); s++) {
+      ret[s].first_stage = segments_[s].first_stage;
+      ret[s].num_stages = segments_[s].num_stages;
+      ret[s].cost_ms = segments_[s].cost_ms;
+      ret[s].num_frames = segments_[s].num_frames;
+      ret[s].busy_ms = segments_[s].busy_ms;
+      ret[s].utilization = wall_ms > 0 ? segments_[s].busy_ms / wall_ms : 0;
+    }
+    return ret;
+  }
+
+  void PipelineExecutor::resetStats() {
+    for (uint32_t s = 0; s < segments_.size(); s++) {
+      segments_[s].num_frames = 0;
+      segments_[s].busy_ms = 0;
+    }
+    stats_start_ = 0;
+    stats_end_ = 0;
+  }
+
+}  // namespace jtorch
@@ -0,0 +1,228 @@
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include "jtorch/quantize.h"
+#include "jtorch/tensor.h"
+#include "jtorch/half.h"
+#include "jtorch/kernel.h"
+#include "jcl/jcl.h"
+
+#define SAFE_DELETE(x) if (x != NULL) { delete x; x = NULL; }
+#define SAFE_DELETE_ARR(x) if (x != NULL) { delete[] x; x = NULL; }
+
+namespace jtorch {
+
+  static KernelHandle quantize_kernel("quantize.cl", "Quantize");
+
+  WeightTensor::WeightTensor(const uint32_t dim, const uint32_t* size,
+    const uint32_t channel_dim) {
+    if (channel_dim >= dim) {
+      throw std::runtime_error("WeightTensor::WeightTensor() - ERROR: "
+        "channel_dim out of range!");
+    }
+    precision_ = WEIGHT_PRECISION_FLOAT;
+    dim_ = dim;
+    size_ = new uint32_t[dim_];
+    memcpy(size_, size, sizeof(size_[0]) * dim_);
+    channel_dim_ = channel_dim;
+    float_ = new Tensor<float>(dim_, size_);
+    half_ = NULL;
+    int8_ = NULL;
+    scales_ = NULL;
+  }
+
+  WeightTensor::~WeightTensor() {
+    SAFE_DELETE_ARR(size_);
+    SAFE_DELETE(float_);
+    SAFE_DELETE(half_);
+    SAFE_DELETE(int8_);
+    SAFE_DELETE(scales_);
+  }
+
+  uint32_t WeightTensor::nelems() const {
+    uint32_t nelem = 1;
+    for (uint32_t i = 0; i < dim_; i++) {
+      nelem *= size_[i];
+    }
+    return nelem;
+  }
+
+  uint64_t WeightTensor::bytes() const {
+    uint64_t ret = 0;
+    if (float_ != NULL) {
+      ret += sizeof(float) * (uint64_t)float_->nelems();
+    }
+    if (half_ != NULL) {
+      ret += sizeof(half) * (uint64_t)half_->nelems();
+    }
+    if (int8_ != NULL) {
+      ret += sizeof(int8_t) * (uint64_t)int8_->nelems();
+    }
+    if (scales_ != NULL) {
+      ret += sizeof(float) * (uint64_t)scales_->nelems();
+    }
+    return ret;
+  }
+
+  void WeightTensor::allocate() {
+    switch (precision_) {
+    case WEIGHT_PRECISION_HALF:
+      half_ = Tensor<half>::uninitialized(dim_, size_);
+      break;
+    case WEIGHT_PRECISION_INT8:
+      int8_ = Tensor<int8_t>::uninitialized(dim_, size_);
+      scales_ = Tensor<float>::uninitialized(1, &size_[channel_dim_]);
+      break;
+    default:
+      float_ = Tensor<float>::uninitialized(dim_, size_);
+      break;
+    }
+  }
+
+  void WeightTensor::setPrecision(const WeightPrecision precision) {
+    if (precision == precision_) {
+      return;
+    }
+    float* data = new float[nelems()];
+    getData(data);
+    SAFE_DELETE(float_);
+    SAFE_DELETE(half_);
+    SAFE_DELETE(int8_);
+    SAFE_DELETE(scales_);
+    precision_ = precision;
+    allocate();
+    setData(data);
+    delete[] data;
+  }
+
+  void WeightTensor::setData(const float* data) {
+    const uint32_t n = nelems();
+    if (precision_ == WEIGHT_PRECISION_HALF) {
+      half* data_half = new half[n];
+      for (uint32_t i = 0; i < n; i++) {
+        data_half[i] = half(data[i]);
+      }
+      half_->setData(data_half);
+      delete[] data_half;
+    } else if (precision_ == WEIGHT_PRECISION_INT8) {
+      // Element i belongs to channel (i / channel_stride) % num_channels
+      uint32_t channel_stride = 1;
+      for (uint32_t i = 0; i < channel_dim_; i++) {
+        channel_stride *= size_[i];
+      }
+      const uint32_t num_channels = size_[channel_dim_];
+      float* scales = new float[num_channels];
+      for (uint32_t c = 0; c < num_channels; c++) {
+        scales[c] = 0.0f;
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        float& scale = scales[(i / channel_stride) % num_channels];
+        scale = std::max<float>(scale, fabsf(data[i]));
+      }
+      for (uint32_t c = 0; c < num_channels; c++) {
+        // An all zero channel quantizes to zero with any scale
+        scales[c] = scales[c] > 0.0f ? scales[c] / 127.0f : 1.0f;
+      }
+      int8_t* data_int8 = new int8_t[n];
+      for (uint32_t i = 0; i < n; i++) {
+        const float scale = scales[(i / channel_stride) % num_channels];
+        float q = floorf(data[i] / scale + 0.5f);
+        data_int8[i] = (int8_t)std::max<float>(-127.0f,
+          std::min<float>(127.0f, q));
+      }
+      int8_->setData(data_int8);
+      scales_->setData(scales);
+      delete[] data_int8;
+      delete[] scales;
+    } else {
+      float_->setData(data);
+    }
+  }
+
+  void WeightTensor::getData(float* data) const {
+    const uint32_t n = nelems();
+    if (precision_ == WEIGHT_PRECISION_HALF) {
+      half* data_half = new half[n];
+      half_->getData(data_half);
+      for (uint32_t i = 0; i < n; i++) {
+        data[i] = (float)data_half[i];
+      }
+      delete[] data_half;
+    } else if (precision_ == WEIGHT_PRECISION_INT8) {
+      uint32_t channel_stride = 1;
+      for (uint32_t i = 0; i < channel_dim_; i++) {
+        channel_stride *= size_[i];
+      }
+      const uint32_t num_channels = size_[channel_dim_];
+      float* scales = new float[num_channels];
+      scales_->getData(scales);
+      int8_t* data_int8 = new int8_t[n];
+      int8_->getData(data_int8);
+      for (uint32_t i = 0; i < n; i++) {
+        data[i] = scales[(i / channel_stride) % num_channels] *
+          (float)data_int8[i];
+      }
+      delete[] data_int8;
+      delete[] scales;
+    } else {
+      float_->getData(data);
+    }
+  }
+
+  ActivationQuantizer::ActivationQuantizer() {
+    calibrating_ = false;
+    calib_max_ = 0.0f;
+    q_ = NULL;
+  }
+
+  ActivationQuantizer::~ActivationQuantizer() {
+    SAFE_DELETE(q_);
+  }
+
+  void ActivationQuantizer::setCalibrating(const bool calibrating) {
+    if (calibrating) {
+      calib_max_ = 0.0f;
+    }
+    calibrating_ = calibrating;
+  }
+
+  void ActivationQuantizer::copyCalibration(const ActivationQuantizer& src) {
+    calibrating_ = src.calibrating_;
+    calib_max_ = src.calib_max_;
+  }
+
+  Tensor<int8_t>* ActivationQuantizer::quantize(const Tensor<float>& x,
+    float& scale) {
+    if (!x.isFlat()) {
+      throw std::runtime_error("ActivationQuantizer::quantize() - ERROR: "
+        "Input must be flat!");
+    }
+    float abs_max;
+    if (calibrated()) {
+      abs_max = calib_max_;
+    } else {
+      abs_max = Tensor<float>::reduce(x, REDUCE_ABS_MAX);
+      if (calibrating_) {
+        calib_max_ = std::max<float>(calib_max_, abs_max);
+      }
+    }
+    scale = abs_max > 0.0f ? abs_max / 127.0f : 1.0f;
+
+    if (q_ == NULL || !(q_->dim() == x.dim() &&
+      memcmp(q_->size(), x.size(), sizeof(x.size()[0]) * x.dim()) == 0)) {
+      SAFE_DELETE(q_);
+      q_ = Tensor<int8_t>::uninitialized(x.dim(), x.size());
+    }
+
+    Kernel* kernel = quantize_kernel.get();
+    kernel->setArg(0, x.storage());
+    kernel->setArg(1, q_->storage());
+    kernel->setArg(2, 1.0f / scale);
+    uint32_t dim = 1;
+    uint32_t nelem = x.nelems();
+    kernel->run(dim, &nelem, false);
+    return q_;
+  }
+
+}  // namespace jtorch
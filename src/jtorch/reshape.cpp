@@ -14,8 +14,10 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
-  Reshape::Reshape(const uint32_t dim, const uint32_t* size) : TorchStage() {
+  Reshape::Reshape(const uint32_t dim, const uint32_t* size,
+    const uint32_t n_input_dims) : TorchStage() {
     odim_ = dim;
+    n_input_dims_ = n_input_dims;
     osize_ = new uint32_t[odim_];
     memcpy(osize_, size, sizeof(osize_[0]) * odim_);
     output = NULL;
@@ -26,6 +28,10 @@ namespace jtorch {
     SAFE_DELETE(output);
   }
 
+  TorchStage* Reshape::clone() const {
+    return new Reshape(odim_, osize_, n_input_dims_);
+  }
+
   uint32_t Reshape::outNElem() const {
     if (odim_ == 0) {
       return 0;
@@ -45,24 +51,38 @@ namespace jtorch {
     Tensor<float>& in = (Tensor<float>&)input;
 
     int32_t nelems = outNElem();
-    if (in.nelems() != nelems) {
+    // As per torch, a batch of inputs keeps its (outer most) batch dimension
+    const uint32_t batch_size = in.size()[in.dim() - 1];
+    const bool batch = n_input_dims_ > 0 ? in.dim() == n_input_dims_ + 1 :
+      (in.nelems() != nelems && in.dim() > 1);
+    if (in.nelems() != nelems * (batch ? batch_size : 1)) {
       throw std::runtime_error("Reshape::init() - Bad input size!");
     }
 
     if (output != NULL) {
       Tensor<float>* out = (Tensor<float>*)output;
-      if (out->storage() != in.storage()) {
+      if (out->storage() != in.storage() || out->offset() != in.offset() ||
+        out->nelems() != in.nelems() ||
+        out->dim() != (batch ? odim_ + 1 : odim_)) {
         // The tensors don't share the same storage! Reinitialize the view.
         SAFE_DELETE(output);
       }
     }
 
-    if (output == NULL) {
+    if (output == NULL && !batch) {
       output = in.view(odim_, osize_);  // rets header that uses same storage
+    } else if (output == NULL) {
+      uint32_t* size = new uint32_t[odim_ + 1];
+      memcpy(size, osize_, sizeof(size[0]) * odim_);
+      size[odim_] = batch_size;
+      output = in.view(odim_ + 1, size);
+      SAFE_DELETE_ARR(size);
     }
   }
 
-  void Reshape::forwardProp(TorchData& input) { 
+  void Reshape::forwardProp(TorchData& strided_input) { 
+    // Contiguous views (even at an offset) are fine as they are
+    TorchData& input = contiguousInput(strided_input, true);
     init(input);
     // Nothing to do.  init will initialize our tensor view that points to the
     // same storage as the input.
@@ -77,7 +97,9 @@ namespace jtorch {
       file.read((char*)(&cur_size), sizeof(cur_size));
       size[i] = cur_size;
     }
-    TorchStage* stage = new Reshape(dim, size);
+    int32_t n_input_dims;
+    file.read((char*)(&n_input_dims), sizeof(n_input_dims));
+    TorchStage* stage = new Reshape(dim, size, n_input_dims);
     SAFE_DELETE_ARR(size);
     return stage;
   }
@@ -25,6 +25,10 @@ namespace jtorch {
     // Nothing to do for output (we don't own it)
   }
 
+  TorchStage* SelectTable::clone() const {
+    return new SelectTable(index_);
+  }
+
 
   TorchStage* SelectTable::loadFromFile(std::ifstream& file) {
     int32_t index;
@@ -1,5 +1,9 @@
 #include "jtorch/sequential.h"
 #include "jtorch/tensor.h"
+#include "jtorch/table.h"
+#include "jtorch/identity.h"
+#include "jtorch/tanh.h"
+#include "jtorch/threshold.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -14,6 +18,29 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  // SharesStorage - true if a tensor in a uses the storage of one in b
+  static bool SharesStorage(TorchData& a, TorchData& b) {
+    if (a.type() == TorchDataType::TABLE_DATA) {
+      Table& table = (Table&)a;
+      for (uint32_t i = 0; i < table.tableSize(); i++) {
+        if (SharesStorage(*table(i), b)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    if (b.type() == TorchDataType::TABLE_DATA) {
+      return SharesStorage(b, a);
+    }
+    if (a.type() == TorchDataType::HALF_TENSOR_DATA &&
+      b.type() == TorchDataType::HALF_TENSOR_DATA) {
+      return ((Tensor<half>&)a).storage() == ((Tensor<half>&)b).storage();
+    }
+    return a.type() == TorchDataType::TENSOR_DATA &&
+      b.type() == TorchDataType::TENSOR_DATA &&
+      ((Tensor<float>&)a).storage() == ((Tensor<float>&)b).storage();
+  }
+
   Sequential::Sequential() {
     // Create an empty container
     network_ = new VectorManaged<TorchStage*>(1);
@@ -24,6 +51,23 @@ namespace jtorch {
     SAFE_DELETE(network_);
   }
 
+  TorchStage* Sequential::clone() const {
+    Sequential* ret = new Sequential();
+    ret->network_->capacity(network_->size());
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      ret->network_->pushBack((*network_)[i]->clone());
+    }
+    return ret;
+  }
+
+  uint64_t Sequential::parameterBytes() const {
+    uint64_t ret = 0;
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      ret += (*network_)[i]->parameterBytes();
+    }
+    return ret;
+  }
+
   void Sequential::add(TorchStage* stage) {
     network_->pushBack(stage);
   }
@@ -52,12 +96,72 @@ namespace jtorch {
       throw std::runtime_error("Sequential::forwardProp() - ERROR: "
         "Network is empty!");
     }
+    (*network_)[0]->setInputExclusive(input_exclusive_);
     (*network_)[0]->forwardProp(input);
     for (uint32_t i = 1; i < network_->size(); i++) {
       TorchData* cur_input = (*network_)[i-1]->output;
+      // Each output is only read by the next stage, unless it is (a view
+      // of) our own input, ie passed through Identity or Reshape
+      (*network_)[i]->setInputExclusive(input_exclusive_ ||
+        !SharesStorage(*cur_input, input));
       (*network_)[i]->forwardProp(*cur_input);
     }
     output = (*network_)[network_->size()-1]->output;
   }
 
+  void Sequential::setWeightPrecision(const WeightPrecision precision) {
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->setWeightPrecision(precision);
+    }
+  }
+
+  void Sequential::setOutputPrecision(const OutputPrecision precision) {
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->setOutputPrecision(precision);
+    }
+  }
+
+  void Sequential::setCalibrating(const bool calibrating) {
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->setCalibrating(calibrating);
+    }
+  }
+
+  void Sequential::planMemory(MemoryPlanner& planner, TorchData& input) {
+    TorchData* cur_input = &input;
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      (*network_)[i]->planMemory(planner, *cur_input);
+      cur_input = (*network_)[i]->output;
+    }
+  }
+
+  uint32_t Sequential::fuseActivations() {
+    uint32_t num_fused = 0;
+    for (uint32_t i = 0; i < network_->size(); i++) {
+      num_fused += (*network_)[i]->fuseActivations();
+    }
+    for (uint32_t i = 0; i + 1 < network_->size(); i++) {
+      TorchStage* next = (*network_)[i + 1];
+      Activation activation;
+      activation.threshold = 0;
+      activation.val = 0;
+      if (next->type() == TANH_STAGE) {
+        activation.type = ACTIVATION_TANH;
+      } else if (next->type() == THRESHOLD_STAGE) {
+        activation.type = ACTIVATION_THRESHOLD;
+        activation.threshold = ((Threshold*)next)->threshold;
+        activation.val = ((Threshold*)next)->val;
+      } else {
+        continue;
+      }
+      if ((*network_)[i]->setActivation(activation)) {
+        // Keep the stage count (and indices) unchanged for get()
+        delete next;
+        (*network_)[i + 1] = new Identity();
+        num_fused++;
+      }
+    }
+    return num_fused;
+  }
+
 }  // namespace jtorch
\ No newline at end of file
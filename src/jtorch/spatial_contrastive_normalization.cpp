@@ -3,6 +3,7 @@
 #include "jtorch/spatial_divisive_normalization.h"
 #include "jtorch/sequential.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -17,6 +18,22 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static KernelHandle spatial_contrastive_normalization_mean_kernel(
+    "spatial_contrastive_normalization.cl",
+    "SpatialContrastiveNormalizationMean");
+  static KernelHandle spatial_contrastive_normalization_kernel(
+    "spatial_contrastive_normalization.cl", "SpatialContrastiveNormalization");
+  static KernelHandle spatial_contrastive_normalization_mean_half_kernel(
+    "spatial_contrastive_normalization_half.cl",
+    "SpatialContrastiveNormalizationMean");
+  static KernelHandle spatial_contrastive_normalization_half_kernel(
+    "spatial_contrastive_normalization_half.cl",
+    "SpatialContrastiveNormalization");
+
+  // The fused kernels' tile must fit in the minimum local memory size that
+  // OpenCL guarantees
+  static const uint32_t max_tile_bytes = 16 * 1024;
+
   // kernel1d default is either TorchStage::gaussian1D<float>(n) or just a
   // vector of 1 values.
   SpatialContrastiveNormalization::SpatialContrastiveNormalization(
@@ -36,7 +53,7 @@ namespace jtorch {
     } else {
       uint32_t dim = 1;
       uint32_t size = 7;
-      Tensor<float>* kernel = new Tensor<float>(dim, &size);
+      Tensor<float>* kernel = Tensor<float>::uninitialized(dim, &size);
       Tensor<float>::fill(*kernel, 1);
       cur_kernel = kernel;
     }
@@ -45,6 +62,38 @@ namespace jtorch {
     network_->add(new SpatialSubtractiveNormalization(*cur_kernel));
     network_->add(new SpatialDivisiveNormalization(*cur_kernel, threshold));
 
+    // The fused kernels take one normalized 2D filter
+    const bool onedim_kernel = cur_kernel->dim() == 1;
+    uint32_t size[2];
+    size[0] = cur_kernel->size()[0];
+    size[1] = onedim_kernel ? size[0] : cur_kernel->size()[1];
+    float* kernel_cpu = new float[cur_kernel->nelems()];
+    float* kernel2d_cpu = new float[size[0] * size[1]];
+    cur_kernel->getData(kernel_cpu);
+    float sum = 0;
+    for (uint32_t v = 0; v < size[1]; v++) {
+      for (uint32_t u = 0; u < size[0]; u++) {
+        float k = onedim_kernel ? kernel_cpu[v] * kernel_cpu[u] :
+          kernel_cpu[v * size[0] + u];
+        kernel2d_cpu[v * size[0] + u] = k;
+        sum += k;
+      }
+    }
+    for (uint32_t i = 0; i < size[0] * size[1]; i++) {
+      kernel2d_cpu[i] /= sum;
+    }
+    kernel2d_.reset(new Tensor<float>(2, size));
+    kernel2d_->setData(kernel2d_cpu);
+    delete[] kernel_cpu;
+    delete[] kernel2d_cpu;
+
+    fused_ = true;
+    threshold_ = threshold;
+    fused_output_ = NULL;
+    mean_ = NULL;
+    local_size_ = 0;
+    output = NULL;
+
     if (kernel == NULL) {
       // remove temporarily allocated kernel (since sub-modules will store
       // their own copy).
@@ -52,15 +101,165 @@ namespace jtorch {
     }
   }
 
+  SpatialContrastiveNormalization::SpatialContrastiveNormalization(
+    const SpatialContrastiveNormalization* src) : TorchStage() {
+    network_ = (Sequential*)src->network_->clone();
+    kernel2d_ = src->kernel2d_;
+    fused_ = src->fused_;
+    threshold_ = src->threshold_;
+    fused_output_ = NULL;
+    mean_ = NULL;
+    local_size_ = 0;
+    output = NULL;
+  }
+
   SpatialContrastiveNormalization::~SpatialContrastiveNormalization() {
     SAFE_DELETE(network_);
+    SAFE_DELETE(fused_output_);
+    SAFE_DELETE(mean_);
+  }
+
+  TorchStage* SpatialContrastiveNormalization::clone() const {
+    TorchStage* ret = new SpatialContrastiveNormalization(this);
+    ret->setOutputPrecision(output_precision_);
+    return ret;
+  }
+
+  void SpatialContrastiveNormalization::setOutputPrecision(
+    const OutputPrecision precision) {
+    output_precision_ = precision;
+    network_->setOutputPrecision(precision);
+  }
+
+  uint64_t SpatialContrastiveNormalization::parameterBytes() const {
+    return sizeof(float) * (uint64_t)kernel2d_->nelems() +
+      network_->parameterBytes();
+  }
+
+  template <typename T>
+  void SpatialContrastiveNormalization::init(Tensor<T>& in) {
+    const uint32_t batch_size = batchSize(in, 3,
+      "SpatialContrastiveNormalization::init()");
+    if (fused_output_ != NULL && (fused_output_->type() != in.type() ||
+      !in.isSameSizeAs(*(Tensor<T>*)fused_output_))) {
+      SAFE_DELETE(fused_output_);
+      SAFE_DELETE(mean_);
+    }
+    if (fused_output_ == NULL) {
+      fused_output_ = Tensor<T>::uninitialized(in.dim(), in.size());
+      // One 2D mean per sample
+      const uint32_t mean_size[3] = {in.size()[0], in.size()[1], batch_size};
+      mean_ = Tensor<float>::uninitialized(in.dim() - 1, mean_size);
+
+      // Use the largest square workgroup that both kernels support and
+      // whose tile fits in local memory
+      const uint32_t max_size = std::min<uint32_t>(
+        KernelFor<T>(spatial_contrastive_normalization_mean_kernel,
+        spatial_contrastive_normalization_mean_half_kernel)->maxWorkgroupSize(),
+        KernelFor<T>(spatial_contrastive_normalization_kernel,
+        spatial_contrastive_normalization_half_kernel)->maxWorkgroupSize());
+      for (local_size_ = 16; local_size_ > 0; local_size_ /= 2) {
+        const uint32_t tile_bytes = (local_size_ + kernel2d_->size()[0] - 1) *
+          (local_size_ + kernel2d_->size()[1] - 1) * sizeof(float);
+        if (local_size_ * local_size_ <= max_size &&
+          tile_bytes <= max_tile_bytes) {
+          break;
+        }
+      }
+    }
   }
 
-  void SpatialContrastiveNormalization::forwardProp(TorchData& input) {
-    network_->forwardProp(input);
+  void SpatialContrastiveNormalization::forwardProp(
+    TorchData& strided_input) {
+    if (fused_ && output_precision_ == OUTPUT_PRECISION_HALF) {
+      if (runFused(halfInput(strided_input,
+        "SpatialContrastiveNormalization::forwardProp()"))) {
+        return;
+      }
+    } else if (fused_) {
+      // Our kernels index the input as a flat array
+      TorchData& input = contiguousInput(strided_input);
+      if (input.type() != TorchDataType::TENSOR_DATA) {
+        throw std::runtime_error("SpatialContrastiveNormalization::init() - "
+          "FloatTensor expected!");
+      }
+      if (runFused((Tensor<float>&)input)) {
+        return;
+      }
+    }
+    network_->setInputExclusive(input_exclusive_);
+    network_->forwardProp(strided_input);
     output = network_->output;
   }
 
+  template <typename T>
+  bool SpatialContrastiveNormalization::runFused(Tensor<T>& in) {
+    init(in);
+    if (local_size_ == 0) {
+      return false;
+    }
+    const int32_t filt_rad_u = ((int32_t)kernel2d_->size()[0] - 1) / 2;
+    const int32_t filt_rad_v = ((int32_t)kernel2d_->size()[1] - 1) / 2;
+    const uint32_t tile_bytes = (local_size_ + 2 * filt_rad_u) *
+      (local_size_ + 2 * filt_rad_v) * sizeof(float);
+    uint32_t local_size[3] = {local_size_, local_size_, 1};
+    uint32_t global_size[3];
+    for (uint32_t i = 0; i < 2; i++) {
+      global_size[i] = ((in.size()[i] + local_size_ - 1) / local_size_) *
+        local_size_;
+    }
+    global_size[2] = in.dim() == 4 ? in.size()[3] : 1;  // batch
+
+    Kernel* kernel = KernelFor<T>(
+      spatial_contrastive_normalization_mean_kernel,
+      spatial_contrastive_normalization_mean_half_kernel);
+    kernel->setArg(0, in.storage());
+    kernel->setArg(1, mean_->storage());
+    kernel->setArg(2, kernel2d_->storage());
+    kernel->setArg(3, filt_rad_u);
+    kernel->setArg(4, filt_rad_v);
+    kernel->setArg(5, (int)in.size()[0]);
+    kernel->setArg(6, (int)in.size()[1]);
+    kernel->setArg(7, (int)in.size()[2]);
+    kernel->setArg(8, tile_bytes, NULL);
+    kernel->run(3, global_size, local_size, false);
+
+    kernel = KernelFor<T>(spatial_contrastive_normalization_kernel,
+      spatial_contrastive_normalization_half_kernel);
+    kernel->setArg(0, in.storage());
+    kernel->setArg(1, ((Tensor<T>*)fused_output_)->storage());
+    kernel->setArg(2, mean_->storage());
+    kernel->setArg(3, kernel2d_->storage());
+    kernel->setArg(4, filt_rad_u);
+    kernel->setArg(5, filt_rad_v);
+    kernel->setArg(6, (int)in.size()[0]);
+    kernel->setArg(7, (int)in.size()[1]);
+    kernel->setArg(8, (int)in.size()[2]);
+    kernel->setArg(9, threshold_);
+    kernel->setArg(10, tile_bytes, NULL);
+    kernel->run(3, global_size, local_size, false);
+
+    output = fused_output_;
+    return true;
+  }
+
+  void SpatialContrastiveNormalization::scratchTensors(
+    std::vector<Tensor<float>*>& scratch) {
+    TorchStage::scratchTensors(scratch);
+    if (mean_ != NULL) {
+      scratch.push_back(mean_);
+    }
+  }
+
+  void SpatialContrastiveNormalization::planMemory(MemoryPlanner& planner,
+    TorchData& input) {
+    if (output != NULL && output == fused_output_) {
+      TorchStage::planMemory(planner, input);
+    } else {
+      network_->planMemory(planner, input);
+    }
+  }
+
   TorchStage* SpatialContrastiveNormalization::loadFromFile(std::ifstream& file) {
     // This whole thing is a little wasteful.  I copy to GPU here, and then
     // I copy it back down in the constructor anyway...  But it's good enough
@@ -73,11 +272,11 @@ namespace jtorch {
       // The kernel is 2D
       uint32_t dim = 2;
       uint32_t size[2] = {kernel_size_1, kernel_size_2};
-      kernel = new Tensor<float>(dim, size);
+      kernel = Tensor<float>::uninitialized(dim, size);
     } else {
       uint32_t dim = 1;
       uint32_t size[1] = {kernel_size_1};
-      kernel = new Tensor<float>(dim, size);
+      kernel = Tensor<float>::uninitialized(dim, size);
     }
     float* kernel_cpu = new float[kernel->nelems()];
     file.read((char*)(kernel_cpu), kernel->nelems() * sizeof(*kernel_cpu));
@@ -1,5 +1,6 @@
 #include "jtorch/spatial_convolution.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jtorch/jtorch.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
@@ -16,6 +17,15 @@ using namespace jcl;
 
 namespace jtorch {
 
+  static KernelHandle spatial_convolution_int8_kernel(
+    "spatial_convolution.cl", "SpatialConvolutionInt8");
+  static KernelHandle spatial_convolution_half_kernel(
+    "spatial_convolution.cl", "SpatialConvolutionHalf");
+  static KernelHandle spatial_convolution_padding_kernel(
+    "spatial_convolution.cl", "SpatialConvolutionPadding");
+  static KernelHandle spatial_convolution_kernel(
+    "spatial_convolution.cl", "SpatialConvolution");
+
   SpatialConvolution::SpatialConvolution(const uint32_t feats_in, 
     const uint32_t feats_out, const uint32_t filt_height, 
     const uint32_t filt_width, const uint32_t padding) : TorchStage() {
@@ -29,20 +39,61 @@ namespace jtorch {
 
     uint32_t dim = 4;
     uint32_t size[4] = {filt_width_, filt_height_, feats_in_, feats_out_};
-    weights_ = new Tensor<float>(dim, size);
-    biases_ = new Tensor<float>(1, &feats_out_);
+    weights_.reset(new WeightTensor(dim, size, 3));  // Output channels: dim 3
+    input_quantizer_ = new ActivationQuantizer();
+    activation_.type = ACTIVATION_NONE;
+    activation_.threshold = 0;
+    activation_.val = 0;
+    biases_.reset(new Tensor<float>(1, &feats_out_));
   }
 
   SpatialConvolution::~SpatialConvolution() {
     SAFE_DELETE(output);
-    SAFE_DELETE(weights_);
-    SAFE_DELETE(biases_);
+    SAFE_DELETE(input_quantizer_);
+  }
+
+  SpatialConvolution::SpatialConvolution(const SpatialConvolution* src)
+    : TorchStage() {
+    filt_width_ = src->filt_width_;
+    filt_height_ = src->filt_height_;
+    feats_in_ = src->feats_in_;
+    feats_out_ = src->feats_out_;
+    padding_ = src->padding_;
+
+    output = NULL;
+    weights_ = src->weights_;
+    biases_ = src->biases_;
+    input_quantizer_ = new ActivationQuantizer();
+    input_quantizer_->copyCalibration(*src->input_quantizer_);
+    activation_ = src->activation_;
+  }
+
+  TorchStage* SpatialConvolution::clone() const {
+    return new SpatialConvolution(this);
+  }
+
+  uint64_t SpatialConvolution::parameterBytes() const {
+    return weights_->bytes() + sizeof(float) * (uint64_t)biases_->nelems();
   }
 
   void SpatialConvolution::setWeights(const float* weights) {
     weights_->setData(weights);
   }
 
+  void SpatialConvolution::setWeightPrecision(
+    const WeightPrecision precision) {
+    weights_->setPrecision(precision);
+  }
+
+  void SpatialConvolution::setCalibrating(const bool calibrating) {
+    input_quantizer_->setCalibrating(calibrating);
+  }
+
+  bool SpatialConvolution::setActivation(const Activation& activation) {
+    activation_ = activation;
+    return true;
+  }
+
   void SpatialConvolution::setBiases(const float* biases) {
     biases_->setData(biases);
   }
@@ -53,9 +104,7 @@ namespace jtorch {
         "FloatTensor expected!");
     }
     Tensor<float>& in = (Tensor<float>&)input;
-    if (in.dim() != 3) {
-      throw std::runtime_error("SpatialConvolution::init() - Input not 3D!");
-    }
+    const uint32_t batch_size = batchSize(in, 3, "SpatialConvolution::init()");
     if (in.size()[2] != feats_in_) {
       throw std::runtime_error("SpatialConvolution::init() - ERROR: "
         "incorrect number of input features!");
@@ -65,43 +114,79 @@ namespace jtorch {
       uint32_t oheight  = in.size()[1] - filt_height_ + 1 + 2 * padding_;
       const uint32_t* out_size = TO_TENSOR_PTR(output)->size();
       if (out_size[0] != owidth || out_size[1] != oheight || 
-        out_size[2] != feats_out_) {
+        out_size[2] != feats_out_ ||
+        TO_TENSOR_PTR(output)->dim() != in.dim() ||
+        (in.dim() == 4 && out_size[3] != batch_size)) {
         SAFE_DELETE(output);
       }
     }
     if (output == NULL) {
-      uint32_t out_dim[3];
+      uint32_t out_dim[4];
       out_dim[0] = in.size()[0] - filt_width_ + 1 + 2 * padding_;
       out_dim[1] = in.size()[1] - filt_height_ + 1 + 2 * padding_;
       out_dim[2] = feats_out_;
-      output = new Tensor<float>(3, out_dim);
+      out_dim[3] = batch_size;
+      output = Tensor<float>::uninitialized(in.dim(), out_dim);
     }
   }
 
-  void SpatialConvolution::forwardProp(TorchData& input) { 
+  void SpatialConvolution::forwardProp(TorchData& strided_input) { 
+    // Our kernels index the input as a flat array
+    TorchData& input = contiguousInput(strided_input);
     init(input);
     Tensor<float>& in = (Tensor<float>&)input;
-    std::string kernel = jtorch::jtorch_path + "kernels/spatial_convolution.cl";
-    if (padding_ > 0) {
-      cl_context->useKernel(kernel.c_str(), "SpatialConvolutionPadding");
+    Tensor<int8_t>* in_q = NULL;
+    float in_scale = 1.0f;
+    if (weights_->i8() != NULL) {
+      in_q = input_quantizer_->quantize(in, in_scale);
+    }
+    Kernel* kernel;
+    if (weights_->i8() != NULL) {
+      kernel = spatial_convolution_int8_kernel.get();
+    } else if (weights_->f16() != NULL) {
+      kernel = spatial_convolution_half_kernel.get();
+    } else if (padding_ > 0) {
+      kernel = spatial_convolution_padding_kernel.get();
     } else {
-      cl_context->useKernel(kernel.c_str(), "SpatialConvolution");
+      kernel = spatial_convolution_kernel.get();
     }
-    cl_context->setArg(0, ((Tensor<float>&)input).storage());
-    cl_context->setArg(1, TO_TENSOR_PTR(output)->storage());
-    cl_context->setArg(2, weights_->storage());
-    cl_context->setArg(3, biases_->storage());
-    cl_context->setArg(4, (int)in.size()[2]);
-    cl_context->setArg(5, (int)in.size()[1]);
-    cl_context->setArg(6, (int)in.size()[0]);
-    cl_context->setArg(7, (int)filt_height_);
-    cl_context->setArg(8, (int)filt_width_);
-    if (padding_ > 0) {
-      cl_context->setArg(9, (int)padding_);
+    if (in_q != NULL) {
+      kernel->setArg(0, in_q->storage());
+      kernel->setArg(10, weights_->scales()->storage());
+      kernel->setArg(11, in_scale);
+    } else {
+      kernel->setArg(0, ((Tensor<float>&)input).storage());
+    }
+    kernel->setArg(1, TO_TENSOR_PTR(output)->storage());
+    if (weights_->i8() != NULL) {
+      kernel->setArg(2, weights_->i8()->storage());
+    } else if (weights_->f16() != NULL) {
+      kernel->setArg(2, weights_->f16()->storage());
+    } else {
+      kernel->setArg(2, weights_->f32()->storage());
+    }
+    kernel->setArg(3, biases_->storage());
+    kernel->setArg(4, (int)in.size()[2]);
+    kernel->setArg(5, (int)in.size()[1]);
+    kernel->setArg(6, (int)in.size()[0]);
+    kernel->setArg(7, (int)filt_height_);
+    kernel->setArg(8, (int)filt_width_);
+    uint32_t act_arg;
+    if (in_q != NULL) {
+      kernel->setArg(9, (int)padding_);
+      act_arg = 12;
+    } else if (padding_ > 0 || weights_->f16() != NULL) {
+      kernel->setArg(9, (int)padding_);
+      act_arg = 10;
+    } else {
+      act_arg = 9;
     }
-    uint32_t dim = 3;
-    cl_context->runKernel(jtorch::deviceid, dim, 
-      TO_TENSOR_PTR(output)->size(), false);
+    setActivationArgs(kernel, act_arg, activation_);
+    kernel->setArg(act_arg + 3, (int)feats_out_);
+    // One plane per output feature of every sample
+    uint32_t global_size[3];
+    planeWorkSize(*TO_TENSOR_PTR(output), global_size);
+    kernel->run(3, global_size, false);
   }
 
   TorchStage* SpatialConvolution::loadFromFile(std::ifstream& file) {
@@ -1,3 +1,4 @@
+#include <cstring>
 #include "jtorch/spatial_convolution_map.h"
 #include "jtorch/tensor.h"
 #include "jcl/threading/thread.h"
@@ -49,8 +50,6 @@ namespace jtorch {
     tp_->stop();
     SAFE_DELETE(tp_);
     SAFE_DELETE(output);
-    SAFE_DELETE_ARR(output_cpu_);
-    SAFE_DELETE_ARR(input_cpu_);
     SAFE_DELETE(thread_cbs_);
     for (uint32_t i = 0; i < feats_out_ * fan_in_; i++) {
       SAFE_DELETE_ARR(weights[i]);
@@ -63,6 +62,21 @@ namespace jtorch {
     SAFE_DELETE_ARR(biases);
   }
 
+  TorchStage* SpatialConvolutionMap::clone() const {
+    SpatialConvolutionMap* ret = new SpatialConvolutionMap(feats_in_,
+      feats_out_, fan_in_, filt_height_, filt_width_);
+    for (uint32_t i = 0; i < feats_out_ * fan_in_; i++) {
+      memcpy(ret->weights[i], weights[i],
+        sizeof(weights[i][0]) * filt_width_ * filt_height_);
+    }
+    for (uint32_t i = 0; i < feats_out_; i++) {
+      memcpy(ret->conn_table[i], conn_table[i],
+        sizeof(conn_table[i][0]) * fan_in_ * 2);
+    }
+    memcpy(ret->biases, biases, sizeof(biases[0]) * feats_out_);
+    return ret;
+  }
+
   void SpatialConvolutionMap::init(TorchData& input, 
     jcl::threading::ThreadPool& tp)  {
     if (input.type() != TorchDataType::TENSOR_DATA) {
@@ -70,9 +84,8 @@ namespace jtorch {
         "FloatTensor expected!");
     }
     Tensor<float>& in = (Tensor<float>&)input;
-    if (in.dim() != 3) {
-      throw std::runtime_error("SpatialConvolution::init() - Input not 3D!");
-    }
+    const uint32_t batch_size = batchSize(in, 3,
+      "SpatialConvolutionMap::init()");
     if (in.size()[2] != feats_in_) {
       throw std::runtime_error("SpatialConvolutionMap::init() - ERROR: "
         "incorrect number of input features!");
@@ -82,22 +95,20 @@ namespace jtorch {
       uint32_t oheight = in.size()[1] - filt_height_ + 1;
       const uint32_t* out_size = TO_TENSOR_PTR(output)->size();
       if (out_size[0] != owidth || out_size[1] != oheight || 
-          out_size[2] != feats_out_) {
+          out_size[2] != feats_out_ || TO_TENSOR_PTR(output)->dim() != 
+          in.dim() || (in.dim() == 4 && out_size[3] != batch_size)) {
         // Input dimension has changed!
         SAFE_DELETE(output);
-        SAFE_DELETE_ARR(output_cpu_);
-        SAFE_DELETE_ARR(input_cpu_);
         SAFE_DELETE(thread_cbs_);
       }
     }
     if (output == NULL) {
-      uint32_t out_dim[3];
+      uint32_t out_dim[4];
       out_dim[0] = in.size()[0] - filt_width_ + 1;
       out_dim[1] = in.size()[1] - filt_height_ + 1;
       out_dim[2] = feats_out_;
-      output = new Tensor<float>(3, out_dim);
-      input_cpu_ = new float[in.nelems()];
-      output_cpu_ = new float[TO_TENSOR_PTR(output)->nelems()];
+      out_dim[3] = batch_size;
+      output = Tensor<float>::uninitialized(in.dim(), out_dim);
     }
     if (thread_cbs_ == NULL) {
       uint32_t n_feats = feats_out_;
@@ -111,12 +122,17 @@ namespace jtorch {
     }
   }
 
-  void SpatialConvolutionMap::forwardProp(TorchData& input) { 
+  void SpatialConvolutionMap::forwardProp(TorchData& strided_input) { 
+    // Contiguous views (even at an offset) are fine as they are
+    TorchData& input = contiguousInput(strided_input, true);
     init(input, *tp_);
     Tensor<float>& in = (Tensor<float>&)input;
     Tensor<float>* out = (Tensor<float>*)output;
-    in.getData(input_cpu_);  // Expensive O(n) copy from the GPU
-    const int32_t n_banks = 1;  // No longer using 4D data
+    // Map rather than copy (zero-copy on CPU and integrated devices)
+    input_cpu_ = in.map(TENSOR_MAP_READ);
+    output_cpu_ = out->map(TENSOR_MAP_WRITE);
+    // Each sample of a batch is a bank
+    const int32_t n_banks = in.dim() == 4 ? (int32_t)in.size()[3] : 1;
     const uint32_t in_bank_size = in.size()[0] * in.size()[1] * in.size()[2];
     const uint32_t out_bank_size = out->size()[0] * out->size()[1] * out->size()[2];
     for (int32_t bank = 0; bank < n_banks; bank++) {
@@ -137,8 +153,11 @@ namespace jtorch {
       }
       ul.unlock();  // Release lock
     }
-    // Now copy the results up to the GPU
-    out->setData(output_cpu_);
+    // Now hand the results back to the device
+    out->unmap();
+    in.unmap();
+    output_cpu_ = NULL;
+    input_cpu_ = NULL;
   }
 
   void SpatialConvolutionMap::forwardPropThread(const uint32_t outf) {
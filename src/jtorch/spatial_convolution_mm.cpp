@@ -1,6 +1,9 @@
 #include "jtorch/spatial_convolution_mm.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jtorch/jtorch.h"
+#include "jtorch/launch_plan.h"
+#include "jtorch/dependency_graph.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -18,9 +21,16 @@ using namespace jcl;
 
 namespace jtorch {
 
+  static KernelHandle gemm_int8_kernel("spatial_convolution_mm.cl", "GemmInt8");
+  static KernelHandle gemm_half_kernel("spatial_convolution_mm.cl", "GemmHalf");
+  static KernelHandle bias_activation_kernel(
+    "spatial_convolution_mm.cl", "BiasActivation");
+  static KernelHandle im2col_kernel(
+    "spatial_convolution_mm.cl", "im2col_kernel");
+
   // Function signatures from Torch (for easy code reuse
   void THCudaBlas_gemm(void* state, char transa, char transb, size_t m, size_t n, size_t k, float alpha, Tensor<float> *a, size_t lda, Tensor<float> *b, size_t ldb, float beta, Tensor<float> *c, size_t ldc);
-  void im2col(const Tensor<float>* data_im, const int channels, const int height, const int width, const int ksize_h, const int ksize_w, const int pad_h, const int pad_w, const int stride_h, const int stride_w, Tensor<float>* data_col);
+  void im2col(const Tensor<float>* data_im, const int channels, const int height, const int width, const int ksize_h, const int ksize_w, const int pad_h, const int pad_w, const int stride_h, const int stride_w, Tensor<float>* data_col, const int batch_size);
 
   SpatialConvolutionMM::SpatialConvolutionMM(const uint32_t feats_in, 
     const uint32_t feats_out, const uint32_t filt_height, 
@@ -34,25 +44,71 @@ namespace jtorch {
     output = NULL;
     ones_ = NULL;
     columns_ = NULL;
+    batch_output_ = NULL;
 
     uint32_t dim = 4;
     uint32_t size[4] = {filt_width_, filt_height_, feats_in_, feats_out_};
-    weights_ = new Tensor<float>(dim, size);
-    biases_ = new Tensor<float>(1, &feats_out_);
+    weights_.reset(new WeightTensor(dim, size, 3));  // Output channels: dim 3
+    biases_.reset(new Tensor<float>(1, &feats_out_));
+    input_quantizer_ = new ActivationQuantizer();
+    activation_.type = ACTIVATION_NONE;
+    activation_.threshold = 0;
+    activation_.val = 0;
   }
 
   SpatialConvolutionMM::~SpatialConvolutionMM() {
     SAFE_DELETE(output);
-    SAFE_DELETE(weights_);
-    SAFE_DELETE(biases_);
     SAFE_DELETE(columns_);
     SAFE_DELETE(ones_);
+    SAFE_DELETE(batch_output_);
+    SAFE_DELETE(input_quantizer_);
+  }
+
+  SpatialConvolutionMM::SpatialConvolutionMM(const SpatialConvolutionMM* src)
+    : TorchStage() {
+    filt_width_ = src->filt_width_;
+    filt_height_ = src->filt_height_;
+    feats_in_ = src->feats_in_;
+    feats_out_ = src->feats_out_;
+    padding_ = src->padding_;
+
+    output = NULL;
+    ones_ = NULL;
+    columns_ = NULL;
+    batch_output_ = NULL;
+    weights_ = src->weights_;
+    biases_ = src->biases_;
+    input_quantizer_ = new ActivationQuantizer();
+    input_quantizer_->copyCalibration(*src->input_quantizer_);
+    activation_ = src->activation_;
+  }
+
+  TorchStage* SpatialConvolutionMM::clone() const {
+    return new SpatialConvolutionMM(this);
+  }
+
+  uint64_t SpatialConvolutionMM::parameterBytes() const {
+    return weights_->bytes() + sizeof(float) * (uint64_t)biases_->nelems();
   }
 
   void SpatialConvolutionMM::setWeights(const float* weights) {
     weights_->setData(weights);
   }
 
+  void SpatialConvolutionMM::setWeightPrecision(
+    const WeightPrecision precision) {
+    weights_->setPrecision(precision);
+  }
+
+  void SpatialConvolutionMM::setCalibrating(const bool calibrating) {
+    input_quantizer_->setCalibrating(calibrating);
+  }
+
+  bool SpatialConvolutionMM::setActivation(const Activation& activation) {
+    activation_ = activation;
+    return true;
+  }
+
   void SpatialConvolutionMM::setBiases(const float* biases) {
     biases_->setData(biases);
   }
@@ -63,9 +119,8 @@ namespace jtorch {
         "FloatTensor expected!");
     }
     Tensor<float>& in = (Tensor<float>&)input;
-    if (in.dim() != 3) {
-      throw std::runtime_error("SpatialConvolutionMM::init() - Input not 3D!");
-    }
+    const uint32_t batch_size = batchSize(in, 3,
+      "SpatialConvolutionMM::init()");
     if (in.size()[2] != feats_in_) {
       throw std::runtime_error("SpatialConvolutionMM::init() - ERROR: "
         "incorrect number of input features!");
@@ -75,11 +130,14 @@ namespace jtorch {
       uint32_t oheight  = in.size()[1] - filt_height_ + 1 + 2 * padding_;
       const uint32_t* out_size = TO_TENSOR_PTR(output)->size();
       if (out_size[0] != owidth || out_size[1] != oheight || 
-        out_size[2] != feats_out_) {
+        out_size[2] != feats_out_ ||
+        TO_TENSOR_PTR(output)->dim() != in.dim() ||
+        (in.dim() == 4 && out_size[3] != batch_size)) {
         // Output size changed
         SAFE_DELETE(output);
         SAFE_DELETE(columns_);
         SAFE_DELETE(ones_);
+        SAFE_DELETE(batch_output_);
       }
     }
 
@@ -90,17 +148,26 @@ namespace jtorch {
       const uint32_t outputHeight = inputHeight - filt_height_ + 1 + 2 * padding_;
 
       // Resize output
-      uint32_t out_dim[3];
+      uint32_t out_dim[4];
       out_dim[0] = outputWidth;
       out_dim[1] = outputHeight;
       out_dim[2] = feats_out_;
-      output = new Tensor<float>(3, out_dim);
+      out_dim[3] = batch_size;
+      // Fully written by forwardProp (see there for the GEMM C buffers)
+      output = Tensor<float>::uninitialized(in.dim(), out_dim);
 
-      // Resize temporary columns
+      // Resize temporary columns (the columns of every sample side by side)
       uint32_t columns_dim[2];
-      columns_dim[0] = outputHeight*outputWidth;
+      columns_dim[0] = outputHeight * outputWidth * batch_size;
       columns_dim[1] = feats_in_ * filt_width_ * filt_height_;
-      columns_ = new Tensor<float>(2, columns_dim);
+      columns_ = Tensor<float>::uninitialized(2, columns_dim);
+
+      if (batch_size > 1) {
+        uint32_t batch_output_dim[2];
+        batch_output_dim[0] = outputHeight * outputWidth * batch_size;
+        batch_output_dim[1] = feats_out_;
+        batch_output_ = Tensor<float>::uninitialized(2, batch_output_dim);
+      }
 
       // Define a buffer of ones, for bias accumulation
       // Note: this buffer can be shared with other modules, it only ever gets increased,
@@ -108,11 +175,14 @@ namespace jtorch {
       uint32_t ones_dim[2];
       ones_dim[0] = outputWidth;
       ones_dim[1] = outputHeight;
-      ones_ = new Tensor<float>(2, ones_dim);
+      ones_ = Tensor<float>::uninitialized(2, ones_dim);
+      Tensor<float>::fill(*ones_, 1);
     }
   }
 
-  void SpatialConvolutionMM::forwardProp(TorchData& input) { 
+  void SpatialConvolutionMM::forwardProp(TorchData& strided_input) { 
+    // Our kernels index the input as a flat array
+    TorchData& input = contiguousInput(strided_input);
     init(input);
 
     Tensor<float>* output_n = TO_TENSOR_PTR(output);
@@ -130,31 +200,89 @@ namespace jtorch {
     const uint32_t padding = padding_;
     const uint32_t dH = 1;
     const uint32_t dW = 1;
+    const uint32_t nBatch = input_n->dim() == 4 ? input_n->size()[3] : 1;
+
+    if (weights_->i8() != NULL) {
+      // clBLAS has no integer GEMM, so we use our own int8 kernel with int32
+      // accumulation (which also adds the bias).  Quantizing the columns 
+      // rather than the input means the padding stays exactly zero.
+      im2col(input_n, nInputPlane, inputHeight, inputWidth, kH, kW, padding, 
+        padding, dH, dW, columns_, nBatch);
+      float in_scale;
+      Tensor<int8_t>* columns_q = 
+        input_quantizer_->quantize(*columns_, in_scale);
+      Kernel* kernel = gemm_int8_kernel.get();
+      kernel->setArg(0, weights_->i8()->storage());
+      kernel->setArg(1, columns_q->storage());
+      kernel->setArg(2, output_n->storage());
+      kernel->setArg(3, weights_->scales()->storage());
+      kernel->setArg(4, biases_->storage());
+      kernel->setArg(5, in_scale);
+      kernel->setArg(6, (int)(outputHeight * outputWidth * nBatch));
+      kernel->setArg(7, (int)(nInputPlane * kH * kW));
+      setActivationArgs(kernel, 8, activation_);
+      kernel->setArg(11, (int)(outputHeight * outputWidth));
+      uint32_t global_size[2] = {outputHeight * outputWidth * nBatch,
+        nOutputPlane};
+      kernel->run(2, global_size, false);
+      return;
+    }
 
-    // Do Bias first:
-    // M,N,K are dims of matrix A and B
-    // (see http://docs.nvidia.com/cuda/cublas/#cublas-lt-t-gt-gemm)
-    uint32_t m_ = nOutputPlane;
-    uint32_t n_ = outputHeight * outputWidth;
-    uint32_t k_ = 1;
-    Tensor<float>::fill(*ones_, 1);
-    // Do GEMM (note: this is a bit confusing because gemm assumes column-major matrices)
-    THCudaBlas_gemm(
-        state,
-        't', 'n',
-        n_, m_, k_,
-        1,
-        ones_, k_,
-        biases_, k_,
-        0,
-        output_n, n_
-    );
+    if (weights_->f16() != NULL) {
+      // clBLAS has no fp16 GEMM either, so fp16 weights use our own kernel
+      // (fp32 accumulation, and it adds the bias)
+      im2col(input_n, nInputPlane, inputHeight, inputWidth, kH, kW, padding,
+        padding, dH, dW, columns_, nBatch);
+      Kernel* kernel = gemm_half_kernel.get();
+      kernel->setArg(0, weights_->f16()->storage());
+      kernel->setArg(1, columns_->storage());
+      kernel->setArg(2, output_n->storage());
+      kernel->setArg(3, biases_->storage());
+      kernel->setArg(4, (int)(outputHeight * outputWidth * nBatch));
+      kernel->setArg(5, (int)(nInputPlane * kH * kW));
+      setActivationArgs(kernel, 6, activation_);
+      kernel->setArg(9, (int)(outputHeight * outputWidth));
+      uint32_t global_size[2] = {outputHeight * outputWidth * nBatch,
+        nOutputPlane};
+      kernel->run(2, global_size, false);
+      return;
+    }
+
+    // With a fused activation or a batch the bias is added in the
+    // BiasActivation epilogue instead.  A batch is one GEMM into
+    // batch_output_ that the epilogue reorders into output.
+    const bool fused = activation_.type != ACTIVATION_NONE || nBatch > 1;
+    Tensor<float>* gemm_output = nBatch > 1 ? batch_output_ : output_n;
+    // The first GEMM into gemm_output uses beta = 0, but clBLAS does not
+    // guarantee C is left unread in that case (0 * NaN garbage would poison
+    // the result).  So C is zeroed before every frame rather than once at
+    // allocation: the buffer pool and MemoryPlanner may hand it stale data.
+    Tensor<float>::fill(*gemm_output, 0);
+    if (!fused) {
+      // Do Bias first:
+      // M,N,K are dims of matrix A and B
+      // (see http://docs.nvidia.com/cuda/cublas/#cublas-lt-t-gt-gemm)
+      uint32_t m_ = nOutputPlane;
+      uint32_t n_ = outputHeight * outputWidth;
+      uint32_t k_ = 1;
+      // Do GEMM (note: this is a bit confusing because gemm assumes column-major matrices)
+      THCudaBlas_gemm(
+          state,
+          't', 'n',
+          n_, m_, k_,
+          1,
+          ones_, k_,
+          biases_.get(), k_,
+          0,
+          output_n, n_
+      );
+    }
 
     // Extract columns:
     im2col(
         input_n,
         nInputPlane, inputHeight, inputWidth, kH, kW, padding, padding, dH, dW,
-        columns_
+        columns_, nBatch
     );
 
     // M,N,K are dims of matrix A and B
@@ -170,7 +298,7 @@ namespace jtorch {
     // long k = weight->size[1];
 
     long m = nOutputPlane;
-    long n = outputHeight * outputWidth;
+    long n = outputHeight * outputWidth * nBatch;
     long k = nInputPlane  *kH * kW;
 
     // Do GEMM (note: this is a bit confusing because gemm assumes column-major matrices)
@@ -180,10 +308,33 @@ namespace jtorch {
         n, m, k,
         1,
         columns_, n,
-        weights_, k,
-        1,
-        output_n, n
+        weights_->f32(), k,
+        fused ? 0.0f : 1.0f,
+        gemm_output, n
     );
+
+    if (fused) {
+      Kernel* kernel = bias_activation_kernel.get();
+      kernel->setArg(0, gemm_output->storage());
+      kernel->setArg(1, output_n->storage());
+      kernel->setArg(2, biases_->storage());
+      kernel->setArg(3, (int)n);
+      kernel->setArg(4, (int)(outputHeight * outputWidth));
+      setActivationArgs(kernel, 5, activation_);
+      uint32_t global_size[2] = {(uint32_t)n, nOutputPlane};
+      kernel->run(2, global_size, false);
+    }
+  }
+
+  void SpatialConvolutionMM::scratchTensors(
+    std::vector<Tensor<float>*>& scratch) {
+    TorchStage::scratchTensors(scratch);
+    if (columns_ != NULL) {
+      scratch.push_back(columns_);  // ones_ is only filled on (re)allocation
+    }
+    if (batch_output_ != NULL) {
+      scratch.push_back(batch_output_);
+    }
   }
 
   TorchStage* SpatialConvolutionMM::loadFromFile(std::ifstream& file) {
@@ -328,47 +479,61 @@ namespace jtorch {
 
 
     clblasOrder order = clblasColumnMajor;  // Not sure what this is
-    cl_command_queue queue = (cl_command_queue)cl_context->queue(jtorch::deviceid);
-    cl_event event = NULL;
-    cl_int err = clblasSgemm(
-      order, 
-      opa, 
-      opb, 
-      m, 
-      n, 
-      k, 
-      alpha, 
-      (cl_mem)cl_context->getCLMem(a->storage()), 
-      0,  // (offA)
-      lda, 
-      (cl_mem)cl_context->getCLMem(b->storage()), 
-      0,  // (offB)
-      ldb, 
-      beta, 
-      (cl_mem)cl_context->getCLMem(c->storage()), 
-      0,  // (offC)
-      ldc,
-      1, &queue, 0, NULL, &event);
-
-    // Non-blocking: Don't wait for events
-    // err = clWaitForEvents( 1, &event );
-
-    if (err != CL_SUCCESS) {
-      std::stringstream ss;
-      ss << "Error clblasSgemm failed: " << getErrorString(err);
-      throw std::runtime_error(ss.str());
+    cl_command_queue queue = CLQueue();
+    cl_mem a_mem = (cl_mem)cl_context->getCLMem(a->storage());
+    cl_mem b_mem = (cl_mem)cl_context->getCLMem(b->storage());
+    cl_mem c_mem = (cl_mem)cl_context->getCLMem(c->storage());
+    std::function<void()> launch = [=]() {
+      cl_command_queue cur_queue = queue;
+      CommandDeps deps;
+      deps.reads(a_mem);
+      deps.reads(b_mem);
+      deps.writes(c_mem);
+      cl_int err = clblasSgemm(
+        order, 
+        opa, 
+        opb, 
+        m, 
+        n, 
+        k, 
+        alpha, 
+        a_mem, 
+        0,  // (offA)
+        lda, 
+        b_mem, 
+        0,  // (offB)
+        ldb, 
+        beta, 
+        c_mem, 
+        0,  // (offC)
+        ldc,
+        1, &cur_queue, deps.numWaits(), deps.waitList(), deps.event());
+
+      if (err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Error clblasSgemm failed: " << getErrorString(err);
+        throw std::runtime_error(ss.str());
+      }
+    };
+    launch();
+    if (LaunchPlan::recording() != NULL) {
+      std::vector<jcl::JCLBuffer> buffers;
+      buffers.push_back(a->storage());
+      buffers.push_back(b->storage());
+      buffers.push_back(c->storage());
+      LaunchPlan::recording()->recordLaunch(launch, buffers);
     }
   }
 
   void im2col(const Tensor<float>* data_im, const int channels,
     const int height, const int width, const int ksize_h, const int ksize_w, 
     const int pad_h, const int pad_w, const int stride_h, const int stride_w, 
-    Tensor<float>* data_col) {
-      // We are going to launch channels * height_col * width_col kernels, each
-      // kernel responsible for copying a single-channel grid.
+    Tensor<float>* data_col, const int batch_size) {
+      // We are going to launch batch_size * channels * height_col * width_col
+      // kernels, each kernel responsible for copying a single-channel grid.
       int height_col = (height + 2 * pad_h - ksize_h) / stride_h + 1;
       int width_col = (width + 2 * pad_w - ksize_w) / stride_w + 1;
-      int num_kernels = channels * height_col * width_col;
+      int num_kernels = batch_size * channels * height_col * width_col;
       // Launch
 
       // The call in torch
@@ -388,26 +553,27 @@ namespace jtorch {
       //    data_col       // 12
       //    );
 
-      std::string kernel = jtorch::jtorch_path + "kernels/spatial_convolution_mm.cl";
-      cl_context->useKernel(kernel.c_str(), "im2col_kernel");
-
-      cl_context->setArg(0, num_kernels);
-      cl_context->setArg(1, TO_TENSOR_PTR(data_im)->storage());
-      cl_context->setArg(2, height);
-      cl_context->setArg(3, width);
-      cl_context->setArg(4, ksize_h);
-      cl_context->setArg(5, ksize_w);
-      cl_context->setArg(6, pad_h);
-      cl_context->setArg(7, pad_w);
-      cl_context->setArg(8, stride_h);
-      cl_context->setArg(9, stride_w);
-      cl_context->setArg(10, height_col);
-      cl_context->setArg(11, width_col);
-      cl_context->setArg(12, TO_TENSOR_PTR(data_col)->storage());
+      Kernel* kernel = im2col_kernel.get();
+
+      kernel->setArg(0, num_kernels);
+      kernel->setArg(1, TO_TENSOR_PTR(data_im)->storage());
+      kernel->setArg(2, height);
+      kernel->setArg(3, width);
+      kernel->setArg(4, ksize_h);
+      kernel->setArg(5, ksize_w);
+      kernel->setArg(6, pad_h);
+      kernel->setArg(7, pad_w);
+      kernel->setArg(8, stride_h);
+      kernel->setArg(9, stride_w);
+      kernel->setArg(10, height_col);
+      kernel->setArg(11, width_col);
+      kernel->setArg(12, TO_TENSOR_PTR(data_col)->storage());
+      kernel->setArg(13, channels);
+      kernel->setArg(14, batch_size);
 
       uint32_t dim = 1;
       const uint32_t global_size[1] = {TO_TENSOR_PTR(data_col)->nelems()};
-      cl_context->runKernel(jtorch::deviceid, dim, global_size, false);
+      kernel->run(dim, global_size, false);
   }
 
 }  // namespace jtorch
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "jtorch/spatial_divisive_normalization.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -14,6 +15,27 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static KernelHandle spatial_divisive_normalization_horiz_kernel(
+    "spatial_divisive_normalization.cl", "SpatialDivisiveNormalizationHoriz");
+  static KernelHandle spatial_divisive_normalization_vert_kernel(
+    "spatial_divisive_normalization.cl", "SpatialDivisiveNormalizationVert");
+  static KernelHandle spatial_divisive_normalization_2d_kernel(
+    "spatial_divisive_normalization.cl", "SpatialDivisiveNormalization2D");
+  static KernelHandle spatial_divisive_normalization_accum_div_kernel(
+    "spatial_divisive_normalization.cl",
+    "SpatialDivisiveNormalizationAccumDiv");
+  static KernelHandle spatial_divisive_normalization_kernel(
+    "spatial_divisive_normalization.cl", "SpatialDivisiveNormalization");
+  // Only the kernels that touch the input or output have fp16 variants
+  static KernelHandle spatial_divisive_normalization_horiz_half_kernel(
+    "spatial_divisive_normalization_half.cl",
+    "SpatialDivisiveNormalizationHoriz");
+  static KernelHandle spatial_divisive_normalization_2d_half_kernel(
+    "spatial_divisive_normalization_half.cl",
+    "SpatialDivisiveNormalization2D");
+  static KernelHandle spatial_divisive_normalization_half_kernel(
+    "spatial_divisive_normalization_half.cl", "SpatialDivisiveNormalization");
+
   // kernel1d default is either TorchStage::gaussian1D<float>(n) or just a
   // vector of 1 values.
   SpatialDivisiveNormalization::SpatialDivisiveNormalization(
@@ -28,7 +50,7 @@ namespace jtorch {
           "Averaging kernel must have odd size!");
     }
 
-    kernel_ = Tensor<float>::clone(kernel);
+    kernel_.reset(Tensor<float>::clone(kernel));
     kernel_norm_ = NULL;   // Normalization is input size dependant
 
     output = NULL;
@@ -40,13 +62,40 @@ namespace jtorch {
     threshold_ = threshold;
   }
 
+  SpatialDivisiveNormalization::SpatialDivisiveNormalization(
+    const SpatialDivisiveNormalization* src) : TorchStage() {
+    kernel_ = src->kernel_;
+    kernel_norm_ = NULL;
+    output = NULL;
+    std_coef_ = NULL;
+    std_pass1_ = NULL;
+    std_pass2_ = NULL;
+    std_ = NULL;
+    threshold_ = src->threshold_;
+  }
+
   SpatialDivisiveNormalization::~SpatialDivisiveNormalization() {
     cleanup();
   }
 
+  TorchStage* SpatialDivisiveNormalization::clone() const {
+    TorchStage* ret = new SpatialDivisiveNormalization(this);
+    ret->setOutputPrecision(output_precision_);
+    return ret;
+  }
+
+  void SpatialDivisiveNormalization::setOutputPrecision(
+    const OutputPrecision precision) {
+    output_precision_ = precision;
+  }
+
+  uint64_t SpatialDivisiveNormalization::parameterBytes() const {
+    return sizeof(float) * (uint64_t)kernel_->nelems();
+  }
+
   void SpatialDivisiveNormalization::cleanup() {
+    // kernel_ is not input size dependant, so it is kept
     SAFE_DELETE(output);
-    SAFE_DELETE(kernel_);
     SAFE_DELETE(kernel_norm_);
     SAFE_DELETE(std_coef_);
     SAFE_DELETE(std_pass1_);
@@ -54,29 +103,40 @@ namespace jtorch {
     SAFE_DELETE(std_);
   }
 
-  void SpatialDivisiveNormalization::init(TorchData& input)  {
-    if (input.type() != TorchDataType::TENSOR_DATA) {
-      throw std::runtime_error("SpatialDivisiveNormalization::init() - "
-        "FloatTensor expected!");
-    }
-    Tensor<float>& in = (Tensor<float>&)input;
+  template <typename T>
+  void SpatialDivisiveNormalization::init(Tensor<T>& in)  {
+    const uint32_t batch_size = batchSize(in, 3,
+      "SpatialDivisiveNormalization::init()");
 
-    if (in.dim() != 3) {
-      throw std::runtime_error("SpatialDivisiveNormalization::init() - "
-        "3D input is expected!");
+    if (output != NULL && output->type() != in.type()) {
+      // The precision has changed (the passes are reallocated with output)
+      SAFE_DELETE(output);
+      SAFE_DELETE(std_pass1_);
+      SAFE_DELETE(std_pass2_);
+      SAFE_DELETE(std_);
     }
 
     if (output != NULL) {
-      if (!in.isSameSizeAs(*(Tensor<float>*)output)) {
+      if (sameSampleSize(in, *(Tensor<T>*)output, 3)) {
+        if (!in.isSameSizeAs(*(Tensor<T>*)output)) {
+          // Only the batch size has changed: kernel_norm_ and std_coef_
+          // (computed on the CPU) depend on the sample size alone, so they
+          // are kept
+          SAFE_DELETE(output);
+          SAFE_DELETE(std_pass1_);
+          SAFE_DELETE(std_pass2_);
+          SAFE_DELETE(std_);
+        }
+      } else {
         // Input dimension has changed!
         cleanup();
       }
     }
 
     if (output == NULL) {
-      output = new Tensor<float>(in.dim(), in.size());
-      std_pass1_ = new Tensor<float>(in.dim(), in.size());
-      std_pass2_ = new Tensor<float>(in.dim(), in.size());
+      output = Tensor<T>::uninitialized(in.dim(), in.size());
+      std_pass1_ = Tensor<float>::uninitialized(in.dim(), in.size());
+      std_pass2_ = Tensor<float>::uninitialized(in.dim(), in.size());
 
       //cl_context->getOptimalLocalWorkgroupSizes(deviceid, 
       //  TO_TENSOR_PTR(output)->dim(), local_worgroup_size_3d);
@@ -87,15 +147,15 @@ namespace jtorch {
 
       // Clone and normalize the input kernel
       kernel_norm_ = Tensor<float>::clone(*kernel_);
-      float sum = Tensor<float>::slowSum(*kernel_norm_);
+      float sum = Tensor<float>::sum(*kernel_norm_);
       float div_val = onedim_kernel ? (sum * sqrtf(n_feats)) : (sum * n_feats);
       Tensor<float>::div(*kernel_norm_, div_val);
     }
     if (std_coef_ == NULL) {
       uint32_t std_coeff_size[2];
-      std_coeff_size[0] = TO_TENSOR_PTR(output)->size()[0];
-      std_coeff_size[1] = TO_TENSOR_PTR(output)->size()[1];
-      std_coef_ = new Tensor<float>(2, std_coeff_size);
+      std_coeff_size[0] = in.size()[0];
+      std_coeff_size[1] = in.size()[1];
+      std_coef_ = Tensor<float>::uninitialized(2, std_coeff_size);
 
       float* std_coef_cpu = new float[std_coef_->nelems()];
       float* kernel_norm_cpu = new float[kernel_norm_->nelems()];
@@ -105,9 +165,9 @@ namespace jtorch {
       // Filter an image of all 1 values to create the normalization constants
       // See norm_test.lua for proof that this works as well as:
       // https://github.com/andresy/torch/blob/master/extra/nn/SpatialDivisiveNormalization.lua
-      int32_t n_feats = TO_TENSOR_PTR(output)->size()[2];
-      int32_t height = TO_TENSOR_PTR(output)->size()[1];
-      int32_t width = TO_TENSOR_PTR(output)->size()[0];
+      int32_t n_feats = in.size()[2];
+      int32_t height = in.size()[1];
+      int32_t width = in.size()[0];
       if (onedim_kernel) {
         // 1D case - The filter is seperable, but we'll just do the dumb 2D 
         // version since we only do this once on startup.  --> O(n * m)
@@ -160,74 +220,106 @@ namespace jtorch {
       delete[] kernel_norm_cpu;
     }
     if (std_ == NULL) {
-      uint32_t std_coeff_size[2];
-      std_coeff_size[0] = TO_TENSOR_PTR(output)->size()[0];
-      std_coeff_size[1] = TO_TENSOR_PTR(output)->size()[1];
-      std_ = new Tensor<float>(2, std_coeff_size);
+      // One 2D map per sample
+      uint32_t std_size[3];
+      std_size[0] = in.size()[0];
+      std_size[1] = in.size()[1];
+      std_size[2] = batch_size;
+      std_ = Tensor<float>::uninitialized(in.dim() - 1, std_size);
 
       //cl_context->getOptimalLocalWorkgroupSizes(deviceid, std_->dim(), 
       //  local_worgroup_size_2d);
     }
   }
 
-  void SpatialDivisiveNormalization::forwardProp(TorchData& input) { 
-    init(input);
+  void SpatialDivisiveNormalization::forwardProp(TorchData& strided_input) { 
+    if (output_precision_ == OUTPUT_PRECISION_HALF) {
+      run(halfInput(strided_input,
+        "SpatialDivisiveNormalization::forwardProp()"));
+      return;
+    }
+    // Our kernels index the input as a flat array
+    TorchData& input = contiguousInput(strided_input);
+    if (input.type() != TorchDataType::TENSOR_DATA) {
+      throw std::runtime_error("SpatialDivisiveNormalization::init() - "
+        "FloatTensor expected!");
+    }
+    run((Tensor<float>&)input);
+  }
+
+  template <typename T>
+  void SpatialDivisiveNormalization::run(Tensor<T>& in) {
+    init(in);
     bool onedim_kernel = kernel_->dim() == 1;
 
-    std::string kernel = jtorch::jtorch_path + 
-      "kernels/spatial_divisive_normalization.cl";
-    Tensor<float>& in = (Tensor<float>&)input;
-    Tensor<float>* out = (Tensor<float>*)output;
+    Kernel* kernel;
+    Tensor<T>* out = (Tensor<T>*)output;
+    uint32_t global_size[3];
+    planeWorkSize(in, global_size);
     if (onedim_kernel) {
       int32_t filt_rad = ((int32_t)kernel_norm_->size()[0] - 1) / 2;
 
       // Perform horizontal filter pass
-      cl_context->useKernel(kernel.c_str(), "SpatialDivisiveNormalizationHoriz");
-      cl_context->setArg(0, in.storage());
-      cl_context->setArg(1, std_pass1_->storage());
-      cl_context->setArg(2, kernel_norm_->storage());
-      cl_context->setArg(3, filt_rad);
-      cl_context->runKernel(jtorch::deviceid, std_pass1_->dim(), 
-        std_pass1_->size(), false);
+      kernel = KernelFor<T>(spatial_divisive_normalization_horiz_kernel,
+        spatial_divisive_normalization_horiz_half_kernel);
+      kernel->setArg(0, in.storage());
+      kernel->setArg(1, std_pass1_->storage());
+      kernel->setArg(2, kernel_norm_->storage());
+      kernel->setArg(3, filt_rad);
+      kernel->run(3, global_size, false);
 
       // Perform vertical filter pass
-      cl_context->useKernel(kernel.c_str(), "SpatialDivisiveNormalizationVert");
-      cl_context->setArg(0, std_pass1_->storage());
-      cl_context->setArg(1, std_pass2_->storage());
-      cl_context->setArg(2, kernel_norm_->storage());
-      cl_context->setArg(3, filt_rad);
-      cl_context->runKernel(jtorch::deviceid, std_pass2_->dim(), 
-        std_pass2_->size(), false);
+      kernel = spatial_divisive_normalization_vert_kernel.get();
+      kernel->setArg(0, std_pass1_->storage());
+      kernel->setArg(1, std_pass2_->storage());
+      kernel->setArg(2, kernel_norm_->storage());
+      kernel->setArg(3, filt_rad);
+      kernel->run(3, global_size, false);
     } else {
       int32_t filt_rad_u = ((int32_t)kernel_norm_->size()[0] - 1) / 2;
       int32_t filt_rad_v = ((int32_t)kernel_norm_->size()[1] - 1) / 2;
 
       // Perform vertical filter pass
-      cl_context->useKernel(kernel.c_str(), "SpatialDivisiveNormalization2D");
-      cl_context->setArg(0, in.storage());
-      cl_context->setArg(1, std_pass2_->storage());
-      cl_context->setArg(2, kernel_norm_->storage());
-      cl_context->setArg(3, filt_rad_u);
-      cl_context->setArg(4, filt_rad_v);
-      cl_context->runKernel(jtorch::deviceid, std_pass2_->dim(), 
-        std_pass2_->size(), false);
+      kernel = KernelFor<T>(spatial_divisive_normalization_2d_kernel,
+        spatial_divisive_normalization_2d_half_kernel);
+      kernel->setArg(0, in.storage());
+      kernel->setArg(1, std_pass2_->storage());
+      kernel->setArg(2, kernel_norm_->storage());
+      kernel->setArg(3, filt_rad_u);
+      kernel->setArg(4, filt_rad_v);
+      kernel->run(3, global_size, false);
     }
 
     // Perform accumulation and division pass
-    cl_context->useKernel(kernel.c_str(), "SpatialDivisiveNormalizationAccumDiv");
-    cl_context->setArg(0, std_pass2_->storage());
-    cl_context->setArg(1, std_->storage());
-    cl_context->setArg(2, std_coef_->storage());
-    cl_context->setArg(3, (int)out->size()[2]);
-    cl_context->setArg(4, threshold_);
-    cl_context->runKernel(jtorch::deviceid, std_->dim(), std_->size(), false);
+    kernel = spatial_divisive_normalization_accum_div_kernel.get();
+    kernel->setArg(0, std_pass2_->storage());
+    kernel->setArg(1, std_->storage());
+    kernel->setArg(2, std_coef_->storage());
+    kernel->setArg(3, (int)out->size()[2]);
+    kernel->setArg(4, threshold_);
+    global_size[2] = std_->dim() == 3 ? std_->size()[2] : 1;
+    kernel->run(3, global_size, false);
 
     // Perform normalization pass
-    cl_context->useKernel(kernel.c_str(), "SpatialDivisiveNormalization");
-    cl_context->setArg(0, in.storage());
-    cl_context->setArg(1, out->storage());
-    cl_context->setArg(2, std_->storage());
-    cl_context->runKernel(jtorch::deviceid, out->dim(), out->size(), false);
+    kernel = KernelFor<T>(spatial_divisive_normalization_kernel,
+      spatial_divisive_normalization_half_kernel);
+    kernel->setArg(0, in.storage());
+    kernel->setArg(1, out->storage());
+    kernel->setArg(2, std_->storage());
+    kernel->setArg(3, (int)out->size()[2]);
+    planeWorkSize(*out, global_size);
+    kernel->run(3, global_size, false);
+  }
+
+  void SpatialDivisiveNormalization::scratchTensors(
+    std::vector<Tensor<float>*>& scratch) {
+    TorchStage::scratchTensors(scratch);
+    // std_coef_ and kernel_norm_ are only computed in init()
+    if (std_ != NULL) {
+      scratch.push_back(std_pass1_);
+      scratch.push_back(std_pass2_);
+      scratch.push_back(std_);
+    }
   }
 
   TorchStage* SpatialDivisiveNormalization::loadFromFile(std::ifstream& file) {
@@ -242,11 +334,11 @@ namespace jtorch {
       // The kernel is 2D
       uint32_t dim = 2;
       uint32_t size[2] = {kernel_size_1, kernel_size_2};
-      kernel = new Tensor<float>(dim, size);
+      kernel = Tensor<float>::uninitialized(dim, size);
     } else {
       uint32_t dim = 1;
       uint32_t size[1] = {kernel_size_1};
-      kernel = new Tensor<float>(dim, size);
+      kernel = Tensor<float>::uninitialized(dim, size);
     }
     float* kernel_cpu = new float[kernel->nelems()];
     file.read((char*)(kernel_cpu), kernel->nelems() * sizeof(*kernel_cpu));
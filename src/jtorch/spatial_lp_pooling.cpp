@@ -31,8 +31,6 @@ namespace jtorch {
   }
 
   void SpatialLPPooling::cleanup() {
-    SAFE_DELETE_ARR(output_cpu_);
-    SAFE_DELETE_ARR(input_cpu_);
     SAFE_DELETE(output);
     SAFE_DELETE(thread_cbs_);
   }
@@ -43,25 +41,34 @@ namespace jtorch {
     cleanup();
   }
 
-  void SpatialLPPooling::init(TorchData& input, ThreadPool& tp)  {
-    if (input.type() != TorchDataType::TENSOR_DATA) {
-      throw std::runtime_error("SpatialLPPooling::init() - "
-        "FloatTensor expected!");
-    }
-    Tensor<float>& in = (Tensor<float>&)input;
-    if (in.dim() != 2 && in.dim() != 3) {
-      throw std::runtime_error("Input dimension must be 2D or 3D!");
+  TorchStage* SpatialLPPooling::clone() const {
+    SpatialLPPooling* ret = new SpatialLPPooling(p_norm_, poolsize_v_,
+      poolsize_u_);
+    ret->setOutputPrecision(output_precision_);
+    return ret;
+  }
+
+  void SpatialLPPooling::setOutputPrecision(const OutputPrecision precision) {
+    output_precision_ = precision;
+  }
+
+  template <typename T>
+  void SpatialLPPooling::init(Tensor<T>& in, ThreadPool& tp)  {
+    if (in.dim() < 2 || in.dim() > 4) {
+      throw std::runtime_error("Input dimension must be 2D, 3D or 4D (a "
+        "batch)!");
     }
 
-    if (output != NULL && TO_TENSOR_PTR(output)->dim() != in.dim()) {
-      // Input dimension has changed!
+    if (output != NULL && (output->type() != in.type() ||
+      ((Tensor<T>*)output)->dim() != in.dim())) {
+      // Input dimension (or precision) has changed!
       cleanup();
     }
 
     if (output != NULL) {
       // Check that the dimensions above the lowest 2 match
       for (uint32_t i = 2; i < in.dim() && output != NULL; i++) {
-        if (TO_TENSOR_PTR(output)->size()[i] != in.size()[i]) {
+        if (((Tensor<T>*)output)->size()[i] != in.size()[i]) {
           cleanup();
         }
       }
@@ -69,8 +76,8 @@ namespace jtorch {
 
     if (output != NULL) {
       // Check that the lowest 2 dimensions are the correct size
-      if (TO_TENSOR_PTR(output)->size()[0] != in.size()[0] / poolsize_u_ ||
-        TO_TENSOR_PTR(output)->size()[1] != in.size()[1] / poolsize_v_) {
+      if (((Tensor<T>*)output)->size()[0] != in.size()[0] / poolsize_u_ ||
+        ((Tensor<T>*)output)->size()[1] != in.size()[1] / poolsize_v_) {
         cleanup();
       }
     }
@@ -89,16 +96,15 @@ namespace jtorch {
         out_size[i] = in.size()[i];
       }
 
-      output = new Tensor<float>(in.dim(), out_size);
-      input_cpu_ = new float[in.nelems()];
-      output_cpu_ = new float[TO_TENSOR_PTR(output)->nelems()];
+      output = Tensor<T>::uninitialized(in.dim(), out_size);
       SAFE_DELETE_ARR(out_size);
     }
 
     if (thread_cbs_ == NULL) {
+      // One thread per feature of every sample
       uint32_t n_threads = 1;
-      if (in.dim() > 2) {
-        n_threads = TO_TENSOR_PTR(output)->size()[2];
+      for (uint32_t i = 2; i < in.dim(); i++) {
+        n_threads *= in.size()[i];
       }
       thread_cbs_ = new VectorManaged<Callback<void>*>(n_threads);
       for (uint32_t f = 0; f < n_threads; f++) {
@@ -108,12 +114,32 @@ namespace jtorch {
     }
   }
 
-  void SpatialLPPooling::forwardProp(TorchData& input) { 
+  void SpatialLPPooling::forwardProp(TorchData& strided_input) { 
+    if (output_precision_ == OUTPUT_PRECISION_HALF) {
+      run(halfInput(strided_input, "SpatialLPPooling::forwardProp()"));
+      return;
+    }
+    // Contiguous views (even at an offset) are fine as they are
+    TorchData& input = contiguousInput(strided_input, true);
+    if (input.type() != TorchDataType::TENSOR_DATA) {
+      throw std::runtime_error("SpatialLPPooling::init() - "
+        "FloatTensor expected!");
+    }
+    run((Tensor<float>&)input);
+  }
+
+  template <typename T>
+  void SpatialLPPooling::run(Tensor<T>& input) {
     init(input, *tp_);
-    Tensor<float>*in = &((Tensor<float>&)input);
-    in->getData(input_cpu_);
+    Tensor<T>* in = &input;
+    Tensor<T>* out = (Tensor<T>*)output;
+    // Map rather than copy (zero-copy on CPU and integrated devices)
+    input_cpu_ = in->map(TENSOR_MAP_READ);
+    output_cpu_ = out->map(TENSOR_MAP_WRITE);
     cur_in_w = in->size()[0];
     cur_in_h = in->size()[1];
+    cur_out_w = out->size()[0];
+    cur_out_h = out->size()[1];
     threads_finished_ = 0;
     for (uint32_t i = 0; i < thread_cbs_->size(); i++) {
       tp_->addTask((*thread_cbs_)[i]);
@@ -125,34 +151,45 @@ namespace jtorch {
       not_finished_.wait(ul);
     }
     ul.unlock();  // Release lock
-    TO_TENSOR_PTR(output)->setData(output_cpu_);
+    out->unmap();
+    in->unmap();
+    output_cpu_ = NULL;
+    input_cpu_ = NULL;
   }
 
-  void SpatialLPPooling::forwardPropThread(const uint32_t outf) {
-    const uint32_t out_w = TO_TENSOR_PTR(output)->size()[0];
-    const uint32_t out_h = TO_TENSOR_PTR(output)->size()[1];
+  template <typename T>
+  void SpatialLPPooling::poolPlane(const T* in, T* out) {
+    const uint32_t out_w = cur_out_w;
+    const uint32_t out_h = cur_out_h;
     const uint32_t in_w = cur_in_w;
-    const uint32_t in_h = cur_in_h;
     const float one_over_p_norm = 1.0f / p_norm_;
 
-    float* out = &output_cpu_[outf * out_w * out_h];
-    float* in = &input_cpu_[outf * in_w * in_h];
-      
     for (uint32_t outv = 0; outv < out_h; outv++) {
       for (uint32_t outu = 0; outu < out_w; outu++) {
-        uint32_t out_index = outv * out_w + outu;
-        out[out_index] = 0.0f;
+        // Accumulate in float (T may be the fp16 storage type)
+        float sum = 0.0f;
         // Now perform max pooling:
         for (uint32_t inv = outv * poolsize_v_; inv < (outv + 1) * poolsize_v_; inv++) {
           for (uint32_t inu = outu * poolsize_u_; inu < (outu + 1) * poolsize_u_; inu++) {
-            float val = fabsf(in[inv * in_w + inu]);
-            out[out_index] += powf(val, p_norm_);
+            float val = fabsf((float)in[inv * in_w + inu]);
+            sum += powf(val, p_norm_);
           }
         }
-        out[outv * out_w + outu] = powf(out[outv * out_w + outu], 
-          one_over_p_norm);
+        out[outv * out_w + outu] = powf(sum, one_over_p_norm);
       }
     }
+  }
+
+  void SpatialLPPooling::forwardPropThread(const uint32_t outf) {
+    const uint32_t out_plane = outf * cur_out_w * cur_out_h;
+    const uint32_t in_plane = outf * cur_in_w * cur_in_h;
+    if (output_precision_ == OUTPUT_PRECISION_HALF) {
+      poolPlane((const half*)input_cpu_ + in_plane,
+        (half*)output_cpu_ + out_plane);
+    } else {
+      poolPlane((const float*)input_cpu_ + in_plane,
+        (float*)output_cpu_ + out_plane);
+    }
     std::unique_lock<std::mutex> ul(thread_update_lock_);
     threads_finished_++;
     not_finished_.notify_all();  // Signify that all threads might have finished
@@ -1,5 +1,6 @@
 #include "jtorch/spatial_max_pooling.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -14,6 +15,15 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static KernelHandle spatial_max_pooling_2d_kernel(
+    "spatial_max_pooling.cl", "SpatialMaxPooling2D");
+  static KernelHandle spatial_max_pooling_kernel(
+    "spatial_max_pooling.cl", "SpatialMaxPooling");
+  static KernelHandle spatial_max_pooling_2d_half_kernel(
+    "spatial_max_pooling_half.cl", "SpatialMaxPooling2D");
+  static KernelHandle spatial_max_pooling_half_kernel(
+    "spatial_max_pooling_half.cl", "SpatialMaxPooling");
+
   SpatialMaxPooling::SpatialMaxPooling(const uint32_t poolsize_v, 
     const uint32_t poolsize_u) : TorchStage() {
     poolsize_v_ = poolsize_v;
@@ -25,25 +35,34 @@ namespace jtorch {
     SAFE_DELETE(output);
   }
 
-  void SpatialMaxPooling::init(TorchData& input)  {
-    if (input.type() != TorchDataType::TENSOR_DATA) {
-      throw std::runtime_error("SpatialMaxPooling::init() - "
-        "FloatTensor expected!");
-    }
-    Tensor<float>& in = (Tensor<float>&)input;
-    if (in.dim() != 2 && in.dim() != 3) {
-      throw std::runtime_error("Input dimension must be 2D or 3D!");
+  TorchStage* SpatialMaxPooling::clone() const {
+    SpatialMaxPooling* ret = new SpatialMaxPooling(poolsize_v_, poolsize_u_);
+    ret->setOutputPrecision(output_precision_);
+    return ret;
+  }
+
+  void SpatialMaxPooling::setOutputPrecision(
+    const OutputPrecision precision) {
+    output_precision_ = precision;
+  }
+
+  template <typename T>
+  void SpatialMaxPooling::init(Tensor<T>& in)  {
+    if (in.dim() < 2 || in.dim() > 4) {
+      throw std::runtime_error("Input dimension must be 2D, 3D or 4D (a "
+        "batch)!");
     }
 
-    if (output != NULL && TO_TENSOR_PTR(output)->dim() != in.dim()) {
-      // Input dimension has changed!
+    if (output != NULL && (output->type() != in.type() ||
+      ((Tensor<T>*)output)->dim() != in.dim())) {
+      // Input dimension (or precision) has changed!
       SAFE_DELETE(output);
     }
 
     if (output != NULL) {
       // Check that the dimensions above the lowest 2 match
       for (uint32_t i = 2; i < in.dim() && output != NULL; i++) {
-        if (TO_TENSOR_PTR(output)->size()[i] != in.size()[i]) {
+        if (((Tensor<T>*)output)->size()[i] != in.size()[i]) {
           SAFE_DELETE(output);
         }
       }
@@ -51,8 +70,8 @@ namespace jtorch {
 
     if (output != NULL) {
       // Check that the lowest 2 dimensions are the correct size
-      if (TO_TENSOR_PTR(output)->size()[0] != in.size()[0] / poolsize_u_ ||
-        TO_TENSOR_PTR(output)->size()[1] != in.size()[1] / poolsize_v_) {
+      if (((Tensor<T>*)output)->size()[0] != in.size()[0] / poolsize_u_ ||
+        ((Tensor<T>*)output)->size()[1] != in.size()[1] / poolsize_v_) {
         SAFE_DELETE(output);
       }
     }
@@ -69,28 +88,52 @@ namespace jtorch {
       for (uint32_t i = 2; i < in.dim(); i++) {
         out_size[i] = in.size()[i];
       }
-      output = new Tensor<float>(in.dim(), out_size);
+      output = Tensor<T>::uninitialized(in.dim(), out_size);
       SAFE_DELETE_ARR(out_size);
     }
   }
 
-  void SpatialMaxPooling::forwardProp(TorchData& input) { 
-    init(input);
-    std::string kernel = jtorch::jtorch_path + "kernels/spatial_max_pooling.cl";
-    bool two_dim = ((Tensor<float>&)input).dim() == 2;
+  void SpatialMaxPooling::forwardProp(TorchData& strided_input) { 
+    if (output_precision_ == OUTPUT_PRECISION_HALF) {
+      run(halfInput(strided_input, "SpatialMaxPooling::forwardProp()"));
+      return;
+    }
+    // Our kernels index the input as a flat array
+    TorchData& input = contiguousInput(strided_input);
+    if (input.type() != TorchDataType::TENSOR_DATA) {
+      throw std::runtime_error("SpatialMaxPooling::init() - "
+        "FloatTensor expected!");
+    }
+    run((Tensor<float>&)input);
+  }
+
+  template <typename T>
+  void SpatialMaxPooling::run(Tensor<T>& in) {
+    init(in);
+    Tensor<T>* out = (Tensor<T>*)output;
+    Kernel* kernel;
+    bool two_dim = in.dim() == 2;
+    if (two_dim) {
+      kernel = KernelFor<T>(spatial_max_pooling_2d_kernel,
+        spatial_max_pooling_2d_half_kernel);
+    } else {
+      kernel = KernelFor<T>(spatial_max_pooling_kernel,
+        spatial_max_pooling_half_kernel);
+    }
+    kernel->setArg(0, in.storage());
+    kernel->setArg(1, out->storage());
+    kernel->setArg(2, (int)in.size()[1]);
+    kernel->setArg(3, (int)in.size()[0]);
+    kernel->setArg(4, (int)poolsize_v_);
+    kernel->setArg(5, (int)poolsize_u_);
     if (two_dim) {
-      cl_context->useKernel(kernel.c_str(), "SpatialMaxPooling2D");
+      kernel->run(2, out->size(), false);
     } else {
-      cl_context->useKernel(kernel.c_str(), "SpatialMaxPooling");
+      // Every feature of every sample is pooled separately
+      uint32_t global_size[3];
+      planeWorkSize(*out, global_size);
+      kernel->run(3, global_size, false);
     }
-    cl_context->setArg(0, ((Tensor<float>&)input).storage());
-    cl_context->setArg(1, TO_TENSOR_PTR(output)->storage());
-    cl_context->setArg(2, (int)((Tensor<float>&)input).size()[1]);
-    cl_context->setArg(3, (int)((Tensor<float>&)input).size()[0]);
-    cl_context->setArg(4, (int)poolsize_v_);
-    cl_context->setArg(5, (int)poolsize_u_);
-    cl_context->runKernel(jtorch::deviceid, TO_TENSOR_PTR(output)->dim(),
-      TO_TENSOR_PTR(output)->size(), false);
   }
 
   TorchStage* SpatialMaxPooling::loadFromFile(std::ifstream& file) {
@@ -1,5 +1,6 @@
 #include "jtorch/spatial_subtractive_normalization.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -14,6 +15,36 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static KernelHandle spatial_subtractive_normalization_horiz_kernel(
+    "spatial_subtractive_normalization.cl",
+    "SpatialSubtractiveNormalizationHoriz");
+  static KernelHandle spatial_subtractive_normalization_vert_kernel(
+    "spatial_subtractive_normalization.cl",
+    "SpatialSubtractiveNormalizationVert");
+  static KernelHandle spatial_subtractive_normalization_2d_kernel(
+    "spatial_subtractive_normalization.cl",
+    "SpatialSubtractiveNormalization2D");
+  static KernelHandle spatial_subtractive_normalization_accum_div_kernel(
+    "spatial_subtractive_normalization.cl",
+    "SpatialSubtractiveNormalizationAccumDiv");
+  static KernelHandle spatial_subtractive_normalization_kernel(
+    "spatial_subtractive_normalization.cl", "SpatialSubtractiveNormalization");
+  static KernelHandle spatial_subtractive_normalization_horiz_half_kernel(
+    "spatial_subtractive_normalization_half.cl",
+    "SpatialSubtractiveNormalizationHoriz");
+  static KernelHandle spatial_subtractive_normalization_vert_half_kernel(
+    "spatial_subtractive_normalization_half.cl",
+    "SpatialSubtractiveNormalizationVert");
+  static KernelHandle spatial_subtractive_normalization_2d_half_kernel(
+    "spatial_subtractive_normalization_half.cl",
+    "SpatialSubtractiveNormalization2D");
+  static KernelHandle spatial_subtractive_normalization_accum_div_half_kernel(
+    "spatial_subtractive_normalization_half.cl",
+    "SpatialSubtractiveNormalizationAccumDiv");
+  static KernelHandle spatial_subtractive_normalization_half_kernel(
+    "spatial_subtractive_normalization_half.cl",
+    "SpatialSubtractiveNormalization");
+
   // kernel1d default is either TorchStage::gaussian1D<float>(n) or just a
   // vector of 1 values.
   SpatialSubtractiveNormalization::SpatialSubtractiveNormalization(
@@ -29,8 +60,8 @@ namespace jtorch {
     }
 
     // Clone and normalize the input kernel
-    kernel_ = Tensor<float>::clone(kernel);
-    float sum = Tensor<float>::slowSum(*kernel_);
+    kernel_.reset(Tensor<float>::clone(kernel));
+    float sum = Tensor<float>::sum(*kernel_);
     Tensor<float>::div(*kernel_, sum);
 
     output = NULL;
@@ -40,54 +71,88 @@ namespace jtorch {
     mean_ = NULL;
   }
 
+  SpatialSubtractiveNormalization::SpatialSubtractiveNormalization(
+    const SpatialSubtractiveNormalization* src) : TorchStage() {
+    kernel_ = src->kernel_;
+    output = NULL;
+    mean_coef_ = NULL;
+    mean_pass1_ = NULL;
+    mean_pass2_ = NULL;
+    mean_ = NULL;
+  }
+
   SpatialSubtractiveNormalization::~SpatialSubtractiveNormalization() {
     SAFE_DELETE(output);
-    SAFE_DELETE(kernel_);
     SAFE_DELETE(mean_coef_);
     SAFE_DELETE(mean_pass1_);
     SAFE_DELETE(mean_pass2_);
     SAFE_DELETE(mean_);
   }
 
+  TorchStage* SpatialSubtractiveNormalization::clone() const {
+    TorchStage* ret = new SpatialSubtractiveNormalization(this);
+    ret->setOutputPrecision(output_precision_);
+    return ret;
+  }
+
+  void SpatialSubtractiveNormalization::setOutputPrecision(
+    const OutputPrecision precision) {
+    output_precision_ = precision;
+  }
+
+  uint64_t SpatialSubtractiveNormalization::parameterBytes() const {
+    return sizeof(float) * (uint64_t)kernel_->nelems();
+  }
+
   void SpatialSubtractiveNormalization::cleanup() {
+    // kernel_ is not input size dependant, so it is kept
     SAFE_DELETE(output);
-    SAFE_DELETE(kernel_);
     SAFE_DELETE(mean_coef_);
     SAFE_DELETE(mean_pass1_);
     SAFE_DELETE(mean_pass2_);
     SAFE_DELETE(mean_);
   }
 
-  void SpatialSubtractiveNormalization::init(TorchData& input)  {
-    if (input.type() != TorchDataType::TENSOR_DATA) {
-      throw std::runtime_error("SpatialSubtractiveNormalization::init() - "
-        "FloatTensor expected!");
-    }
-    Tensor<float>& in = (Tensor<float>&)input;
+  template <typename T>
+  void SpatialSubtractiveNormalization::init(Tensor<T>& in)  {
+    const uint32_t batch_size = batchSize(in, 3,
+      "SpatialSubtractiveNormalization::init()");
 
-    if (in.dim() != 3) {
-      throw std::runtime_error("SpatialDivisiveNormalization::init() - "
-        "3D input is expected!");
+    if (output != NULL && output->type() != in.type()) {
+      // The precision has changed (mean_coef_ is always float)
+      SAFE_DELETE(output);
+      SAFE_DELETE(mean_pass1_);
+      SAFE_DELETE(mean_pass2_);
+      SAFE_DELETE(mean_);
     }
 
     if (output != NULL) {
-      if (!in.isSameSizeAs(*(Tensor<float>*)output)) {
+      if (sameSampleSize(in, *(Tensor<T>*)output, 3)) {
+        if (!in.isSameSizeAs(*(Tensor<T>*)output)) {
+          // Only the batch size has changed: mean_coef_ (computed on the CPU)
+          // depends on the sample size alone, so it is kept
+          SAFE_DELETE(output);
+          SAFE_DELETE(mean_pass1_);
+          SAFE_DELETE(mean_pass2_);
+          SAFE_DELETE(mean_);
+        }
+      } else {
         // Input dimension has changed!
         cleanup();
       }
     }
 
     if (output == NULL) {
-      output = new Tensor<float>(in.dim(), in.size());
-      mean_pass1_ = new Tensor<float>(in.dim(), in.size());
-      mean_pass2_ = new Tensor<float>(in.dim(), in.size());
+      output = Tensor<T>::uninitialized(in.dim(), in.size());
+      mean_pass1_ = Tensor<T>::uninitialized(in.dim(), in.size());
+      mean_pass2_ = Tensor<T>::uninitialized(in.dim(), in.size());
     }
 
     if (mean_coef_ == NULL) {
       uint32_t mean_coeff_size[2];
-      mean_coeff_size[0] = TO_TENSOR_PTR(output)->size()[0];
-      mean_coeff_size[1] = TO_TENSOR_PTR(output)->size()[1];
-      mean_coef_ = new Tensor<float>(2, mean_coeff_size);
+      mean_coeff_size[0] = in.size()[0];
+      mean_coeff_size[1] = in.size()[1];
+      mean_coef_ = Tensor<float>::uninitialized(2, mean_coeff_size);
 
       float* mean_coef_cpu = new float[mean_coef_->nelems()];
       float* kernel_cpu = new float[kernel_->nelems()];
@@ -97,9 +162,9 @@ namespace jtorch {
       // Filter an image of all 1 values to create the normalization constants
       // See norm_test.lua for proof that this works as well as:
       // https://github.com/andresy/torch/blob/master/extra/nn/SpatialSubtractiveNormalization.lua
-      int32_t n_feats = TO_TENSOR_PTR(output)->size()[2];
-      int32_t height = TO_TENSOR_PTR(output)->size()[1];
-      int32_t width = TO_TENSOR_PTR(output)->size()[0];
+      int32_t n_feats = in.size()[2];
+      int32_t height = in.size()[1];
+      int32_t width = in.size()[0];
       if (onedim_kernel) {
         // 1D case - The filter is seperable, but we'll just do the dumb 2D 
         // version since we only do this once on startup.  --> O(n * m)
@@ -151,70 +216,108 @@ namespace jtorch {
       delete[] kernel_cpu;
     }
     if (mean_ == NULL) {
-      uint32_t mean_coeff_size[2];
-      mean_coeff_size[0] = TO_TENSOR_PTR(output)->size()[0];
-      mean_coeff_size[1] = TO_TENSOR_PTR(output)->size()[1];
-      mean_ = new Tensor<float>(2, mean_coeff_size);
+      // One 2D map per sample
+      uint32_t mean_size[3];
+      mean_size[0] = in.size()[0];
+      mean_size[1] = in.size()[1];
+      mean_size[2] = batch_size;
+      mean_ = Tensor<T>::uninitialized(in.dim() - 1, mean_size);
+    }
+  }
+
+  void SpatialSubtractiveNormalization::forwardProp(TorchData& strided_input) { 
+    if (output_precision_ == OUTPUT_PRECISION_HALF) {
+      run(halfInput(strided_input,
+        "SpatialSubtractiveNormalization::forwardProp()"));
+      return;
+    }
+    // Our kernels index the input as a flat array
+    TorchData& input = contiguousInput(strided_input);
+    if (input.type() != TorchDataType::TENSOR_DATA) {
+      throw std::runtime_error("SpatialSubtractiveNormalization::init() - "
+        "FloatTensor expected!");
     }
+    run((Tensor<float>&)input);
   }
 
-  void SpatialSubtractiveNormalization::forwardProp(TorchData& input) { 
-    init(input);
+  template <typename T>
+  void SpatialSubtractiveNormalization::run(Tensor<T>& in) {
+    init(in);
     bool onedim_kernel = kernel_->dim() == 1;
 
-    Tensor<float>& in = (Tensor<float>&)input;
-    Tensor<float>* out = (Tensor<float>*)output;
-    std::string kernel = jtorch::jtorch_path + "kernels/spatial_subtractive_normalization.cl";
+    Tensor<T>* out = (Tensor<T>*)output;
+    Tensor<T>* mean_pass1 = (Tensor<T>*)mean_pass1_;
+    Tensor<T>* mean_pass2 = (Tensor<T>*)mean_pass2_;
+    Tensor<T>* mean = (Tensor<T>*)mean_;
+    uint32_t global_size[3];
+    planeWorkSize(in, global_size);
+    Kernel* kernel;
 
     if (onedim_kernel) {
       int32_t filt_rad = ((int32_t)kernel_->size()[0] - 1) / 2;
     
       // Perform horizontal filter pass
-      cl_context->useKernel(kernel.c_str(), "SpatialSubtractiveNormalizationHoriz");
-      cl_context->setArg(0, in.storage());
-      cl_context->setArg(1, mean_pass1_->storage());
-      cl_context->setArg(2, kernel_->storage());
-      cl_context->setArg(3, filt_rad);
-      cl_context->runKernel(jtorch::deviceid, mean_pass1_->dim(), 
-        mean_pass1_->size(), false);
+      kernel = KernelFor<T>(spatial_subtractive_normalization_horiz_kernel,
+        spatial_subtractive_normalization_horiz_half_kernel);
+      kernel->setArg(0, in.storage());
+      kernel->setArg(1, mean_pass1->storage());
+      kernel->setArg(2, kernel_->storage());
+      kernel->setArg(3, filt_rad);
+      kernel->run(3, global_size, false);
 
       // Perform vertical filter pass
-      cl_context->useKernel(kernel.c_str(), "SpatialSubtractiveNormalizationVert");
-      cl_context->setArg(0, mean_pass1_->storage());
-      cl_context->setArg(1, mean_pass2_->storage());
-      cl_context->setArg(2, kernel_->storage());
-      cl_context->setArg(3, filt_rad);
-      cl_context->runKernel(jtorch::deviceid, mean_pass2_->dim(), 
-        mean_pass2_->size(), false);
+      kernel = KernelFor<T>(spatial_subtractive_normalization_vert_kernel,
+        spatial_subtractive_normalization_vert_half_kernel);
+      kernel->setArg(0, mean_pass1->storage());
+      kernel->setArg(1, mean_pass2->storage());
+      kernel->setArg(2, kernel_->storage());
+      kernel->setArg(3, filt_rad);
+      kernel->run(3, global_size, false);
     } else {
       int32_t filt_rad_u = ((int32_t)kernel_->size()[0] - 1) / 2;
       int32_t filt_rad_v = ((int32_t)kernel_->size()[1] - 1) / 2;
     
       // Perform horizontal filter pass
-      cl_context->useKernel(kernel.c_str(), "SpatialSubtractiveNormalization2D");
-      cl_context->setArg(0, in.storage());
-      cl_context->setArg(1, mean_pass2_->storage());
-      cl_context->setArg(2, kernel_->storage());
-      cl_context->setArg(3, filt_rad_u);
-      cl_context->setArg(4, filt_rad_v);
-      cl_context->runKernel(jtorch::deviceid, mean_pass2_->dim(), 
-        mean_pass2_->size(), false);
+      kernel = KernelFor<T>(spatial_subtractive_normalization_2d_kernel,
+        spatial_subtractive_normalization_2d_half_kernel);
+      kernel->setArg(0, in.storage());
+      kernel->setArg(1, mean_pass2->storage());
+      kernel->setArg(2, kernel_->storage());
+      kernel->setArg(3, filt_rad_u);
+      kernel->setArg(4, filt_rad_v);
+      kernel->run(3, global_size, false);
     }
 
     // Perform accumulation and division pass
-    cl_context->useKernel(kernel.c_str(), "SpatialSubtractiveNormalizationAccumDiv");
-    cl_context->setArg(0, mean_pass2_->storage());
-    cl_context->setArg(1, mean_->storage());
-    cl_context->setArg(2, mean_coef_->storage());
-    cl_context->setArg(3, (int)out->size()[2]);
-    cl_context->runKernel(jtorch::deviceid, mean_->dim(), mean_->size(), false);
+    kernel = KernelFor<T>(spatial_subtractive_normalization_accum_div_kernel,
+      spatial_subtractive_normalization_accum_div_half_kernel);
+    kernel->setArg(0, mean_pass2->storage());
+    kernel->setArg(1, mean->storage());
+    kernel->setArg(2, mean_coef_->storage());
+    kernel->setArg(3, (int)out->size()[2]);
+    global_size[2] = mean->dim() == 3 ? mean->size()[2] : 1;
+    kernel->run(3, global_size, false);
 
     // Perform normalization pass
-    cl_context->useKernel(kernel.c_str(), "SpatialSubtractiveNormalization");
-    cl_context->setArg(0, in.storage());
-    cl_context->setArg(1, out->storage());
-    cl_context->setArg(2, mean_->storage());
-    cl_context->runKernel(jtorch::deviceid, out->dim(), out->size(), false);
+    kernel = KernelFor<T>(spatial_subtractive_normalization_kernel,
+      spatial_subtractive_normalization_half_kernel);
+    kernel->setArg(0, in.storage());
+    kernel->setArg(1, out->storage());
+    kernel->setArg(2, mean->storage());
+    kernel->setArg(3, (int)out->size()[2]);
+    planeWorkSize(*out, global_size);
+    kernel->run(3, global_size, false);
+  }
+
+  void SpatialSubtractiveNormalization::scratchTensors(
+    std::vector<Tensor<float>*>& scratch) {
+    TorchStage::scratchTensors(scratch);
+    // mean_coef_ is only computed in init().  fp16 passes are not planned.
+    if (mean_ != NULL && mean_->type() == TorchDataType::TENSOR_DATA) {
+      scratch.push_back(TO_TENSOR_PTR(mean_pass1_));
+      scratch.push_back(TO_TENSOR_PTR(mean_pass2_));
+      scratch.push_back(TO_TENSOR_PTR(mean_));
+    }
   }
 
   TorchStage* SpatialSubtractiveNormalization::loadFromFile(std::ifstream& file) {
@@ -229,11 +332,11 @@ namespace jtorch {
       // The kernel is 2D
       uint32_t dim = 2;
       uint32_t size[2] = {kernel_size_1, kernel_size_2};
-      kernel = new Tensor<float>(dim, size);
+      kernel = Tensor<float>::uninitialized(dim, size);
     } else {
       uint32_t dim = 1;
       uint32_t size[1] = {kernel_size_1};
-      kernel = new Tensor<float>(dim, size);
+      kernel = Tensor<float>::uninitialized(dim, size);
     }
     float* kernel_cpu = new float[kernel->nelems()];
     file.read((char*)(kernel_cpu), kernel->nelems() * sizeof(*kernel_cpu));
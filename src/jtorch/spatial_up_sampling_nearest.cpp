@@ -1,5 +1,6 @@
 #include "jtorch/spatial_up_sampling_nearest.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jtorch/jtorch.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
@@ -15,6 +16,11 @@ using namespace jcl;
 
 namespace jtorch {
 
+  static KernelHandle spatial_up_sampling_nearest_2d_kernel(
+    "spatial_up_sampling_nearest.cl", "SpatialUpSamplingNearest2D");
+  static KernelHandle spatial_up_sampling_nearest_kernel(
+    "spatial_up_sampling_nearest.cl", "SpatialUpSamplingNearest");
+
   SpatialUpSamplingNearest::SpatialUpSamplingNearest(const int32_t scale) 
     : TorchStage() {
     scale_ = scale;
@@ -27,6 +33,10 @@ namespace jtorch {
     SAFE_DELETE_ARR(out_size_);
   }
 
+  TorchStage* SpatialUpSamplingNearest::clone() const {
+    return new SpatialUpSamplingNearest(scale_);
+  }
+
   void SpatialUpSamplingNearest::init(TorchData& input)  {
     if (input.type() != TorchDataType::TENSOR_DATA) {
       throw std::runtime_error("SpatialConvolution::init() - "
@@ -68,27 +78,35 @@ namespace jtorch {
       out_size[0] *= scale_;
       out_size[1] *= scale_;
 
-      output = new Tensor<float>(in.dim(), out_size);
+      output = Tensor<float>::uninitialized(in.dim(), out_size);
       
       SAFE_DELETE_ARR(out_size);
     }
   }
 
-  void SpatialUpSamplingNearest::forwardProp(TorchData& input) { 
+  void SpatialUpSamplingNearest::forwardProp(TorchData& strided_input) { 
+    // Our kernels index the input as a flat array
+    TorchData& input = contiguousInput(strided_input);
     init(input);
 
     Tensor<float>& in = (Tensor<float>&)input;
-    std::string kernel = jtorch::jtorch_path + "kernels/spatial_up_sampling_nearest.cl";
+    Kernel* kernel;
+    if (in.dim() == 2) {
+      kernel = spatial_up_sampling_nearest_2d_kernel.get();
+    } else {
+      kernel = spatial_up_sampling_nearest_kernel.get();
+    }
+    kernel->setArg(0, ((Tensor<float>&)input).storage());
+    kernel->setArg(1, TO_TENSOR_PTR(output)->storage());
+    kernel->setArg(2, (int)scale_);
     if (in.dim() == 2) {
-      cl_context->useKernel(kernel.c_str(), "SpatialUpSamplingNearest2D");
+      kernel->run(2, TO_TENSOR_PTR(output)->size(), false);
     } else {
-      cl_context->useKernel(kernel.c_str(), "SpatialUpSamplingNearest");
+      // Every feature of every sample (and any higher dimension) is a plane
+      uint32_t global_size[3];
+      planeWorkSize(*TO_TENSOR_PTR(output), global_size);
+      kernel->run(3, global_size, false);
     }
-    cl_context->setArg(0, ((Tensor<float>&)input).storage());
-    cl_context->setArg(1, TO_TENSOR_PTR(output)->storage());
-    cl_context->setArg(2, (int)scale_);
-    cl_context->runKernel(jtorch::deviceid, TO_TENSOR_PTR(output)->dim(),
-      TO_TENSOR_PTR(output)->size(), false);
   }
 
   TorchStage* SpatialUpSamplingNearest::loadFromFile(std::ifstream& file) {
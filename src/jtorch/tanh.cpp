@@ -1,6 +1,7 @@
 #include "jtorch/tanh.h"
 #include "jtorch/jtorch.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -15,6 +16,9 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static KernelHandle tanh_kernel("tanh.cl", "TanH1D");
+  static KernelHandle tanh_strided_kernel("tanh.cl", "TanHStrided");
+
   Tanh::Tanh() : TorchStage() {
     output = NULL;
   }
@@ -23,34 +27,41 @@ namespace jtorch {
     SAFE_DELETE(output);
   }
 
+  TorchStage* Tanh::clone() const {
+    Tanh* ret = new Tanh();
+    ret->setInPlace(in_place_);
+    return ret;
+  }
+
   void Tanh::init(TorchData& input)  {
     if (input.type() != TorchDataType::TENSOR_DATA) {
       throw std::runtime_error("Tanh::init() - FloatTensor expected!");
     }
-    Tensor<float>& in = (Tensor<float>&)input;
-    Tensor<float>* out = (Tensor<float>*)output;
-    if (output != NULL) {
-      if (!out->isSameSizeAs(in)) {
-        // Input dimension has changed!
-        SAFE_DELETE(output);
-      }
-    }
-    if (output == NULL) {
-      output = new Tensor<float>(in.dim(), in.size());
-      //cl_context->getOptimalLocalWorkgroupSizes(deviceid, 
-      //  TO_TENSOR_PTR(output)->dim(), local_worgroup_size);
-    }
+    elementwiseOutput((Tensor<float>&)input);
   }
 
   void Tanh::forwardProp(TorchData& input) { 
     init(input);
-    std::string kernel = jtorch::jtorch_path + "kernels/tanh.cl";
-    cl_context->useKernel(kernel.c_str(), "TanH1D");
-    cl_context->setArg(0, ((Tensor<float>&)input).storage());
-    cl_context->setArg(1, TO_TENSOR_PTR(output)->storage());
+    Tensor<float>& in = (Tensor<float>&)input;
+    if (!in.isFlat()) {
+      // Read the strided view directly (the output is always contiguous)
+      Kernel* kernel = tanh_strided_kernel.get();
+      kernel->setArg(0, in.storage());
+      in.setStridedArgs(kernel, 1);
+      kernel->setArg(6, TO_TENSOR_PTR(output)->storage());
+      kernel->setArg(7, in.dim() > 2 ? (int)in.size()[2] : 1);
+      uint32_t global_size[3];
+      in.stridedWorkSize(global_size);
+      kernel->run(3, global_size, false);
+      return;
+    }
+    // output may be a view of the input (see setInPlace)
+    Kernel* kernel = tanh_kernel.get();
+    kernel->setArg(0, in.storage());
+    kernel->setArg(1, TO_TENSOR_PTR(output)->storage());
     uint32_t dim = 1;
     uint32_t nelem = TO_TENSOR_PTR(output)->nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
   }
 
   TorchStage* Tanh::loadFromFile(std::ifstream& file) {
@@ -1,6 +1,7 @@
 #include "jtorch/threshold.h"
 #include "jtorch/jtorch.h"
 #include "jtorch/tensor.h"
+#include "jtorch/kernel.h"
 #include "jcl/threading/thread.h"
 #include "jcl/threading/callback.h"
 #include "jcl/threading/thread_pool.h"
@@ -15,6 +16,10 @@ using namespace jcl::data_str;
 
 namespace jtorch {
 
+  static KernelHandle threshold_strided_kernel(
+    "threshold.cl", "ThresholdStrided");
+  static KernelHandle threshold1_d_kernel("threshold.cl", "Threshold1D");
+
   Threshold::Threshold() : TorchStage() {
     output = NULL;
     threshold = 1e-6f;
@@ -25,35 +30,49 @@ namespace jtorch {
     SAFE_DELETE(output);
   }
 
+  TorchStage* Threshold::clone() const {
+    Threshold* ret = new Threshold();
+    ret->threshold = threshold;
+    ret->val = val;
+    ret->setInPlace(in_place_);
+    return ret;
+  }
+
   void Threshold::init(TorchData& input)  {
     if (input.type() != TorchDataType::TENSOR_DATA) {
       throw std::runtime_error("Threshold::init() - "
         "FloatTensor expected!");
     }
-    Tensor<float>& in = (Tensor<float>&)input;
-    if (output != NULL) {
-      if (!in.isSameSizeAs(*TO_TENSOR_PTR(output))){
-        // Input dimension has changed!
-        delete output;
-        output = NULL;
-      }
-    }
-    if (output == NULL) {
-      output = new Tensor<float>(in.dim(), in.size());
-    }
+    elementwiseOutput((Tensor<float>&)input);
   }
 
   void Threshold::forwardProp(TorchData& input) { 
     init(input);
-    std::string kernel = jtorch::jtorch_path + "kernels/threshold.cl";
-    cl_context->useKernel(kernel.c_str(), "Threshold1D");
-    cl_context->setArg(0, ((Tensor<float>&)input).storage());
-    cl_context->setArg(1, TO_TENSOR_PTR(output)->storage());
-    cl_context->setArg(2, threshold);
-    cl_context->setArg(3, val);
+    Kernel* kernel;
+    Tensor<float>& in = (Tensor<float>&)input;
+    if (!in.isFlat()) {
+      // Read the strided view directly (the output is always contiguous)
+      kernel = threshold_strided_kernel.get();
+      kernel->setArg(0, in.storage());
+      in.setStridedArgs(kernel, 1);
+      kernel->setArg(6, TO_TENSOR_PTR(output)->storage());
+      kernel->setArg(7, in.dim() > 2 ? (int)in.size()[2] : 1);
+      kernel->setArg(8, threshold);
+      kernel->setArg(9, val);
+      uint32_t global_size[3];
+      in.stridedWorkSize(global_size);
+      kernel->run(3, global_size, false);
+      return;
+    }
+    // output may be a view of the input (see setInPlace)
+    kernel = threshold1_d_kernel.get();
+    kernel->setArg(0, in.storage());
+    kernel->setArg(1, TO_TENSOR_PTR(output)->storage());
+    kernel->setArg(2, threshold);
+    kernel->setArg(3, val);
     uint32_t dim = 1;
     uint32_t nelem = TO_TENSOR_PTR(output)->nelems();
-    cl_context->runKernel(jtorch::deviceid, dim, &nelem, false);
+    kernel->run(dim, &nelem, false);
   }
 
   TorchStage* Threshold::loadFromFile(std::ifstream& file) {
@@ -3,6 +3,12 @@
 #include <stdexcept>
 #include <fstream>
 #include "jtorch/torch_stage.h"
+#include "jtorch/tensor.h"
+#include "jtorch/memory_planner.h"
+#include "jtorch/kernel.h"
+#include "jtorch/engine.h"
+#include "jtorch/table.h"
+#include "jtorch/dependency_graph.h"
 #include "jtorch/linear.h"
 #include "jtorch/parallel_table.h"
 #include "jtorch/reshape.h"
@@ -34,13 +40,279 @@ namespace jtorch {
 
   TorchStage::TorchStage() {
     output = NULL; 
+    contiguous_input_ = NULL;
+    half_input_ = NULL;
+    output_precision_ = OUTPUT_PRECISION_FLOAT;
+    in_place_ = IN_PLACE_AUTO;
+    input_exclusive_ = false;
+    output_in_place_ = false;
   }
 
   TorchStage::~TorchStage() {
-    
+    SAFE_DELETE(contiguous_input_);
+    SAFE_DELETE(half_input_);
   }
 
-  TorchStage* TorchStage::loadFromFile(const std::string& file) {
+  // SameSize - isSameSizeAs for tensors of different precision
+  template <typename T1, typename T2>
+  static bool SameSize(const Tensor<T1>& a, const Tensor<T2>& b) {
+    if (a.dim() != b.dim()) {
+      return false;
+    }
+    for (uint32_t i = 0; i < a.dim(); i++) {
+      if (a.size()[i] != b.size()[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  TorchData& TorchStage::contiguousInput(TorchData& input, 
+    const bool allow_offset) {
+    Tensor<half>* half_in = TO_HALF_TENSOR_PTR(&input);
+    if (half_in != NULL) {
+      if (contiguous_input_ == NULL || !SameSize(*contiguous_input_, 
+        *half_in)) {
+        SAFE_DELETE(contiguous_input_);
+        contiguous_input_ = Tensor<float>::uninitialized(half_in->dim(),
+          half_in->size());
+      }
+      ConvertTensor(*contiguous_input_, *half_in);
+      return *contiguous_input_;
+    }
+    Tensor<float>* in = TO_TENSOR_PTR(&input);
+    if (in == NULL || in->isFlat() || (allow_offset && in->isContiguous())) {
+      return input;
+    }
+    if (contiguous_input_ == NULL || !contiguous_input_->isSameSizeAs(*in)) {
+      SAFE_DELETE(contiguous_input_);
+      contiguous_input_ = Tensor<float>::uninitialized(in->dim(), in->size());
+    }
+    Tensor<float>::copy(*contiguous_input_, *in);
+    return *contiguous_input_;
+  }
+
+  Tensor<half>& TorchStage::halfInput(TorchData& input, const char* func) {
+    Tensor<half>* half_in = TO_HALF_TENSOR_PTR(&input);
+    if (half_in != NULL) {
+      return *half_in;  // fp16 outputs are always flat
+    }
+    Tensor<float>* in = TO_TENSOR_PTR(&contiguousInput(input));
+    if (in == NULL) {
+      std::stringstream ss;
+      ss << func << " - ERROR: FloatTensor or HalfTensor expected!";
+      throw std::runtime_error(ss.str());
+    }
+    if (half_input_ == NULL || !SameSize(*half_input_, *in)) {
+      SAFE_DELETE(half_input_);
+      half_input_ = Tensor<half>::uninitialized(in->dim(), in->size());
+    }
+    ConvertTensor(*half_input_, *in);
+    return *half_input_;
+  }
+
+  template <typename T>
+  uint32_t TorchStage::batchSize(const Tensor<T>& input,
+    const uint32_t sample_dim, const char* func) {
+    if (input.dim() == sample_dim) {
+      return 1;
+    }
+    if (input.dim() != sample_dim + 1) {
+      std::stringstream ss;
+      ss << func << " - ERROR: " << sample_dim << "D input (or " <<
+        sample_dim + 1 << "D for a batch) expected!";
+      throw std::runtime_error(ss.str());
+    }
+    return input.size()[sample_dim];
+  }
+
+  template <typename T>
+  bool TorchStage::sameSampleSize(const Tensor<T>& a,
+    const Tensor<T>& b, const uint32_t sample_dim) {
+    if (a.dim() < sample_dim || b.dim() < sample_dim) {
+      return false;
+    }
+    for (uint32_t i = 0; i < sample_dim; i++) {
+      if (a.size()[i] != b.size()[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename T>
+  void TorchStage::planeWorkSize(const Tensor<T>& tensor,
+    uint32_t* global_size) {
+    global_size[0] = tensor.size()[0];
+    global_size[1] = tensor.dim() > 1 ? tensor.size()[1] : 1;
+    global_size[2] = 1;
+    for (uint32_t i = 2; i < tensor.dim(); i++) {
+      global_size[2] *= tensor.size()[i];
+    }
+  }
+
+  template uint32_t TorchStage::batchSize(const Tensor<float>& input,
+    const uint32_t sample_dim, const char* func);
+  template uint32_t TorchStage::batchSize(const Tensor<half>& input,
+    const uint32_t sample_dim, const char* func);
+  template bool TorchStage::sameSampleSize(const Tensor<float>& a,
+    const Tensor<float>& b, const uint32_t sample_dim);
+  template bool TorchStage::sameSampleSize(const Tensor<half>& a,
+    const Tensor<half>& b, const uint32_t sample_dim);
+  template void TorchStage::planeWorkSize(const Tensor<float>& tensor,
+    uint32_t* global_size);
+  template void TorchStage::planeWorkSize(const Tensor<half>& tensor,
+    uint32_t* global_size);
+
+  void TorchStage::setActivationArgs(Kernel* kernel, const uint32_t first_arg,
+    const Activation& activation) {
+    kernel->setArg(first_arg, (int)activation.type);
+    kernel->setArg(first_arg + 1, activation.threshold);
+    kernel->setArg(first_arg + 2, activation.val);
+  }
+
+  bool TorchStage::elementwiseOutput(Tensor<float>& input) {
+    const bool in_place = input.isFlat() && (in_place_ == IN_PLACE_ALWAYS ||
+      (in_place_ == IN_PLACE_AUTO && input_exclusive_));
+    Tensor<float>* out = (Tensor<float>*)output;
+    if (output != NULL) {
+      if (!out->isSameSizeAs(input) || output_in_place_ != in_place ||
+        (in_place && out->storage() != input.storage())) {
+        // Input dimension (or storage) has changed!
+        SAFE_DELETE(output);
+      }
+    }
+    if (output == NULL) {
+      if (in_place) {
+        output = input.view(input.dim(), input.size());
+      } else {
+        output = Tensor<float>::uninitialized(input.dim(), input.size());
+      }
+      output_in_place_ = in_place;
+    }
+    return in_place;
+  }
+
+  // collectTensors - Every fp32 or fp16 tensor in data (recursing into
+  // tables)
+  static void collectTensors(TorchData* data,
+    std::vector<TorchData*>& tensors) {
+    if (data == NULL) {
+      return;
+    }
+    if (data->type() == TorchDataType::TABLE_DATA) {
+      Table* table = (Table*)data;
+      for (uint32_t i = 0; i < table->tableSize(); i++) {
+        collectTensors((*table)(i), tensors);
+      }
+    } else if (data->type() == TorchDataType::TENSOR_DATA ||
+      data->type() == TorchDataType::HALF_TENSOR_DATA) {
+      tensors.push_back(data);
+    }
+  }
+
+  static const jcl::JCLBuffer& TensorStorage(TorchData* tensor) {
+    Tensor<float>* t = TO_TENSOR_PTR(tensor);
+    return t != NULL ? t->storage() : TO_HALF_TENSOR_PTR(tensor)->storage();
+  }
+
+  template <typename T>
+  static void addOutput(PreparedStage& stage, const Tensor<T>& output) {
+    stage.output_size.push_back(std::vector<uint32_t>(output.size(),
+      output.size() + output.dim()));
+    stage.output_bytes += (uint64_t)output.nelems() * sizeof(T);
+  }
+
+  Event TorchStage::forwardPropAsync(TorchData& input) {
+    forwardProp(input);
+    // On the out-of-order queue the marker only waits for the commands that
+    // wrote output (on an in-order queue it follows everything before it)
+    std::vector<TorchData*> outputs;
+    collectTensors(output, outputs);
+    CommandDeps deps;
+    for (uint32_t i = 0; i < outputs.size(); i++) {
+      deps.reads((cl_mem)cl_context->getCLMem(TensorStorage(outputs[i])));
+    }
+    cl_event event;
+    cl_int err = clEnqueueMarkerWithWaitList(CLQueue(), deps.numWaits(),
+      deps.waitList(), &event);
+    if (err != CL_SUCCESS) {
+      std::stringstream ss;
+      ss << "TorchStage::forwardPropAsync() - ERROR: "
+        "clEnqueueMarkerWithWaitList failed: " <<
+        jcl::JCL::getErrorString(err);
+      throw std::runtime_error(ss.str());
+    }
+    clFlush(CLQueue());
+    return Event(event);
+  }
+
+  PrepareReport TorchStage::prepare(const uint32_t input_dim,
+    const uint32_t* input_size) {
+    Tensor<float> input(input_dim, input_size);  // Zeros
+    return prepare(input);
+  }
+
+  PrepareReport TorchStage::prepare(TorchData& input) {
+    const uint64_t bytes_start = buffer_pool->stats().bytes_in_use;
+    forwardProp(input);
+    Sync();
+    const uint64_t bytes_end = buffer_pool->stats().bytes_in_use;
+
+    PrepareReport report;
+    report.allocated_bytes = bytes_end > bytes_start ?
+      bytes_end - bytes_start : 0;
+    report.parameter_bytes = parameterBytes();
+    // Only walks the tree, nothing is rebound
+    MemoryPlanner walk;
+    planMemory(walk, input);
+    const std::vector<MemoryPlanStep>& steps = walk.steps();
+    report.stages.resize(steps.size());
+    for (uint32_t i = 0; i < steps.size(); i++) {
+      PreparedStage& stage = report.stages[i];
+      stage.stage = steps[i].stage;
+      stage.output_bytes = 0;
+      stage.scratch_bytes = 0;
+      std::vector<TorchData*> outputs;
+      collectTensors(steps[i].output, outputs);
+      for (uint32_t j = 0; j < outputs.size(); j++) {
+        if (outputs[j]->type() == TorchDataType::HALF_TENSOR_DATA) {
+          addOutput(stage, *TO_HALF_TENSOR_PTR(outputs[j]));
+        } else {
+          addOutput(stage, *TO_TENSOR_PTR(outputs[j]));
+        }
+      }
+      for (uint32_t j = 0; j < steps[i].scratch.size(); j++) {
+        stage.scratch_bytes += (uint64_t)steps[i].scratch[j]->nelems() *
+          sizeof(float);
+      }
+    }
+    return report;
+  }
+
+  void TorchStage::planMemory(MemoryPlanner& planner, TorchData& input) {
+    std::vector<Tensor<float>*> scratch;
+    scratchTensors(scratch);
+    planner.addStep(*this, input, output, scratch);
+  }
+
+  void TorchStage::scratchTensors(std::vector<Tensor<float>*>& scratch) {
+    if (contiguous_input_ != NULL) {
+      scratch.push_back(contiguous_input_);
+    }
+  }
+
+  void TorchStage::calibrate(const uint32_t num_inputs, 
+    TorchData* const* inputs) {
+    setCalibrating(true);
+    for (uint32_t i = 0; i < num_inputs; i++) {
+      forwardProp(*inputs[i]);
+    }
+    setCalibrating(false);
+  }
+
+  TorchStage* TorchStage::loadFromFile(const std::string& file,
+    const WeightPrecision precision) {
     TorchStage* ret = NULL;
     std::ifstream ifile(file.c_str(), std::ios::in|std::ios::binary);
     if (ifile.is_open()) {
@@ -49,6 +321,9 @@ namespace jtorch {
       std::cout << "Loading torch model..." << std::endl;
       ret = TorchStage::loadFromFile(ifile);
       ifile.close();
+      if (precision != WEIGHT_PRECISION_FLOAT) {
+        ret->setWeightPrecision(precision);
+      }
     } else {
       std::stringstream ss;
       ss << "TorchStage::loadFromFile() - ERROR: Could not open modelfile";
@@ -58,6 +333,12 @@ namespace jtorch {
     return ret;
   }
 
+  TorchStage* TorchStage::loadFromFile(Engine& engine,
+    const std::string& file, const WeightPrecision precision) {
+    EngineScope scope(engine);
+    return loadFromFile(file, precision);
+  }
+
   TorchStage* TorchStage::loadFromFile(std::ifstream& ifile) { 
     // Read in the enum type:
     int type;
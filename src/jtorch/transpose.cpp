@@ -17,9 +17,28 @@ namespace jtorch {
 
   Transpose::Transpose() {
     output = NULL;
+    num_permutations_ = 0;
+    perms_ = NULL;
+  }
+
+  Transpose::Transpose(const uint32_t num_permutations, 
+    const int32_t* perms) {
+    output = NULL;
+    num_permutations_ = num_permutations;
+    perms_ = new int32_t[num_permutations_ * 2];
+    memcpy(perms_, perms, sizeof(perms_[0]) * num_permutations_ * 2);
   }
 
   Transpose::~Transpose() {
+    SAFE_DELETE(output);
+    SAFE_DELETE_ARR(perms_);
+  }
+
+  TorchStage* Transpose::clone() const {
+    if (num_permutations_ == 0) {
+      return new Transpose();
+    }
+    return new Transpose(num_permutations_, perms_);
   }
 
   TorchStage* Transpose::loadFromFile(std::ifstream& file) {
@@ -27,14 +46,34 @@ namespace jtorch {
     file.read((char*)(&num_permutations), sizeof(num_permutations));
     int32_t* perms = new int32_t[num_permutations * 2];
     file.read((char*)(perms), sizeof(perms[0]) * num_permutations * 2);
-    // But we don't really use it...
-    TorchStage* ret_val = new Transpose();
+    TorchStage* ret_val = new Transpose(num_permutations, perms);
     delete[] perms;
     return ret_val;
   }
 
   void Transpose::forwardProp(TorchData& input) {
-    output = &input;
+    if (input.type() != TorchDataType::TENSOR_DATA) {
+      throw std::runtime_error("Transpose::forwardProp() - "
+        "FloatTensor expected!");
+    }
+    Tensor<float>& in = (Tensor<float>&)input;
+    // Building the view is O(1) (no data is touched) so just rebuild it.
+    SAFE_DELETE(output);
+    Tensor<float>* cur = in.narrow(0, 0, in.size()[0]);  // Copy of the header
+    for (uint32_t i = 0; i < num_permutations_; i++) {
+      const int32_t d0 = (int32_t)in.dim() - perms_[i * 2];
+      const int32_t d1 = (int32_t)in.dim() - perms_[i * 2 + 1];
+      if (d0 < 0 || d1 < 0 || d0 >= (int32_t)in.dim() || 
+        d1 >= (int32_t)in.dim()) {
+        delete cur;
+        throw std::runtime_error("Transpose::forwardProp() - ERROR: "
+          "permutation is out of range!");
+      }
+      Tensor<float>* next = cur->transpose(d0, d1);
+      delete cur;
+      cur = next;
+    }
+    output = cur;
   }
 
 }  // namespace jtorch
\ No newline at end of file
@@ -260,6 +260,15 @@ print('Test model result saved to test_data/test_model_result.bin')
 -- Save the Test model
 saveModel(test_model, "test_data/testmodel.bin")
 
+-- Save a model that joins along the feature dimension in batch mode
+do
+  local model = nn.Sequential()
+  model:add(nn.ParallelTable():add(nn.Identity()):add(nn.Tanh()))
+  model:add(nn.JoinTable(1, 3))
+  saveModel(model, "test_data/join_table_model.bin")
+  print('JoinTable model saved to test_data/join_table_model.bin')
+end
+
 -- test SpatialUpSamplingNearest
 do
   local model = nn.SpatialUpSamplingNearest(4)
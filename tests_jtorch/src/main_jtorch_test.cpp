@@ -3,12 +3,24 @@
 #include <stdlib.h>
 #include <cmath>
 #include <thread>
+#include <atomic>
 #include <iostream>
 #include <limits>
 #include <assert.h>
 #include "jtorch/torch_stage.h"
 #include "jtorch/jtorch.h"
+#include "jtorch/engine.h"
 #include "jtorch/tensor.h"
+#include "jtorch/buffer_pool.h"
+#include "jtorch/host_buffer.h"
+#include "jtorch/event.h"
+#include "jtorch/half.h"
+#include "jtorch/kernel.h"
+#include "jtorch/memory_planner.h"
+#include "jtorch/launch_plan.h"
+#include "jtorch/inference_queue.h"
+#include "jtorch/device_dispatcher.h"
+#include "jtorch/pipeline_executor.h"
 #include "jtorch/spatial_convolution.h"
 #include "jtorch/spatial_convolution_map.h"
 #include "jtorch/spatial_convolution_mm.h"
@@ -37,9 +49,17 @@
 
 #if defined(WIN32) || defined(_WIN32)
   #define snprintf _snprintf_s
+  #include <direct.h>
+  #include <io.h>
+  #include <process.h>
+#else
+  #include <dirent.h>
+  #include <unistd.h>
 #endif
 
 #define JTORCH_FLOAT_PRECISION 1e-6f
+#define JTORCH_HALF_PRECISION 1e-2f  // fp16 weights --> ~3 sig. figures
+#define JTORCH_INT8_PRECISION 3e-2f  // Relative to the output range
 
 using namespace std;
 using namespace jtorch;
@@ -118,6 +138,55 @@ void testJTorchValue(jtorch::Tensor<float>* data, const std::string& filename,
   delete[] correct_data;
 }
 
+// makeTempDir - A new empty directory (the returned path ends with a
+// separator)
+std::string makeTempDir() {
+#if defined(WIN32) || defined(_WIN32)
+  const char* tmp = getenv("TEMP");
+  std::stringstream ss;
+  ss << (tmp != NULL ? tmp : ".") << "\\jtorch_test_" << _getpid();
+  if (_mkdir(ss.str().c_str()) != 0) {
+    throw std::runtime_error("makeTempDir() - ERROR: _mkdir failed!");
+  }
+  return ss.str() + "\\";
+#else
+  char path[] = "/tmp/jtorch_test_XXXXXX";
+  if (mkdtemp(path) == NULL) {
+    throw std::runtime_error("makeTempDir() - ERROR: mkdtemp failed!");
+  }
+  return std::string(path) + "/";
+#endif
+}
+
+// removeTempDir - Deletes a directory from makeTempDir() and its files
+void removeTempDir(const std::string& dir) {
+#if defined(WIN32) || defined(_WIN32)
+  _finddata_t data;
+  intptr_t handle = _findfirst((dir + "*").c_str(), &data);
+  if (handle != -1) {
+    do {
+      if (!(data.attrib & _A_SUBDIR)) {
+        remove((dir + data.name).c_str());
+      }
+    } while (_findnext(handle, &data) == 0);
+    _findclose(handle);
+  }
+  _rmdir(dir.c_str());
+#else
+  DIR* d = opendir(dir.c_str());
+  if (d != NULL) {
+    for (dirent* entry = readdir(d); entry != NULL; entry = readdir(d)) {
+      const std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        remove((dir + name).c_str());
+      }
+    }
+    closedir(d);
+  }
+  rmdir(dir.c_str());
+#endif
+}
+
 void assertTrue(bool value, const std::string& module_name) {
   if (value) {
     std::cout << "Test PASSED: " << module_name << std::endl;
@@ -126,6 +195,42 @@ void assertTrue(bool value, const std::string& module_name) {
   }
 }
 
+// halfOutputMatches - Runs stage with fp32 and then fp16 outputs on input and
+// checks that the fp16 result is a Tensor<half> within JTORCH_HALF_PRECISION
+// of the fp32 one (the stage is left at OUTPUT_PRECISION_FLOAT)
+bool halfOutputMatches(TorchStage& stage, TorchData& input) {
+  stage.setOutputPrecision(OUTPUT_PRECISION_FLOAT);
+  stage.forwardProp(input);
+  Tensor<float>* out = TO_TENSOR_PTR(stage.output);
+  float* ref = new float[out->nelems()];
+  float* res = new float[out->nelems()];
+  out->getData(ref);
+  stage.setOutputPrecision(OUTPUT_PRECISION_HALF);
+  stage.forwardProp(input);
+  bool test_passed = stage.output->type() == HALF_TENSOR_DATA;
+  if (test_passed) {
+    Tensor<half>* out_half = TO_HALF_TENSOR_PTR(stage.output);
+    Tensor<float>* out_float = Tensor<float>::uninitialized(out_half->dim(),
+      out_half->size());
+    ConvertTensor(*out_float, *out_half);
+    test_passed = out_float->isSameSizeAs(*out);
+    if (test_passed) {
+      out_float->getData(res);
+      for (uint32_t i = 0; i < out->nelems(); i++) {
+        const float delta = fabsf(res[i] - ref[i]);
+        test_passed = test_passed && (delta < JTORCH_HALF_PRECISION ||
+          delta / std::max<float>(fabsf(ref[i]), LOOSE_EPSILON) < 
+          JTORCH_HALF_PRECISION);
+      }
+    }
+    delete out_float;
+  }
+  stage.setOutputPrecision(OUTPUT_PRECISION_FLOAT);
+  delete[] ref;
+  delete[] res;
+  return test_passed;
+}
+
 int main(int argc, char *argv[]) {  
 #if defined(_DEBUG) || defined(DEBUG)
   jcl::debug::EnableMemoryLeakChecks();
@@ -252,6 +357,17 @@ int main(int argc, char *argv[]) {
       convmm.forwardProp(*stages.get(1)->output);
       testJTorchValue(TO_TENSOR_PTR(convmm.output), 
         "./test_data/spatial_convolution_mm_padding.bin");
+
+      // The same convolution with fp16 weights (fp32 arithmetic)
+      conv.setWeightPrecision(WEIGHT_PRECISION_HALF);
+      conv.forwardProp(*stages.get(1)->output);
+      testJTorchValue(TO_TENSOR_PTR(conv.output), 
+        "./test_data/spatial_convolution.bin", JTORCH_HALF_PRECISION);
+      convmm.setWeightPrecision(WEIGHT_PRECISION_HALF);
+      convmm.forwardProp(*stages.get(1)->output);
+      testJTorchValue(TO_TENSOR_PTR(convmm.output), 
+        "./test_data/spatial_convolution_mm_padding.bin",
+        JTORCH_HALF_PRECISION);
     }
     
     // ***********************************************
@@ -365,6 +481,103 @@ int main(int argc, char *argv[]) {
       lin_stage.forwardProp(data_in);
       testJTorchValue(TO_TENSOR_PTR(lin_stage.output), 
         "./test_data/linear.bin");
+
+      // The Sequential container forwards the precision change to lin
+      lin_stage.setWeightPrecision(WEIGHT_PRECISION_HALF);
+      lin_stage.forwardProp(data_in);
+      testJTorchValue(TO_TENSOR_PTR(lin_stage.output), 
+        "./test_data/linear.bin", JTORCH_HALF_PRECISION);
+    }
+
+    // ***********************************************
+    // Test half conversions
+    {
+      bool test_passed = half(1.0f).bits == 0x3c00 && 
+        half(-2.0f).bits == 0xc000 && half(65504.0f).bits == 0x7bff &&
+        half(70000.0f).bits == 0x7c00 && half(1e-7f).bits == 0x0002 &&
+        half(1.0f + 1.0f / 4096.0f).bits == 0x3c00 &&  // Ties to even
+        (float)half(0.333251953125f) == 0.333251953125f;
+      for (uint32_t i = 0; i < 0x7c00; i++) {
+        half h;
+        h.bits = (uint16_t)i;
+        test_passed = test_passed && half((float)h).bits == h.bits;
+      }
+
+      Tensor<half>* t_half = Tensor<half>::uninitialized(data_in.dim(), 
+        data_in.size());
+      Tensor<float>* t_float = Tensor<float>::uninitialized(data_in.dim(),
+        data_in.size());
+      ConvertTensor(*t_half, data_in);
+      ConvertTensor(*t_float, *t_half);
+      half* res_half = new half[data_in.nelems()];
+      float* res_float = new float[data_in.nelems()];
+      t_half->getData(res_half);
+      t_float->getData(res_float);
+      for (uint32_t i = 0; i < data_in.nelems(); i++) {
+        test_passed = test_passed && res_half[i].bits == half(din[i]).bits &&
+          res_float[i] == (float)res_half[i];
+      }
+      assertTrue(test_passed, "half conversions");
+      delete[] res_half;
+      delete[] res_float;
+      delete t_half;
+      delete t_float;
+    }
+
+    // ***********************************************
+    // Test int8 quantization (and report the accuracy vs fp32)
+    {
+      SpatialConvolution conv(num_feats_in, num_feats_out, filt_height, 
+        filt_width);
+      conv.setWeights(cweights);
+      conv.setBiases(cbiases);
+      SpatialConvolutionMM convmm(num_feats_in, num_feats_out, filt_height, 
+        filt_width, 2);
+      convmm.setWeights(cweights);
+      convmm.setBiases(cbiases);
+      Sequential lin_stage;
+      lin_stage.add(new Reshape(1, &lin_size_in));
+      Linear* lin = new Linear(lin_size_in, lin_size_out);
+      lin->setWeights(lweights);
+      lin->setBiases(lbiases);
+      lin_stage.add(lin);
+
+      TorchStage* modules[3] = {&conv, &convmm, &lin_stage};
+      TorchData* inputs[1] = {&data_in};
+      bool test_passed = true;
+      for (uint32_t i = 0; i < 3; i++) {
+        modules[i]->forwardProp(data_in);
+        Tensor<float>* out = TO_TENSOR_PTR(modules[i]->output);
+        float* ref = new float[out->nelems()];
+        float* res = new float[out->nelems()];
+        out->getData(ref);
+        float range = 0.0f;
+        for (uint32_t j = 0; j < out->nelems(); j++) {
+          range = std::max<float>(range, fabsf(ref[j]));
+        }
+
+        modules[i]->setWeightPrecision(WEIGHT_PRECISION_INT8);
+        float err[2];  // Dynamic then calibrated input scales
+        for (uint32_t pass = 0; pass < 2; pass++) {
+          if (pass == 1) {
+            modules[i]->calibrate(1, inputs);
+          }
+          modules[i]->forwardProp(data_in);
+          TO_TENSOR_PTR(modules[i]->output)->getData(res);
+          err[pass] = 0.0f;
+          for (uint32_t j = 0; j < out->nelems(); j++) {
+            err[pass] = std::max<float>(err[pass], fabsf(res[j] - ref[j]));
+          }
+          err[pass] /= range;
+          test_passed = test_passed && err[pass] < JTORCH_INT8_PRECISION;
+        }
+        std::cout << "\tint8 " << modules[i]->name() << " max error: " << 
+          err[0] * 100 << "% (dynamic), " << err[1] * 100 << 
+          "% (calibrated) of the fp32 output range" << std::endl;
+        delete[] ref;
+        delete[] res;
+      }
+      assertTrue(test_passed, "int8 quantization");
     }
 
     // ***********************************************
@@ -378,6 +591,226 @@ int main(int argc, char *argv[]) {
       delete rand;
     }
 
+    // ***********************************************
+    // Test strided views (narrow, select and transpose)
+    {
+      float* temp = new float[width * height * num_feats_in];
+      // narrow --> feature planes 1 and 2, rows 3 to 6
+      Tensor<float>* feats = data_in.narrow(2, 1, 2);
+      Tensor<float>* rows = feats->narrow(1, 3, 4);
+      rows->getData(temp);
+      bool test_passed = !rows->isContiguous() && feats->isContiguous();
+      for (uint32_t f = 0; f < 2; f++) {
+        for (uint32_t v = 0; v < 4; v++) {
+          for (uint32_t u = 0; u < width; u++) {
+            test_passed = test_passed && temp[(f * 4 + v) * width + u] == 
+              din[((f + 1) * height + (v + 3)) * width + u];
+          }
+        }
+      }
+      // select --> column 7 (a 2D height x feats tensor)
+      Tensor<float>* col = data_in.select(0, 7);
+      col->getData(temp);
+      for (uint32_t f = 0; f < num_feats_in; f++) {
+        for (uint32_t v = 0; v < height; v++) {
+          test_passed = test_passed && temp[f * height + v] == 
+            din[(f * height + v) * width + 7];
+        }
+      }
+      // transpose --> swap u and v, then run Tanh directly on the view
+      Tensor<float>* trans = data_in.transpose(0, 1);
+      Tanh tanh_stage;
+      tanh_stage.forwardProp(*trans);
+      TO_TENSOR_PTR(tanh_stage.output)->getData(temp);
+      for (uint32_t f = 0; f < num_feats_in; f++) {
+        for (uint32_t u = 0; u < width; u++) {
+          for (uint32_t v = 0; v < height; v++) {
+            float expected = tanhf(din[(f * height + v) * width + u]);
+            test_passed = test_passed && fabsf(temp[(f * width + u) * height +
+              v] - expected) < JTORCH_FLOAT_PRECISION;
+          }
+        }
+      }
+      assertTrue(test_passed, "Tensor strided views");
+      delete trans;
+      delete col;
+      delete rows;
+      delete feats;
+      delete[] temp;
+    }
+
+    // ***********************************************
+    // Test JoinTable (along the height dimension)
+    {
+      Table input;
+      const uint32_t heights[3] = {2, 5, 3};
+      float* gt = new float[width * 10 * num_feats_in];
+      uint32_t v_offset = 0;
+      for (uint32_t i = 0; i < 3; i++) {
+        const uint32_t size[3] = {width, heights[i], num_feats_in};
+        Tensor<float>* cur = new Tensor<float>(3, size);
+        float* cur_data = new float[cur->nelems()];
+        for (uint32_t f = 0; f < num_feats_in; f++) {
+          for (uint32_t v = 0; v < heights[i]; v++) {
+            for (uint32_t u = 0; u < width; u++) {
+              float val = (float)(i * 1000 + f * 100 + v * 10 + u);
+              cur_data[(f * heights[i] + v) * width + u] = val;
+              gt[(f * 10 + v + v_offset) * width + u] = val;
+            }
+          }
+        }
+        cur->setData(cur_data);
+        delete[] cur_data;
+        input.add(cur);  // Transfers ownership
+        v_offset += heights[i];
+      }
+      JoinTable module(1);  // torch dimension 2 (ie height in fxhxw)
+      module.forwardProp(input);
+      Tensor<float>* out = TO_TENSOR_PTR(module.output);
+      float* temp = new float[out->nelems()];
+      out->getData(temp);
+      bool test_passed = out->size()[1] == 10 && 
+        out->nelems() == width * 10 * num_feats_in;
+      for (uint32_t i = 0; i < out->nelems() && test_passed; i++) {
+        test_passed = test_passed && temp[i] == gt[i];
+      }
+      assertTrue(test_passed, "JoinTable");
+      delete[] temp;
+      delete[] gt;
+    }
+
+    // ***********************************************
+    // Test a loaded JoinTable(1, 3) joining features of a batch (and of
+    // single samples)
+    {
+      TorchStage* model = TorchStage::loadFromFile(
+        "./test_data/join_table_model.bin");
+      JoinTable* join = (JoinTable*)((Sequential*)model)->get(1);
+      const uint32_t batch_size = 2;
+      const uint32_t bsize[4] = {width, height, num_feats_in, batch_size};
+      const uint32_t sample_nelems = width * height * num_feats_in;
+      std::vector<float> batch_cpu(sample_nelems * batch_size);
+      for (uint32_t i = 0; i < batch_cpu.size(); i++) {
+        batch_cpu[i] = din[i % sample_nelems] * (i < sample_nelems ? 1 : -2);
+      }
+      Table batch_in;
+      for (uint32_t i = 0; i < 2; i++) {
+        Tensor<float>* cur = new Tensor<float>(4, bsize);
+        cur->setData(&batch_cpu[0]);
+        batch_in.add(cur);
+      }
+      model->forwardProp(batch_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model->output);
+      bool test_passed = join->nInputDims() == 3 && out->dim() == 4 &&
+        out->size()[2] == 2 * num_feats_in && out->size()[3] == batch_size;
+      std::vector<float> batch_res(out->nelems());
+      out->getData(&batch_res[0]);
+
+      const uint32_t out_nelems = 2 * sample_nelems;
+      for (uint32_t b = 0; b < batch_size && test_passed; b++) {
+        Table sample_in;
+        for (uint32_t i = 0; i < 2; i++) {
+          Tensor<float>* cur = new Tensor<float>(3, bsize);
+          cur->setData(&batch_cpu[b * sample_nelems]);
+          sample_in.add(cur);
+        }
+        model->forwardProp(sample_in);
+        out = TO_TENSOR_PTR(model->output);
+        std::vector<float> res(out->nelems());
+        out->getData(&res[0]);
+        test_passed = out->dim() == 3 && res.size() == out_nelems &&
+          std::equal(res.begin(), res.end(),
+          batch_res.begin() + b * out_nelems);
+      }
+      assertTrue(test_passed, "JoinTable batch mode (loaded)");
+      delete model;
+    }
+
+    // ***********************************************
+    // Test Tensor reductions
+    {
+      // A length that needs two passes and a partial last chunk
+      const uint32_t n = 100003;
+      float* data = new float[n];
+      double sum = 0, sum_sq = 0;
+      float max_val = -1e30f, min_val = 1e30f;
+      uint32_t argmax = 0;
+      for (uint32_t i = 0; i < n; i++) {
+        data[i] = (float)((i * 7919) % 1013) / 1013.0f - 0.5f;
+        sum += data[i];
+        sum_sq += data[i] * data[i];
+        if (data[i] > max_val) {
+          max_val = data[i];
+          argmax = i;
+        }
+        min_val = std::min<float>(min_val, data[i]);
+      }
+      Tensor<float>* t = Tensor<float>::uninitialized(1, &n);
+      t->setData(data);
+      const float precision = JTORCH_FLOAT_PRECISION * 10;
+      bool test_passed = 
+        fabsf(Tensor<float>::sum(*t) - (float)sum) < precision &&
+        Tensor<float>::reduce(*t, REDUCE_MAX) == max_val &&
+        Tensor<float>::reduce(*t, REDUCE_MIN) == min_val &&
+        fabsf(Tensor<float>::reduce(*t, REDUCE_MEAN) - (float)(sum / n)) <
+          precision &&
+        fabsf(Tensor<float>::reduce(*t, REDUCE_L2) - (float)sqrt(sum_sq)) <
+          precision &&
+        Tensor<float>::argmax(*t) == argmax;
+      delete t;
+      delete[] data;
+
+      // Along each dimension of data_in (strided for dim 0)
+      float* temp = new float[width * height * num_feats_in];
+      for (uint32_t dim = 0; dim < 3; dim++) {
+        Tensor<float>* x = dim == 0 ? data_in.transpose(0, 1) : 
+          data_in.view(3, data_in.size());
+        uint32_t out_size[3];
+        memcpy(out_size, x->size(), sizeof(out_size));
+        out_size[dim] = 1;
+        Tensor<float>* out = Tensor<float>::uninitialized(3, out_size);
+        Tensor<float>* out_idx = Tensor<float>::uninitialized(3, out_size);
+        Tensor<float>::reduce(*out, *x, dim, REDUCE_SUM);
+        Tensor<float>::reduce(*out_idx, *x, dim, REDUCE_ARGMAX);
+        float* res = new float[out->nelems()];
+        float* res_idx = new float[out->nelems()];
+        out->getData(res);
+        out_idx->getData(res_idx);
+        x->getData(temp);
+        const uint32_t* sz = x->size();
+        for (uint32_t k = 0; k < out_size[2]; k++) {
+          for (uint32_t j = 0; j < out_size[1]; j++) {
+            for (uint32_t i = 0; i < out_size[0]; i++) {
+              // (i, j, k) is the output element
+              float expected = 0, best = -1e30f;
+              uint32_t best_r = 0;
+              for (uint32_t r = 0; r < sz[dim]; r++) {
+                uint32_t c[3] = {i, j, k};
+                c[dim] = r;
+                float val = temp[c[0] + sz[0] * (c[1] + sz[1] * c[2])];
+                expected += val;
+                if (val > best) {
+                  best = val;
+                  best_r = r;
+                }
+              }
+              uint32_t o = i + out_size[0] * (j + out_size[1] * k);
+              test_passed = test_passed && 
+                fabsf(res[o] - expected) < JTORCH_FLOAT_PRECISION &&
+                res_idx[o] == (float)best_r;
+            }
+          }
+        }
+        delete[] res;
+        delete[] res_idx;
+        delete out;
+        delete out_idx;
+        delete x;
+      }
+      delete[] temp;
+      assertTrue(test_passed, "Tensor reductions");
+    }
+
     // ***********************************************
     // Test SelectTable
     {
@@ -448,62 +881,1626 @@ int main(int argc, char *argv[]) {
     }
 
     // ***********************************************
-    // Test Loading and running a model
+    // Test BufferPool
     {
-      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      const uint32_t size[3] = {width, height, num_feats_in};
+      jtorch::buffer_pool->trim();
+      jtorch::buffer_pool->resetStats();
+      Tensor<float>* t0 = new Tensor<float>(3, size);
+      delete t0;  // Should return the buffer to the free list
+      Tensor<float>* t1 = new Tensor<float>(3, size);
+      Tensor<float>* t1_view = t1->view(3, size);
+      BufferPoolStats stats = jtorch::buffer_pool->stats();
+      bool test_passed = stats.misses == 1 && stats.hits == 1 &&
+        t1->storage() == t1_view->storage();
+      Tensor<float>::fill(*t1, 1.0f);
+      delete t1;  // The view still holds a reference
+      test_passed = test_passed && 
+        jtorch::buffer_pool->stats().buffers_cached == 0 &&
+        Tensor<float>::sum(*t1_view) == (float)t1_view->nelems();
+      delete t1_view;
+      jtorch::buffer_pool->trim();
+      stats = jtorch::buffer_pool->stats();
+      test_passed = test_passed && stats.bytes_cached == 0 &&
+        stats.buffers_cached == 0;
+      assertTrue(test_passed, "BufferPool");
+    }
 
-      model->forwardProp(data_in);
+    // ***********************************************
+    // Test Tensor::uninitialized
+    {
+      const uint32_t size[3] = {width, height, num_feats_in};
+      Tensor<float>* t = Tensor<float>::uninitialized(3, size);
+      t->setData(din);
+      float* temp = new float[t->nelems()];
+      t->getData(temp);
+      bool test_passed = t->isSameSizeAs(data_in);
+      for (uint32_t i = 0; i < t->nelems(); i++) {
+        test_passed = test_passed && temp[i] == din[i];
+      }
+      assertTrue(test_passed, "Tensor::uninitialized");
+      delete[] temp;
+      delete t;
+    }
 
-      // Some debugging if things go wrong:
-      if (model->type() != SEQUENTIAL_STAGE) {
-        throw std::runtime_error("main() - ERROR: Expecting Sequential!");
+    // ***********************************************
+    // Test Tensor::map and HostBuffer
+    {
+      const uint32_t size[3] = {width, height, num_feats_in};
+      Tensor<float>* t = Tensor<float>::uninitialized(3, size);
+      float* mapped = t->map(TENSOR_MAP_WRITE);
+      memcpy(mapped, din, sizeof(din[0]) * t->nelems());
+      t->unmap();
+      HostBuffer staging(sizeof(float) * t->nelems());
+      t->getData((float*)staging.data());
+      bool test_passed = true;
+      for (uint32_t i = 0; i < t->nelems(); i++) {
+        test_passed = test_passed && ((float*)staging.data())[i] == din[i];
       }
-      const TorchStageType stages[] = {SPATIAL_CONVOLUTION_STAGE, TANH_STAGE,
-        THRESHOLD_STAGE, SPATIAL_MAX_POOLING_STAGE, SPATIAL_CONVOLUTION_STAGE,
-        RESHAPE_STAGE, LINEAR_STAGE};
+      assertTrue(test_passed, "Tensor::map and HostBuffer");
+      delete t;
+    }
 
-      if (((Sequential*)model)->size() != sizeof(stages) / sizeof(stages[0])) {
-        throw std::runtime_error("main() - ERROR: Badly formatted model!");
+    // ***********************************************
+    // Test setDataAsync and getDataAsync
+    {
+      const uint32_t size[3] = {width, height, num_feats_in};
+      Tensor<float>* t = Tensor<float>::uninitialized(3, size);
+      float* temp = new float[t->nelems()];
+      std::atomic<int32_t> callbacks_fired(0);
+      Event upload = t->setDataAsync(din);
+      upload.setCallback([&callbacks_fired]() { callbacks_fired++; });
+      Event download = t->getDataAsync(temp);
+      download.setCallback([&callbacks_fired]() { callbacks_fired++; });
+      download.wait();
+      bool test_passed = upload.isComplete() && download.isComplete();
+      for (uint32_t i = 0; i < t->nelems(); i++) {
+        test_passed = test_passed && temp[i] == din[i];
       }
+      jtorch::Sync();
+      // Callbacks run on a runtime thread, possibly just after wait() returns
+      while (callbacks_fired != 2) {
+        std::this_thread::yield();
+      }
+      assertTrue(test_passed, "setDataAsync and getDataAsync");
+      delete[] temp;
+      delete t;
+    }
 
-      for (uint32_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
-        TorchStage* stage = ((Sequential*)model)->get(i);
-        if (stage->type() != stages[i]) {
-          throw std::runtime_error("main() - ERROR: Badly formatted model!");
+    // ***********************************************
+    // Test the kernel registry
+    {
+      KernelHandle fill("fill.cl", "Fill");
+      Kernel* kernel = fill.get();
+      bool test_passed = kernel == kernel_registry->get("fill.cl", "Fill") &&
+        kernel == fill.get() && kernel->name() == "Fill";
+      bool threw = false;
+      try {
+        kernel_registry->get("fill.cl", "NotAKernel");
+      } catch (std::runtime_error&) {
+        threw = true;
+      }
+      assertTrue(test_passed && threw, "Kernel registry");
+    }
+
+    // ***********************************************
+    // Test the kernel binary cache (the second registry should hit)
+    {
+      const std::string cache_dir = makeTempDir();
+      KernelRegistry* cold = new KernelRegistry(jtorch_path, cache_dir);
+      cold->get("fill.cl", "Fill");
+      KernelCacheStats cold_stats = cold->stats();
+      delete cold;
+      KernelRegistry* warm = new KernelRegistry(jtorch_path, cache_dir);
+      warm->get("fill.cl", "Fill");
+      KernelCacheStats warm_stats = warm->stats();
+      delete warm;
+      removeTempDir(cache_dir);
+      std::cout << "\tKernel cache: cold " << cold_stats.build_ms << "ms, " <<
+        "warm " << warm_stats.build_ms << "ms" << std::endl;
+      // Drivers may decline to return binaries (then nothing was written)
+      bool test_passed = cold_stats.cache_hits + cold_stats.cache_misses == 1 &&
+        (cold_stats.cache_writes == 0 || warm_stats.cache_hits == 1);
+      assertTrue(test_passed, "Kernel binary cache");
+    }
+
+    // ***********************************************
+    // Test engines with a kernel cache (their registries precompile on a
+    // background thread that has no current engine)
+    {
+      Tanh ref_stage;
+      ref_stage.forwardProp(data_in);
+      std::vector<float> ref(TO_TENSOR_PTR(ref_stage.output)->nelems());
+      TO_TENSOR_PTR(ref_stage.output)->getData(&ref[0]);
+
+      const std::string cache_dir = makeTempDir();
+      bool test_passed = true;
+      // The first engine fills the cache, the second one loads from it
+      for (uint32_t i = 0; i < 2; i++) {
+        Engine engine("../", use_cpu, cache_dir);
+        EngineScope scope(engine);
+        Tensor<float> input(3, isize);
+        input.setData(din);
+        Tanh stage;
+        stage.forwardProp(input);
+        std::vector<float> res(ref.size());
+        TO_TENSOR_PTR(stage.output)->getData(&res[0]);
+        test_passed = test_passed && res == ref;
+      }
+      removeTempDir(cache_dir);
+      assertTrue(test_passed, "Engine with a kernel cache");
+    }
+
+    // ***********************************************
+    // Test in-place Tanh and Threshold (the model input must not change)
+    {
+      Sequential model;
+      model.add(new Tanh());
+      model.add(new Threshold());
+      model.forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model.output);
+      float* res = new float[out->nelems()];
+      float* ref = new float[out->nelems()];
+      out->getData(res);
+      bool test_passed = out->storage() ==
+        TO_TENSOR_PTR(model.get(0)->output)->storage() &&
+        out->storage() != data_in.storage();
+
+      model.get(1)->setInPlace(IN_PLACE_NEVER);
+      model.forwardProp(data_in);
+      out = TO_TENSOR_PTR(model.output);
+      out->getData(ref);
+      test_passed = test_passed && out->storage() !=
+        TO_TENSOR_PTR(model.get(0)->output)->storage();
+      for (uint32_t i = 0; i < out->nelems(); i++) {
+        test_passed = test_passed && ref[i] == res[i];
+      }
+
+      Tensor<float>* in = Tensor<float>::clone(data_in);
+      Tanh tanh_stage;
+      tanh_stage.setInPlace(IN_PLACE_ALWAYS);
+      tanh_stage.forwardProp(*in);
+      test_passed = test_passed &&
+        TO_TENSOR_PTR(tanh_stage.output)->storage() == in->storage();
+      model.get(0)->forwardProp(data_in);
+      TO_TENSOR_PTR(model.get(0)->output)->getData(ref);
+      in->getData(res);
+      for (uint32_t i = 0; i < in->nelems(); i++) {
+        test_passed = test_passed && ref[i] == res[i];
+      }
+      assertTrue(test_passed, "In-place Tanh and Threshold");
+      delete in;
+      delete[] ref;
+      delete[] res;
+    }
+
+    // ***********************************************
+    // Test replaying a launch plan (with new input data)
+    {
+      Sequential model;
+      SpatialConvolutionMM* convmm = new SpatialConvolutionMM(num_feats_in,
+        num_feats_out, filt_height, filt_width, 2);
+      convmm->setWeights(cweights);
+      convmm->setBiases(cbiases);
+      model.add(convmm);
+      model.add(new Tanh());
+      model.add(new SpatialMaxPooling(2, 2));
+      model.add(new Threshold());
+      Tensor<float>* in = Tensor<float>::clone(data_in);
+
+      LaunchPlan plan;
+      plan.compile(model, *in);
+      Tensor<float>::mul(*in, 0.5f);
+      model.forwardProp(*in);
+      Tensor<float>* out = TO_TENSOR_PTR(model.output);
+      float* ref = new float[out->nelems()];
+      float* res = new float[out->nelems()];
+      out->getData(ref);
+      Tensor<float>::mul(*in, 2.0f);
+      plan.run();
+      Tensor<float>::mul(*in, 0.5f);  // Ordered with the replay
+      plan.run();
+      out->getData(res);
+      bool test_passed = plan.numLaunches() > 0;
+      for (uint32_t i = 0; i < out->nelems(); i++) {
+        test_passed = test_passed && ref[i] == res[i];
+      }
+
+      // SpatialConvolutionMap runs on the host, so it can't be recorded
+      Sequential host_model;
+      host_model.add(new SpatialConvolutionMap(num_feats_in, num_feats_out,
+        fan_in, filt_height, filt_width));
+      LaunchPlan host_plan;
+      bool threw = false;
+      try {
+        host_plan.compile(host_model, data_in);
+      } catch (std::runtime_error&) {
+        threw = true;
+      }
+      assertTrue(test_passed && threw, "Launch plan");
+      delete[] ref;
+      delete[] res;
+      delete in;
+    }
+
+    // ***********************************************
+    // Test folding activations into the conv and linear epilogues
+    {
+      Sequential conv_model;
+      SpatialConvolution* conv = new SpatialConvolution(num_feats_in,
+        num_feats_out, filt_height, filt_width, 2);
+      conv->setWeights(cweights);
+      conv->setBiases(cbiases);
+      conv_model.add(conv);
+      conv_model.add(new Tanh());
+      Sequential convmm_model;
+      SpatialConvolutionMM* convmm = new SpatialConvolutionMM(num_feats_in,
+        num_feats_out, filt_height, filt_width, 2);
+      convmm->setWeights(cweights);
+      convmm->setBiases(cbiases);
+      convmm_model.add(convmm);
+      Threshold* threshold = new Threshold();
+      threshold->threshold = 0.5f;
+      threshold->val = -1.0f;
+      convmm_model.add(threshold);
+      Sequential lin_model;
+      lin_model.add(new Reshape(1, &lin_size_in));
+      Linear* lin = new Linear(lin_size_in, lin_size_out);
+      lin->setWeights(lweights);
+      lin->setBiases(lbiases);
+      lin_model.add(lin);
+      lin_model.add(new Tanh());
+
+      Sequential* models[3] = {&conv_model, &convmm_model, &lin_model};
+      bool test_passed = true;
+      const float precision = JTORCH_FLOAT_PRECISION * 10;
+      for (uint32_t i = 0; i < 3; i++) {
+        models[i]->forwardProp(data_in);
+        // The old output belongs to the activation stage that gets replaced
+        const uint32_t nelems = TO_TENSOR_PTR(models[i]->output)->nelems();
+        float* ref = new float[nelems];
+        float* res = new float[nelems];
+        TO_TENSOR_PTR(models[i]->output)->getData(ref);
+        const uint32_t size = models[i]->size();
+        test_passed = test_passed && models[i]->fuseActivations() == 1 &&
+          models[i]->size() == size &&
+          models[i]->get(size - 1)->type() == IDENTITY_STAGE;
+        models[i]->forwardProp(data_in);
+        TO_TENSOR_PTR(models[i]->output)->getData(res);
+        for (uint32_t j = 0; j < nelems; j++) {
+          const float delta = fabsf(res[j] - ref[j]);
+          test_passed = test_passed && (delta < precision ||
+            delta / std::max<float>(fabsf(ref[j]), LOOSE_EPSILON) < precision);
         }
+        delete[] ref;
+        delete[] res;
       }
+      assertTrue(test_passed, "Activation fusion");
+    }
 
-      testJTorchValue(TO_TENSOR_PTR(model->output),
-        "./test_data/test_model_result.bin");
+    // ***********************************************
+    // Test the fused SpatialContrastiveNormalization against the unfused one
+    {
+      const uint32_t kernel_size[2] = {7, 5};
+      Tensor<float>* kernel_1d = new Tensor<float>(1, kernel_size);
+      Tensor<float>* kernel_2d = new Tensor<float>(2, kernel_size);
+      float kernel_cpu[7 * 5];
+      for (uint32_t i = 0; i < 7 * 5; i++) {
+        kernel_cpu[i] = 1.0f + (float)(i % 3);
+      }
+      kernel_1d->setData(kernel_cpu);
+      kernel_2d->setData(kernel_cpu);
 
-      delete model;
+      Tensor<float>* kernels[2] = {kernel_1d, kernel_2d};
+      bool test_passed = true;
+      const float precision = JTORCH_FLOAT_PRECISION * 10;
+      for (uint32_t i = 0; i < 2; i++) {
+        SpatialContrastiveNormalization cont_norm_stage(kernels[i]);
+        cont_norm_stage.setFused(false);
+        cont_norm_stage.forwardProp(data_in);
+        Tensor<float>* out = TO_TENSOR_PTR(cont_norm_stage.output);
+        float* ref = new float[out->nelems()];
+        float* res = new float[out->nelems()];
+        out->getData(ref);
+        cont_norm_stage.setFused(true);
+        cont_norm_stage.forwardProp(data_in);
+        test_passed = test_passed && cont_norm_stage.output != out;
+        TO_TENSOR_PTR(cont_norm_stage.output)->getData(res);
+        for (uint32_t j = 0; j < out->nelems(); j++) {
+          const float delta = fabsf(res[j] - ref[j]);
+          test_passed = test_passed && (delta < precision ||
+            delta / std::max<float>(fabsf(ref[j]), LOOSE_EPSILON) < precision);
+        }
+        delete[] ref;
+        delete[] res;
+      }
+      assertTrue(test_passed, "Fused SpatialContrastiveNormalization");
+      delete kernel_1d;
+      delete kernel_2d;
     }
 
     // ***********************************************
-    // Test Loading and running a big model (ie our body tracking model)
-    if (jcl::file_io::fileExists("./test_data/big_model.bin")) {
-      TorchStage* model = TorchStage::loadFromFile("./test_data/big_model.bin");
+    // Test fp16 activations for the pooling and normalization stages, and
+    // their conversion back to fp32 for a stage that needs it
+    {
+      uint32_t gauss_size = 7;
+      Tensor<float>* kernel_1d = Tensor<float>::gaussian1D(gauss_size);
+      Tensor<float>* kernel_2d = Tensor<float>::gaussian(gauss_size);
 
-      // The input is a nested table of tensors (one for each resolution bank)
-      Table* input = new Table();
-      const uint32_t num_banks = 3;
-      for (uint32_t i = 1; i <= num_banks; i++) {
-        std::stringstream ss;
-        ss << "./test_data/big_model_input_bank" << i << ".bin";
-        Table* cur_table = new Table();
-        cur_table->add(Tensor<float>::loadFromFile(ss.str()));
-        cur_table->add(NULL);
-        input->add(cur_table);
+      SpatialMaxPooling max_pool_stage(2, 2);
+      bool test_passed = halfOutputMatches(max_pool_stage, data_in);
+      SpatialLPPooling lp_pool_stage(2, 2, 2);
+      test_passed = test_passed && halfOutputMatches(lp_pool_stage, data_in);
+      SpatialSubtractiveNormalization sub_norm_stage(*kernel_1d);
+      test_passed = test_passed && halfOutputMatches(sub_norm_stage, data_in);
+      SpatialSubtractiveNormalization sub_norm_stage_2d(*kernel_2d);
+      test_passed = test_passed && 
+        halfOutputMatches(sub_norm_stage_2d, data_in);
+      SpatialDivisiveNormalization div_norm_stage(*kernel_1d);
+      test_passed = test_passed && halfOutputMatches(div_norm_stage, data_in);
+      SpatialDivisiveNormalization div_norm_stage_2d(*kernel_2d);
+      test_passed = test_passed && 
+        halfOutputMatches(div_norm_stage_2d, data_in);
+      for (uint32_t i = 0; i < 2; i++) {
+        SpatialContrastiveNormalization cont_norm_stage(kernel_1d);
+        cont_norm_stage.setFused(i == 1);
+        test_passed = test_passed && 
+          halfOutputMatches(cont_norm_stage, data_in);
       }
 
-      model->forwardProp(*input);
+      // The fp16 pooling output is converted back for SpatialUpSamplingNearest
+      Sequential seq;
+      seq.add(new SpatialMaxPooling(2, 2));
+      seq.add(new SpatialUpSamplingNearest(2));
+      seq.forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(seq.output);
+      float* ref = new float[out->nelems()];
+      float* res = new float[out->nelems()];
+      out->getData(ref);
+      seq.setOutputPrecision(OUTPUT_PRECISION_HALF);
+      seq.forwardProp(data_in);
+      test_passed = test_passed && seq.output->type() == TENSOR_DATA &&
+        seq.get(0)->output->type() == HALF_TENSOR_DATA;
+      if (test_passed) {
+        TO_TENSOR_PTR(seq.output)->getData(res);
+        for (uint32_t i = 0; i < out->nelems(); i++) {
+          test_passed = test_passed && res[i] == (float)half(ref[i]);
+        }
+      }
+      assertTrue(test_passed, "fp16 activations");
+      delete[] ref;
+      delete[] res;
+      delete kernel_1d;
+      delete kernel_2d;
+    }
 
-      const float precision = JTORCH_FLOAT_PRECISION * 100;
-      testJTorchValue(TO_TENSOR_PTR(model->output),
-        "./test_data/big_model_output.bin", precision);
+    // ***********************************************
+    // Test that each sample of a batch gives the single sample output
+    {
+      const uint32_t batch_size = 3;
+      const uint32_t sample_nelems = width * height * num_feats_in;
+      float* batch_cpu = new float[sample_nelems * batch_size];
+      for (uint32_t b = 0; b < batch_size; b++) {
+        for (uint32_t i = 0; i < sample_nelems; i++) {
+          batch_cpu[b * sample_nelems + i] = din[i] * (1.0f + 0.5f * b) -
+            0.25f * b;
+        }
+      }
+      const uint32_t bsize[4] = {width, height, num_feats_in, batch_size};
+      Tensor<float> batch_in(4, bsize);
+      batch_in.setData(batch_cpu);
+      Tensor<float> sample_in(3, isize);
 
-      delete model;
-      delete input;
+      Tensor<float>* kernel_1d = Tensor<float>::gaussian1D(7);
+      Tensor<float>* kernel_2d = Tensor<float>::gaussian(7);
+      Sequential conv_model;
+      SpatialConvolution* conv = new SpatialConvolution(num_feats_in,
+        num_feats_out, filt_height, filt_width, 2);
+      conv->setWeights(cweights);
+      conv->setBiases(cbiases);
+      conv_model.add(conv);
+      conv_model.add(new Tanh());
+      conv_model.add(new SpatialMaxPooling(2, 2));
+      conv_model.add(new SpatialUpSamplingNearest(2));
+      Sequential convmm_model;
+      SpatialConvolutionMM* convmm = new SpatialConvolutionMM(num_feats_in,
+        num_feats_out, filt_height, filt_width, 2);
+      convmm->setWeights(cweights);
+      convmm->setBiases(cbiases);
+      convmm_model.add(convmm);
+      convmm_model.add(new Threshold());
+      convmm_model.add(new SpatialSubtractiveNormalization(*kernel_1d));
+      convmm_model.add(new SpatialDivisiveNormalization(*kernel_2d));
+      Sequential norm_model;
+      norm_model.add(new SpatialContrastiveNormalization(kernel_1d));
+      norm_model.add(new SpatialLPPooling(2.0f, 2, 2));
+      Sequential lin_model;
+      lin_model.add(new Reshape(1, &lin_size_in));
+      Linear* lin = new Linear(lin_size_in, lin_size_out);
+      lin->setWeights(lweights);
+      lin->setBiases(lbiases);
+      lin_model.add(lin);
+      lin_model.add(new Tanh());
+
+      Sequential* models[4] = {&conv_model, &convmm_model, &norm_model,
+        &lin_model};
+      bool test_passed = true;
+      const float precision = JTORCH_FLOAT_PRECISION * 10;
+      for (uint32_t i = 0; i < 4; i++) {
+        models[i]->forwardProp(batch_in);
+        Tensor<float>* out = TO_TENSOR_PTR(models[i]->output);
+        const uint32_t nelems = out->nelems();
+        const uint32_t out_nelems = nelems / batch_size;
+        test_passed = test_passed && out->size()[out->dim() - 1] == batch_size;
+        float* batch_res = new float[nelems];
+        float* res = new float[out_nelems];
+        out->getData(batch_res);
+        for (uint32_t b = 0; b < batch_size; b++) {
+          sample_in.setData(&batch_cpu[b * sample_nelems]);
+          models[i]->forwardProp(sample_in);
+          out = TO_TENSOR_PTR(models[i]->output);
+          test_passed = test_passed && out->nelems() == out_nelems;
+          out->getData(res);
+          for (uint32_t j = 0; j < out_nelems; j++) {
+            const float ref = batch_res[b * out_nelems + j];
+            const float delta = fabsf(res[j] - ref);
+            test_passed = test_passed && (delta < precision ||
+              delta / std::max<float>(fabsf(ref), LOOSE_EPSILON) < precision);
+          }
+        }
+        delete[] batch_res;
+        delete[] res;
+      }
+      assertTrue(test_passed, "Batched forwardProp");
+      delete kernel_1d;
+      delete kernel_2d;
+      delete[] batch_cpu;
+    }
+
+    // ***********************************************
+    // Test that Reshape keeps the batch dimension of a batch of one
+    {
+      const uint32_t bsize[4] = {width, height, num_feats_in, 1};
+      Tensor<float> batch_in(4, bsize);
+      Tensor<float> sample_in(3, isize);
+      Reshape reshape(1, &lin_size_in, 3);
+      reshape.forwardProp(batch_in);
+      Tensor<float>* out = TO_TENSOR_PTR(reshape.output);
+      bool test_passed = out->dim() == 2 && out->size()[0] == lin_size_in &&
+        out->size()[1] == 1;
+      reshape.forwardProp(sample_in);
+      out = TO_TENSOR_PTR(reshape.output);
+      test_passed = test_passed && out->dim() == 1 &&
+        out->size()[0] == lin_size_in;
+      assertTrue(test_passed, "Reshape batch of one");
+    }
+
+    // ***********************************************
+    // Test the inference queue (concurrent single sample callers)
+    {
+      Sequential model;
+      model.add(new Reshape(1, &lin_size_in));
+      Linear* lin = new Linear(lin_size_in, lin_size_out);
+      lin->setWeights(lweights);
+      lin->setBiases(lbiases);
+      model.add(lin);
+      model.add(new Tanh());
+
+      const uint32_t num_threads = 4;
+      const uint32_t num_samples = 16;
+      const uint32_t sample_nelems = width * height * num_feats_in;
+      float* samples = new float[sample_nelems * num_samples];
+      float* ref = new float[lin_size_out * num_samples];
+      Tensor<float> sample_in(3, isize);
+      for (uint32_t i = 0; i < num_samples; i++) {
+        for (uint32_t j = 0; j < sample_nelems; j++) {
+          samples[i * sample_nelems + j] = din[j] * (1.0f - 0.1f * i);
+        }
+        sample_in.setData(&samples[i * sample_nelems]);
+        model.forwardProp(sample_in);
+        TO_TENSOR_PTR(model.output)->getData(&ref[i * lin_size_out]);
+      }
+
+      InferenceQueue queue(model, 3, isize, 8, 5.0);
+      std::vector<std::future<std::vector<float>>> results(num_samples);
+      // Callers submit from their own threads while this (the jtorch)
+      // thread pumps the queue
+      std::thread callers([&]() {
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < num_threads; t++) {
+          threads.push_back(std::thread([&, t]() {
+            for (uint32_t i = t; i < num_samples; i += num_threads) {
+              results[i] = queue.submit(&samples[i * sample_nelems]);
+            }
+          }));
+        }
+        for (uint32_t t = 0; t < num_threads; t++) {
+          threads[t].join();
+        }
+        queue.stop();
+      });
+      queue.run();
+      callers.join();
+
+      InferenceQueueStats stats = queue.stats();
+      uint64_t histogram_samples = 0;
+      for (uint32_t i = 0; i < stats.batch_size_histogram.size(); i++) {
+        histogram_samples += i * stats.batch_size_histogram[i];
+      }
+      bool test_passed = stats.num_requests == num_samples &&
+        histogram_samples == num_samples && stats.queue_depth == 0 &&
+        stats.num_batches <= num_samples;
+      const float precision = JTORCH_FLOAT_PRECISION * 10;
+      for (uint32_t i = 0; i < num_samples; i++) {
+        std::vector<float> res = results[i].get();
+        test_passed = test_passed && res.size() == lin_size_out;
+        for (uint32_t j = 0; j < res.size() && test_passed; j++) {
+          const float delta = fabsf(res[j] - ref[i * lin_size_out + j]);
+          test_passed = delta < precision || delta / std::max<float>(
+            fabsf(ref[i * lin_size_out + j]), LOOSE_EPSILON) < precision;
+        }
+      }
+      std::cout << "\tInference queue: " << stats.num_requests <<
+        " requests in " << stats.num_batches << " batches (max depth " <<
+        stats.max_queue_depth << ", mean added latency " <<
+        stats.mean_added_latency_ms << "ms)" << std::endl;
+
+      // A batch of 3 is padded to 4 (the padding output is dropped)
+      InferenceQueue padded_queue(model, 3, isize, 8, 5.0);
+      for (uint32_t i = 0; i < 3; i++) {
+        results[i] = padded_queue.submit(&samples[i * sample_nelems]);
+      }
+      padded_queue.stop();
+      test_passed = test_passed && padded_queue.processBatch() == 3 &&
+        TO_TENSOR_PTR(model.output)->size()[1] == 4;
+      for (uint32_t i = 0; i < 3; i++) {
+        std::vector<float> res = results[i].get();
+        test_passed = test_passed && res.size() == lin_size_out;
+        for (uint32_t j = 0; j < res.size() && test_passed; j++) {
+          const float delta = fabsf(res[j] - ref[i * lin_size_out + j]);
+          test_passed = delta < precision || delta / std::max<float>(
+            fabsf(ref[i * lin_size_out + j]), LOOSE_EPSILON) < precision;
+        }
+      }
+      assertTrue(test_passed, "Inference queue");
+      delete[] samples;
+      delete[] ref;
+    }
+
+    // ***********************************************
+    // Test ParallelTable branches on separate queues against running them in
+    // order
+    {
+      ParallelTable model;
+      Table input;
+      for (uint32_t i = 0; i < 3; i++) {
+        Sequential* bank = new Sequential();
+        SpatialConvolutionMM* convmm = new SpatialConvolutionMM(num_feats_in,
+          num_feats_out, filt_height, filt_width, 2);
+        convmm->setWeights(cweights);
+        convmm->setBiases(cbiases);
+        bank->add(convmm);
+        bank->add(new Tanh());
+        bank->add(new SpatialMaxPooling(2, 2));
+        model.add(bank);
+        const uint32_t size[3] = {width << i, height << i, num_feats_in};
+        Tensor<float>* bank_in = new Tensor<float>(3, size);
+        float* bank_in_cpu = new float[bank_in->nelems()];
+        for (uint32_t j = 0; j < bank_in->nelems(); j++) {
+          bank_in_cpu[j] = din[j % (width * height * num_feats_in)];
+        }
+        bank_in->setData(bank_in_cpu);
+        delete[] bank_in_cpu;
+        input.add(bank_in);
+      }
+
+      bool test_passed = model.concurrent();
+      std::vector<float> ref[3];
+      for (uint32_t concurrent = 0; concurrent < 2; concurrent++) {
+        model.setConcurrent(concurrent == 1);
+        model.forwardProp(input);
+        Table* out = (Table*)model.output;
+        for (uint32_t i = 0; i < 3; i++) {
+          Tensor<float>* bank_out = TO_TENSOR_PTR((*out)(i));
+          std::vector<float> res(bank_out->nelems());
+          bank_out->getData(&res[0]);
+          if (concurrent == 0) {
+            ref[i] = res;
+          } else {
+            test_passed = test_passed && res == ref[i];
+          }
+        }
+      }
+      assertTrue(test_passed, "Concurrent ParallelTable");
+    }
+
+    // ***********************************************
+    // Test normalization stages initializing inside concurrent branches
+    // (their init() does blocking transfers on the branch queue)
+    {
+      Tensor<float>* kernel_1d = Tensor<float>::gaussian1D(7);
+      ParallelTable models[2];
+      Table input;
+      for (uint32_t i = 0; i < 2; i++) {
+        for (uint32_t b = 0; b < 2; b++) {
+          Sequential* bank = new Sequential();
+          bank->add(new SpatialSubtractiveNormalization(*kernel_1d));
+          bank->add(new SpatialDivisiveNormalization(*kernel_1d));
+          models[i].add(bank);
+        }
+        models[i].setConcurrent(i == 1);
+      }
+      for (uint32_t b = 0; b < 2; b++) {
+        const uint32_t size[3] = {width << b, height << b, num_feats_in};
+        Tensor<float>* bank_in = new Tensor<float>(3, size);
+        std::vector<float> bank_in_cpu(bank_in->nelems());
+        for (uint32_t j = 0; j < bank_in->nelems(); j++) {
+          bank_in_cpu[j] = din[j % (width * height * num_feats_in)];
+        }
+        bank_in->setData(&bank_in_cpu[0]);
+        input.add(bank_in);
+      }
+
+      bool test_passed = true;
+      for (uint32_t i = 0; i < 2; i++) {
+        models[i].forwardProp(input);
+      }
+      for (uint32_t b = 0; b < 2; b++) {
+        std::vector<float> res[2];
+        for (uint32_t i = 0; i < 2; i++) {
+          Tensor<float>* out = TO_TENSOR_PTR((*(Table*)models[i].output)(b));
+          res[i].resize(out->nelems());
+          out->getData(&res[i][0]);
+        }
+        test_passed = test_passed && res[0] == res[1];
+      }
+      assertTrue(test_passed, "Normalization in concurrent branches");
+      delete kernel_1d;
+    }
+
+    // ***********************************************
+    // Test the memory planner (the output must not change)
+    {
+      Sequential model;
+      SpatialConvolutionMM* convmm = new SpatialConvolutionMM(num_feats_in,
+        num_feats_out, filt_height, filt_width, 2);
+      convmm->setWeights(cweights);
+      convmm->setBiases(cbiases);
+      model.add(convmm);
+      model.add(new Tanh());
+      model.add(new Threshold());
+      model.add(new SpatialMaxPooling(2, 2));
+      model.add(new Tanh());
+
+      model.forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model.output);
+      float* ref = new float[out->nelems()];
+      float* res = new float[out->nelems()];
+      out->getData(ref);
+
+      MemoryPlanner planner;
+      MemoryPlanStats stats = planner.plan(model, data_in);
+      model.forwardProp(data_in);
+      TO_TENSOR_PTR(model.output)->getData(res);
+      bool test_passed = stats.num_steps == 5 &&
+        stats.peak_bytes_after < stats.peak_bytes_before;
+      for (uint32_t i = 0; i < out->nelems(); i++) {
+        test_passed = test_passed && ref[i] == res[i];
+      }
+      std::cout << "\tMemory plan: " << stats.peak_bytes_before << " bytes (" <<
+        stats.num_buffers << " buffers) -> " << stats.peak_bytes_after <<
+        " bytes (" << stats.num_slots << " buffers)" << std::endl;
+      assertTrue(test_passed, "Memory planner");
+      delete[] ref;
+      delete[] res;
+    }
+
+    // ***********************************************
+    // Test that the GEMM stages don't depend on their output starting out
+    // zeroed (planned or recycled buffers hold stale data, ie NaNs)
+    {
+      const uint32_t bsize[4] = {width, height, num_feats_in, 2};
+      Tensor<float> batch_in(4, bsize);
+      std::vector<float> batch_cpu(din, din + lin_size_in);
+      batch_cpu.insert(batch_cpu.end(), din, din + lin_size_in);
+      batch_in.setData(&batch_cpu[0]);
+      SpatialConvolutionMM convmm(num_feats_in, num_feats_out, filt_height,
+        filt_width, 2);
+      convmm.setWeights(cweights);
+      convmm.setBiases(cbiases);
+      Sequential lin_model;
+      lin_model.add(new Reshape(1, &lin_size_in, 3));
+      Linear* lin = new Linear(lin_size_in, lin_size_out);
+      lin->setWeights(lweights);
+      lin->setBiases(lbiases);
+      lin_model.add(lin);
+      TorchStage* stages[2] = {&convmm, &lin_model};
+      bool test_passed = true;
+      for (uint32_t s = 0; s < 2; s++) {
+        TorchData* inputs[2] = {&data_in, &batch_in};
+        for (uint32_t i = 0; i < 2; i++) {
+          stages[s]->forwardProp(*inputs[i]);
+          Tensor<float>* out = TO_TENSOR_PTR(stages[s]->output);
+          std::vector<float> ref(out->nelems());
+          std::vector<float> res(out->nelems());
+          out->getData(&ref[0]);
+          Tensor<float>::fill(*out, std::numeric_limits<float>::quiet_NaN());
+          stages[s]->forwardProp(*inputs[i]);
+          TO_TENSOR_PTR(stages[s]->output)->getData(&res[0]);
+          test_passed = test_passed && res == ref;
+        }
+      }
+      assertTrue(test_passed, "GEMM outputs need no zero fill");
+    }
+
+    // ***********************************************
+    // Test that PipelineExecutor refuses a planned model (the planned buffers
+    // are shared between stages that would run concurrently)
+    {
+      Sequential model;
+      for (uint32_t i = 0; i < 6; i++) {
+        model.add(new SpatialMaxPooling(1, 1));
+      }
+      bool test_passed = true;
+      try {
+        PipelineExecutor pipeline(model, 3, isize, 3);
+      } catch (std::runtime_error&) {
+        test_passed = false;  // Nothing is shared before planning
+      }
+      MemoryPlanner planner;
+      planner.plan(model, data_in);
+      try {
+        PipelineExecutor pipeline(model, 3, isize, 3);
+        test_passed = false;
+      } catch (std::runtime_error&) {
+      }
+      assertTrue(test_passed, "Pipelined Sequential refuses a planned model");
+    }
+
+    // ***********************************************
+    // Test Loading and running a model
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+
+      model->forwardProp(data_in);
+
+      // Some debugging if things go wrong:
+      if (model->type() != SEQUENTIAL_STAGE) {
+        throw std::runtime_error("main() - ERROR: Expecting Sequential!");
+      }
+      const TorchStageType stages[] = {SPATIAL_CONVOLUTION_STAGE, TANH_STAGE,
+        THRESHOLD_STAGE, SPATIAL_MAX_POOLING_STAGE, SPATIAL_CONVOLUTION_STAGE,
+        RESHAPE_STAGE, LINEAR_STAGE};
+
+      if (((Sequential*)model)->size() != sizeof(stages) / sizeof(stages[0])) {
+        throw std::runtime_error("main() - ERROR: Badly formatted model!");
+      }
+
+      for (uint32_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        TorchStage* stage = ((Sequential*)model)->get(i);
+        if (stage->type() != stages[i]) {
+          throw std::runtime_error("main() - ERROR: Badly formatted model!");
+        }
+      }
+
+      testJTorchValue(TO_TENSOR_PTR(model->output),
+        "./test_data/test_model_result.bin");
+
+      delete model;
+    }
+
+    // ***********************************************
+    // Test dispatching frames to a model replica on every device
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      model->forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model->output);
+      std::vector<float> ref(out->nelems());
+      out->getData(&ref[0]);
+      delete model;
+
+      const uint32_t nframes = 8;
+      // The caller's queue must survive the dispatcher switching devices
+      SetCLQueue(CLExtraQueue(0));
+      DeviceDispatcher dispatcher([]() {
+        return TorchStage::loadFromFile("./test_data/testmodel.bin");
+      }, 3, isize);
+      std::vector<float> res(nframes * dispatcher.outputNElems());
+      for (uint32_t i = 0; i < nframes; i++) {
+        dispatcher.dispatch(din, &res[i * dispatcher.outputNElems()]);
+      }
+      dispatcher.sync();
+      bool test_passed = dispatcher.outputNElems() == ref.size() &&
+        dispatcher.numReplicas() == jtorch::NumDevices();
+      uint64_t frames = 0;
+      for (uint32_t i = 0; i < dispatcher.numReplicas(); i++) {
+        frames += dispatcher.replicaFrames(i);
+      }
+      test_passed = test_passed && frames == nframes && deviceid == 0 &&
+        CLQueue() == CLExtraQueue(0);
+      SetCLQueue(NULL);
+      for (uint32_t i = 0; i < res.size() && test_passed; i++) {
+        test_passed = res[i] == ref[i % ref.size()];
+      }
+      assertTrue(test_passed, "Device dispatcher");
+    }
+
+    // ***********************************************
+    // Test independent engines running the test model from their own threads
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      model->forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model->output);
+      std::vector<float> ref(out->nelems());
+      out->getData(&ref[0]);
+      delete model;
+
+      Engine* main_engine = Engine::current();
+      KernelRegistry* main_registry = kernel_registry;
+      const uint32_t num_threads = 2;
+      const uint32_t num_frames = 10;
+      std::atomic<bool> threads_passed(true);
+      std::vector<std::thread> threads;
+      for (uint32_t t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&]() {
+          try {
+            Engine engine("../", use_cpu);
+            TorchStage* model = TorchStage::loadFromFile(engine,
+              "./test_data/testmodel.bin");
+            EngineScope scope(engine);
+            Tensor<float> input(3, isize);
+            input.setData(din);
+            std::vector<float> res(ref.size());
+            const float precision = JTORCH_FLOAT_PRECISION * 10;
+            for (uint32_t i = 0; i < num_frames; i++) {
+              model->forwardProp(input);
+              TO_TENSOR_PTR(model->output)->getData(&res[0]);
+              for (uint32_t j = 0; j < res.size(); j++) {
+                const float delta = fabsf(res[j] - ref[j]);
+                if (delta > precision && delta / std::max<float>(
+                  fabsf(ref[j]), LOOSE_EPSILON) > precision) {
+                  threads_passed = false;
+                }
+              }
+            }
+            delete model;
+          } catch (std::runtime_error& e) {
+            std::cout << "\tEngine thread: " << e.what() << std::endl;
+            threads_passed = false;
+          }
+        }));
+      }
+      for (uint32_t t = 0; t < num_threads; t++) {
+        threads[t].join();
+      }
+      const bool test_passed = threads_passed &&
+        Engine::current() == main_engine && kernel_registry == main_registry;
+      assertTrue(test_passed, "Engines on separate threads");
+    }
+
+    // ***********************************************
+    // Test that a clone shares the weights (and costs less than loading the
+    // model again)
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      model->forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model->output);
+      std::vector<float> ref(out->nelems());
+      out->getData(&ref[0]);
+
+      uint64_t bytes_start = buffer_pool->stats().bytes_in_use;
+      TorchStage* replica = model->clone();
+      replica->forwardProp(data_in);
+      const uint64_t clone_bytes = buffer_pool->stats().bytes_in_use -
+        bytes_start;
+      bytes_start = buffer_pool->stats().bytes_in_use;
+      TorchStage* loaded = TorchStage::loadFromFile(
+        "./test_data/testmodel.bin");
+      loaded->forwardProp(data_in);
+      const uint64_t load_bytes = buffer_pool->stats().bytes_in_use -
+        bytes_start;
+
+      std::vector<float> res(ref.size());
+      TO_TENSOR_PTR(replica->output)->getData(&res[0]);
+      SpatialConvolution* conv = (SpatialConvolution*)
+        ((Sequential*)model)->get(0);
+      SpatialConvolution* conv_replica = (SpatialConvolution*)
+        ((Sequential*)replica)->get(0);
+      const bool test_passed = res == ref &&
+        replica->output != model->output &&
+        conv_replica->weightTensor() == conv->weightTensor() &&
+        replica->parameterBytes() == model->parameterBytes() &&
+        model->parameterBytes() > 0 && clone_bytes < load_bytes;
+      std::cout << "\tClone: " << clone_bytes << " bytes vs " << load_bytes <<
+        " bytes to load again (" << model->parameterBytes() <<
+        " bytes of shared parameters)" << std::endl;
+      assertTrue(test_passed, "Clone shares parameters");
+      delete loaded;
+      delete replica;
+      delete model;
+    }
+
+    // ***********************************************
+    // Test the out-of-order queue: two frames in flight with only their
+    // buffer dependencies ordering them must match the in-order results
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      TorchStage* replica = model->clone();
+      Tensor<float>* data_in2 = Tensor<float>::clone(data_in);
+      Tensor<float>::mul(*data_in2, -0.5f);
+      std::vector<float> ref[2];
+      for (uint32_t i = 0; i < 2; i++) {
+        model->forwardProp(i == 0 ? data_in : *data_in2);
+        Tensor<float>* out = TO_TENSOR_PTR(model->output);
+        ref[i].resize(out->nelems());
+        out->getData(&ref[i][0]);
+      }
+
+      Sync();  // The queues are not ordered with each other
+      SetCLQueue(CLOutOfOrderQueue());
+      bool test_passed = CLDependencies() != NULL;
+      model->forwardProp(data_in);
+      replica->forwardProp(*data_in2);
+      std::vector<float> res[2];
+      for (uint32_t i = 0; i < 2; i++) {
+        Tensor<float>* out = TO_TENSOR_PTR((i == 0 ? model : replica)->output);
+        res[i].resize(out->nelems());
+        out->getData(&res[i][0]);
+        test_passed = test_passed && res[i] == ref[i];
+      }
+      test_passed = test_passed && CLDependencies()->numBuffers() > 0;
+      Sync();
+      test_passed = test_passed && CLDependencies()->numBuffers() == 0;
+      SetCLQueue(NULL);
+      test_passed = test_passed && CLDependencies() == NULL;
+      assertTrue(test_passed, "Out-of-order queue");
+      delete data_in2;
+      delete replica;
+      delete model;
+    }
+
+    // ***********************************************
+    // Test forwardPropAsync with the readback queued behind its event (on the
+    // default queue, and on another queue than the forward pass)
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      model->forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model->output);
+      std::vector<float> ref(out->nelems());
+      out->getData(&ref[0]);
+
+      bool test_passed = true;
+      for (uint32_t other_queue = 0; other_queue < 2; other_queue++) {
+        std::vector<float> res(ref.size(), 0);
+        Event done = model->forwardPropAsync(data_in);
+        if (other_queue == 1) {
+          SetCLQueue(CLExtraQueue(0));
+        }
+        Event read = TO_TENSOR_PTR(model->output)->getDataAsync(&res[0],
+          done);
+        SetCLQueue(NULL);
+        read.wait();
+        test_passed = test_passed && done.isComplete() && res == ref;
+      }
+      assertTrue(test_passed, "Asynchronous forwardProp");
+      delete model;
+    }
+
+    // ***********************************************
+    // Test that prepare() leaves nothing for the first forwardProp to
+    // allocate (and does not change the result)
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      model->forwardProp(data_in);
+      Tensor<float>* out = TO_TENSOR_PTR(model->output);
+      std::vector<float> ref(out->nelems());
+      out->getData(&ref[0]);
+
+      TorchStage* prepared = model->clone();
+      PrepareReport report = prepared->prepare(data_in.dim(), data_in.size());
+      bool test_passed = report.stages.size() > 0 &&
+        report.allocated_bytes > 0 &&
+        report.parameter_bytes == model->parameterBytes();
+      for (uint32_t i = 0; i < report.stages.size(); i++) {
+        const PreparedStage& stage = report.stages[i];
+        std::cout << "\t" << stage.stage->name() << ":";
+        for (uint32_t j = 0; j < stage.output_size.size(); j++) {
+          std::cout << (j == 0 ? " " : ", ");
+          for (uint32_t d = 0; d < stage.output_size[j].size(); d++) {
+            std::cout << (d == 0 ? "" : "x") << stage.output_size[j][d];
+          }
+        }
+        std::cout << " (" << stage.output_bytes + stage.scratch_bytes <<
+          " bytes)" << std::endl;
+      }
+      const PreparedStage& last = report.stages.back();
+      test_passed = test_passed && last.output_size.size() == 1 &&
+        last.output_size[0] == std::vector<uint32_t>(out->size(),
+        out->size() + out->dim());
+
+      const BufferPoolStats before = buffer_pool->stats();
+      prepared->forwardProp(data_in);
+      const BufferPoolStats after = buffer_pool->stats();
+      std::vector<float> res(ref.size());
+      TO_TENSOR_PTR(prepared->output)->getData(&res[0]);
+      test_passed = test_passed && res == ref &&
+        after.misses == before.misses &&
+        after.bytes_in_use == before.bytes_in_use;
+      assertTrue(test_passed, "Prepare for an input size");
+      delete prepared;
+      delete model;
+    }
+
+    // ***********************************************
+    // Test pipelining the test model across frames (every frame must match
+    // running the model on its own)
+    {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/testmodel.bin");
+      const uint32_t nframes = 8;
+      const uint32_t in_nelems = data_in.nelems();
+      std::vector<float> frames(in_nelems * nframes);
+      for (uint32_t i = 0; i < nframes; i++) {
+        for (uint32_t j = 0; j < in_nelems; j++) {
+          frames[i * in_nelems + j] = din[j] * (1.0f - 0.1f * i);
+        }
+      }
+      std::vector<float> ref;
+      Tensor<float> frame_in(3, isize);
+      for (uint32_t i = 0; i < nframes; i++) {
+        frame_in.setData(&frames[i * in_nelems]);
+        model->forwardProp(frame_in);
+        Tensor<float>* out = TO_TENSOR_PTR(model->output);
+        ref.resize(out->nelems() * nframes);
+        out->getData(&ref[i * out->nelems()]);
+      }
+
+      bool test_passed = true;
+      {
+        PipelineExecutor pipeline(*(Sequential*)model, 3, isize, 3);
+        const uint32_t out_nelems = pipeline.outputNElems();
+        std::vector<float> res(out_nelems * nframes);
+        for (uint32_t i = 0; i < nframes; i++) {
+          pipeline.push(&frames[i * in_nelems], &res[i * out_nelems]);
+        }
+        pipeline.sync();
+        test_passed = res == ref && pipeline.numSegments() == 3;
+        std::vector<PipelineSegmentStats> stats = pipeline.segmentStats();
+        uint32_t num_stages = 0;
+        for (uint32_t s = 0; s < stats.size(); s++) {
+          test_passed = test_passed && stats[s].first_stage == num_stages &&
+            stats[s].num_frames == nframes && stats[s].utilization <= 1.01;
+          num_stages += stats[s].num_stages;
+          std::cout << "\tPipeline segment " << s << ": " <<
+            stats[s].num_stages << " stages, " << stats[s].cost_ms <<
+            "ms, utilization " << 100.0 * stats[s].utilization << "%" <<
+            std::endl;
+        }
+        test_passed = test_passed &&
+          num_stages == ((Sequential*)model)->size();
+      }
+      assertTrue(test_passed, "Pipelined Sequential");
+      delete model;
+    }
+
+    // ***********************************************
+    // Test Loading and running a big model (ie our body tracking model)
+    if (jcl::file_io::fileExists("./test_data/big_model.bin")) {
+      TorchStage* model = TorchStage::loadFromFile("./test_data/big_model.bin");
+
+      // The input is a nested table of tensors (one for each resolution bank)
+      Table* input = new Table();
+      const uint32_t num_banks = 3;
+      for (uint32_t i = 1; i <= num_banks; i++) {
+        std::stringstream ss;
+        ss << "./test_data/big_model_input_bank" << i << ".bin";
+        Table* cur_table = new Table();
+        cur_table->add(Tensor<float>::loadFromFile(ss.str()));
+        cur_table->add(NULL);
+        input->add(cur_table);
+      }
+
+      model->forwardProp(*input);
+
+      const float precision = JTORCH_FLOAT_PRECISION * 100;
+      testJTorchValue(TO_TENSOR_PTR(model->output),
+        "./test_data/big_model_output.bin", precision);
+
+      delete model;
+      delete input;
+    }
+
+    // ***********************************************
+    // Profile host <--> device transfers
+    {
+      const uint32_t size[3] = {640, 480, 32};
+      const double t_test = 2.0;
+      double t_start, t_end;
+      uint64_t niters;
+      Tensor<float>* tensor = Tensor<float>::uninitialized(3, size);
+      const uint64_t nbytes = sizeof(float) * tensor->nelems();
+      float* pageable = new float[tensor->nelems()];
+      memset(pageable, 0, nbytes);
+      HostBuffer* staging = new HostBuffer(nbytes);
+      memset(staging->data(), 0, nbytes);
+      clk::Clk clk;
+
+      std::cout << "\tProfiling setData + getData from pageable memory for "
+        << t_test << " seconds" << std::endl;
+      t_start = clk.getTime();
+      t_end = t_start;
+      niters = 0;
+      while (t_end - t_start < t_test) {
+        tensor->setData(pageable);
+        tensor->getData(pageable);
+        niters++;
+        t_end = clk.getTime();
+      }
+      std::cout << "\t\tBandwidth: " << (2.0 * nbytes * niters) / 
+        ((t_end - t_start) * 1e9) << " GB/s" << std::endl;
+
+      std::cout << "\tProfiling setData + getData from " <<
+        (staging->isSVM() ? "SVM" : "pinned") << " memory for " << t_test <<
+        " seconds" << std::endl;
+      t_start = clk.getTime();
+      t_end = t_start;
+      niters = 0;
+      while (t_end - t_start < t_test) {
+        tensor->setData((float*)staging->data());
+        tensor->getData((float*)staging->data());
+        niters++;
+        t_end = clk.getTime();
+      }
+      std::cout << "\t\tBandwidth: " << (2.0 * nbytes * niters) / 
+        ((t_end - t_start) * 1e9) << " GB/s" << std::endl;
+
+      std::cout << "\tProfiling map(WRITE) + map(READ) for " << t_test << 
+        " seconds" << std::endl;
+      t_start = clk.getTime();
+      t_end = t_start;
+      niters = 0;
+      while (t_end - t_start < t_test) {
+        tensor->map(TENSOR_MAP_WRITE)[0] = 1.0f;
+        tensor->unmap();
+        volatile float val = tensor->map(TENSOR_MAP_READ)[0];
+        static_cast<void>(val);
+        tensor->unmap();
+        jtorch::Sync();
+        niters++;
+        t_end = clk.getTime();
+      }
+      std::cout << "\t\tEffective bandwidth: " << (2.0 * nbytes * niters) / 
+        ((t_end - t_start) * 1e9) << " GB/s" << std::endl;
+
+      delete staging;
+      delete[] pageable;
+      delete tensor;
+    }
+
+    // ***********************************************
+    // Profile device reductions vs reading back to the host
+    {
+      const uint32_t size[3] = {640, 480, 32};
+      const double t_test = 2.0;
+      double t_start, t_end;
+      uint64_t niters;
+      Tensor<float>* tensor = new Tensor<float>(3, size);
+      Tensor<float>::fill(*tensor, 1.0f);
+      float* host = new float[tensor->nelems()];
+      clk::Clk clk;
+
+      std::cout << "\tProfiling host sum (getData) of " << tensor->nelems() <<
+        " elements for " << t_test << " seconds" << std::endl;
+      t_start = clk.getTime();
+      t_end = t_start;
+      niters = 0;
+      while (t_end - t_start < t_test) {
+        tensor->getData(host);
+        volatile float sum = 0.0f;
+        for (uint32_t i = 0; i < tensor->nelems(); i++) {
+          sum = sum + host[i];
+        }
+        niters++;
+        t_end = clk.getTime();
+      }
+      std::cout << "\t\tExecution time: " << (t_end - t_start) / niters * 1e3 <<
+        " ms per sum" << std::endl;
+
+      const ReduceOp ops[4] = {REDUCE_SUM, REDUCE_MAX, REDUCE_ARGMAX, 
+        REDUCE_L2};
+      const char* op_names[4] = {"sum", "max", "argmax", "L2 norm"};
+      for (uint32_t i = 0; i < 4; i++) {
+        std::cout << "\tProfiling device " << op_names[i] << " for " << 
+          t_test << " seconds" << std::endl;
+        t_start = clk.getTime();
+        t_end = t_start;
+        niters = 0;
+        while (t_end - t_start < t_test) {
+          Tensor<float>::reduce(*tensor, ops[i]);
+          niters++;
+          t_end = clk.getTime();
+        }
+        std::cout << "\t\tExecution time: " << (t_end - t_start) / niters * 
+          1e3 << " ms per reduction" << std::endl;
+      }
+
+      delete[] host;
+      delete tensor;
+    }
+
+    // ***********************************************
+    // Profile blocking vs asynchronous frame streaming
+    {
+      const uint32_t fin = 16, fout = 16, k = 5, pad = 2, imw = 320, 
+        imh = 240, nframes = 100;
+      double t_start, t_end;
+      SpatialConvolution conv(fin, fout, k, k, pad);
+      Tensor<float>::fill(*conv.weights(), 0.01f);
+      Tensor<float>::fill(*conv.biases(), 0);
+      uint32_t size[3] = {imw, imh, fin};
+      Tensor<float>* input[2];
+      input[0] = Tensor<float>::uninitialized(3, size);
+      input[1] = Tensor<float>::uninitialized(3, size);
+      const uint32_t in_nelems = input[0]->nelems();
+      const uint32_t out_nelems = imw * imh * fout;
+      HostBuffer frames_in(2 * sizeof(float) * in_nelems);
+      HostBuffer frames_out(2 * sizeof(float) * out_nelems);
+      memset(frames_in.data(), 0, frames_in.nbytes());
+      clk::Clk clk;
+
+      std::cout << "\tProfiling " << nframes << " blocking frames" << 
+        std::endl;
+      t_start = clk.getTime();
+      for (uint32_t i = 0; i < nframes; i++) {
+        input[0]->setData((float*)frames_in.data());
+        conv.forwardProp(*input[0]);
+        TO_TENSOR_PTR(conv.output)->getData((float*)frames_out.data());
+      }
+      t_end = clk.getTime();
+      std::cout << "\t\tExecution time: " << (t_end - t_start) / nframes
+         << " seconds per frame" << std::endl;
+
+      // Double buffer the host arrays and input tensors so the host never
+      // waits on the upload of frame N+1 or the readback of frame N.
+      std::cout << "\tProfiling " << nframes << " asynchronous frames" << 
+        std::endl;
+      Event readback[2];
+      t_start = clk.getTime();
+      for (uint32_t i = 0; i < nframes; i++) {
+        const uint32_t b = i % 2;
+        readback[b].wait();  // Host buffer b is free again
+        input[b]->setDataAsync((float*)frames_in.data() + b * in_nelems);
+        conv.forwardProp(*input[b]);
+        readback[b] = TO_TENSOR_PTR(conv.output)->getDataAsync(
+          (float*)frames_out.data() + b * out_nelems);
+      }
+      Event::waitAll(2, readback);
+      t_end = clk.getTime();
+      std::cout << "\t\tExecution time: " << (t_end - t_start) / nframes
+         << " seconds per frame" << std::endl;
+
+      delete input[0];
+      delete input[1];
+    }
+
+    // ***********************************************
+    // Profile per frame host overhead of forwardProp vs a launch plan
+    {
+      const uint32_t fin = 4, imw = 16, imh = 16, nlayers = 16, 
+        nframes = 1000;
+      double t_start, t_end, t_host;
+      Sequential model;
+      for (uint32_t i = 0; i < nlayers; i++) {
+        SpatialConvolution* conv = new SpatialConvolution(fin, fin, 3, 3, 1);
+        Tensor<float>::fill(*conv->weights(), 0.01f);
+        Tensor<float>::fill(*conv->biases(), 0);
+        model.add(conv);
+        model.add(new Tanh());
+      }
+      uint32_t size[3] = {imw, imh, fin};
+      Tensor<float>* input = new Tensor<float>(3, size);
+      clk::Clk clk;
+
+      std::cout << "\tProfiling " << nframes << " forwardProp frames" << 
+        std::endl;
+      model.forwardProp(*input);
+      jtorch::Sync();
+      t_start = clk.getTime();
+      for (uint32_t i = 0; i < nframes; i++) {
+        model.forwardProp(*input);
+      }
+      t_host = clk.getTime();
+      jtorch::Sync();
+      t_end = clk.getTime();
+      std::cout << "\t\tHost time: " << (t_host - t_start) / nframes
+         << " seconds per frame (" << (t_end - t_start) / nframes 
+         << " with execution)" << std::endl;
+
+      LaunchPlan plan;
+      plan.compile(model, *input);
+      std::cout << "\tProfiling " << nframes << " launch plan frames (" <<
+        plan.numLaunches() << " launches)" << std::endl;
+      jtorch::Sync();
+      t_start = clk.getTime();
+      for (uint32_t i = 0; i < nframes; i++) {
+        plan.run();
+      }
+      t_host = clk.getTime();
+      jtorch::Sync();
+      t_end = clk.getTime();
+      std::cout << "\t\tHost time: " << (t_host - t_start) / nframes
+         << " seconds per frame (" << (t_end - t_start) / nframes 
+         << " with execution)" << std::endl;
+
+      plan.clear();
+      delete input;
+    }
+
+    // ***********************************************
+    // Profile fused vs unfused SpatialContrastiveNormalization
+    {
+      const uint32_t nframes = 100;
+      double t_start, t_end;
+      Tensor<float>* lena =
+        Tensor<float>::loadFromFile("./test_data/lena_image.bin");
+      uint32_t size[3] = {640, 480, 32};
+      Tensor<float>* input = new Tensor<float>(3, size);
+      Tensor<float>::fill(*input, 1);
+      Tensor<float>* inputs[2] = {lena, input};
+      const uint32_t kernel_size = 7;
+      Tensor<float>* kernel = new Tensor<float>(1, &kernel_size);
+      Tensor<float>::fill(*kernel, 1);
+      SpatialContrastiveNormalization cont_norm_stage(kernel);
+      clk::Clk clk;
+
+      for (uint32_t i = 0; i < 2; i++) {
+        for (uint32_t fused = 0; fused < 2; fused++) {
+          cont_norm_stage.setFused(fused == 1);
+          cont_norm_stage.forwardProp(*inputs[i]);
+          jtorch::Sync();
+          t_start = clk.getTime();
+          for (uint32_t j = 0; j < nframes; j++) {
+            cont_norm_stage.forwardProp(*inputs[i]);
+          }
+          jtorch::Sync();
+          t_end = clk.getTime();
+          std::cout << "\t" << (fused == 1 ? "Fused" : "Unfused") <<
+            " SpatialContrastiveNormalization (" << inputs[i]->size()[0] <<
+            "x" << inputs[i]->size()[1] << "x" << inputs[i]->size()[2] <<
+            "): " << (t_end - t_start) / nframes << " seconds per FPROP" <<
+            std::endl;
+        }
+      }
+
+      delete kernel;
+      delete input;
+      delete lena;
+    }
+
+    // ***********************************************
+    // Profile batched throughput (frames per second vs batch size)
+    {
+      const uint32_t fin = 16, fout = 32, k = 5, pad = 2, imw = 64, imh = 48;
+      const uint32_t nframes = 256;
+      double t_start, t_end;
+      Sequential model;
+      SpatialConvolutionMM* conv = new SpatialConvolutionMM(fin, fout, k, k,
+        pad);
+      Tensor<float>::fill(*conv->weights(), 0.01f);
+      Tensor<float>::fill(*conv->biases(), 0.01f);
+      model.add(conv);
+      model.add(new Tanh());
+      model.add(new SpatialMaxPooling(2, 2));
+      const uint32_t lin_in = (imw / 2) * (imh / 2) * fout;
+      model.add(new Reshape(1, &lin_in));
+      Linear* lin = new Linear(lin_in, 10);
+      Tensor<float>::fill(*lin->weights(), 0.01f);
+      Tensor<float>::fill(*lin->biases(), 0.01f);
+      model.add(lin);
+      clk::Clk clk;
+
+      for (uint32_t batch_size = 1; batch_size <= 64; batch_size *= 2) {
+        uint32_t size[4] = {imw, imh, fin, batch_size};
+        Tensor<float>* input = new Tensor<float>(batch_size > 1 ? 4 : 3,
+          size);
+        Tensor<float>::fill(*input, 1);
+        model.forwardProp(*input);
+        jtorch::Sync();
+        t_start = clk.getTime();
+        for (uint32_t i = 0; i < nframes / batch_size; i++) {
+          model.forwardProp(*input);
+        }
+        jtorch::Sync();
+        t_end = clk.getTime();
+        std::cout << "	Batch size " << batch_size << ": " <<
+          (double)((nframes / batch_size) * batch_size) / (t_end - t_start) <<
+          " frames per second" << std::endl;
+        delete input;
+      }
+    }
+
+    // ***********************************************
+    // Profile a 3 bank ParallelTable with the banks in order vs on separate
+    // queues
+    {
+      const uint32_t nframes = 100;
+      const uint32_t fin = 8, fout = 16, k = 5, pad = 2;
+      double t_start, t_end;
+      ParallelTable model;
+      Table input;
+      for (uint32_t i = 0; i < 3; i++) {
+        Sequential* bank = new Sequential();
+        SpatialConvolutionMM* convmm = new SpatialConvolutionMM(fin, fout, k,
+          k, pad);
+        Tensor<float>::fill(*convmm->weights(), 0.01f);
+        Tensor<float>::fill(*convmm->biases(), 0.01f);
+        bank->add(convmm);
+        bank->add(new Tanh());
+        bank->add(new SpatialMaxPooling(2, 2));
+        model.add(bank);
+        // The per-resolution banks of our big model: 96x96, 48x48, 24x24
+        const uint32_t size[3] = {96 >> i, 96 >> i, fin};
+        Tensor<float>* bank_in = new Tensor<float>(3, size);
+        Tensor<float>::fill(*bank_in, 1);
+        input.add(bank_in);
+      }
+      clk::Clk clk;
+
+      for (uint32_t concurrent = 0; concurrent < 2; concurrent++) {
+        model.setConcurrent(concurrent == 1);
+        model.forwardProp(input);
+        jtorch::Sync();
+        t_start = clk.getTime();
+        for (uint32_t i = 0; i < nframes; i++) {
+          model.forwardProp(input);
+        }
+        jtorch::Sync();
+        t_end = clk.getTime();
+        std::cout << "\t3 bank ParallelTable (" << (concurrent == 1 ?
+          "separate queues" : "in order") << "): " <<
+          (t_end - t_start) / nframes << " seconds per FPROP" << std::endl;
+      }
+    }
+
+    // ***********************************************
+    // Profile multi-device scaling (frames per second as devices are added)
+    {
+      const uint32_t nframes = 200;
+      const uint32_t fin = 16, fout = 32, k = 5, pad = 2, imw = 128, imh = 96;
+      double t_start, t_end;
+      const uint32_t size[3] = {imw, imh, fin};
+      std::vector<float> input(imw * imh * fin, 1.0f);
+      std::function<TorchStage*()> create_replica = [&]() {
+        Sequential* model = new Sequential();
+        SpatialConvolutionMM* conv = new SpatialConvolutionMM(fin, fout, k,
+          k, pad);
+        Tensor<float>::fill(*conv->weights(), 0.01f);
+        Tensor<float>::fill(*conv->biases(), 0.01f);
+        model->add(conv);
+        model->add(new Tanh());
+        model->add(new SpatialMaxPooling(2, 2));
+        return (TorchStage*)model;
+      };
+      clk::Clk clk;
+
+      double fps_1 = 0;
+      for (uint32_t n = 1; n <= jtorch::NumDevices(); n++) {
+        std::vector<uint32_t> devices;
+        for (uint32_t d = 0; d < n; d++) {
+          devices.push_back(d);
+        }
+        DeviceDispatcher dispatcher(create_replica, 3, size, devices);
+        std::vector<float> output(dispatcher.outputNElems() * nframes);
+        t_start = clk.getTime();
+        for (uint32_t i = 0; i < nframes; i++) {
+          dispatcher.dispatch(&input[0],
+            &output[i * dispatcher.outputNElems()]);
+        }
+        dispatcher.sync();
+        t_end = clk.getTime();
+        const double fps = nframes / (t_end - t_start);
+        if (n == 1) {
+          fps_1 = fps;
+        }
+        std::cout << "\t" << n << " device(s) (" << jtorch::DeviceName(n - 1) <<
+          "): " << fps << " frames per second, scaling efficiency " <<
+          100.0 * fps / (n * fps_1) << "%" << std::endl;
+      }
+    }
+
+    // ***********************************************
+    // Profile a 3 bank ParallelTable on the out-of-order queue (against the
+    // default queue)
+    {
+      const uint32_t nframes = 100;
+      const uint32_t fin = 8, fout = 16, k = 5, pad = 2;
+      double t_start, t_end;
+      ParallelTable model;
+      Table input;
+      for (uint32_t i = 0; i < 3; i++) {
+        Sequential* bank = new Sequential();
+        SpatialConvolutionMM* convmm = new SpatialConvolutionMM(fin, fout, k,
+          k, pad);
+        Tensor<float>::fill(*convmm->weights(), 0.01f);
+        Tensor<float>::fill(*convmm->biases(), 0.01f);
+        bank->add(convmm);
+        bank->add(new Tanh());
+        bank->add(new SpatialMaxPooling(2, 2));
+        model.add(bank);
+        const uint32_t size[3] = {96 >> i, 96 >> i, fin};
+        Tensor<float>* bank_in = new Tensor<float>(3, size);
+        Tensor<float>::fill(*bank_in, 1);
+        input.add(bank_in);
+      }
+      clk::Clk clk;
+
+      for (uint32_t ooo = 0; ooo < 2; ooo++) {
+        jtorch::Sync();
+        SetCLQueue(ooo == 1 ? CLOutOfOrderQueue() : NULL);
+        model.forwardProp(input);
+        jtorch::Sync();
+        t_start = clk.getTime();
+        for (uint32_t i = 0; i < nframes; i++) {
+          model.forwardProp(input);
+        }
+        jtorch::Sync();
+        t_end = clk.getTime();
+        std::cout << "\t3 bank ParallelTable (" << (ooo == 1 ?
+          "out-of-order queue" : "default queue") << "): " <<
+          (t_end - t_start) / nframes << " seconds per FPROP" << std::endl;
+      }
+      SetCLQueue(NULL);
+    }
+
+    // ***********************************************
+    // Profile pipelining a stream of frames (against one frame at a time)
+    {
+      const uint32_t nframes = 200;
+      const uint32_t fin = 16, fout = 32, k = 5, pad = 2, imw = 128, imh = 96;
+      double t_start, t_end;
+      const uint32_t size[3] = {imw, imh, fin};
+      std::vector<float> input(imw * imh * fin, 1.0f);
+      Sequential model;
+      for (uint32_t i = 0; i < 4; i++) {
+        SpatialConvolutionMM* conv = new SpatialConvolutionMM(
+          i == 0 ? fin : fout, fout, k, k, pad);
+        Tensor<float>::fill(*conv->weights(), 0.01f);
+        Tensor<float>::fill(*conv->biases(), 0.01f);
+        model.add(conv);
+        model.add(new Tanh());
+      }
+      Tensor<float> frame_in(3, size);
+      clk::Clk clk;
+
+      model.forwardProp(frame_in);
+      std::vector<float> output(TO_TENSOR_PTR(model.output)->nelems());
+      t_start = clk.getTime();
+      for (uint32_t i = 0; i < nframes; i++) {
+        frame_in.setData(&input[0]);
+        model.forwardProp(frame_in);
+        TO_TENSOR_PTR(model.output)->getData(&output[0]);
+      }
+      t_end = clk.getTime();
+      const double fps_serial = nframes / (t_end - t_start);
+      std::cout << "\tOne frame at a time: " << fps_serial <<
+        " frames per second" << std::endl;
+
+      for (uint32_t n_segments = 2; n_segments <= 4; n_segments++) {
+        PipelineExecutor pipeline(model, 3, size, n_segments);
+        t_start = clk.getTime();
+        for (uint32_t i = 0; i < nframes; i++) {
+          pipeline.push(&input[0], &output[0]);
+        }
+        pipeline.sync();
+        t_end = clk.getTime();
+        const double fps = nframes / (t_end - t_start);
+        std::cout << "\t" << n_segments << " segments: " << fps <<
+          " frames per second (" << fps / fps_serial << "x), utilization";
+        std::vector<PipelineSegmentStats> stats = pipeline.segmentStats();
+        for (uint32_t s = 0; s < stats.size(); s++) {
+          std::cout << " " << 100.0 * stats[s].utilization << "%";
+        }
+        std::cout << std::endl;
+      }
     }
 
     // ***********************************************